@@ -0,0 +1,42 @@
+# Find libnuma
+# NUMA_FOUND - system has the NUMA library
+# NUMA_INCLUDE_DIR - the NUMA include directory
+# NUMA_LIBRARIES - The libraries needed to use NUMA
+
+if (NUMA_INCLUDE_DIR AND NUMA_LIBRARIES)
+	# in cache already
+	SET(NUMA_FOUND TRUE)
+else (NUMA_INCLUDE_DIR AND NUMA_LIBRARIES)
+	FIND_PATH(NUMA_INCLUDE_DIR numaif.h
+		 ${NUMA_ROOT}/include/
+		 /usr/include/
+		 /usr/local/include/
+	)
+
+	FIND_LIBRARY(NUMA_LIBRARIES NAMES numa
+		PATHS
+		${NUMA_ROOT}/lib
+		${NUMA_ROOT}/lib64
+		/usr/lib
+		/usr/lib64
+		/usr/local/lib
+		/usr/local/lib64
+		)
+
+	if (NUMA_INCLUDE_DIR AND NUMA_LIBRARIES)
+		 set(NUMA_FOUND TRUE)
+	endif (NUMA_INCLUDE_DIR AND NUMA_LIBRARIES)
+
+	if (NUMA_FOUND)
+		 if (NOT NUMA_FIND_QUIETLY)
+				message(STATUS "Found NUMA: ${NUMA_LIBRARIES}")
+		 endif (NOT NUMA_FIND_QUIETLY)
+	else (NUMA_FOUND)
+		 if (NUMA_FIND_REQUIRED)
+				message(FATAL_ERROR "Could NOT find NUMA")
+		 endif (NUMA_FIND_REQUIRED)
+	endif (NUMA_FOUND)
+
+	MARK_AS_ADVANCED(NUMA_INCLUDE_DIR NUMA_LIBRARIES)
+endif (NUMA_INCLUDE_DIR AND NUMA_LIBRARIES)
+
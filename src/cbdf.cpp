@@ -6,18 +6,27 @@
  */
 
 #include <cbdf.h>
-#include <boost/iostreams/device/file.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/bzip2.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <boost/crc.hpp>
-
-#ifdef WITH_LZMA
-#include "lzma.hpp"
-#endif
-
-#ifdef WITH_LZO
-#include "lzo.hpp"
+#include <cbdfBufferPool.h>
+#include "cbdfFormat.h"
+#include "cbdfStream.h"
+#include "cbdfFooter.h"
+#include "cbdfCodec.h"
+#include "cbdfCrc.h"
+#include "cbdfScanner.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <deque>
+#include <sstream>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
 #endif
 
 #ifdef WITH_BOOST_UUID
@@ -29,48 +38,25 @@
 #endif
 
 
-namespace boostIO = boost::iostreams;
-
-
-#pragma pack(4) // Enforce 32 Bit alignment for ondisk format
-struct cbdf::cbdfFileHeader_t {
-    uint32_t openTag;           //0xCBDFCBDF
-    uint64_t timeStart;         //Unix time. Cast to time_t if neccessary
-    uint64_t features;          //Bitset of cbdf features (see documentation)
-    char uuid[36];              //UUID for given file stored as string (xxxxxxxx-xxxx-4xxx-xxxx-xxxxxxxxxxxx)
-    uint32_t closeTag;          //0xCBDFCBDF
-};
-
-struct cbdf::cbdfFileTrailer_t {
-    uint32_t openTag;           //0xFDBCFDBC
-    uint64_t timeStop;          //Unix time. Cast to time_t if neccessary
-    uint64_t features;          //Bitset of cbdf features (see documentation)
-    char uuid[36];              //UUID for given file for given file stored as string (xxxxxxxx-xxxx-4xxx-xxxx-xxxxxxxxxxxx)
-    uint32_t closeTag;          //0xFDBCFDBC
-};
-
-struct cbdf::cbdfEventHeader_t {
-    uint32_t openTag;           //0xCBEDCBED
-    uint64_t eventNumber;       //Linear throughout the file
-    uint64_t userFlags;         //User defined Flags (e.g. Eventtype)
-    uint64_t eventSize;         //Payload size in bytes
-    uint32_t closeTag;          //0xCBEDCBED
-};
-
-struct cbdf::cbdfEventTrailer_t {
-    uint32_t openTag;           //0xDEBCDEBC
-    uint32_t crc32;             //CRC32 checksum of payload
-    uint64_t eventSize;         //Payload size in bytes
-    uint32_t closeTag;          //0xDEBCDEBC
-};
-
-
-struct cbdf::cbdfBankHeader_t {
-    char name[12];              // \0 terminated string of up to 11 characters
-    uint16_t userFlags;         // User defined bank flags
-    uint32_t size;              // Payloadsize of the bank in bytes
+#define FOLLOW_MAX_BACKOFF 64 // Upper limit in ms for polling a followed file
+
+// Names of the registered feature bits, for diagnostics
+static const struct {
+    uint64_t bit;
+    const char* name;
+} featureRegistry[] = {
+    {CBDF_FEATURE_FOOTER, "footer"},
+    {CBDF_FEATURE_SUMMARY, "summary"},
+    {CBDF_FEATURE_LINEAGE, "lineage"},
+    {CBDF_FEATURE_SOURCE_INDEX, "sourceindex"},
+    {CBDF_FEATURE_ALIGN16, "align16"},
+    {CBDF_FEATURE_ALIGN32, "align32"},
+    {CBDF_FEATURE_ALIGN64, "align64"},
+    {CBDF_FEATURE_BANK_CODECS, "bankcodecs"},
+    {CBDF_FEATURE_DICTIONARY, "dictionary"},
+    {CBDF_FEATURE_EVENT_ZSTD, "eventzstd"},
+    {CBDF_FEATURE_EVENT_CODECS, "eventcodecs"},
 };
-#pragma pack() // reset padding to compiler defaults
 
 
 // Utility functions
@@ -99,6 +85,396 @@ uint32_t cbdf::headerTrailerMismatch()
 }
 
 
+/*
+ * Background worker of a rotating writer. It opens the next chunk ahead of
+ * time and finishes chunks that were rotated out (trailer, compressor flush,
+ * close), so that writeEvent() only has to swap stream pointers.
+ */
+struct cbdf::cbdfRotator_t {
+    struct closeJob_t {
+        cbdfOutStream* stream;
+        cbdfFileTrailer_t trailer;
+        std::string footer;
+        std::string checkpointName;   // Sidecar to remove once the chunk is complete
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable wakeup;
+    boost::condition_variable spareReady;
+    std::deque<closeJob_t> closeJobs;
+    compressionType_t compression;
+    cbdfIOOptions_t ioOptions;
+    std::string spareName;
+    cbdfOutStream* spare;
+    bool openRequested;
+    bool openFailed;
+    bool stop;
+    boost::thread worker;
+
+    void run()
+    {
+        boost::mutex::scoped_lock _lock(mutex);
+        while (true)
+        {
+            if (openRequested && !stop)
+            {
+                std::string _name = spareName;
+                openRequested = false;
+                _lock.unlock();
+                cbdfOutStream* _stream = openOutStream(_name, compression, ioOptions);
+                _lock.lock();
+                spare = _stream;
+                spareName = _name;
+                openFailed = (_stream == NULL);
+                spareReady.notify_all();
+            }
+            else if (!closeJobs.empty())
+            {
+                closeJob_t _job = closeJobs.front();
+                closeJobs.pop_front();
+                _lock.unlock();
+                _job.stream->write((const char *) &_job.trailer, sizeof(cbdfFileTrailer_t));
+                if (_job.stream->close(_job.footer))
+                    unlink(_job.checkpointName.c_str());
+                delete _job.stream;
+                _lock.lock();
+            }
+            else if (stop)
+            {
+                break;
+            }
+            else
+            {
+                wakeup.wait(_lock);
+            }
+        }
+    }
+};
+
+bool cbdf::rotationEnabled()
+{
+    return (rotationBytes || rotationEvents || rotationSeconds);
+}
+
+// Insert the chunk number in front of the extension of the base file name
+std::string cbdf::chunkFileName(uint32_t chunk)
+{
+    char _suffix[16];
+    snprintf(_suffix, sizeof(_suffix), "_%04u", chunk);
+    size_t _dot = rotationBaseName.find_last_of('.');
+    size_t _slash = rotationBaseName.find_last_of('/');
+    if (_dot == std::string::npos || (_slash != std::string::npos && _dot < _slash))
+        return rotationBaseName + _suffix;
+    return rotationBaseName.substr(0, _dot) + _suffix + rotationBaseName.substr(_dot);
+}
+
+void cbdf::startRotator(int compr)
+{
+    rotator = new cbdfRotator_t;
+    rotator->compression = (compressionType_t) compr;
+    rotator->ioOptions = ioOptions;
+    rotator->spare = NULL;
+    rotator->spareName = chunkFileName(rotationChunk + 1);
+    rotator->openRequested = true;
+    rotator->openFailed = false;
+    rotator->stop = false;
+    rotator->worker = boost::thread(&cbdfRotator_t::run, rotator);
+}
+
+// Finish all pending closes and remove the chunk that was opened ahead but never used
+void cbdf::stopRotator()
+{
+    {
+        boost::mutex::scoped_lock _lock(rotator->mutex);
+        rotator->stop = true;
+        rotator->wakeup.notify_one();
+    }
+    rotator->worker.join();
+    if (rotator->spare != NULL)
+    {
+        delete rotator->spare;
+        unlink(rotator->spareName.c_str());
+    }
+    delete rotator;
+    rotator = NULL;
+}
+
+// Continue in the next chunk once a rotation limit is reached, called before an event is written so no chunk is left empty
+int cbdf::checkRotation()
+{
+    if (rotator != NULL && chunkEvents > 0 && ((rotationBytes && chunkBytes >= rotationBytes) || (rotationEvents && chunkEvents >= rotationEvents) || (rotationSeconds && (uint64_t) time(NULL) - chunkStart >= rotationSeconds)))
+        return rotateFile();
+    return 0;
+}
+
+/*
+ * Hand the current chunk to the worker for closing and continue in the
+ * chunk it opened ahead of time. Event numbers continue across chunks.
+ */
+int cbdf::rotateFile()
+{
+    cbdfRotator_t::closeJob_t _job;
+    {
+        boost::mutex::scoped_lock _lock(rotator->mutex);
+        while (rotator->spare == NULL && !rotator->openFailed)
+            rotator->spareReady.wait(_lock);
+        if (rotator->spare == NULL)
+        {
+            std::cerr << "Could not open " << rotator->spareName << ", continuing in " << currentFileName << std::endl;
+            rotator->spareName = chunkFileName(rotationChunk + 1);
+            rotator->openRequested = true;
+            rotator->openFailed = false;
+            rotator->wakeup.notify_one();
+            chunkBytes = 0;
+            chunkEvents = 0;
+            chunkStart = time(NULL);
+            return -1;
+        }
+
+        _job.stream = cbdfOutFile;
+        _job.trailer = *wFileTrailer;
+        _job.trailer.timeStop = time(NULL);
+        buildFooter(_job.footer, _job.trailer.timeStop);
+        _job.checkpointName = currentFileName + CBDF_CHECKPOINT_SUFFIX;
+        rotator->closeJobs.push_back(_job);
+
+        cbdfOutFile = rotator->spare;
+        currentFileName = rotator->spareName;
+        rotator->spare = NULL;
+        rotationChunk++;
+        rotator->spareName = chunkFileName(rotationChunk + 1);
+        rotator->openRequested = true;
+        rotator->wakeup.notify_one();
+    }
+    return writeFileHeader();
+}
+
+bool cbdf::checkpointsEnabled()
+{
+    return (checkpointBytes || checkpointSeconds);
+}
+
+int cbdf::checkCheckpoint()
+{
+    if ((checkpointBytes && chunkBytes - checkpointAt >= checkpointBytes) || (checkpointSeconds && (uint64_t) time(NULL) - checkpointTime >= checkpointSeconds))
+        return checkpoint();
+    return 0;
+}
+
+// Replace the checkpoint sidecar of fileName. Until the rename the previous one stays in place, and stays valid
+static bool writeCheckpointFile(const std::string &fileName, const std::string &block)
+{
+    std::string _name = fileName + CBDF_CHECKPOINT_SUFFIX;
+    std::string _tmpName = _name + ".tmp";
+    int _fd = open(_tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0)
+        return false;
+    uint64_t _done = 0;
+    while (_done < block.size())
+    {
+        ssize_t _ret = write(_fd, block.data() + _done, block.size() - _done);
+        if (_ret < 0 && errno == EINTR)
+            continue;
+        if (_ret <= 0)
+            break;
+        _done += _ret;
+    }
+    bool _ok = (_done == block.size()) && fdatasync(_fd) == 0;
+    _ok = (close(_fd) == 0) && _ok;
+    if (_ok && rename(_tmpName.c_str(), _name.c_str()) == 0)
+        return true;
+    unlink(_tmpName.c_str());
+    return false;
+}
+
+// Read the checkpoint sidecar of fileName, -1 if there is none or it is damaged
+static int readCheckpointFile(const std::string &fileName, cbdf::cbdfCheckpoint_t &record, std::vector<std::string> &parentUuids, std::string &summary)
+{
+    std::ifstream _file((fileName + CBDF_CHECKPOINT_SUFFIX).c_str(), std::ios::binary);
+    cbdf::cbdfBlockHeader_t _header;
+    cbdf::cbdfBlockTrailer_t _trailer;
+    if (!_file.read((char*) &_header, sizeof(_header)) || _header.type != CBDF_BLOCK_CHECKPOINT || _header.size < sizeof(record) || _header.size > CBDF_CHECKPOINT_MAX_SIZE)
+        return -1;
+    std::string _payload(_header.size, '\0');
+    if (!_file.read(&_payload[0], _payload.size()) || !_file.read((char*) &_trailer, sizeof(_trailer)) || !checkBlock(_header, _payload, _trailer))
+        return -1;
+    memcpy(&record, _payload.data(), sizeof(record));
+    if (_payload.size() != sizeof(record) + (uint64_t) record.nParents * 36 + record.summarySize)
+        return -1;
+    parentUuids.clear();
+    for (uint32_t i = 0; i < record.nParents; i++)
+        parentUuids.push_back(_payload.substr(sizeof(record) + i * 36, 36));
+    summary = _payload.substr(sizeof(record) + (uint64_t) record.nParents * 36);
+    return 0;
+}
+
+/*
+ * End the compressed stream, so that everything written so far decodes on
+ * its own, fdatasync the file and only then replace the sidecar record of
+ * where it may be cut to continue. A crash at any point leaves either the
+ * previous checkpoint or this one valid.
+ */
+int cbdf::checkpoint()
+{
+    if (fileAccessMode != writeMode || cbdfOutFile == NULL || wCompression == lzo)
+        return -1;
+    checkpointAt = chunkBytes;
+    checkpointTime = time(NULL);
+    uint64_t _start = cbdfCompressionController::nowNs();
+    uint64_t _fileSize = 0;
+    if (!cbdfOutFile->restart())
+    {
+        std::cerr << "Checkpoint of " << currentFileName << " failed ending the compressed stream" << std::endl;
+        return -1;
+    }
+    uint64_t _flushed = cbdfCompressionController::nowNs();
+    if (!cbdfOutFile->persist(_fileSize))
+    {
+        std::cerr << "Checkpoint of " << currentFileName << " failed syncing the file" << std::endl;
+        return -1;
+    }
+
+    cbdfCheckpoint_t _record;
+    std::string _summary;
+    if (summaryEnabled)
+        summary->serialize(_summary, wFileHeader->uuid, wFileHeader->timeStart, checkpointTime);
+    _record.header = *wFileHeader;
+    _record.timeStamp = checkpointTime;
+    _record.fileSize = _fileSize;
+    _record.dataBytes = chunkBytes;
+    _record.events = chunkEvents;
+    _record.lastEventNumber = currentEventnumber - 1;
+    _record.nParents = parentUuids.size();
+    _record.summarySize = _summary.size();
+    std::string _payload((const char*) &_record, sizeof(_record));
+    for (uint32_t i = 0; i < parentUuids.size(); i++)
+        _payload.append(parentUuids[i]);
+    _payload.append(_summary);
+    std::string _block;
+    appendFooterBlock(_block, CBDF_BLOCK_CHECKPOINT, _payload);
+    if (!writeCheckpointFile(currentFileName, _block))
+    {
+        std::cerr << "Could not write the checkpoint of " << currentFileName << std::endl;
+        return -1;
+    }
+
+    uint64_t _end = cbdfCompressionController::nowNs();
+    checkpointStats.checkpoints++;
+    checkpointStats.fileSize = _fileSize;
+    checkpointStats.lastEventNumber = _record.lastEventNumber;
+    checkpointStats.codecNs += _flushed - _start;
+    checkpointStats.syncNs += _end - _flushed;
+    checkpointStats.maxNs = std::max(checkpointStats.maxNs, _end - _start);
+    return 0;
+}
+
+/*
+ * Open fileName for writing behind its last checkpoint. The file is cut
+ * where the checkpoint ends, a compressed one continues in a new stream,
+ * and the header, summary and lineage are taken over from the checkpoint,
+ * the dictionary from the file. A file with a source index is refused, the
+ * index of the events before the checkpoint is not kept. Unless
+ * adoptLayout, the current settings have to lay out events like the file
+ * does.
+ */
+int cbdf::resumeFile(std::string fileName, bool adoptLayout)
+{
+    if (cbdfOutFile != NULL || cbdfInFile != NULL || rotationEnabled())
+        return -1;
+    compressionType_t _compr = guessCompression(fileName);
+    if (_compr == lzo)
+        return CBDF_UNSUPPORTED_FEATURE;
+    cbdfCheckpoint_t _record;
+    std::vector<std::string> _parents;
+    std::string _summary;
+    if (readCheckpointFile(fileName, _record, _parents, _summary) != 0)
+    {
+        std::cerr << "No usable checkpoint for " << fileName << std::endl;
+        return -1;
+    }
+
+    // The sidecar has to belong to this file. Behind the checkpoint a compressed stream may end half written
+    cbdfIOOptions_t _options = {0, 0, false, 0, 0, 0, 0, 0};
+    cbdfInStream* _in = openInStream(fileName, _compr, _options, _record.fileSize);
+    if (_in == NULL)
+        return -1;
+    cbdfFileHeader_t _header;
+    uint64_t _read = _in->read((char*) &_header, sizeof(_header));
+    if (_read != sizeof(_header) || memcmp(&_header, &_record.header, sizeof(_header)) != 0)
+    {
+        delete _in;
+        std::cerr << "Checkpoint does not match " << fileName << std::endl;
+        return CBDF_FILE_HEADER_ERROR;
+    }
+    uint64_t _features = _record.header.features;
+    // Events behind the checkpoint have to be compressed with the dictionary of the file
+    std::string _dictionary;
+    if (_features & CBDF_FEATURE_DICTIONARY)
+    {
+        cbdfBlockHeader_t _block;
+        cbdfBlockTrailer_t _trailer;
+        bool _ok = _in->read((char*) &_block, sizeof(_block)) == sizeof(_block) && _block.openTag == 0xCBBDCBBD
+                   && _block.type == CBDF_BLOCK_DICTIONARY && _block.size > 0 && _block.size <= CBDF_DICTIONARY_MAX_SIZE;
+        if (_ok)
+        {
+            _dictionary.resize(_block.size);
+            _ok = _in->read(&_dictionary[0], _block.size) == _block.size && _in->read((char*) &_trailer, sizeof(_trailer)) == sizeof(_trailer)
+                  && checkBlock(_block, _dictionary, _trailer);
+        }
+        if (!_ok)
+        {
+            delete _in;
+            std::cerr << "Dictionary block of " << fileName << " corrupt" << std::endl;
+            return CBDF_FILE_HEADER_ERROR;
+        }
+    }
+    delete _in;
+    if (_features & CBDF_FEATURE_SOURCE_INDEX)
+    {
+        std::cerr << "Source index of " << fileName << " can not be continued" << std::endl;
+        return CBDF_UNSUPPORTED_FEATURE;
+    }
+    if (!adoptLayout && ((layoutFeatures() ^ _features) & CBDF_FEATURES_REQUIRED))
+    {
+        std::cerr << "Settings do not match the layout of " << fileName << std::endl;
+        return CBDF_UNSUPPORTED_FEATURE;
+    }
+
+    std::string _baseName = (_compr == none) ? fileName : fileName.substr(0, fileName.find_last_of('.'));
+    cbdfOutFile = openOutStream(_baseName, _compr, ioOptions, _record.fileSize);
+    if (cbdfOutFile == NULL)
+        return -1;
+    fileAccessMode = writeMode;
+    currentFileName = _baseName;
+    wCompression = _compr;
+    *wFileHeader = _record.header;
+    wFileTrailer->openTag = 0xFDBCFDBC;
+    wFileTrailer->closeTag = 0xFDBCFDBC;
+    wFileTrailer->features = _features;
+    memcpy(wFileTrailer->uuid, _record.header.uuid, sizeof(wFileTrailer->uuid));
+    parentUuids = _parents;
+    sourceUuid.clear();
+    sourceIndex.clear();
+    sourcePending.clear();
+    summaryEnabled = (_features & CBDF_FEATURE_SUMMARY) != 0;
+    summary->reset(bankAlignment(_features));
+    if (summaryEnabled && !summary->restore(_summary))
+        summary->reset(bankAlignment(_features));
+    coder->setDictionary(_dictionary);
+
+    rotationChunk = 0;
+    chunkBytes = _record.dataBytes;
+    chunkEvents = _record.events;
+    chunkStart = _record.header.timeStart;
+    currentEventnumber = _record.lastEventNumber + 1;
+    memset(&checkpointStats, 0, sizeof(checkpointStats));
+    checkpointStats.fileSize = _record.fileSize;
+    checkpointStats.lastEventNumber = _record.lastEventNumber;
+    checkpointAt = chunkBytes;
+    checkpointTime = time(NULL);
+    return 0;
+}
+
 //Private methods
 
 int cbdf::writeFileHeader()
@@ -118,37 +494,115 @@ int cbdf::writeFileHeader()
     wFileHeader->openTag = 0xCBDFCBDF;
     wFileHeader->closeTag = 0xCBDFCBDF;
     wFileHeader->timeStart = time(NULL);
-    wFileHeader->features = 0; //TODO Define feature bitset
+    wFileHeader->features = layoutFeatures();
 
     //Prepare Trailer
     wFileTrailer->openTag = 0xFDBCFDBC;
     wFileTrailer->closeTag = 0xFDBCFDBC;
-    wFileTrailer->features = 0;
-
-    ((boostIO::filtering_ostream*)cbdfOutFile)->write((const char *) wFileHeader, sizeof(cbdfFileHeader_t));
+    wFileTrailer->features = wFileHeader->features;
+    summary->reset(wBankAlignment);
+    unlink((currentFileName + CBDF_CHECKPOINT_SUFFIX).c_str()); // Left over by an earlier file of this name
+
+    cbdfOutFile->write((const char *) wFileHeader, sizeof(cbdfFileHeader_t));
+    chunkBytes = sizeof(cbdfFileHeader_t);
+    coder->setDictionary(wDictionary);
+    if (!wDictionary.empty())
+    {
+        std::string _block;
+        appendFooterBlock(_block, CBDF_BLOCK_DICTIONARY, wDictionary);
+        cbdfOutFile->write(_block.data(), _block.size());
+        chunkBytes += _block.size();
+    }
+    chunkEvents = 0;
+    chunkStart = wFileHeader->timeStart;
+    checkpointAt = chunkBytes;
+    checkpointTime = chunkStart;
     return 0;
 }
+
+// Feature bits of a file written with the current settings
+uint64_t cbdf::layoutFeatures()
+{
+    uint64_t _features = (uint64_t) CBDF_FEATURE_REGISTRY_VERSION << CBDF_FEATURES_VERSION_SHIFT;
+    if (summaryEnabled)
+        _features |= CBDF_FEATURE_FOOTER | CBDF_FEATURE_SUMMARY;
+    if (!parentUuids.empty())
+        _features |= CBDF_FEATURE_FOOTER | CBDF_FEATURE_LINEAGE;
+    if (!sourceUuid.empty())
+        _features |= CBDF_FEATURE_FOOTER | CBDF_FEATURE_SOURCE_INDEX;
+    if (wBankAlignment == 16)
+        _features |= CBDF_FEATURE_ALIGN16;
+    else if (wBankAlignment == 32)
+        _features |= CBDF_FEATURE_ALIGN32;
+    else if (wBankAlignment == 64)
+        _features |= CBDF_FEATURE_ALIGN64;
+    if (!codecRules.empty() || wForeignBankCodecs)
+        _features |= CBDF_FEATURE_BANK_CODECS;
+    if (!wDictionary.empty())
+        _features |= CBDF_FEATURE_DICTIONARY;
+    if (controller != NULL)
+        _features |= CBDF_FEATURE_EVENT_CODECS;
+    else if (wEventZstd)
+        _features |= CBDF_FEATURE_EVENT_ZSTD;
+    return _features;
+}
+
 int cbdf::writeFileTrailer()
 {
     wFileTrailer->timeStop = time(NULL);
-    ((boostIO::filtering_ostream*)cbdfOutFile)->write((const char *) wFileTrailer, sizeof(cbdfFileTrailer_t));
+    cbdfOutFile->write((const char *) wFileTrailer, sizeof(cbdfFileTrailer_t));
     return 0;
 }
 
+// Footer blocks stored behind the trailer of the current file
+void cbdf::buildFooter(std::string &footer, uint64_t timeStop)
+{
+    footer.clear();
+    if (summaryEnabled)
+    {
+        std::string _payload;
+        summary->serialize(_payload, wFileHeader->uuid, wFileHeader->timeStart, timeStop);
+        appendFooterBlock(footer, CBDF_BLOCK_SUMMARY, _payload);
+    }
+    if (!parentUuids.empty())
+    {
+        std::string _payload;
+        for (uint32_t i = 0; i < parentUuids.size(); i++)
+            _payload.append(parentUuids[i]);
+        appendFooterBlock(footer, CBDF_BLOCK_LINEAGE, _payload);
+    }
+    if (!sourceUuid.empty())
+    {
+        // Each chunk only indexes its own events
+        appendFooterBlock(footer, CBDF_BLOCK_SOURCE_INDEX, sourceUuid + sourceIndex);
+        sourceIndex.clear();
+    }
+}
+
 uint32_t cbdf::crc32()
 {
-    boost::crc_32_type _result;
-    _result.process_bytes(payloadBase, payloadSize);
-    return _result.checksum();
+    return cbdfCrc32(payloadBase, payloadSize);
 }
 
-int cbdf::resizeEventbuffer()
+/*
+ * Grow the event buffer to hold at least requiredSize bytes. Only the first
+ * keepBytes are carried over, the rest of the buffer is about to be
+ * overwritten by the caller and is not copied.
+ */
+int cbdf::resizeEventbuffer(uint64_t requiredSize, uint64_t keepBytes)
 {
-    eventBufferSize *= 2;
-    eventBufferBase = (char*) realloc(eventBufferBase, eventBufferSize);
-    if (eventBufferBase == NULL)
+    uint64_t _newSize = eventBufferSize;
+    while (_newSize < requiredSize)
+        _newSize *= 2;
+    char* _newBuffer = allocator->allocate(_newSize);
+    if (_newBuffer == NULL)
         return -1;
 
+    memcpy(_newBuffer, eventBufferBase, keepBytes);
+    allocator->release(eventBufferBase, eventBufferSize);
+    eventBufferBase = _newBuffer;
+    eventBufferSize = _newSize;
+
     wEventHeader = (cbdfEventHeader_t*) eventBufferBase;
     rEventHeader = (cbdfEventHeader_t*) eventBufferBase;
     payloadBase = eventBufferBase + sizeof(cbdfEventHeader_t);
@@ -158,8 +612,116 @@ int cbdf::resizeEventbuffer()
 
 int cbdf::readFileHeader()
 {
-    ((boostIO::filtering_istream*)cbdfInFile)->read((char*) rFileHeader, sizeof(cbdfFileHeader_t));
-    return checkFileHeader();
+    if (readStream((char*) rFileHeader, sizeof(cbdfFileHeader_t)) != 0)
+    {
+        std::cerr << "File too short for a file header" << std::endl;
+        return CBDF_FILE_HEADER_ERROR;
+    }
+    int _ret = checkFileHeader();
+    // A damaged header may be no header at all, its bytes are read again as
+    // the start of the events, where scanForNextEvent() can search them
+    if (_ret == CBDF_FILE_HEADER_ERROR)
+    {
+        rPending.assign((const char*) rFileHeader, sizeof(cbdfFileHeader_t));
+        rPendingPos = 0;
+        rStreamOffset = 0;
+    }
+    rBankAlignment = (_ret == 0) ? bankAlignment(rFileHeader->features) : 0;
+    rBankCodecs = (_ret == 0) && (rFileHeader->features & CBDF_FEATURE_BANK_CODECS);
+    rEventZstd = (_ret == 0) && (rFileHeader->features & CBDF_FEATURE_EVENT_ZSTD);
+    rEventCodecs = (_ret == 0) && (rFileHeader->features & CBDF_FEATURE_EVENT_CODECS);
+    coder->setDictionary(std::string());
+    rDictionary.clear();
+    if (_ret == 0 && (rFileHeader->features & CBDF_FEATURE_DICTIONARY))
+    {
+        cbdfBlockHeader_t _header;
+        cbdfBlockTrailer_t _trailer;
+        std::string _dictionary;
+        if (readStream((char*) &_header, sizeof(_header)) != 0 || _header.openTag != 0xCBBDCBBD || _header.type != CBDF_BLOCK_DICTIONARY || _header.size > CBDF_DICTIONARY_MAX_SIZE)
+        {
+            std::cerr << "Dictionary block not found behind the file header" << std::endl;
+            return CBDF_FILE_HEADER_ERROR;
+        }
+        _dictionary.resize(_header.size);
+        if ((_header.size && readStream(&_dictionary[0], _header.size) != 0) || readStream((char*) &_trailer, sizeof(_trailer)) != 0 || !checkBlock(_header, _dictionary, _trailer))
+        {
+            std::cerr << "Dictionary block corrupt" << std::endl;
+            return CBDF_FILE_HEADER_ERROR;
+        }
+        coder->setDictionary(_dictionary);
+        rDictionary.swap(_dictionary);
+    }
+    return _ret;
+}
+
+/*
+ * Read exactly size bytes from the input stream. In follow mode a short read
+ * is not an error: the stream is rearmed and we wait for the writer to
+ * append more data, backing off exponentially while nothing arrives.
+ */
+int cbdf::readStream(char* buffer, uint64_t size)
+{
+    uint64_t _read = 0;
+    uint32_t _backoff = 1;
+    uint32_t _idle = 0;
+
+    if (rPendingPos < rPending.size())
+    {
+        _read = std::min(size, (uint64_t) rPending.size() - rPendingPos);
+        memcpy(buffer, rPending.data() + rPendingPos, _read);
+        rPendingPos += _read;
+        rStreamOffset += _read;
+        if (rPendingPos == rPending.size())
+        {
+            rPending.clear();
+            rPendingPos = 0;
+        }
+        if (_read == size)
+            return 0;
+    }
+    while (true)
+    {
+        uint64_t _got = cbdfInFile->read(buffer + _read, size - _read);
+        _read += _got;
+        rStreamOffset += _got;
+        if (_read == size)
+            return 0;
+        if (!followMode || cbdfInFile->bad())
+            return CBDF_UNEXPECTED_EOF;
+        if (_got > 0)
+        {
+            _idle = 0;
+            _backoff = 1;
+        }
+        if (followTimeout && _idle >= followTimeout)
+            return CBDF_UNEXPECTED_EOF;
+        waitForData(_backoff);
+        _idle += _backoff;
+        if (_backoff < FOLLOW_MAX_BACKOFF)
+            _backoff *= 2;
+    }
+}
+
+/*
+ * Sleep until the followed file is modified or timeoutMs passed. With
+ * inotify the writer wakes us immediately, otherwise this is plain polling.
+ */
+void cbdf::waitForData(uint32_t timeoutMs)
+{
+    if (followFd < 0)
+    {
+        usleep(timeoutMs * 1000);
+        return;
+    }
+    struct pollfd _pfd;
+    _pfd.fd = followFd;
+    _pfd.events = POLLIN;
+    if (poll(&_pfd, 1, timeoutMs) > 0)
+    {
+        char _events[4096];
+        while (read(followFd, _events, sizeof(_events)) > 0)
+            ;
+    }
 }
 
 int cbdf::checkFileHeader()
@@ -167,6 +729,12 @@ int cbdf::checkFileHeader()
     if ((rFileHeader->openTag & rFileHeader->closeTag) == 0xcbdfcbdf)
     {
         std::cerr << "Found file header" << std::endl;
+        uint64_t _unsupported = unsupportedFeatures(rFileHeader->features);
+        if (_unsupported)
+        {
+            std::cerr << "File requires unsupported features 0x" << std::hex << _unsupported << std::dec << std::endl;
+            return CBDF_UNSUPPORTED_FEATURE;
+        }
         return 0;
     }
     std::cerr << "Fileheader mismatch" << std::endl;
@@ -178,6 +746,8 @@ int cbdf::checkFileTrailer()
     if ((rFileTrailer->openTag & rFileTrailer->closeTag) == 0xfdbcfdbc)
     {
         std::cerr << "End of file detected, found file trailer" << std::endl;
+        if (rFileTrailer->features != rFileHeader->features)
+            std::cerr << "File trailer features " << describeFeatures(rFileTrailer->features) << " differ from the header" << std::endl;
         return CBDF_EOF;
     }
     std::cerr << "Unexpected end of file, no file trailer found" << std::endl;
@@ -193,12 +763,71 @@ int cbdf::checkEvent()
         return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
 }
 
+/*
+ * Walk the bank headers of the buffered payload in a single pass. Every bank
+ * is bounds checked against the remaining payload before it is entered, so a
+ * corrupt size field can never move the cursor past the end of the buffer.
+ * Each header is fetched with one fixed size copy, which the compiler lowers
+ * to wide loads, and the name is bounded to its 12 byte field instead of
+ * relying on a terminating \0.
+ */
+int cbdf::parseBankDirectory()
+{
+    cbdfBankMapEntry_t _currentBank;
+    const char* _cursor = payloadBase;
+    const char* _end = payloadBase + payloadSize;
+
+    while (_cursor != _end)
+    {
+        uint32_t _padding = bankPadding(_cursor - payloadBase, rBankAlignment);
+        if ((uint64_t) (_end - _cursor) < _padding + sizeof(cbdfBankHeader_t))
+            break;
+        _cursor += _padding;
+        memcpy(&_currentBank, _cursor, sizeof(cbdfBankHeader_t));
+        if (_currentBank.size > (uint64_t) (_end - _cursor) - sizeof(cbdfBankHeader_t))
+            break;
+        _currentBank.dataPtr = (char*) _cursor + sizeof(cbdfBankHeader_t);
+        if (rBankCodecs && (_currentBank.userFlags & CBDF_BANK_CODEC_MASK))
+        {
+            // Only reserve room, the bank is decompressed when it is asked for
+            uint32_t _rawSize;
+            if (_currentBank.size < sizeof(_rawSize))
+                break;
+            memcpy(&_rawSize, _currentBank.dataPtr, sizeof(_rawSize));
+            decodeBufferNeeded += (_rawSize + 63) & ~63ULL;
+        }
+        else if (rBankCodecs && (_currentBank.userFlags & CBDF_BANK_FILTER_MASK))
+            decodeBufferNeeded += (_currentBank.size + 63) & ~63ULL;
+        _cursor = _currentBank.dataPtr + _currentBank.size;
+        bankDirectory.push_back(_currentBank);
+    }
+
+    // Reject the event if the banks do not tile the payload exactly
+    if (_cursor != _end)
+    {
+        bankDirectory.clear();
+        return CBDF_BANK_ERROR;
+    }
+
+    for (uint32_t i = 0; i < bankDirectory.size(); i++)
+    {
+        std::string _name(bankDirectory[i].name, strnlen(bankDirectory[i].name, sizeof(bankDirectory[i].name)));
+        bankMap.insert(bankPair_t(_name, bankDirectory[i]));
+        if (rBankCodecs)
+            bankIndex.insert(std::pair<std::string, uint32_t>(_name, i));
+    }
+    payloadPtr = (char*) _end;
+    return 0;
+}
+
 //Public methods
 
-cbdf::cbdf(uint64_t _eventBufferSize)
+cbdf::cbdf(uint64_t _eventBufferSize, cbdfAllocator* _allocator)
 {
     // Allocate event buffer
-    eventBufferBase = (char*) calloc(_eventBufferSize, 1);
+    allocator = _allocator ? _allocator : cbdfBufferPool::defaultPool();
+    eventBufferSize = _eventBufferSize;
+    eventBufferBase = allocator->allocate(eventBufferSize);
 
     // Allocate data structures
     wEventTrailer = new cbdfEventTrailer_t;
@@ -221,7 +850,6 @@ cbdf::cbdf(uint64_t _eventBufferSize)
 
     payloadBase = eventBufferBase + sizeof(cbdfEventHeader_t);
     payloadPtr = payloadBase;
-    eventBufferSize = _eventBufferSize;
     payloadSize = 0;
     bytesBuffered = 0;
     currentUserFlags=0;
@@ -232,53 +860,114 @@ cbdf::cbdf(uint64_t _eventBufferSize)
     wBankHeader = NULL;
     fileAccessMode = readMode;
     eventBuffered = false;
+    followMode = false;
+    followTimeout = 0;
+    followFd = -1;
+    rotator = NULL;
+    rotationBytes = 0;
+    rotationEvents = 0;
+    rotationSeconds = 0;
+    rotationChunk = 0;
+    checkpointBytes = 0;
+    checkpointSeconds = 0;
+    checkpointAt = 0;
+    checkpointTime = 0;
+    memset(&checkpointStats, 0, sizeof(checkpointStats));
+    wCompression = none;
+    rStreamOffset = 0;
+    rEventOffset = 0;
+    rPendingPos = 0;
+    rFramed = false;
+    ioOptions.preallocate = 0;
+    ioOptions.writebackInterval = 0;
+    ioOptions.sequential = true;
+    ioOptions.dropBehind = 0;
+    ioOptions.queueDepth = 0;
+    ioOptions.blockSize = 1048576;
+    ioOptions.compressThreads = 0;
+    ioOptions.compressBlockSize = 8388608;
+    summary = new cbdfSummaryBuilder;
+    summaryEnabled = true;
+    summaryRequested = false;
+    wBankAlignment = 0;
+    rBankAlignment = 0;
+    wForeignBankCodecs = false;
+    coder = new cbdfBankCoder;
+    filterBufferBase = NULL;
+    filterBufferSize = 0;
+    rBankCodecs = false;
+    decodeBufferBase = NULL;
+    decodeBufferSize = 0;
+    decodeBufferUsed = 0;
+    decodeBufferNeeded = 0;
+    wEventZstd = false;
+    wEventLevel = 0;
+    rEventZstd = false;
+    controller = NULL;
+    rEventCodecs = false;
 
 }
 
 int cbdf::fileOpen(std::string filename, fileAccessMode_t mode, compressionType_t compr)
 {
-    int _nfilters = 0;
+    cbdfIOOptions_t _options;
+    uint64_t _features;
+    uint64_t _dataEnd;
+    int _ret;
     currentFileName=filename;
     switch (mode)
     {
     case (readMode):
-        cbdfInFile = (void*) new boostIO::filtering_istream();
-        switch (compr)
+        if (followMode && compr != none)
         {
-        case (gzip):
-            ((boostIO::filtering_istream*)cbdfInFile)->push(boostIO::gzip_decompressor());
-            _nfilters++;
-            break;
-        case (bzip2):
-            ((boostIO::filtering_istream*)cbdfInFile)->push(boostIO::bzip2_decompressor());
-            _nfilters++;
-            break;
-        case (xz):
-#ifdef WITH_LZMA
-            ((boostIO::filtering_istream*)cbdfInFile)->push(boostIO::lzma_decompressor());
-            _nfilters++;
-#else
-            std::cerr << "No LZMA support enabled at compile time -- Exiting\n";
-            exit(-1);
-#endif
-            break;
-        case (lzo):
-#ifdef WITH_LZO
-            ((boostIO::filtering_istream*)cbdfInFile)->push(boostIO::lzo_decompressor());
-            _nfilters++;
-#else
-            std::cerr << "No LZO support enabled at compile time -- Exiting\n";
-            exit(-1);
-#endif
-            break;
-        default:
-            break;
+            std::cerr << "Follow mode is only supported for uncompressed files, disabling it\n";
+            followMode = false;
+        }
+        _options = ioOptions;
+        if (followMode)
+            _options.queueDepth = 0; // Read-ahead would take the current end for the end of the file
+        // Compressed data ends where the footer starts, which only files flagged with one have
+        _dataEnd = 0;
+        if (compr != none)
+        {
+            _ret = readFileFeatures(currentFileName, compr, _features);
+            if (_ret == CBDF_UNSUPPORTED_FEATURE)
+                return _ret;
+            std::vector<cbdfFooterBlock_t> _blocks;
+            if (_ret == 0 && (_features & CBDF_FEATURE_FOOTER))
+                readFooter(currentFileName, _blocks, _dataEnd);
         }
-        ((boostIO::filtering_istream*)cbdfInFile)->push(boostIO::file_source(currentFileName));
-        if (((boostIO::filtering_istream*)cbdfInFile)->component<boostIO::file_source>(1)->is_open())
+        cbdfInFile = openInStream(currentFileName, compr, _options, _dataEnd);
+        rStreamOffset = 0;
+        rEventOffset = 0;
+        rPending.clear();
+        rPendingPos = 0;
+        rFramed = false;
+        if (cbdfInFile != NULL)
         {
             fileAccessMode = readMode;
-            readFileHeader();
+#ifdef __linux__
+            if (followMode)
+            {
+                followFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (followFd >= 0 && inotify_add_watch(followFd, currentFileName.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0)
+                {
+                    close(followFd);
+                    followFd = -1;
+                }
+            }
+#endif
+            if (readFileHeader() == CBDF_UNSUPPORTED_FEATURE)
+            {
+                delete cbdfInFile;
+                cbdfInFile = NULL;
+                if (followFd >= 0)
+                {
+                    close(followFd);
+                    followFd = -1;
+                }
+                return CBDF_UNSUPPORTED_FEATURE;
+            }
             rEventHeader = (cbdfEventHeader_t*) eventBufferBase;
             payloadBase = eventBufferBase + sizeof(cbdfEventHeader_t);
         }
@@ -288,45 +977,30 @@ int cbdf::fileOpen(std::string filename, fileAccessMode_t mode, compressionType_
         }
         break;
     case (writeMode):
-        cbdfOutFile = (void*) new boostIO::filtering_ostream;
-        switch (compr)
+        rotationChunk = 0;
+        if (rotationEnabled())
         {
-        case (gzip):
-            ((boostIO::filtering_ostream*)cbdfOutFile)->push(boostIO::gzip_compressor());
-            currentFileName = currentFileName + ".gz";
-            _nfilters++;
-            break;
-        case (bzip2):
-            ((boostIO::filtering_ostream*)cbdfOutFile)->push(boostIO::bzip2_compressor());
-            currentFileName = currentFileName + ".bz2";
-            _nfilters++;
-            break;
-        case (xz):
-#ifdef WITH_LZMA
-            ((boostIO::filtering_ostream*)cbdfOutFile)->push(boostIO::lzma_compressor());
-            currentFileName = currentFileName + ".xz";
-            _nfilters++;
-#else
-            std::cerr << "LZMA support not enabled at compile time, writing uncompressed!\n";
-#endif
-            break;
-        case (lzo):
-#ifdef WITH_LZO
-            ((boostIO::filtering_ostream*)cbdfOutFile)->push(boostIO::lzo_compressor());
-            currentFileName = currentFileName + ".lzo";
-            _nfilters++;
-#else
-            std::cerr << "LZO support not enabled at compile time, writing uncompressed!\n";
-#endif
-            break;
-        default:
-            break;
+            rotationBaseName = filename;
+            currentFileName = chunkFileName(rotationChunk);
+        }
+        if (compr == lzo && checkpointsEnabled())
+        {
+            std::cerr << "Checkpoints are not supported for lzo files, disabling them\n";
+            checkpointBytes = 0;
+            checkpointSeconds = 0;
         }
-        ((boostIO::filtering_ostream*)cbdfOutFile)->push(boostIO::file_sink(currentFileName));
-        if (((boostIO::filtering_ostream*)cbdfOutFile)->component<boostIO::file_sink>(_nfilters)->is_open())
+        // Footer blocks follow the compressed stream, keep it valid for other tools unless asked for
+        if (!summaryRequested)
+            summaryEnabled = (compr == none);
+        wCompression = compr;
+        memset(&checkpointStats, 0, sizeof(checkpointStats));
+        cbdfOutFile = openOutStream(currentFileName, compr, ioOptions);
+        if (cbdfOutFile != NULL)
         {
             fileAccessMode = writeMode;
             writeFileHeader();
+            if (rotationEnabled())
+                startRotator(compr);
         }
         else
         {
@@ -343,16 +1017,31 @@ int cbdf::fileOpen(std::string filename, fileAccessMode_t mode, compressionType_
 
 int cbdf::fileClose()
 {
+    std::string _footer;
     switch (fileAccessMode)
     {
     case (readMode):
-        ((boostIO::filtering_istream*)cbdfInFile)->pop();
-        delete (boostIO::filtering_istream*) cbdfInFile;
+        if (cbdfInFile == NULL)
+            return -1;
+        delete cbdfInFile;
+        cbdfInFile = NULL;
+        if (followFd >= 0)
+        {
+            close(followFd);
+            followFd = -1;
+        }
         break;
     case (writeMode):
+        if (cbdfOutFile == NULL)
+            return -1;
         writeFileTrailer();
-        ((boostIO::filtering_ostream*)cbdfOutFile)->pop();
-        delete (boostIO::filtering_ostream*) cbdfOutFile;
+        buildFooter(_footer, wFileTrailer->timeStop);
+        if (cbdfOutFile->close(_footer))
+            unlink((currentFileName + CBDF_CHECKPOINT_SUFFIX).c_str());
+        delete cbdfOutFile;
+        cbdfOutFile = NULL;
+        if (rotator != NULL)
+            stopRotator();
         break;
     default:
         break;
@@ -361,33 +1050,493 @@ int cbdf::fileClose()
     return 0;
 }
 
-// Write access methods
-int cbdf::clearEvent()
+int cbdf::flush()
 {
-    payloadSize = 0;
-    payloadPtr = payloadBase;
-    bankMap.clear();
+    if (fileAccessMode != writeMode || cbdfOutFile == NULL)
+        return -1;
+    if (!cbdfOutFile->flush())
+    {
+        std::cerr << "Could not flush " << currentFileName << std::endl;
+        return -1;
+    }
     return 0;
 }
 
-int cbdf::writeEvent()
+int cbdf::setCheckpoints(uint64_t intervalBytes, uint32_t intervalSeconds)
 {
-//Fill in header values
-    wEventHeader->eventNumber = currentEventnumber;
-    wEventHeader->userFlags = currentUserFlags;
-    wEventHeader->eventSize = payloadSize;
-
+    if (cbdfOutFile != NULL)
+        return -1;
+    checkpointBytes = intervalBytes;
+    checkpointSeconds = intervalSeconds;
+    return 0;
+}
+
+int cbdf::getCheckpointStats(cbdfCheckpointStats_t &stats)
+{
+    stats = checkpointStats;
+    return 0;
+}
+
+int cbdf::fileResume(std::string fileName)
+{
+    return resumeFile(fileName, false);
+}
+
+int cbdf::recoverFile(std::string fileName, uint64_t &events)
+{
+    cbdf _writer;
+    int _ret = _writer.resumeFile(fileName, true);
+    if (_ret != 0)
+        return _ret;
+    events = _writer.chunkEvents;
+    return _writer.fileClose();
+}
+
+int cbdf::setRotation(uint64_t maxBytes, uint64_t maxEvents, uint32_t maxSeconds)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    rotationBytes = maxBytes;
+    rotationEvents = maxEvents;
+    rotationSeconds = maxSeconds;
+    return 0;
+}
+
+int cbdf::setWriteOptions(uint64_t preallocateBytes, uint64_t writebackInterval)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    ioOptions.preallocate = preallocateBytes;
+    ioOptions.writebackInterval = writebackInterval;
+    return 0;
+}
+
+int cbdf::setReadOptions(bool sequential, uint64_t dropBehind)
+{
+    if (cbdfInFile != NULL)
+        return -1;
+    ioOptions.sequential = sequential;
+    ioOptions.dropBehind = dropBehind;
+    return 0;
+}
+
+int cbdf::setAsyncIO(uint32_t queueDepth, uint32_t blockSize)
+{
+    if (cbdfInFile != NULL || cbdfOutFile != NULL || (queueDepth && blockSize == 0))
+        return -1;
+#ifndef WITH_URING
+    if (queueDepth)
+        std::cerr << "io_uring support not enabled at compile time, using blocking I/O\n";
+#endif
+    ioOptions.queueDepth = queueDepth;
+    ioOptions.blockSize = blockSize;
+    return 0;
+}
+
+int cbdf::setCompressionThreads(uint32_t threads, uint64_t blockSize)
+{
+    if (cbdfOutFile != NULL || (threads > 1 && blockSize == 0))
+        return -1;
+    ioOptions.compressThreads = threads;
+    ioOptions.compressBlockSize = blockSize;
+    return 0;
+}
+
+int cbdf::setSummary(bool enable)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    summaryEnabled = enable;
+    summaryRequested = true;
+    return 0;
+}
+
+int cbdf::setBankAlignment(uint32_t alignment)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if (alignment != 0 && alignment != 16 && alignment != 32 && alignment != 64)
+        return -1;
+    wBankAlignment = alignment;
+    return 0;
+}
+
+uint32_t cbdf::getBankAlignment()
+{
+    if(fileAccessMode==readMode)
+        return rBankAlignment;
+    else
+        return wBankAlignment;
+}
+
+int cbdf::setBankCodec(std::string bankName, bankCodec_t codec, int level)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if (!cbdfBankCoder::available(codec))
+    {
+        std::cerr << "Bank codec " << codec << " not enabled at compile time" << std::endl;
+        return -1;
+    }
+    uint32_t _rule = codecRule(bankName);
+    codecRules[_rule].codec = codec;
+    codecRules[_rule].level = level;
+    codecRules[_rule].codecSet = true;
+    return 0;
+}
+
+int cbdf::setBankFilter(std::string bankName, uint32_t filters, uint32_t elementSize)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if ((filters & filterByteShuffle) && (filters & filterBitShuffle))
+        return -1;
+    uint16_t _filter = 0;
+    switch (elementSize)
+    {
+    case 1: break;
+    case 2: _filter = 1 << CBDF_BANK_FILTER_ELEMENT_SHIFT; break;
+    case 4: _filter = 2 << CBDF_BANK_FILTER_ELEMENT_SHIFT; break;
+    case 8: _filter = 3 << CBDF_BANK_FILTER_ELEMENT_SHIFT; break;
+    default: return -1;
+    }
+    if (filters & filterDelta)
+        _filter |= CBDF_BANK_FILTER_DELTA;
+    if (filters & filterByteShuffle)
+        _filter |= CBDF_BANK_FILTER_BYTESHUFFLE;
+    if (filters & filterBitShuffle)
+        _filter |= CBDF_BANK_FILTER_BITSHUFFLE;
+    // The element size alone does not change the data
+    if (!(_filter & ~CBDF_BANK_FILTER_ELEMENT_MASK))
+        _filter = 0;
+    codecRules[codecRule(bankName)].filter = _filter;
+    return 0;
+}
+
+int cbdf::setDictionary(const std::string &dictionary)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if (!dictionary.empty() && !cbdfBankCoder::available(bankZstd))
+    {
+        std::cerr << "zstd not enabled at compile time" << std::endl;
+        return -1;
+    }
+    if (dictionary.size() > CBDF_DICTIONARY_MAX_SIZE)
+        return -1;
+    wDictionary = dictionary;
+    return 0;
+}
+
+int cbdf::setEventCompression(bool enable, int level)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if (enable && !cbdfBankCoder::available(bankZstd))
+    {
+        std::cerr << "zstd not enabled at compile time" << std::endl;
+        return -1;
+    }
+    wEventZstd = enable;
+    wEventLevel = level;
+    return 0;
+}
+
+int cbdf::setAdaptiveCompression(bool enable, double targetBacklog, double cpuBudget)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    delete controller;
+    controller = NULL;
+    if (enable)
+    {
+        controller = new cbdfCompressionController;
+        controller->configure(targetBacklog, cpuBudget);
+    }
+    return 0;
+}
+
+int cbdf::reportBacklog(double fill)
+{
+    if (controller == NULL)
+        return -1;
+    controller->reportBacklog(fill);
+    return 0;
+}
+
+int cbdf::getEventCompression(bankCodec_t &codec, int &level)
+{
+    if (controller != NULL)
+    {
+        codec = (bankCodec_t) controller->codec();
+        level = controller->level();
+    }
+    else
+    {
+        codec = wEventZstd ? bankZstd : bankRaw;
+        level = wEventZstd ? wEventLevel : 0;
+    }
+    return 0;
+}
+
+int cbdf::trainDictionary(const std::vector<std::string> &samples, uint32_t maxSize, std::string &dictionary)
+{
+    if (!cbdfBankCoder::available(bankZstd))
+    {
+        std::cerr << "zstd not enabled at compile time" << std::endl;
+        return -1;
+    }
+    return cbdfBankCoder::trainDictionary(samples, maxSize, dictionary) ? 0 : -1;
+}
+
+// Index of the codec rule for bankName, a new raw one if there is none yet
+uint32_t cbdf::codecRule(const std::string &bankName)
+{
+    char _name[12];
+    memset(_name, 0, sizeof(_name));
+    strncpy(_name, bankName.c_str(), sizeof(_name));
+    for (uint32_t i = 0; i < codecRules.size(); i++)
+        if (memcmp(codecRules[i].name, _name, sizeof(_name)) == 0)
+            return i;
+    cbdfCodecRule_t _rule;
+    memcpy(_rule.name, _name, sizeof(_name));
+    _rule.codec = bankRaw;
+    _rule.level = 0;
+    _rule.codecSet = false;
+    _rule.filter = 0;
+    codecRules.push_back(_rule);
+    return codecRules.size() - 1;
+}
+
+// Scratch space of at least size bytes, kept for the next bank
+char* cbdf::filterBuffer(uint64_t size)
+{
+    if (size <= filterBufferSize)
+        return filterBufferBase;
+    if (filterBufferBase != NULL)
+        allocator->release(filterBufferBase, filterBufferSize);
+    filterBufferSize = size;
+    filterBufferBase = allocator->allocate(filterBufferSize);
+    if (filterBufferBase == NULL)
+        filterBufferSize = 0;
+    return filterBufferBase;
+}
+
+int cbdf::setFollowMode(bool follow, uint32_t idleTimeoutMs)
+{
+    followMode = follow;
+    followTimeout = idleTimeoutMs;
+    return 0;
+}
+
+// Write access methods
+int cbdf::clearEvent()
+{
+    payloadSize = 0;
+    payloadPtr = payloadBase;
+    bankMap.clear();
+    bankDirectory.clear();
+    bankIndex.clear();
+    decodeBufferUsed = 0;
+    decodeBufferNeeded = 0;
+    return 0;
+}
+
+int cbdf::writeEvent()
+{
+//Fill in header values
+    wEventHeader->eventNumber = currentEventnumber;
+    wEventHeader->userFlags = currentUserFlags;
+    wEventHeader->eventSize = payloadSize;
+
 //Calculate CRC and add trailer to buffer
     wEventTrailer->eventSize = payloadSize;
     wEventTrailer->crc32 = crc32();
     memcpy(payloadPtr, wEventTrailer, sizeof(cbdfEventTrailer_t));
 
+//Start the next chunk if the current one is full
+    int _ret = checkRotation();
+    if (_ret != 0)
+        return _ret;
+
 //Write buffer to file
-    ((boostIO::filtering_ostream*)cbdfOutFile)->write((const char *) eventBufferBase, wEventSize());
+    std::string _sourceEntry;
+    _sourceEntry.swap(sourcePending);
+    uint64_t _written = writeRecord(eventBufferBase);
+    if (_written == 0)
+        return -1;
+    if (summaryEnabled)
+        summary->addEvent(eventBufferBase);
+    sourceIndex.append(_sourceEntry);
+    chunkBytes += _written;
+    chunkEvents++;
 //Prepare next event
     currentEventnumber++;
     clearEvent();
 
+    checkCheckpoint();
+
+    return 0;
+}
+
+/*
+ * Write a complete event record (header, payload and trailer exactly as
+ * writeEvent() lays them out) that was built outside of this instance. The
+ * record keeps its event number and CRC, numbering continues after it.
+ */
+int cbdf::writeEventRecord(const char* eventRecord)
+{
+    std::string _sourceEntry;
+    _sourceEntry.swap(sourcePending);
+    if (fileAccessMode != writeMode || cbdfOutFile == NULL)
+        return -1;
+    const cbdfEventHeader_t* _header = (const cbdfEventHeader_t*) eventRecord;
+    if ((_header->openTag != 0xcbedcbed) || (_header->closeTag != 0xcbedcbed))
+        return CBDF_EVENT_HEADER_NOT_FOUND;
+    const cbdfEventTrailer_t* _trailer = (const cbdfEventTrailer_t*) (eventRecord + sizeof(cbdfEventHeader_t) + _header->eventSize);
+    if ((_trailer->openTag != 0xdebcdebc) || (_trailer->closeTag != 0xdebcdebc) || (_trailer->eventSize != _header->eventSize))
+        return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
+
+    int _ret = checkRotation();
+    if (_ret != 0)
+    {
+        sourcePending.swap(_sourceEntry);
+        return _ret;
+    }
+    uint64_t _written = writeRecord(eventRecord);
+    if (_written == 0)
+        return -1;
+    if (summaryEnabled)
+        summary->addEvent(eventRecord);
+    sourceIndex.append(_sourceEntry);
+    chunkBytes += _written;
+    chunkEvents++;
+    currentEventnumber = _header->eventNumber + 1;
+
+    checkCheckpoint();
+    return 0;
+}
+
+/*
+ * Hand a finished event record to the output stream, as it is or, with event
+ * compression, rebuilt in the scratch space around the compressed payload.
+ * The stored payload starts with the uncompressed size, in adaptive mode
+ * followed by the codec as uint32_t. If the compressed data would not be
+ * smaller the raw payload follows instead (codec bankRaw). Returns the bytes
+ * written, 0 on failure.
+ */
+uint64_t cbdf::writeRecord(const char* eventRecord)
+{
+    const cbdfEventHeader_t* _header = (const cbdfEventHeader_t*) eventRecord;
+    uint64_t _size = _header->eventSize;
+    // Readers take larger events for damage
+    if (_size > CBDF_SCAN_MAX_EVENT_SIZE)
+    {
+        std::cerr << "Event of " << _size << " bytes exceeds the maximum event size" << std::endl;
+        return 0;
+    }
+    if (!wEventZstd && controller == NULL)
+    {
+        uint64_t _recordSize = sizeof(cbdfEventHeader_t) + _size + sizeof(cbdfEventTrailer_t);
+        cbdfOutFile->write(eventRecord, _recordSize);
+        return _recordSize;
+    }
+    if (_size > 0xffffffffULL)
+    {
+        std::cerr << "Event too large for event compression" << std::endl;
+        return 0;
+    }
+
+    uint32_t _rawSize = _size;
+    uint32_t _codec = (controller != NULL) ? controller->codec() : (uint32_t) bankZstd;
+    int _level = (controller != NULL) ? controller->level() : wEventLevel;
+    uint64_t _prefix = (controller != NULL) ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+    uint64_t _room = cbdfBankCoder::bound(_codec, _size);
+    if (_room < _size)
+        _room = _size;
+    char* _record = filterBuffer(sizeof(cbdfEventHeader_t) + _prefix + _room + sizeof(cbdfEventTrailer_t));
+    if (_record == NULL)
+        return 0;
+    char* _payload = _record + sizeof(cbdfEventHeader_t);
+    uint64_t _stored = 0;
+    uint64_t _start = (controller != NULL) ? cbdfCompressionController::nowNs() : 0;
+    if (_size > 1 && _codec != bankRaw)
+        _stored = coder->compress(_codec, _level, eventRecord + sizeof(cbdfEventHeader_t), _size, _payload + _prefix, _size - 1);
+    if (controller != NULL)
+        controller->update(cbdfCompressionController::nowNs() - _start);
+    if (_stored == 0)
+    {
+        memcpy(_payload + _prefix, eventRecord + sizeof(cbdfEventHeader_t), _size);
+        _stored = _size;
+        _codec = bankRaw;
+    }
+    memcpy(_payload, &_rawSize, sizeof(_rawSize));
+    if (controller != NULL)
+        memcpy(_payload + sizeof(_rawSize), &_codec, sizeof(_codec));
+    _stored += _prefix;
+
+    cbdfEventHeader_t* _storedHeader = (cbdfEventHeader_t*) _record;
+    memcpy(_storedHeader, _header, sizeof(cbdfEventHeader_t));
+    _storedHeader->eventSize = _stored;
+    cbdfEventTrailer_t _trailer = *wEventTrailer;
+    _trailer.crc32 = cbdfCrc32(_payload, _stored);
+    _trailer.eventSize = _stored;
+    memcpy(_payload + _stored, &_trailer, sizeof(_trailer));
+
+    uint64_t _recordSize = sizeof(cbdfEventHeader_t) + _stored + sizeof(cbdfEventTrailer_t);
+    cbdfOutFile->write(_record, _recordSize);
+    return _recordSize;
+}
+
+/*
+ * Records written with writeEventRecord() are stored as they are, so a file
+ * taking them over from another file needs the same bank layout: the bank
+ * alignment, the bank codec bit if its banks may be encoded, and the
+ * dictionary its zstd banks were compressed with.
+ */
+int cbdf::setLayoutFeatures(uint64_t features, const std::string &dictionary)
+{
+    if (cbdfOutFile != NULL)
+        return -1;
+    if (unsupportedFeatures(features))
+        return CBDF_UNSUPPORTED_FEATURE;
+    if ((features & CBDF_FEATURE_DICTIONARY) && dictionary.empty())
+    {
+        std::cerr << "Records are compressed with a dictionary that was not handed over" << std::endl;
+        return -1;
+    }
+    if ((features & CBDF_FEATURE_DICTIONARY) && setDictionary(dictionary) != 0)
+        return -1;
+    wBankAlignment = bankAlignment(features);
+    wForeignBankCodecs = (features & CBDF_FEATURE_BANK_CODECS) != 0;
+    return 0;
+}
+
+int cbdf::addParentUuid(std::string uuid)
+{
+    if (cbdfOutFile != NULL || uuid.size() != sizeof(wFileHeader->uuid))
+        return -1;
+    if (std::find(parentUuids.begin(), parentUuids.end(), uuid) == parentUuids.end())
+        parentUuids.push_back(uuid);
+    return 0;
+}
+
+int cbdf::setSourceIndex(std::string uuid)
+{
+    if (cbdfOutFile != NULL || uuid.size() != sizeof(wFileHeader->uuid))
+        return -1;
+    sourceUuid = uuid;
+    sourceIndex.clear();
+    sourcePending.clear();
+    return 0;
+}
+
+int cbdf::addSourceIndexEntry(uint64_t eventNumber, uint64_t offset)
+{
+    if (cbdfOutFile == NULL || sourceUuid.empty())
+        return -1;
+    sourcePending.assign((const char*) &eventNumber, sizeof(eventNumber));
+    sourcePending.append((const char*) &offset, sizeof(offset));
     return 0;
 }
 
@@ -405,27 +1554,116 @@ int cbdf::setEventUserFlags(uint64_t userFlags)
 
 }
 
+/*
+ * With codec rules the bank is pre-filtered into the scratch space and
+ * compressed straight into the event buffer, which is grown to the worst
+ * case size of the codec first. Banks that do not get smaller are stored
+ * raw and unfiltered.
+ */
 int cbdf::addBank(const char* name, uint16_t userFlags, char* dataPointer, uint32_t dataSize)
 {
-    uint32_t _bankSize = sizeof(cbdfBankHeader_t) + dataSize;
-    while ((payloadSize + sizeof(cbdfEventHeader_t) + sizeof(cbdfEventTrailer_t) + _bankSize) > eventBufferSize)
-        resizeEventbuffer();
-    wBankHeader = (cbdfBankHeader_t *) payloadPtr;
-    for (int i = 0; i < 12; i++)
-        wBankHeader->name[i] = name[i];
+    uint32_t _codec = bankRaw;
+    int _level = 0;
+    uint16_t _filter = 0;
+    if (!codecRules.empty())
+    {
+        if (userFlags & CBDF_BANK_FLAGS_RESERVED)
+        {
+            std::cerr << "Bank " << name << ": user flags 0x" << std::hex << userFlags << std::dec << " use bits reserved for bank codecs" << std::endl;
+            return -1;
+        }
+        char _name[12];
+        strncpy(_name, name, sizeof(_name));
+        int _named = -1;
+        int _default = -1;
+        for (uint32_t i = 0; i < codecRules.size(); i++)
+        {
+            if (memcmp(codecRules[i].name, _name, sizeof(_name)) == 0)
+                _named = i;
+            else if (codecRules[i].name[0] == '\0')
+                _default = i;
+        }
+        if (_default >= 0)
+        {
+            _codec = codecRules[_default].codec;
+            _level = codecRules[_default].level;
+            _filter = codecRules[_default].filter;
+        }
+        // A rule that only sets filters keeps the codec of the default rule
+        if (_named >= 0)
+        {
+            if (codecRules[_named].codecSet)
+            {
+                _codec = codecRules[_named].codec;
+                _level = codecRules[_named].level;
+            }
+            _filter = codecRules[_named].filter;
+        }
+        if (dataSize < CBDF_BANK_CODEC_MIN_SIZE)
+        {
+            _codec = bankRaw;
+            _filter = 0;
+        }
+    }
+
+    uint32_t _padding = bankPadding(payloadSize, wBankAlignment);
+    uint64_t _room = dataSize;
+    if (_codec != bankRaw && sizeof(uint32_t) + cbdfBankCoder::bound(_codec, dataSize) > _room)
+        _room = sizeof(uint32_t) + cbdfBankCoder::bound(_codec, dataSize);
+    uint64_t _required = payloadSize + sizeof(cbdfEventHeader_t) + sizeof(cbdfEventTrailer_t) + _padding + sizeof(cbdfBankHeader_t) + _room;
+    if (_required > eventBufferSize)
+        if (resizeEventbuffer(_required, sizeof(cbdfEventHeader_t) + payloadSize))
+            return -1;
+    memset(payloadPtr, 0, _padding);
+    wBankHeader = (cbdfBankHeader_t *) (payloadPtr + _padding);
+    strncpy(wBankHeader->name, name, sizeof(wBankHeader->name));
+    char* _data = (char*) wBankHeader + sizeof(cbdfBankHeader_t);
+
+    uint64_t _stored = 0;
+    char* _scratch = _filter ? filterBuffer(3 * (uint64_t) dataSize) : NULL;
+    if (_filter && _scratch == NULL)
+        return -1;
+    if (_codec != bankRaw)
+    {
+        const char* _source = dataPointer;
+        if (_filter)
+        {
+            encodeBankFilter(_filter, dataPointer, dataSize, _scratch, _scratch + dataSize);
+            _source = _scratch;
+        }
+        uint64_t _compressed = coder->compress(_codec, _level, _source, dataSize, _data + sizeof(uint32_t), _room - sizeof(uint32_t));
+        if (_compressed && _compressed + sizeof(uint32_t) < dataSize)
+        {
+            memcpy(_data, &dataSize, sizeof(uint32_t));
+            _stored = _compressed + sizeof(uint32_t);
+            userFlags |= (_codec << CBDF_BANK_CODEC_SHIFT) | _filter;
+        }
+    }
+    else if (_filter)
+    {
+        // Filtered only, for files compressed as a whole
+        encodeBankFilter(_filter, dataPointer, dataSize, _data, _scratch);
+        _stored = dataSize;
+        userFlags |= _filter;
+    }
+    if (_stored == 0)
+    {
+        memcpy(_data, dataPointer, dataSize);
+        _stored = dataSize;
+    }
     wBankHeader->userFlags = userFlags;
-    wBankHeader->size = dataSize;
-    memcpy(payloadPtr + sizeof(cbdfBankHeader_t), dataPointer, dataSize);
-    payloadPtr += _bankSize;
-    payloadSize += _bankSize;
+    wBankHeader->size = _stored;
+    payloadPtr += _padding + sizeof(cbdfBankHeader_t) + _stored;
+    payloadSize += _padding + sizeof(cbdfBankHeader_t) + _stored;
 
     return 0;
 }
 
 int cbdf::addRawData(char* bankPointer, uint32_t bankSize)
 {
-    while ((payloadSize + sizeof(cbdfEventHeader_t) + sizeof(cbdfEventTrailer_t) + bankSize) > eventBufferSize)
-        resizeEventbuffer();
+    if ((payloadSize + sizeof(cbdfEventHeader_t) + sizeof(cbdfEventTrailer_t) + bankSize) > eventBufferSize)
+        if (resizeEventbuffer(payloadSize + sizeof(cbdfEventHeader_t) + sizeof(cbdfEventTrailer_t) + bankSize, sizeof(cbdfEventHeader_t) + payloadSize))
+            return -1;
     memcpy(payloadPtr, bankPointer, bankSize);
     payloadPtr += bankSize;
     payloadSize += bankSize;
@@ -436,9 +1674,10 @@ int cbdf::skipEvents(int toSkip)
 {
     for(int i=0; i < toSkip ; i++)
     {
-        ((boostIO::filtering_istream*)cbdfInFile)->read((char *) eventBufferBase, sizeof(cbdfEventHeader_t));
         eventBuffered=false;
-        if (((boostIO::filtering_istream*)cbdfInFile)->good())
+        rFramed = false;
+        rEventOffset = rStreamOffset;
+        if (readStream((char *) eventBufferBase, sizeof(cbdfEventHeader_t)) == 0)
         {
             if (badEventHeader())
             {
@@ -446,7 +1685,8 @@ int cbdf::skipEvents(int toSkip)
                 if (rEventHeader->openTag == 0xfdbcfdbc)
                 {
                     // Read in complete header
-                    ((boostIO::filtering_istream*)cbdfInFile)->read((char *) payloadBase, sizeof(cbdfFileTrailer_t) - sizeof(cbdfEventHeader_t));
+                    if (readStream((char *) payloadBase, sizeof(cbdfFileTrailer_t) - sizeof(cbdfEventHeader_t)) != 0)
+                        return CBDF_UNEXPECTED_EOF;
                     rFileTrailer = (cbdfFileTrailer_t*) eventBufferBase;
                     return checkFileTrailer();
                 }
@@ -454,9 +1694,17 @@ int cbdf::skipEvents(int toSkip)
                 printEvent();
                 return CBDF_EVENT_HEADER_NOT_FOUND;
             }
-            while (rEventSize() > eventBufferSize)
-                resizeEventbuffer();
-            ((boostIO::filtering_istream*)cbdfInFile)->read((char *) payloadBase, rEventHeader->eventSize + sizeof(cbdfEventTrailer_t));
+            if (rEventHeader->eventSize > CBDF_SCAN_MAX_EVENT_SIZE)
+            {
+                std::cerr << "Event size " << rEventHeader->eventSize << " out of range at offset " << rEventOffset << std::endl;
+                return CBDF_EVENT_HEADER_NOT_FOUND;
+            }
+            if (rEventSize() > eventBufferSize)
+                if (resizeEventbuffer(rEventSize(), sizeof(cbdfEventHeader_t)))
+                    return -1;
+            payloadSize = rEventHeader->eventSize;
+            if (readStream((char *) payloadBase, rEventHeader->eventSize + sizeof(cbdfEventTrailer_t)) != 0)
+                return CBDF_UNEXPECTED_EOF;
             eventBuffered=true;
             payloadPtr = payloadBase;
             rEventTrailer = (cbdfEventTrailer_t*) (payloadBase + payloadSize);
@@ -466,6 +1714,7 @@ int cbdf::skipEvents(int toSkip)
                 printEvent();
                 return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
             }
+            rFramed = true;
         } else
         {
             return CBDF_UNEXPECTED_EOF;
@@ -476,13 +1725,62 @@ int cbdf::skipEvents(int toSkip)
 
 int cbdf::readEvent()
 {
-    cbdfBankMapEntry_t _currentBank;
-    std::string _currentBankName;
-    uint32_t _sizeRead = 0;
+    int _ret = readRecord(true);
+    if (_ret != 0)
+        return _ret;
+    //Fill Bank Map
+    return parseBankDirectory();
+}
+
+/*
+ * The record of a compressed event is rebuilt around the uncompressed
+ * payload, with a new trailer and CRC, so it can be written to any file.
+ */
+int cbdf::readEventRecord(const char* &record, bool checkCrc)
+{
+    int _ret = readRecord(checkCrc);
+    if (_ret != 0)
+        return _ret;
+    if (rEventZstd || rEventCodecs)
+    {
+        if (sizeof(cbdfEventHeader_t) + payloadSize + sizeof(cbdfEventTrailer_t) > eventBufferSize)
+            if (resizeEventbuffer(sizeof(cbdfEventHeader_t) + payloadSize + sizeof(cbdfEventTrailer_t), sizeof(cbdfEventHeader_t) + payloadSize))
+                return -1;
+        rEventHeader->eventSize = payloadSize;
+        cbdfEventTrailer_t _trailer = *wEventTrailer;
+        _trailer.crc32 = crc32();
+        _trailer.eventSize = payloadSize;
+        memcpy(payloadBase + payloadSize, &_trailer, sizeof(_trailer));
+        rEventTrailer = (cbdfEventTrailer_t*) (payloadBase + payloadSize);
+    }
+    record = eventBufferBase;
+    return 0;
+}
+
+int cbdf::parseBanks()
+{
+    if (fileAccessMode != readMode || !eventBuffered)
+        return -1;
+    bankMap.clear();
+    bankDirectory.clear();
+    bankIndex.clear();
+    decodeBufferUsed = 0;
+    decodeBufferNeeded = 0;
+    return parseBankDirectory();
+}
+
+// Read the next event record, check it and uncompress its payload, without touching the banks
+int cbdf::readRecord(bool checkCrc)
+{
     bankMap.clear();
-    ((boostIO::filtering_istream*)cbdfInFile)->read((char *) eventBufferBase, sizeof(cbdfEventHeader_t));
+    bankDirectory.clear();
+    bankIndex.clear();
+    decodeBufferUsed = 0;
+    decodeBufferNeeded = 0;
     eventBuffered=false;
-    if (((boostIO::filtering_istream*)cbdfInFile)->good())
+    rFramed = false;
+    rEventOffset = rStreamOffset;
+    if (readStream((char *) eventBufferBase, sizeof(cbdfEventHeader_t)) == 0)
     {
         if (badEventHeader())
         {
@@ -490,7 +1788,8 @@ int cbdf::readEvent()
             if (rEventHeader->openTag == 0xfdbcfdbc)
             {
                 // Read in complete header
-                ((boostIO::filtering_istream*)cbdfInFile)->read((char *) payloadBase, sizeof(cbdfFileTrailer_t) - sizeof(cbdfEventHeader_t));
+                if (readStream((char *) payloadBase, sizeof(cbdfFileTrailer_t) - sizeof(cbdfEventHeader_t)) != 0)
+                    return CBDF_UNEXPECTED_EOF;
                 rFileTrailer = (cbdfFileTrailer_t*) eventBufferBase;
                 return checkFileTrailer();
             }
@@ -498,12 +1797,23 @@ int cbdf::readEvent()
             printEvent();
             return CBDF_EVENT_HEADER_NOT_FOUND;
         }
+        // A damaged size must not make us allocate and read gigabytes
+        if (rEventHeader->eventSize > CBDF_SCAN_MAX_EVENT_SIZE)
+        {
+            std::cerr << "Event size " << rEventHeader->eventSize << " out of range at offset " << rEventOffset << std::endl;
+            return CBDF_EVENT_HEADER_NOT_FOUND;
+        }
         currentEventnumber = rEventHeader->eventNumber;
         currentUserFlags = rEventHeader->userFlags;
         payloadSize = rEventHeader->eventSize;
-        while (rEventSize() > eventBufferSize)
-            resizeEventbuffer();
-        ((boostIO::filtering_istream*)cbdfInFile)->read((char *) payloadBase, rEventHeader->eventSize + sizeof(cbdfEventTrailer_t));
+        if (rEventSize() > eventBufferSize)
+            if (resizeEventbuffer(rEventSize(), sizeof(cbdfEventHeader_t)))
+                return -1;
+        if (readStream((char *) payloadBase, rEventHeader->eventSize + sizeof(cbdfEventTrailer_t)) != 0)
+        {
+            std::cerr << "EOF detected" << std::endl;
+            return CBDF_UNEXPECTED_EOF;
+        }
         eventBuffered=true;
         payloadPtr = payloadBase;
         rEventTrailer = (cbdfEventTrailer_t*) (payloadBase + payloadSize);
@@ -514,46 +1824,87 @@ int cbdf::readEvent()
 
             return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
         }
+        rFramed = true;
 
-        if (crc32() != rEventTrailer->crc32)
+        // Compressed payloads can only be trusted once their CRC matched
+        if ((checkCrc || rEventZstd || rEventCodecs) && crc32() != rEventTrailer->crc32)
         {
             std::cerr << "CRC32 mismatch Payload:" << crc32() << " Event: " << rEventTrailer->crc32 << std::endl;
 
             return CBDF_EVENT_CRC_ERROR;
         }
-        //Fill Bank Map
-        while (_sizeRead < payloadSize)
-        {
-            rBankHeader = (cbdfBankHeader_t *) payloadPtr;
-            _currentBankName.assign(rBankHeader->name);
-            memcpy(&_currentBank, rBankHeader, sizeof(cbdfBankHeader_t));
-            payloadPtr += sizeof(cbdfBankHeader_t);
-            _currentBank.dataPtr = payloadPtr;
-            bankMap.insert(bankPair_t(_currentBankName, _currentBank));
-            payloadPtr += _currentBank.size;
-            _sizeRead += sizeof(cbdfBankHeader_t) + _currentBank.size;
-        }
-        // Check if the whole payload was consumed otherwise clear bankmap
-        if (_sizeRead != payloadSize)
-        {
-            bankMap.clear();
-            return CBDF_BANK_ERROR;
-        }
+        if (rEventZstd || rEventCodecs)
+            return unpackEvent();
         return 0;
     }
     else
     {
-        bankMap.clear();
         std::cerr << "EOF detected" << std::endl;
         return CBDF_UNEXPECTED_EOF;
     }
 }
 
+/*
+ * Replace the stored payload of a compressed event (size prefix, with
+ * CBDF_FEATURE_EVENT_CODECS also the codec, and the compressed or raw
+ * payload) by the uncompressed payload. Compressed data is moved to the
+ * scratch space first and decompressed into the event buffer, the event
+ * trailer is not kept.
+ */
+int cbdf::unpackEvent()
+{
+    uint32_t _rawSize;
+    uint32_t _codec = bankZstd;
+    uint64_t _prefix = rEventCodecs ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+    if (payloadSize < _prefix)
+        return CBDF_BANK_ERROR;
+    memcpy(&_rawSize, payloadBase, sizeof(_rawSize));
+    if (rEventCodecs)
+        memcpy(&_codec, payloadBase + sizeof(_rawSize), sizeof(_codec));
+    uint64_t _stored = payloadSize - _prefix;
+    if (rEventCodecs ? (_codec == bankRaw) : (_stored == _rawSize))
+    {
+        if (_stored != _rawSize)
+            return CBDF_BANK_ERROR;
+        memmove(payloadBase, payloadBase + _prefix, _rawSize);
+    }
+    else
+    {
+        char* _frame = filterBuffer(_stored);
+        if (_frame == NULL)
+            return -1;
+        memcpy(_frame, payloadBase + _prefix, _stored);
+        if (sizeof(cbdfEventHeader_t) + _rawSize > eventBufferSize)
+            if (resizeEventbuffer(sizeof(cbdfEventHeader_t) + _rawSize, sizeof(cbdfEventHeader_t)))
+                return -1;
+        if (!coder->decompress(_codec, _frame, _stored, payloadBase, _rawSize))
+        {
+            std::cerr << "Event " << currentEventnumber << " does not decompress" << std::endl;
+            return CBDF_BANK_ERROR;
+        }
+    }
+    payloadSize = _rawSize;
+    payloadPtr = payloadBase;
+    return 0;
+}
+
+// Entry handed out for a bank that failed to decode
+static cbdf::cbdfBankMapEntry_t undecodedBank(cbdf::cbdfBankMapEntry_t bank)
+{
+    bank.dataPtr = NULL;
+    bank.size = 0;
+    return bank;
+}
+
 cbdf::cbdfBankMapEntry_t cbdf::getBank(std::string bankName)
 {
-    if (bankMap.find(bankName) != bankMap.end())
+    bankMapIt_t _itBank = bankMap.find(bankName);
+    if (_itBank != bankMap.end())
     {
-        return bankMap.find(bankName)->second;
+        std::map<std::string, uint32_t>::iterator _itIndex = bankIndex.find(bankName);
+        if (_itIndex != bankIndex.end() && decodeBank(_itIndex->second) != 0)
+            return undecodedBank(_itBank->second);
+        return _itBank->second;
     }
     else
     {
@@ -564,15 +1915,104 @@ cbdf::cbdfBankMapEntry_t cbdf::getBank(std::string bankName)
     }
 }
 
+cbdf::cbdfBankMapEntry_t cbdf::getBankAt(uint32_t index)
+{
+    if (index < bankDirectory.size())
+    {
+        if (decodeBank(index) != 0)
+            return undecodedBank(bankDirectory[index]);
+        return bankDirectory[index];
+    }
+    std::cerr << "Bank index " << index << " out of range" << std::endl;
+    cbdfBankMapEntry_t _dummyBank;
+    bzero(&_dummyBank, sizeof(_dummyBank));
+    return _dummyBank;
+}
+
+/*
+ * Decode a bank into the decode buffer, which is sized for all encoded
+ * banks of the event when the first one is asked for. The
+ * directory and map entries of the bank both point to the result
+ * afterwards, so it is decompressed only once.
+ */
+int cbdf::decodeBank(uint32_t index)
+{
+    const cbdfBankMapEntry_t &bank = bankDirectory[index];
+    uint32_t _codec = (bank.userFlags & CBDF_BANK_CODEC_MASK) >> CBDF_BANK_CODEC_SHIFT;
+    uint16_t _filter = bank.userFlags & CBDF_BANK_FILTER_MASK;
+    if (!rBankCodecs || (_codec == bankRaw && _filter == 0))
+        return 0;
+    uint32_t _rawSize = bank.size;
+    if (_codec != bankRaw)
+        memcpy(&_rawSize, bank.dataPtr, sizeof(_rawSize));
+    uint64_t _slot = (_rawSize + 63) & ~63ULL;
+
+    if (decodeBufferUsed == 0 && decodeBufferSize < decodeBufferNeeded)
+    {
+        if (decodeBufferBase != NULL)
+            allocator->release(decodeBufferBase, decodeBufferSize);
+        decodeBufferSize = decodeBufferNeeded;
+        decodeBufferBase = allocator->allocate(decodeBufferSize);
+        if (decodeBufferBase == NULL)
+        {
+            decodeBufferSize = 0;
+            return -1;
+        }
+    }
+    if (decodeBufferUsed + _slot > decodeBufferSize)
+        return CBDF_BANK_ERROR;
+    char* _target = decodeBufferBase + decodeBufferUsed;
+    // Filtered banks are decompressed into the scratch space first and unfiltered into the decode buffer
+    char* _scratch = _filter ? filterBuffer(2 * (uint64_t) _rawSize) : NULL;
+    if (_filter && _scratch == NULL)
+        return -1;
+    if (_codec == bankRaw)
+        decodeBankFilter(_filter, bank.dataPtr, _rawSize, _target, _scratch);
+    else if (coder->decompress(_codec, bank.dataPtr + sizeof(_rawSize), bank.size - sizeof(_rawSize), _filter ? _scratch : _target, _rawSize))
+    {
+        if (_filter)
+            decodeBankFilter(_filter, _scratch, _rawSize, _target, _scratch + _rawSize);
+    }
+    else
+    {
+        std::cerr << "Bank " << std::string(bank.name, strnlen(bank.name, sizeof(bank.name))) << " can not be decompressed" << std::endl;
+        return CBDF_BANK_ERROR;
+    }
+    decodeBufferUsed += _slot;
+
+    cbdfBankMapEntry_t _decoded = bank;
+    _decoded.dataPtr = _target;
+    _decoded.size = _rawSize;
+    _decoded.userFlags &= ~(CBDF_BANK_CODEC_MASK | CBDF_BANK_FILTER_MASK);
+    bankDirectory[index] = _decoded;
+    // The map holds the first bank of each name only
+    std::string _name(_decoded.name, strnlen(_decoded.name, sizeof(_decoded.name)));
+    std::map<std::string, uint32_t>::iterator _itIndex = bankIndex.find(_name);
+    if (_itIndex != bankIndex.end() && _itIndex->second == index)
+        bankMap[_name] = _decoded;
+    return 0;
+}
+
+// Encoded banks are decoded up front, so that walking bankMap hands out their data
 cbdf::bankMapIt_t cbdf::getBanks()
 {
+    for (std::map<std::string, uint32_t>::iterator _itIndex = bankIndex.begin(); _itIndex != bankIndex.end(); _itIndex++)
+        if (decodeBank(_itIndex->second) != 0)
+            bankMap[_itIndex->first] = undecodedBank(bankMap[_itIndex->first]);
     return bankMap.begin();
 }
 
+const cbdf::bankDirectory_t& cbdf::getBankDirectory()
+{
+    return bankDirectory;
+}
+
 int cbdf::getRawData(char* dataPointer, uint64_t &dataSize)
 {
-    dataPointer = eventBufferBase + sizeof(cbdfEventHeader_t);
-    dataSize = rEventHeader->eventSize;
+    if (!eventBuffered)
+        return -1;
+    memcpy(dataPointer, payloadBase, payloadSize);
+    dataSize = payloadSize;
     return 0;
 }
 
@@ -591,6 +2031,11 @@ uint64_t cbdf::getEventSize()
     return payloadSize;
 }
 
+uint64_t cbdf::getEventOffset()
+{
+    return rEventOffset;
+}
+
 char* cbdf::getUuid()
 {
     if(fileAccessMode==readMode)
@@ -599,25 +2044,249 @@ char* cbdf::getUuid()
         return wFileHeader->uuid;
 }
 
+uint64_t cbdf::getFileStartTime()
+{
+    if(fileAccessMode==readMode)
+        return rFileHeader->timeStart;
+    else
+        return wFileHeader->timeStart;
+}
+
 std::string cbdf::getFileName()
 {
     return currentFileName;
 }
 
+cbdf::compressionType_t cbdf::guessCompression(std::string fileName)
+{
+    size_t _dot = fileName.find_last_of('.');
+    if (_dot == std::string::npos)
+        return none;
+    std::string _extension = fileName.substr(_dot);
+    if (_extension == ".gz")
+        return gzip;
+    if (_extension == ".bz2")
+        return bzip2;
+    if (_extension == ".xz")
+        return xz;
+    if (_extension == ".lzo")
+        return lzo;
+    return none;
+}
+
+const std::string& cbdf::getDictionary()
+{
+    return rDictionary;
+}
+
+uint64_t cbdf::getFileFeatures()
+{
+    if(fileAccessMode==readMode)
+        return rFileHeader->features;
+    else
+        return wFileHeader->features;
+}
+
+int cbdf::readFileFeatures(std::string fileName, compressionType_t compr, uint64_t &features)
+{
+    // The features are not known yet, but footer blocks are recognised without them. The first
+    // buffer of a small compressed file would take them for data behind the compressed stream
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd = 0;
+    if (compr != none)
+        readFooter(fileName, _blocks, _dataEnd);
+    cbdfIOOptions_t _options = {0, 0, false, 0, 0, 0, 0, 0};
+    cbdfInStream* _in = openInStream(fileName, compr, _options, _dataEnd);
+    if (_in == NULL)
+        return CBDF_FILE_HEADER_ERROR;
+    cbdfFileHeader_t _header;
+    uint64_t _read = _in->read((char*) &_header, sizeof(_header));
+    delete _in;
+    if (_read != sizeof(_header) || (_header.openTag & _header.closeTag) != 0xcbdfcbdf)
+        return CBDF_FILE_HEADER_ERROR;
+    features = _header.features;
+    return unsupportedFeatures(features) ? CBDF_UNSUPPORTED_FEATURE : 0;
+}
+
+uint64_t cbdf::unsupportedFeatures(uint64_t features)
+{
+    uint64_t _known = CBDF_FEATURES_KNOWN;
+#ifndef WITH_ZSTD
+    _known &= ~(CBDF_FEATURE_DICTIONARY | CBDF_FEATURE_EVENT_ZSTD);
+#endif
+    return features & CBDF_FEATURES_REQUIRED & ~_known;
+}
+
+std::string cbdf::describeFeatures(uint64_t features)
+{
+    std::ostringstream _out;
+    _out << "v" << (features >> CBDF_FEATURES_VERSION_SHIFT);
+    uint64_t _unknown = features & (CBDF_FEATURES_OPTIONAL | CBDF_FEATURES_REQUIRED);
+    for (uint32_t i = 0; i < sizeof(featureRegistry) / sizeof(featureRegistry[0]); i++)
+    {
+        if (features & featureRegistry[i].bit)
+            _out << " " << featureRegistry[i].name;
+        _unknown &= ~featureRegistry[i].bit;
+    }
+    if (_unknown)
+        _out << " unknown:0x" << std::hex << _unknown;
+    return _out.str();
+}
+
+int cbdf::readLineage(std::string fileName, std::vector<std::string> &parentUuids)
+{
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd;
+    parentUuids.clear();
+    readFooter(fileName, _blocks, _dataEnd);
+    for (uint32_t i = 0; i < _blocks.size(); i++)
+    {
+        if (_blocks[i].type != CBDF_BLOCK_LINEAGE)
+            continue;
+        const uint64_t _uuidSize = sizeof(((cbdfFileHeader_t*) NULL)->uuid);
+        for (uint64_t _pos = 0; _pos + _uuidSize <= _blocks[i].payload.size(); _pos += _uuidSize)
+            parentUuids.push_back(_blocks[i].payload.substr(_pos, _uuidSize));
+        return 0;
+    }
+    return -1;
+}
+
+int cbdf::readSourceIndex(std::string fileName, std::string &uuid, std::vector<std::pair<uint64_t, uint64_t> > &entries)
+{
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd;
+    entries.clear();
+    readFooter(fileName, _blocks, _dataEnd);
+    for (uint32_t i = 0; i < _blocks.size(); i++)
+    {
+        const std::string &_payload = _blocks[i].payload;
+        const uint64_t _uuidSize = sizeof(((cbdfFileHeader_t*) NULL)->uuid);
+        if (_blocks[i].type != CBDF_BLOCK_SOURCE_INDEX || _payload.size() < _uuidSize)
+            continue;
+        uuid = _payload.substr(0, _uuidSize);
+        std::pair<uint64_t, uint64_t> _entry;
+        for (uint64_t _pos = _uuidSize; _pos + 2 * sizeof(uint64_t) <= _payload.size(); _pos += 2 * sizeof(uint64_t))
+        {
+            memcpy(&_entry.first, _payload.data() + _pos, sizeof(uint64_t));
+            memcpy(&_entry.second, _payload.data() + _pos + sizeof(uint64_t), sizeof(uint64_t));
+            entries.push_back(_entry);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+uint64_t cbdf::eventRecordSize(const char* record)
+{
+    return sizeof(cbdfEventHeader_t) + ((const cbdfEventHeader_t*) record)->eventSize + sizeof(cbdfEventTrailer_t);
+}
+
+int cbdf::checkEventRecord(const char* record)
+{
+    const cbdfEventHeader_t* _header = (const cbdfEventHeader_t*) record;
+    if ((_header->openTag != 0xcbedcbed) || (_header->closeTag != 0xcbedcbed))
+        return CBDF_EVENT_HEADER_NOT_FOUND;
+    const cbdfEventTrailer_t* _trailer = (const cbdfEventTrailer_t*) (record + sizeof(cbdfEventHeader_t) + _header->eventSize);
+    if ((_trailer->openTag != 0xdebcdebc) || (_trailer->closeTag != 0xdebcdebc) || (_trailer->eventSize != _header->eventSize))
+        return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
+    return (cbdfCrc32(record + sizeof(cbdfEventHeader_t), _header->eventSize) == _trailer->crc32) ? 0 : CBDF_EVENT_CRC_ERROR;
+}
+
 /*
  * Error handling functions
  */
 
+/*
+ * The search starts at the second byte of the record that failed, whose
+ * bytes are still in the event buffer, and goes on through the stream. The
+ * candidate found and everything read behind it is handed back to
+ * readStream(). Only a window of CBDF_SCAN_WINDOW_SIZE plus the largest
+ * candidate record is held at a time.
+ */
 int cbdf::scanForNextEvent()
 {
-    //TODO Here be error handling
-    if(eventBuffered)
-    {
+    if (fileAccessMode != readMode || cbdfInFile == NULL)
+        return -1;
+    // After a CRC or decompression error the next record follows right behind the bad one
+    if (rFramed)
+        return 0;
+    eventBuffered = false;
 
-    } else
+    std::string _window;
+    uint64_t _consumed = rStreamOffset - rEventOffset;
+    if (_consumed > 1)
+        _window.assign(eventBufferBase + 1, _consumed - 1);
+    _window.append(rPending, rPendingPos, std::string::npos);
+    rPending.clear();
+    rPendingPos = 0;
+    uint64_t _offset = rEventOffset + 1;    // Of _window[0] in the input
+    uint64_t _pos = 0;
+    uint64_t _need = sizeof(uint32_t);
+    bool _end = false;
+    while (true)
     {
+        if (_window.size() - _pos < _need)
+        {
+            if (_end)
+            {
+                // A candidate cut off by the end of the data is none
+                if (_need == sizeof(uint32_t))
+                    break;
+                _pos++;
+                _need = sizeof(uint32_t);
+                continue;
+            }
+            _window.erase(0, _pos);
+            _offset += _pos;
+            _pos = 0;
+            uint64_t _buffered = _window.size();
+            uint64_t _chunk = std::max((uint64_t) CBDF_SCAN_WINDOW_SIZE, _need - _buffered);
+            _window.resize(_buffered + _chunk);
+            uint64_t _got = cbdfInFile->read(&_window[_buffered], _chunk);
+            _window.resize(_buffered + _got);
+            _end = _got < _chunk;
+            continue;
+        }
 
+        const char* _data = _window.data() + _pos;
+        uint64_t _available = _window.size() - _pos;
+        uint32_t _tag;
+        memcpy(&_tag, _data, sizeof(_tag));
+        if (_tag == 0xfdbcfdbc)
+        {
+            if (_available < sizeof(cbdfFileTrailer_t))
+            {
+                _need = sizeof(cbdfFileTrailer_t);
+                continue;
+            }
+            if (cbdfFrameTrailer(_data, _available))
+                break;
+        }
+        else if (_tag == 0xcbedcbed)
+        {
+            uint64_t _size;
+            int _ret = cbdfFrameRecord(_data, _available, _size);
+            if (_ret == CBDF_UNEXPECTED_EOF)
+            {
+                _need = _size;
+                continue;
+            }
+            if (_ret == 0)
+                break;
+        }
+        _pos++;
+        _need = sizeof(uint32_t);
+    }
+
+    if (_window.size() - _pos < sizeof(uint32_t))
+    {
+        rStreamOffset = _offset + _window.size();
+        std::cerr << "No event found behind offset " << rEventOffset << std::endl;
+        return CBDF_UNEXPECTED_EOF;
     }
+    rPending = _window.substr(_pos);
+    rStreamOffset = _offset + _pos;
+    std::cerr << "Skipped " << rStreamOffset - rEventOffset << " bytes at offset " << rEventOffset << std::endl;
     return 0;
 }
 
@@ -637,14 +2306,15 @@ void cbdf::printFileHeader()
 void cbdf::printEvent()
 {
     std::cout << "Header:\n" << std::hex << rEventHeader->openTag << " " << rEventHeader->closeTag << std::endl;
-    std::cout << "Trailer:\n" << std::hex << rEventTrailer->openTag << " " << rEventTrailer->closeTag << std::endl;
+    // The trailer is only known once a whole record was read
+    if (eventBuffered)
+        std::cout << "Trailer:\n" << std::hex << rEventTrailer->openTag << " " << rEventTrailer->closeTag << std::endl;
 }
 
 void cbdf::printBanks()
 {
-    bankMap_t::iterator _itBankMap = getBanks();
-    for (_itBankMap = bankMap.begin(); _itBankMap != bankMap.end(); _itBankMap++)
-        hexDump(_itBankMap->second, ascii);
+    for (uint32_t i = 0; i < bankDirectory.size(); i++)
+        hexDump(getBankAt(i), ascii);
 }
 
 void cbdf::hexDump(cbdfBankMapEntry_t bank, dumpMode_t dumpMode)
@@ -684,6 +2354,21 @@ void cbdf::hexDump(cbdfBankMapEntry_t bank, dumpMode_t dumpMode)
 
 cbdf::~cbdf()
 {
-// TODO Auto-generated destructor stub
+    // Close a file that is still open so that a write stream gets its trailer
+    if (cbdfInFile != NULL || cbdfOutFile != NULL)
+        fileClose();
+
+    allocator->release(eventBufferBase, eventBufferSize);
+    delete wEventTrailer;
+    delete wFileHeader;
+    delete rFileHeader;
+    delete wFileTrailer;
+    delete summary;
+    delete coder;
+    delete controller;
+    if (filterBufferBase != NULL)
+        allocator->release(filterBufferBase, filterBufferSize);
+    if (decodeBufferBase != NULL)
+        allocator->release(decodeBufferBase, decodeBufferSize);
 }
 
@@ -0,0 +1,241 @@
+/*
+ * cbdfBufferPool.cpp
+ *
+ *  Pluggable allocators for the event buffers of cbdf instances
+ */
+
+#include <cbdfBufferPool.h>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef WITH_NUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#endif
+
+#define HUGE_PAGE_SIZE 2097152
+#define PLACEMENT_SAMPLES 64 // Pages checked per buffer in stats()
+
+cbdfBufferPool::cbdfBufferPool(uint64_t _maxCachedBytes, hugePageMode_t _hugePageMode, int _numaNode)
+{
+    memset(&poolStats, 0, sizeof(poolStats));
+    maxCachedBytes = _maxCachedBytes;
+    hugePageMode = _hugePageMode;
+    numaNode = _numaNode;
+    pageSize = sysconf(_SC_PAGESIZE);
+#ifdef WITH_NUMA
+    if (numaNode >= 0 && (numa_available() < 0 || numaNode > numa_max_node()))
+    {
+        std::cerr << "NUMA node " << numaNode << " not available, buffers are not bound\n";
+        numaNode = -1;
+    }
+#else
+    if (numaNode >= 0)
+    {
+        std::cerr << "No NUMA support enabled at compile time, buffers are not bound\n";
+        numaNode = -1;
+    }
+#endif
+}
+
+cbdfBufferPool* cbdfBufferPool::defaultPool()
+{
+    // Intentionally never destroyed, instances may outlive static destruction
+    static cbdfBufferPool* _defaultPool = new cbdfBufferPool();
+    return _defaultPool;
+}
+
+uint64_t cbdfBufferPool::roundSize(uint64_t size)
+{
+    uint64_t _rounded = (hugePageMode == explicitHugePages) ? HUGE_PAGE_SIZE : pageSize;
+    while (_rounded < size)
+        _rounded *= 2;
+    return _rounded;
+}
+
+/*
+ * Map a new buffer. Binding to the NUMA node has to happen before the first
+ * touch, so the pages are only faulted in (on the bound node) afterwards.
+ * Transparent huge pages need a 2 MB aligned range, the mapping is made
+ * larger and the unaligned ends are cut off again.
+ */
+char* cbdfBufferPool::systemAllocate(uint64_t size)
+{
+    char* _buffer = NULL;
+    bool _hugePages = false;
+    bool _fallback = false;
+
+    if (hugePageMode == explicitHugePages)
+    {
+#ifdef MAP_HUGETLB
+        void* _map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (_map != MAP_FAILED)
+        {
+            _buffer = (char*) _map;
+            _hugePages = true;
+        }
+#endif
+        _fallback = (_buffer == NULL);
+    }
+
+    if (_buffer == NULL && hugePageMode != noHugePages && size >= HUGE_PAGE_SIZE)
+    {
+        void* _map = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (_map == MAP_FAILED)
+            return NULL;
+        char* _aligned = (char*) (((uintptr_t) _map + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+        if (_aligned != (char*) _map)
+            munmap(_map, _aligned - (char*) _map);
+        munmap(_aligned + size, (char*) _map + HUGE_PAGE_SIZE - _aligned);
+#ifdef MADV_HUGEPAGE
+        _hugePages = (madvise(_aligned, size, MADV_HUGEPAGE) == 0);
+#endif
+        _buffer = _aligned;
+    }
+
+    if (_buffer == NULL)
+    {
+        void* _map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (_map == MAP_FAILED)
+            return NULL;
+        _buffer = (char*) _map;
+    }
+
+#ifdef WITH_NUMA
+    if (numaNode >= 0)
+    {
+        numa_tonode_memory(_buffer, size, numaNode);
+        for (uint64_t _offset = 0; _offset < size; _offset += pageSize)
+            _buffer[_offset] = 0;
+    }
+#endif
+
+    boost::mutex::scoped_lock _lock(poolMutex);
+    cbdfMapping_t _mapping = {size, _hugePages};
+    mappedList[_buffer] = _mapping;
+    poolStats.systemAllocations++;
+    poolStats.bytesMapped += size;
+    if (_fallback)
+        poolStats.hugePageFallbacks++;
+    if (_hugePages)
+        poolStats.hugePageBytes += size;
+    return _buffer;
+}
+
+void cbdfBufferPool::systemRelease(char* buffer, uint64_t size)
+{
+    {
+        boost::mutex::scoped_lock _lock(poolMutex);
+        mappedList_t::iterator _it = mappedList.find(buffer);
+        if (_it != mappedList.end())
+        {
+            if (_it->second.hugePages)
+                poolStats.hugePageBytes -= _it->second.size;
+            mappedList.erase(_it);
+        }
+        poolStats.systemReleases++;
+        poolStats.bytesMapped -= size;
+    }
+    munmap(buffer, size);
+}
+
+char* cbdfBufferPool::allocate(uint64_t &size)
+{
+    size = roundSize(size);
+    {
+        boost::mutex::scoped_lock _lock(poolMutex);
+        poolStats.allocations++;
+        freeList_t::iterator _it = freeList.find(size);
+        if (_it != freeList.end() && !_it->second.empty())
+        {
+            char* _buffer = _it->second.back();
+            _it->second.pop_back();
+            poolStats.bytesCached -= size;
+            poolStats.poolHits++;
+            return _buffer;
+        }
+    }
+    return systemAllocate(size);
+}
+
+void cbdfBufferPool::release(char* buffer, uint64_t size)
+{
+    if (buffer == NULL)
+        return;
+    {
+        boost::mutex::scoped_lock _lock(poolMutex);
+        if (poolStats.bytesCached + size <= maxCachedBytes)
+        {
+            freeList[size].push_back(buffer);
+            poolStats.bytesCached += size;
+            return;
+        }
+    }
+    systemRelease(buffer, size);
+}
+
+void cbdfBufferPool::trim()
+{
+    freeList_t _idle;
+    {
+        boost::mutex::scoped_lock _lock(poolMutex);
+        _idle.swap(freeList);
+        poolStats.bytesCached = 0;
+    }
+    for (freeList_t::iterator _it = _idle.begin(); _it != _idle.end(); _it++)
+        for (std::vector<char*>::iterator _buf = _it->second.begin(); _buf != _it->second.end(); _buf++)
+            systemRelease(*_buf, _it->first);
+}
+
+/*
+ * Query the node of a sample of pages of every mapped buffer. Pages count as
+ * local if they sit on the node the pool is bound to, or for unbound pools
+ * on the node of the calling thread. Pages not yet faulted in are skipped.
+ */
+void cbdfBufferPool::samplePlacement(cbdfPoolStats_t &_stats)
+{
+#ifdef WITH_NUMA
+    if (numa_available() < 0)
+        return;
+    int _localNode = (numaNode >= 0) ? numaNode : numa_node_of_cpu(sched_getcpu());
+    void* _pages[PLACEMENT_SAMPLES];
+    int _status[PLACEMENT_SAMPLES];
+
+    for (mappedList_t::iterator _it = mappedList.begin(); _it != mappedList.end(); _it++)
+    {
+        uint64_t _nPages = _it->second.size / pageSize;
+        uint64_t _stride = (_nPages + PLACEMENT_SAMPLES - 1) / PLACEMENT_SAMPLES;
+        unsigned long _count = 0;
+        for (uint64_t _page = 0; _page < _nPages && _count < PLACEMENT_SAMPLES; _page += _stride)
+            _pages[_count++] = _it->first + _page * pageSize;
+        if (move_pages(0, _count, _pages, NULL, _status, 0) != 0)
+            continue;
+        for (unsigned long i = 0; i < _count; i++)
+        {
+            if (_status[i] < 0)
+                continue;
+            _stats.pagesSampled++;
+            if (_status[i] == _localNode)
+                _stats.pagesLocal++;
+            else
+                _stats.pagesRemote++;
+        }
+    }
+#endif
+}
+
+cbdfBufferPool::cbdfPoolStats_t cbdfBufferPool::stats()
+{
+    boost::mutex::scoped_lock _lock(poolMutex);
+    cbdfPoolStats_t _stats = poolStats;
+    samplePlacement(_stats);
+    return _stats;
+}
+
+cbdfBufferPool::~cbdfBufferPool()
+{
+    trim();
+}
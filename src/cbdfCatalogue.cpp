@@ -0,0 +1,254 @@
+/*
+ * cbdfCatalogue.cpp
+ *
+ *  Event catalogue of a cbdf file built from the event headers and trailers
+ *  only, without reading or checking the payloads
+ */
+
+#include <cbdfCatalogue.h>
+#include "cbdfFormat.h"
+#include "cbdfStream.h"
+#include "cbdfFooter.h"
+#include <iostream>
+#include <iomanip>
+
+// Histogram bin of a payload size: 0 for empty events, else the bit length of the size
+static int sizeBin(uint64_t size)
+{
+    int _bin = 0;
+    while (size)
+    {
+        size >>= 1;
+        _bin++;
+    }
+    return _bin;
+}
+
+static void clearCatalogue(cbdfCatalogue_t &catalogue)
+{
+    catalogue.uuid.clear();
+    catalogue.features = 0;
+    catalogue.timeStart = 0;
+    catalogue.timeStop = 0;
+    catalogue.events = 0;
+    catalogue.firstEvent = 0;
+    catalogue.lastEvent = 0;
+    catalogue.payloadBytes = 0;
+    catalogue.minEventSize = 0;
+    catalogue.maxEventSize = 0;
+    for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        catalogue.sizeHistogram[i] = 0;
+    catalogue.userFlags.clear();
+    catalogue.otherUserFlags = 0;
+    catalogue.banks.clear();
+    catalogue.otherBanks = 0;
+    catalogue.complete = false;
+    catalogue.fromSummary = false;
+    catalogue.status = 0;
+}
+
+static void addEvent(cbdfCatalogue_t &catalogue, const cbdf::cbdfEventHeader_t &header)
+{
+    if (catalogue.events == 0)
+    {
+        catalogue.firstEvent = header.eventNumber;
+        catalogue.minEventSize = header.eventSize;
+    }
+    catalogue.lastEvent = header.eventNumber;
+    catalogue.events++;
+    catalogue.payloadBytes += header.eventSize;
+    if (header.eventSize < catalogue.minEventSize)
+        catalogue.minEventSize = header.eventSize;
+    if (header.eventSize > catalogue.maxEventSize)
+        catalogue.maxEventSize = header.eventSize;
+    catalogue.sizeHistogram[sizeBin(header.eventSize)]++;
+
+    std::map<uint64_t, uint64_t>::iterator _it = catalogue.userFlags.find(header.userFlags);
+    if (_it != catalogue.userFlags.end())
+        _it->second++;
+    else if (catalogue.userFlags.size() < CBDF_CATALOGUE_MAX_FLAGS)
+        catalogue.userFlags[header.userFlags] = 1;
+    else
+        catalogue.otherUserFlags++;
+}
+
+int readFileSummary(std::string fileName, cbdfCatalogue_t &catalogue)
+{
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd;
+    clearCatalogue(catalogue);
+    catalogue.fileName = fileName;
+    if (readFooter(fileName, _blocks, _dataEnd) <= 0)
+        return -1;
+    for (uint32_t i = 0; i < _blocks.size(); i++)
+    {
+        if (_blocks[i].type == CBDF_BLOCK_SUMMARY && parseSummary(_blocks[i].payload, catalogue))
+        {
+            catalogue.complete = true;
+            catalogue.fromSummary = true;
+            return 0;
+        }
+    }
+    clearCatalogue(catalogue);
+    return -1;
+}
+
+int scanCatalogue(std::string fileName, cbdfCatalogue_t &catalogue, bool useSummary)
+{
+    return scanCatalogue(fileName, cbdf::guessCompression(fileName), catalogue, useSummary);
+}
+
+int scanCatalogue(std::string fileName, cbdf::compressionType_t compression, cbdfCatalogue_t &catalogue, bool useSummary)
+{
+    uint64_t _features = 0;
+    int _ret = cbdf::readFileFeatures(fileName, compression, _features);
+    if (useSummary && _ret == 0 && (_features & CBDF_FEATURE_SUMMARY) && readFileSummary(fileName, catalogue) == 0)
+    {
+        catalogue.features = _features;
+        return 0;
+    }
+    clearCatalogue(catalogue);
+    catalogue.fileName = fileName;
+    catalogue.features = _features;
+    if (_ret != 0)
+        return catalogue.status = _ret;
+
+    cbdf::cbdfIOOptions_t _options;
+    _options.preallocate = 0;
+    _options.writebackInterval = 0;
+    _options.sequential = true;
+    _options.dropBehind = 0;
+    _options.queueDepth = 0;
+    _options.blockSize = 0;
+    _options.compressThreads = 0;
+    _options.compressBlockSize = 0;
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd = 0;
+    if (compression != cbdf::none && (_features & CBDF_FEATURE_FOOTER))
+        readFooter(fileName, _blocks, _dataEnd);
+    cbdfInStream* _in = openInStream(fileName, compression, _options, _dataEnd);
+    if (_in == NULL)
+        return catalogue.status = CBDF_FILE_HEADER_ERROR;
+
+    cbdf::cbdfFileHeader_t _fileHeader;
+    if (_in->read((char*) &_fileHeader, sizeof(_fileHeader)) != sizeof(_fileHeader) || (_fileHeader.openTag & _fileHeader.closeTag) != 0xcbdfcbdf)
+    {
+        delete _in;
+        return catalogue.status = CBDF_FILE_HEADER_ERROR;
+    }
+    catalogue.uuid = std::string(_fileHeader.uuid, sizeof(_fileHeader.uuid));
+    catalogue.timeStart = _fileHeader.timeStart;
+    if (_fileHeader.features & CBDF_FEATURE_DICTIONARY)
+    {
+        cbdf::cbdfBlockHeader_t _block;
+        uint64_t _rest = 0;
+        if (_in->read((char*) &_block, sizeof(_block)) == sizeof(_block) && _block.openTag == 0xCBBDCBBD && _block.closeTag == 0xCBBDCBBD)
+            _rest = _block.size + sizeof(cbdf::cbdfBlockTrailer_t);
+        if (_rest == 0 || _in->skip(_rest) != _rest)
+        {
+            delete _in;
+            return catalogue.status = CBDF_FILE_HEADER_ERROR;
+        }
+    }
+
+    // The file trailer is longer than an event header, so its start is read into a buffer that fits both
+    union {
+        cbdf::cbdfEventHeader_t event;
+        cbdf::cbdfFileTrailer_t file;
+    } _header;
+    cbdf::cbdfEventTrailer_t _trailer;
+    while (true)
+    {
+        if (_in->read((char*) &_header.event, sizeof(_header.event)) != sizeof(_header.event))
+        {
+            catalogue.status = CBDF_UNEXPECTED_EOF;
+            break;
+        }
+        if (_header.event.openTag == 0xfdbcfdbc)
+        {
+            uint64_t _rest = sizeof(_header.file) - sizeof(_header.event);
+            if (_in->read(((char*) &_header.file) + sizeof(_header.event), _rest) != _rest)
+                catalogue.status = CBDF_UNEXPECTED_EOF;
+            else if (_header.file.closeTag != 0xfdbcfdbc)
+                catalogue.status = CBDF_EVENT_HEADER_NOT_FOUND;
+            else
+            {
+                catalogue.timeStop = _header.file.timeStop;
+                catalogue.complete = true;
+            }
+            break;
+        }
+        if ((_header.event.openTag != 0xcbedcbed) || (_header.event.closeTag != 0xcbedcbed))
+        {
+            catalogue.status = CBDF_EVENT_HEADER_NOT_FOUND;
+            break;
+        }
+        if (_in->skip(_header.event.eventSize) != _header.event.eventSize || _in->read((char*) &_trailer, sizeof(_trailer)) != sizeof(_trailer))
+        {
+            catalogue.status = CBDF_UNEXPECTED_EOF;
+            break;
+        }
+        if ((_trailer.openTag != 0xdebcdebc) || (_trailer.closeTag != 0xdebcdebc) || (_trailer.eventSize != _header.event.eventSize))
+        {
+            catalogue.status = CBDF_EVENT_HEADER_TRAILER_MISMATCH;
+            break;
+        }
+        addEvent(catalogue, _header.event);
+    }
+    delete _in;
+    return catalogue.status;
+}
+
+void printCatalogue(const cbdfCatalogue_t &catalogue, std::ostream &out, bool printUserFlags)
+{
+    out << catalogue.fileName << (catalogue.fromSummary ? " (summary)" : "") << "\n";
+    out << "  uuid        " << catalogue.uuid << "\n";
+    out << "  features    " << cbdf::describeFeatures(catalogue.features) << "\n";
+    out << "  time        " << catalogue.timeStart << " - ";
+    if (catalogue.complete)
+        out << catalogue.timeStop << " (" << (catalogue.timeStop - catalogue.timeStart) << " s)\n";
+    else
+        out << "? (no file trailer)\n";
+    out << "  events      " << catalogue.events;
+    if (catalogue.events)
+        out << " (" << catalogue.firstEvent << " - " << catalogue.lastEvent << ")";
+    out << "\n";
+    out << "  payload     " << catalogue.payloadBytes << " bytes";
+    if (catalogue.events)
+        out << ", min " << catalogue.minEventSize << " avg " << catalogue.payloadBytes / catalogue.events << " max " << catalogue.maxEventSize;
+    out << "\n";
+    if (catalogue.events)
+    {
+        out << "  sizes      ";
+        for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        {
+            if (catalogue.sizeHistogram[i] == 0)
+                continue;
+            if (i == 0)
+                out << " 0:" << catalogue.sizeHistogram[i];
+            else
+                out << " <2^" << i << ":" << catalogue.sizeHistogram[i];
+        }
+        out << "\n";
+    }
+    if (printUserFlags && catalogue.events)
+    {
+        out << "  userFlags  ";
+        for (std::map<uint64_t, uint64_t>::const_iterator _it = catalogue.userFlags.begin(); _it != catalogue.userFlags.end(); ++_it)
+            out << " 0x" << std::hex << _it->first << std::dec << ":" << _it->second;
+        if (catalogue.otherUserFlags)
+            out << " other:" << catalogue.otherUserFlags;
+        out << "\n";
+    }
+    if (!catalogue.banks.empty())
+    {
+        out << "  banks      ";
+        for (std::map<std::string, uint64_t>::const_iterator _it = catalogue.banks.begin(); _it != catalogue.banks.end(); ++_it)
+            out << " " << _it->first << ":" << _it->second;
+        if (catalogue.otherBanks)
+            out << " other:" << catalogue.otherBanks;
+        out << "\n";
+    }
+    if (catalogue.status)
+        out << "  status      " << catalogue.status << "\n";
+}
@@ -0,0 +1,677 @@
+/*
+ * cbdfCodec.cpp
+ *
+ *  Block codecs and pre-filters for compressing single banks and events
+ */
+
+#include "cbdfCodec.h"
+#include <cbdf.h>
+#include <cstring>
+#include <time.h>
+
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef WITH_ZSTD
+#include <zdict.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+cbdfBankCoder::cbdfBankCoder()
+{
+    memset(&deflater, 0, sizeof(deflater));
+    memset(&inflater, 0, sizeof(inflater));
+    deflaterReady = false;
+    inflaterReady = false;
+    deflateLevel = 0;
+#ifdef WITH_ZSTD
+    zstdCompressor = NULL;
+    zstdDecompressor = NULL;
+    zstdCompressDict = NULL;
+    zstdDecompressDict = NULL;
+    zstdDictLevel = 0;
+#endif
+}
+
+cbdfBankCoder::~cbdfBankCoder()
+{
+    if (deflaterReady)
+        deflateEnd(&deflater);
+    if (inflaterReady)
+        inflateEnd(&inflater);
+#ifdef WITH_ZSTD
+    if (zstdCompressor != NULL)
+        ZSTD_freeCCtx(zstdCompressor);
+    if (zstdDecompressor != NULL)
+        ZSTD_freeDCtx(zstdDecompressor);
+    setDictionary(std::string());
+#endif
+}
+
+bool cbdfBankCoder::available(uint32_t codec)
+{
+    switch (codec)
+    {
+    case cbdf::bankRaw:
+    case cbdf::bankDeflate:
+        return true;
+#ifdef WITH_LZ4
+    case cbdf::bankLZ4:
+        return true;
+#endif
+#ifdef WITH_ZSTD
+    case cbdf::bankZstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+uint64_t cbdfBankCoder::bound(uint32_t codec, uint64_t size)
+{
+    switch (codec)
+    {
+    case cbdf::bankDeflate:
+        return compressBound(size);
+#ifdef WITH_LZ4
+    case cbdf::bankLZ4:
+        return (size > LZ4_MAX_INPUT_SIZE) ? 0 : LZ4_compressBound(size);
+#endif
+#ifdef WITH_ZSTD
+    case cbdf::bankZstd:
+        return ZSTD_compressBound(size);
+#endif
+    default:
+        return size;
+    }
+}
+
+// Level 0 picks the fastest setting of each codec
+uint64_t cbdfBankCoder::compress(uint32_t codec, int level, const char* data, uint64_t size, char* dest, uint64_t destSize)
+{
+    switch (codec)
+    {
+    case cbdf::bankDeflate:
+        if (level <= 0)
+            level = 1;
+        if (!deflaterReady)
+        {
+            // Raw deflate, the event CRC already covers the data
+            if (deflateInit2(&deflater, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return 0;
+            deflaterReady = true;
+            deflateLevel = level;
+        }
+        else
+        {
+            deflateReset(&deflater);
+            if (level != deflateLevel && deflateParams(&deflater, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                return 0;
+            deflateLevel = level;
+        }
+        deflater.next_in = (Bytef*) data;
+        deflater.avail_in = size;
+        deflater.next_out = (Bytef*) dest;
+        deflater.avail_out = destSize;
+        if (deflate(&deflater, Z_FINISH) != Z_STREAM_END)
+            return 0;
+        return deflater.total_out;
+#ifdef WITH_LZ4
+    case cbdf::bankLZ4:
+    {
+        if (size > LZ4_MAX_INPUT_SIZE)
+            return 0;
+        int _ret = LZ4_compress_fast(data, dest, size, destSize > 0x7fffffff ? 0x7fffffff : destSize, level <= 0 ? 1 : level);
+        return (_ret > 0) ? _ret : 0;
+    }
+#endif
+#ifdef WITH_ZSTD
+    case cbdf::bankZstd:
+    {
+        if (zstdCompressor == NULL && (zstdCompressor = ZSTD_createCCtx()) == NULL)
+            return 0;
+        if (level <= 0)
+            level = 1;
+        if (dictionary.empty())
+        {
+            size_t _ret = ZSTD_compressCCtx(zstdCompressor, dest, destSize, data, size, level);
+            return ZSTD_isError(_ret) ? 0 : _ret;
+        }
+        if (zstdCompressDict == NULL || zstdDictLevel != level)
+        {
+            if (zstdCompressDict != NULL)
+                ZSTD_freeCDict(zstdCompressDict);
+            zstdCompressDict = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+            zstdDictLevel = level;
+            if (zstdCompressDict == NULL)
+                return 0;
+        }
+        size_t _ret = ZSTD_compress_usingCDict(zstdCompressor, dest, destSize, data, size, zstdCompressDict);
+        return ZSTD_isError(_ret) ? 0 : _ret;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+bool cbdfBankCoder::decompress(uint32_t codec, const char* data, uint64_t size, char* dest, uint64_t rawSize)
+{
+    switch (codec)
+    {
+    case cbdf::bankDeflate:
+        if (!inflaterReady)
+        {
+            if (inflateInit2(&inflater, -15) != Z_OK)
+                return false;
+            inflaterReady = true;
+        }
+        else
+            inflateReset(&inflater);
+        inflater.next_in = (Bytef*) data;
+        inflater.avail_in = size;
+        inflater.next_out = (Bytef*) dest;
+        inflater.avail_out = rawSize;
+        return (inflate(&inflater, Z_FINISH) == Z_STREAM_END && inflater.total_out == rawSize);
+#ifdef WITH_LZ4
+    case cbdf::bankLZ4:
+        if (size > 0x7fffffff || rawSize > 0x7fffffff)
+            return false;
+        return (LZ4_decompress_safe(data, dest, size, rawSize) == (int) rawSize);
+#endif
+#ifdef WITH_ZSTD
+    case cbdf::bankZstd:
+    {
+        if (zstdDecompressor == NULL && (zstdDecompressor = ZSTD_createDCtx()) == NULL)
+            return false;
+        if (!dictionary.empty() && zstdDecompressDict == NULL && (zstdDecompressDict = ZSTD_createDDict(dictionary.data(), dictionary.size())) == NULL)
+            return false;
+        size_t _ret = dictionary.empty() ? ZSTD_decompressDCtx(zstdDecompressor, dest, rawSize, data, size) : ZSTD_decompress_usingDDict(zstdDecompressor, dest, rawSize, data, size, zstdDecompressDict);
+        return (!ZSTD_isError(_ret) && _ret == rawSize);
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+// The digested dictionaries are made when a bank or event first needs them
+bool cbdfBankCoder::setDictionary(const std::string &_dictionary)
+{
+#ifdef WITH_ZSTD
+    if (zstdCompressDict != NULL)
+        ZSTD_freeCDict(zstdCompressDict);
+    if (zstdDecompressDict != NULL)
+        ZSTD_freeDDict(zstdDecompressDict);
+    zstdCompressDict = NULL;
+    zstdDecompressDict = NULL;
+    dictionary = _dictionary;
+    return true;
+#else
+    dictionary.clear();
+    return _dictionary.empty();
+#endif
+}
+
+bool cbdfBankCoder::trainDictionary(const std::vector<std::string> &samples, uint32_t maxSize, std::string &dictionary)
+{
+#ifdef WITH_ZSTD
+    std::string _samples;
+    std::vector<size_t> _sizes;
+    for (uint32_t i = 0; i < samples.size(); i++)
+    {
+        _samples.append(samples[i]);
+        _sizes.push_back(samples[i].size());
+    }
+    if (_sizes.empty())
+        return false;
+    dictionary.resize(maxSize);
+    size_t _ret = ZDICT_trainFromBuffer(&dictionary[0], maxSize, _samples.data(), &_sizes[0], _sizes.size());
+    if (ZDICT_isError(_ret))
+    {
+        dictionary.clear();
+        return false;
+    }
+    dictionary.resize(_ret);
+    return true;
+#else
+    (void) samples;
+    (void) maxSize;
+    dictionary.clear();
+    return false;
+#endif
+}
+
+// Transpose the 8x8 bit matrix in x: bit c of byte r moves to bit r of byte c
+static inline uint64_t transpose8x8(uint64_t x)
+{
+    uint64_t _t;
+    _t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ _t ^ (_t << 7);
+    _t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ _t ^ (_t << 14);
+    _t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ _t ^ (_t << 28);
+    return x;
+}
+
+template <typename T> static void deltaEncode(const char* data, uint64_t n, char* dest)
+{
+    T _previous = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        T _value;
+        memcpy(&_value, data + i * sizeof(T), sizeof(T));
+        T _delta = (T) (_value - _previous);
+        T _zigzag = (T) ((T) (_delta << 1) ^ (T) (0 - (_delta >> (8 * sizeof(T) - 1))));
+        memcpy(dest + i * sizeof(T), &_zigzag, sizeof(T));
+        _previous = _value;
+    }
+}
+
+#ifdef __SSE2__
+/*
+ * Undo zigzag and delta 16 bytes at a time. The running sum within a
+ * vector takes log2(lanes) shifted adds, the last value of each vector is
+ * carried into the next one. Returns the number of elements done.
+ */
+template <typename T> static uint64_t deltaDecodeVector(char* data, uint64_t n, T &previous);
+
+template <> uint64_t deltaDecodeVector<uint8_t>(char* data, uint64_t n, uint8_t &previous)
+{
+    const __m128i _one = _mm_set1_epi8(1);
+    const __m128i _low7 = _mm_set1_epi8(0x7f);
+    __m128i _carry = _mm_set1_epi8((char) previous);
+    uint64_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i _z = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i _x = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(_z, 1), _low7), _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(_z, _one)));
+        _x = _mm_add_epi8(_x, _mm_slli_si128(_x, 1));
+        _x = _mm_add_epi8(_x, _mm_slli_si128(_x, 2));
+        _x = _mm_add_epi8(_x, _mm_slli_si128(_x, 4));
+        _x = _mm_add_epi8(_x, _mm_slli_si128(_x, 8));
+        _x = _mm_add_epi8(_x, _carry);
+        _mm_storeu_si128((__m128i*) (data + i), _x);
+        _carry = _mm_shufflehi_epi16(_mm_unpackhi_epi8(_x, _x), 0xff);
+        _carry = _mm_unpackhi_epi64(_carry, _carry);
+    }
+    if (i > 0)
+        previous = (uint8_t) data[i - 1];
+    return i;
+}
+
+template <> uint64_t deltaDecodeVector<uint16_t>(char* data, uint64_t n, uint16_t &previous)
+{
+    const __m128i _one = _mm_set1_epi16(1);
+    __m128i _carry = _mm_set1_epi16((short) previous);
+    uint64_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i _z = _mm_loadu_si128((const __m128i*) (data + 2 * i));
+        __m128i _x = _mm_xor_si128(_mm_srli_epi16(_z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(_z, _one)));
+        _x = _mm_add_epi16(_x, _mm_slli_si128(_x, 2));
+        _x = _mm_add_epi16(_x, _mm_slli_si128(_x, 4));
+        _x = _mm_add_epi16(_x, _mm_slli_si128(_x, 8));
+        _x = _mm_add_epi16(_x, _carry);
+        _mm_storeu_si128((__m128i*) (data + 2 * i), _x);
+        _carry = _mm_shufflehi_epi16(_x, 0xff);
+        _carry = _mm_unpackhi_epi64(_carry, _carry);
+    }
+    if (i > 0)
+        memcpy(&previous, data + 2 * (i - 1), sizeof(previous));
+    return i;
+}
+
+template <> uint64_t deltaDecodeVector<uint32_t>(char* data, uint64_t n, uint32_t &previous)
+{
+    const __m128i _one = _mm_set1_epi32(1);
+    __m128i _carry = _mm_set1_epi32((int) previous);
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i _z = _mm_loadu_si128((const __m128i*) (data + 4 * i));
+        __m128i _x = _mm_xor_si128(_mm_srli_epi32(_z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(_z, _one)));
+        _x = _mm_add_epi32(_x, _mm_slli_si128(_x, 4));
+        _x = _mm_add_epi32(_x, _mm_slli_si128(_x, 8));
+        _x = _mm_add_epi32(_x, _carry);
+        _mm_storeu_si128((__m128i*) (data + 4 * i), _x);
+        _carry = _mm_shuffle_epi32(_x, 0xff);
+    }
+    if (i > 0)
+        memcpy(&previous, data + 4 * (i - 1), sizeof(previous));
+    return i;
+}
+
+template <> uint64_t deltaDecodeVector<uint64_t>(char* data, uint64_t n, uint64_t &previous)
+{
+    const __m128i _one = _mm_set_epi32(0, 1, 0, 1);
+    __m128i _carry = _mm_loadl_epi64((const __m128i*) &previous);
+    _carry = _mm_unpacklo_epi64(_carry, _carry);
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i _z = _mm_loadu_si128((const __m128i*) (data + 8 * i));
+        __m128i _x = _mm_xor_si128(_mm_srli_epi64(_z, 1), _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(_z, _one)));
+        _x = _mm_add_epi64(_x, _mm_slli_si128(_x, 8));
+        _x = _mm_add_epi64(_x, _carry);
+        _mm_storeu_si128((__m128i*) (data + 8 * i), _x);
+        _carry = _mm_unpackhi_epi64(_x, _x);
+    }
+    if (i > 0)
+        memcpy(&previous, data + 8 * (i - 1), sizeof(previous));
+    return i;
+}
+#endif
+
+template <typename T> static void deltaDecode(char* data, uint64_t n)
+{
+    T _previous = 0;
+    uint64_t i = 0;
+#ifdef __SSE2__
+    i = deltaDecodeVector<T>(data, n, _previous);
+#endif
+    for (; i < n; i++)
+    {
+        T _zigzag;
+        memcpy(&_zigzag, data + i * sizeof(T), sizeof(T));
+        _previous = (T) (_previous + (T) ((_zigzag >> 1) ^ (T) (0 - (_zigzag & 1))));
+        memcpy(data + i * sizeof(T), &_previous, sizeof(T));
+    }
+}
+
+static void byteShuffle(const char* data, uint64_t n, uint32_t elementSize, char* dest)
+{
+    for (uint32_t k = 0; k < elementSize; k++)
+        for (uint64_t i = 0; i < n; i++)
+            dest[k * n + i] = data[i * elementSize + k];
+}
+
+#ifdef __SSE2__
+/*
+ * Interleave 16 bytes from each of 2, 4 or 8 planes into 16 elements of
+ * that many bytes: unpacking bytes, then words, then double words.
+ */
+template <uint32_t count> static inline void interleavePlanes(const __m128i* planes, __m128i* rows)
+{
+    __m128i _pairs[8], _quads[8];
+    for (uint32_t j = 0; j < count / 2; j++)
+    {
+        _pairs[2 * j] = _mm_unpacklo_epi8(planes[2 * j], planes[2 * j + 1]);
+        _pairs[2 * j + 1] = _mm_unpackhi_epi8(planes[2 * j], planes[2 * j + 1]);
+    }
+    if (count == 2)
+    {
+        rows[0] = _pairs[0];
+        rows[1] = _pairs[1];
+        return;
+    }
+    // _quads[4 * h + m] holds elements 4m to 4m+3 of planes 4h to 4h+3
+    for (uint32_t h = 0; h < count / 4; h++)
+        for (uint32_t q = 0; q < 2; q++)
+        {
+            _quads[4 * h + 2 * q] = _mm_unpacklo_epi16(_pairs[4 * h + q], _pairs[4 * h + 2 + q]);
+            _quads[4 * h + 2 * q + 1] = _mm_unpackhi_epi16(_pairs[4 * h + q], _pairs[4 * h + 2 + q]);
+        }
+    if (count == 4)
+    {
+        for (uint32_t m = 0; m < 4; m++)
+            rows[m] = _quads[m];
+        return;
+    }
+    for (uint32_t m = 0; m < 4; m++)
+    {
+        rows[2 * m] = _mm_unpacklo_epi32(_quads[m], _quads[4 + m]);
+        rows[2 * m + 1] = _mm_unpackhi_epi32(_quads[m], _quads[4 + m]);
+    }
+}
+
+// transpose8x8() on both 64 bit lanes
+static inline __m128i transpose8x8x2(__m128i x)
+{
+    __m128i _t;
+    _t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)), _mm_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm_xor_si128(_mm_xor_si128(x, _t), _mm_slli_epi64(_t, 7));
+    _t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)), _mm_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, _t), _mm_slli_epi64(_t, 14));
+    _t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)), _mm_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm_xor_si128(_mm_xor_si128(x, _t), _mm_slli_epi64(_t, 28));
+    return x;
+}
+
+// Returns the number of elements done
+template <uint32_t elementSize> static uint64_t byteUnshuffleVector(const char* data, uint64_t n, char* dest)
+{
+    uint64_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i _planes[8], _rows[8];
+        for (uint32_t k = 0; k < elementSize; k++)
+            _planes[k] = _mm_loadu_si128((const __m128i*) (data + k * n + i));
+        interleavePlanes<elementSize>(_planes, _rows);
+        for (uint32_t k = 0; k < elementSize; k++)
+            _mm_storeu_si128((__m128i*) (dest + i * elementSize + 16 * k), _rows[k]);
+    }
+    return i;
+}
+#endif
+
+static void byteUnshuffle(const char* data, uint64_t n, uint32_t elementSize, char* dest)
+{
+    uint64_t _done = 0;
+#ifdef __SSE2__
+    switch (elementSize)
+    {
+    case 2: _done = byteUnshuffleVector<2>(data, n, dest); break;
+    case 4: _done = byteUnshuffleVector<4>(data, n, dest); break;
+    case 8: _done = byteUnshuffleVector<8>(data, n, dest); break;
+    default: break;
+    }
+#endif
+    for (uint32_t k = 0; k < elementSize; k++)
+        for (uint64_t i = _done; i < n; i++)
+            dest[i * elementSize + k] = data[k * n + i];
+}
+
+/*
+ * Split n bytes (a multiple of 8) into 8 bit planes of n / 8 bytes. SSE2
+ * collects one bit of 16 bytes per movemask, the rest goes through the
+ * 64 bit transpose.
+ */
+static void bitPlanesEncode(const char* data, uint64_t n, char* dest)
+{
+    uint64_t _groups = n / 8;
+    uint64_t g = 0;
+#ifdef __SSE2__
+    for (; g + 2 <= _groups; g += 2)
+    {
+        __m128i _bytes = _mm_loadu_si128((const __m128i*) (data + 8 * g));
+        for (int b = 7; b >= 0; b--)
+        {
+            uint16_t _bits = _mm_movemask_epi8(_bytes);
+            memcpy(dest + b * _groups + g, &_bits, sizeof(_bits));
+            _bytes = _mm_add_epi8(_bytes, _bytes);
+        }
+    }
+#endif
+    for (; g < _groups; g++)
+    {
+        uint64_t _x;
+        memcpy(&_x, data + 8 * g, sizeof(_x));
+        _x = transpose8x8(_x);
+        for (int b = 0; b < 8; b++)
+            dest[b * _groups + g] = (char) (_x >> (8 * b));
+    }
+}
+
+/*
+ * Inverse of bitPlanesEncode(). SSE2 gathers the plane bytes of 16
+ * groups with the byte interleave of byteUnshuffle() and transposes two
+ * groups per vector.
+ */
+static void bitPlanesDecode(const char* data, uint64_t n, char* dest)
+{
+    uint64_t _groups = n / 8;
+    uint64_t g = 0;
+#ifdef __SSE2__
+    for (; g + 16 <= _groups; g += 16)
+    {
+        __m128i _planes[8], _rows[8];
+        for (int b = 0; b < 8; b++)
+            _planes[b] = _mm_loadu_si128((const __m128i*) (data + b * _groups + g));
+        interleavePlanes<8>(_planes, _rows);
+        for (int r = 0; r < 8; r++)
+            _mm_storeu_si128((__m128i*) (dest + 8 * g + 16 * r), transpose8x8x2(_rows[r]));
+    }
+#endif
+    for (; g < _groups; g++)
+    {
+        uint64_t _x = 0;
+        for (int b = 0; b < 8; b++)
+            _x |= (uint64_t) (uint8_t) data[b * _groups + g] << (8 * b);
+        _x = transpose8x8(_x);
+        memcpy(dest + 8 * g, &_x, sizeof(_x));
+    }
+}
+
+void encodeBankFilter(uint16_t filter, const char* data, uint64_t size, char* dest, char* scratch)
+{
+    uint32_t _elementSize = 1 << ((filter & CBDF_BANK_FILTER_ELEMENT_MASK) >> CBDF_BANK_FILTER_ELEMENT_SHIFT);
+    uint64_t _n = size / _elementSize;
+    const char* _current = data;
+    if (filter & CBDF_BANK_FILTER_DELTA)
+    {
+        char* _target = (filter & (CBDF_BANK_FILTER_BYTESHUFFLE | CBDF_BANK_FILTER_BITSHUFFLE)) ? scratch + size : dest;
+        switch (_elementSize)
+        {
+        case 1: deltaEncode<uint8_t>(_current, _n, _target); break;
+        case 2: deltaEncode<uint16_t>(_current, _n, _target); break;
+        case 4: deltaEncode<uint32_t>(_current, _n, _target); break;
+        default: deltaEncode<uint64_t>(_current, _n, _target); break;
+        }
+        memcpy(_target + _n * _elementSize, _current + _n * _elementSize, size - _n * _elementSize);
+        _current = _target;
+    }
+    if (filter & CBDF_BANK_FILTER_BITSHUFFLE)
+    {
+        uint64_t _n8 = _n & ~7ULL;
+        byteShuffle(_current, _n8, _elementSize, scratch);
+        for (uint32_t k = 0; k < _elementSize; k++)
+            bitPlanesEncode(scratch + k * _n8, _n8, dest + k * _n8);
+        memcpy(dest + _n8 * _elementSize, _current + _n8 * _elementSize, size - _n8 * _elementSize);
+    }
+    else if (filter & CBDF_BANK_FILTER_BYTESHUFFLE)
+    {
+        byteShuffle(_current, _n, _elementSize, dest);
+        memcpy(dest + _n * _elementSize, _current + _n * _elementSize, size - _n * _elementSize);
+    }
+    else if (_current != dest)
+        memcpy(dest, _current, size);
+}
+
+void decodeBankFilter(uint16_t filter, const char* data, uint64_t size, char* dest, char* scratch)
+{
+    uint32_t _elementSize = 1 << ((filter & CBDF_BANK_FILTER_ELEMENT_MASK) >> CBDF_BANK_FILTER_ELEMENT_SHIFT);
+    uint64_t _n = size / _elementSize;
+    if (filter & CBDF_BANK_FILTER_BITSHUFFLE)
+    {
+        uint64_t _n8 = _n & ~7ULL;
+        for (uint32_t k = 0; k < _elementSize; k++)
+            bitPlanesDecode(data + k * _n8, _n8, scratch + k * _n8);
+        byteUnshuffle(scratch, _n8, _elementSize, dest);
+        memcpy(dest + _n8 * _elementSize, data + _n8 * _elementSize, size - _n8 * _elementSize);
+    }
+    else if (filter & CBDF_BANK_FILTER_BYTESHUFFLE)
+    {
+        byteUnshuffle(data, _n, _elementSize, dest);
+        memcpy(dest + _n * _elementSize, data + _n * _elementSize, size - _n * _elementSize);
+    }
+    else if (data != dest)
+        memcpy(dest, data, size);
+    if (filter & CBDF_BANK_FILTER_DELTA)
+    {
+        switch (_elementSize)
+        {
+        case 1: deltaDecode<uint8_t>(dest, _n); break;
+        case 2: deltaDecode<uint16_t>(dest, _n); break;
+        case 4: deltaDecode<uint32_t>(dest, _n); break;
+        default: deltaDecode<uint64_t>(dest, _n); break;
+        }
+    }
+}
+
+cbdfCompressionController::cbdfCompressionController()
+{
+    configure(0.25, 0.5);
+}
+
+void cbdfCompressionController::configure(double _targetBacklog, double _cpuBudget)
+{
+    static const step_t _steps[] = {
+        {cbdf::bankRaw, 0},
+        {cbdf::bankLZ4, 1},
+        {cbdf::bankZstd, 1},
+        {cbdf::bankZstd, 3},
+        {cbdf::bankZstd, 6},
+        {cbdf::bankZstd, 12},
+        {cbdf::bankZstd, 19},
+    };
+    static const step_t _deflateSteps[] = {
+        {cbdf::bankDeflate, 1},
+        {cbdf::bankDeflate, 6},
+        {cbdf::bankDeflate, 9},
+    };
+    ladder.clear();
+    for (uint32_t i = 0; i < sizeof(_steps) / sizeof(_steps[0]); i++)
+        if (cbdfBankCoder::available(_steps[i].codec))
+            ladder.push_back(_steps[i]);
+    if (!cbdfBankCoder::available(cbdf::bankZstd))
+        ladder.insert(ladder.end(), _deflateSteps, _deflateSteps + sizeof(_deflateSteps) / sizeof(_deflateSteps[0]));
+    current = ladder.size() / 2;
+    targetBacklog = _targetBacklog;
+    cpuBudget = _cpuBudget;
+    backlog = 0;
+    windowStart = nowNs();
+    windowBusy = 0;
+    calmWindows = 0;
+}
+
+void cbdfCompressionController::update(uint64_t compressNs)
+{
+    windowBusy += compressNs;
+    uint64_t _now = nowNs();
+    uint64_t _elapsed = _now - windowStart;
+    if (_elapsed < (uint64_t) CBDF_ADAPTIVE_WINDOW_MS * 1000000)
+        return;
+    double _busy = (double) windowBusy / _elapsed;
+    if (backlog > targetBacklog || _busy > cpuBudget)
+    {
+        if (current > 0)
+            current--;
+        calmWindows = 0;
+    }
+    else if (backlog < targetBacklog / 2 && _busy < cpuBudget / 2)
+    {
+        if (++calmWindows >= CBDF_ADAPTIVE_CALM_WINDOWS && current + 1 < ladder.size())
+        {
+            current++;
+            calmWindows = 0;
+        }
+    }
+    else
+        calmWindows = 0;
+    windowStart = _now;
+    windowBusy = 0;
+}
+
+uint64_t cbdfCompressionController::nowNs()
+{
+    struct timespec _now;
+    clock_gettime(CLOCK_MONOTONIC, &_now);
+    return (uint64_t) _now.tv_sec * 1000000000 + _now.tv_nsec;
+}
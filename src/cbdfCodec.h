@@ -0,0 +1,129 @@
+/*
+ * cbdfCodec.h
+ *
+ *  Block codecs and pre-filters for compressing single banks and events
+ */
+
+#ifndef CBDFCODEC_H_
+#define CBDFCODEC_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * In files with CBDF_FEATURE_BANK_CODECS bits 13-15 of the bank user flags
+ * name the codec of the bank data. Compressed data starts with the size of
+ * the uncompressed bank as uint32_t.
+ */
+#define CBDF_BANK_CODEC_SHIFT 13
+#define CBDF_BANK_CODEC_MASK 0xe000
+#define CBDF_BANK_CODEC_MIN_SIZE 64 // Smaller banks are always stored raw
+
+/*
+ * Bits 8-12 of the same user flags list the pre-filters applied before the
+ * codec, on elements of 1 << (bits 8-9) bytes. Delta runs first, then one
+ * of the shuffles. Bytes behind the last whole element (bit shuffle: the
+ * last whole group of 8 elements) are stored unfiltered.
+ */
+#define CBDF_BANK_FILTER_MASK 0x1f00
+#define CBDF_BANK_FILTER_ELEMENT_SHIFT 8
+#define CBDF_BANK_FILTER_ELEMENT_MASK 0x0300
+#define CBDF_BANK_FILTER_DELTA 0x0400       // Zigzag encoded difference to the previous element
+#define CBDF_BANK_FILTER_BYTESHUFFLE 0x0800 // Byte k of all elements, then byte k+1, ...
+#define CBDF_BANK_FILTER_BITSHUFFLE 0x1000  // Bit b of byte k of all elements, then bit b+1, ...
+
+// Apply and undo the pre-filters of filter (user flag bits) to size bytes, scratch holds 2 * size bytes
+void encodeBankFilter(uint16_t filter, const char* data, uint64_t size, char* dest, char* scratch);
+void decodeBankFilter(uint16_t filter, const char* data, uint64_t size, char* dest, char* scratch);
+
+/*
+ * Compressor and decompressor state of one cbdf instance, kept between
+ * banks so the codecs do not set up their tables for every bank. Not
+ * thread safe.
+ */
+class cbdfBankCoder
+{
+public:
+
+  cbdfBankCoder();
+  ~cbdfBankCoder();
+
+  static bool available(uint32_t codec); // Compiled in
+  static uint64_t bound(uint32_t codec, uint64_t size); // Worst case compressed size
+
+  // Compress into dest, returns the compressed size or 0 if it failed or did not fit into destSize
+  uint64_t compress(uint32_t codec, int level, const char* data, uint64_t size, char* dest, uint64_t destSize);
+  // Decompress exactly rawSize bytes into dest
+  bool decompress(uint32_t codec, const char* data, uint64_t size, char* dest, uint64_t rawSize);
+
+  bool setDictionary(const std::string &dictionary); // zstd dictionary for both directions, empty for none
+  static bool trainDictionary(const std::vector<std::string> &samples, uint32_t maxSize, std::string &dictionary);
+
+private:
+
+  z_stream deflater;
+  z_stream inflater;
+  bool deflaterReady;
+  bool inflaterReady;
+  int deflateLevel;
+  std::string dictionary;
+#ifdef WITH_ZSTD
+  ZSTD_CCtx* zstdCompressor;
+  ZSTD_DCtx* zstdDecompressor;
+  ZSTD_CDict* zstdCompressDict;   // Digested for one level, made on first use
+  ZSTD_DDict* zstdDecompressDict;
+  int zstdDictLevel;
+#endif
+};
+
+/*
+ * Picks codec and level of each event in adaptive event compression. The
+ * settings form a ladder from storing raw over the fastest to the strongest
+ * codec. Every window of CBDF_ADAPTIVE_WINDOW_MS the backlog reported by the
+ * writer's producers and the share of wall time spent compressing are
+ * compared against their targets: if either is exceeded the controller
+ * steps down at once, after CBDF_ADAPTIVE_CALM_WINDOWS windows well below
+ * both it steps up by one. The lowest step stores events raw, so falling
+ * behind costs ratio, never events.
+ */
+#define CBDF_ADAPTIVE_WINDOW_MS 50
+#define CBDF_ADAPTIVE_CALM_WINDOWS 4
+
+class cbdfCompressionController
+{
+public:
+
+  cbdfCompressionController();
+
+  void configure(double targetBacklog, double cpuBudget); // Also starts over in the middle of the ladder
+  uint32_t codec() const { return ladder[current].codec; }
+  int level() const { return ladder[current].level; }
+
+  void reportBacklog(double fill) { backlog = fill; }
+  void update(uint64_t compressNs); // After each event with the time its compression took
+  static uint64_t nowNs();
+
+private:
+
+  struct step_t {
+      uint32_t codec;
+      int level;
+  };
+
+  std::vector<step_t> ladder;
+  uint32_t current;
+  double targetBacklog;
+  double cpuBudget;
+  double backlog;           // Last reported fill of the producer queue, 0..1
+  uint64_t windowStart;
+  uint64_t windowBusy;      // ns spent compressing in this window
+  uint32_t calmWindows;
+};
+
+#endif /* CBDFCODEC_H_ */
@@ -0,0 +1,403 @@
+/*
+ * cbdfCompressEval.cpp
+ *
+ *  Compression ratio and speed of the available codecs measured on events
+ *  sampled from a cbdf file
+ */
+
+#include <cbdfCompressEval.h>
+#include <cbdfCatalogue.h>
+#include "cbdfFormat.h"
+#include "cbdfCodec.h"
+#include "cbdfCrc.h"
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <time.h>
+
+#ifdef WITH_LZMA
+#include "lzma.hpp"
+#endif
+
+#ifdef WITH_LZO
+#include "lzo.hpp"
+#endif
+
+namespace boostIO = boost::iostreams;
+
+struct evalSetting_t {
+    const char* name;
+    bool stream;
+    int codec;                  // compressionType_t for stream codecs, else bankCodec_t
+    int level;
+};
+
+static const evalSetting_t evalSettings[] = {
+    {"none", true, cbdf::none, 0},
+    {"gzip-1", true, cbdf::gzip, 1},
+    {"gzip-6", true, cbdf::gzip, 6},
+    {"gzip-9", true, cbdf::gzip, 9},
+    {"bzip2-1", true, cbdf::bzip2, 1},
+    {"bzip2-9", true, cbdf::bzip2, 9},
+#ifdef WITH_LZMA
+    {"xz-1", true, cbdf::xz, 1},
+    {"xz-6", true, cbdf::xz, 6},
+    {"xz-9", true, cbdf::xz, 9},
+#endif
+#ifdef WITH_LZO
+    {"lzo", true, cbdf::lzo, 0},
+#endif
+    {"deflate-1", false, cbdf::bankDeflate, 1},
+    {"deflate-6", false, cbdf::bankDeflate, 6},
+    {"deflate-9", false, cbdf::bankDeflate, 9},
+    {"lz4", false, cbdf::bankLZ4, 1},
+    {"zstd-1", false, cbdf::bankZstd, 1},
+    {"zstd-3", false, cbdf::bankZstd, 3},
+    {"zstd-6", false, cbdf::bankZstd, 6},
+    {"zstd-12", false, cbdf::bankZstd, 12},
+    {"zstd-19", false, cbdf::bankZstd, 19},
+};
+
+// One codec setting run on one set of samples
+struct evalJob_t {
+    const evalSetting_t* setting;
+    const std::vector<std::string>* items;
+    cbdfEvalResult_t* result;
+};
+
+static double threadSeconds()
+{
+    struct timespec _now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &_now);
+    return _now.tv_sec + _now.tv_nsec * 1e-9;
+}
+
+// Concatenate items into blocks of about blockSize bytes, as a stream codec sees them
+static void packBlocks(const std::vector<std::string> &items, uint64_t blockSize, std::vector<std::string> &blocks)
+{
+    blocks.clear();
+    std::string _block;
+    for (uint32_t i = 0; i < items.size(); i++)
+    {
+        _block.append(items[i]);
+        if (_block.size() >= blockSize)
+        {
+            blocks.push_back(_block);
+            _block.clear();
+        }
+    }
+    if (!_block.empty())
+        blocks.push_back(_block);
+}
+
+static bool streamCompress(int codec, int level, const std::string &data, std::string &packed)
+{
+    packed.clear();
+    boostIO::filtering_ostream _out;
+    switch (codec)
+    {
+    case (cbdf::gzip):
+        _out.push(boostIO::gzip_compressor(boostIO::gzip_params(level)));
+        break;
+    case (cbdf::bzip2):
+        _out.push(boostIO::bzip2_compressor(boostIO::bzip2_params(level)));
+        break;
+#ifdef WITH_LZMA
+    case (cbdf::xz):
+        _out.push(boostIO::lzma_compressor(boostIO::lzma_params(level)));
+        break;
+#endif
+#ifdef WITH_LZO
+    case (cbdf::lzo):
+        _out.push(boostIO::lzo_compressor());
+        break;
+#endif
+    default:
+        break;
+    }
+    _out.push(boostIO::back_inserter(packed));
+    _out.write(data.data(), data.size());
+    _out.reset(); // Flushes and closes the compressor
+    return true;
+}
+
+static bool streamDecompress(int codec, const std::string &packed, std::string &data)
+{
+    boostIO::filtering_istream _in;
+    switch (codec)
+    {
+    case (cbdf::gzip):
+        _in.push(boostIO::gzip_decompressor());
+        break;
+    case (cbdf::bzip2):
+        _in.push(boostIO::bzip2_decompressor());
+        break;
+#ifdef WITH_LZMA
+    case (cbdf::xz):
+        _in.push(boostIO::lzma_decompressor());
+        break;
+#endif
+#ifdef WITH_LZO
+    case (cbdf::lzo):
+        _in.push(boostIO::lzo_decompressor());
+        break;
+#endif
+    default:
+        break;
+    }
+    _in.push(boostIO::array_source(packed.data(), packed.size()));
+    _in.read(&data[0], data.size());
+    return (uint64_t) _in.gcount() == data.size() && _in.get() == EOF;
+}
+
+static void runStreamJob(const evalJob_t &job, uint64_t blockSize)
+{
+    std::vector<std::string> _blocks;
+    packBlocks(*job.items, blockSize, _blocks);
+    cbdfEvalResult_t &_result = *job.result;
+    std::string _packed, _unpacked;
+    for (uint32_t i = 0; i < _blocks.size(); i++)
+    {
+        _result.items++;
+        _result.rawBytes += _blocks[i].size();
+        _unpacked.assign(_blocks[i].size(), '\0');
+        if (job.setting->codec == cbdf::none)
+        {
+            double _start = threadSeconds();
+            memcpy(&_unpacked[0], _blocks[i].data(), _blocks[i].size());
+            _result.compressSeconds += threadSeconds() - _start;
+            _result.compressedBytes += _blocks[i].size();
+            continue;
+        }
+        try
+        {
+            double _start = threadSeconds();
+            streamCompress(job.setting->codec, job.setting->level, _blocks[i], _packed);
+            _result.compressSeconds += threadSeconds() - _start;
+            _result.compressedBytes += _packed.size();
+            _start = threadSeconds();
+            if (!streamDecompress(job.setting->codec, _packed, _unpacked) || _unpacked != _blocks[i])
+                _result.failed = true;
+            _result.decompressSeconds += threadSeconds() - _start;
+        }
+        catch (const std::exception &_error)
+        {
+            _result.failed = true;
+        }
+    }
+}
+
+static void runBlockJob(const evalJob_t &job, cbdfBankCoder &coder)
+{
+    cbdfEvalResult_t &_result = *job.result;
+    std::string _packed, _unpacked;
+    for (uint32_t i = 0; i < job.items->size(); i++)
+    {
+        const std::string &_item = (*job.items)[i];
+        _result.items++;
+        _result.rawBytes += _item.size();
+        _packed.resize(cbdfBankCoder::bound(job.setting->codec, _item.size()) + 1);
+        double _start = threadSeconds();
+        uint64_t _size = coder.compress(job.setting->codec, job.setting->level, _item.data(), _item.size(), &_packed[0], _packed.size());
+        _result.compressSeconds += threadSeconds() - _start;
+        if (_size == 0 || _size >= _item.size())
+        {
+            _result.compressedBytes += _item.size();
+            continue;
+        }
+        _result.compressedBytes += _size;
+        _unpacked.resize(_item.size());
+        _start = threadSeconds();
+        if (!coder.decompress(job.setting->codec, _packed.data(), _size, &_unpacked[0], _item.size()) || _unpacked != _item)
+            _result.failed = true;
+        _result.decompressSeconds += threadSeconds() - _start;
+    }
+}
+
+static void evalWorker(const std::vector<evalJob_t> *jobs, boost::atomic<uint32_t> *next, uint64_t blockSize)
+{
+    cbdfBankCoder _coder;
+    uint32_t _job;
+    while ((_job = (*next)++) < jobs->size())
+    {
+        if ((*jobs)[_job].setting->stream)
+            runStreamJob((*jobs)[_job], blockSize);
+        else
+            runBlockJob((*jobs)[_job], _coder);
+    }
+}
+
+// Payload of the current event with every bank decoded, laid out as the writer does without bank codecs
+static std::string decodedPayload(cbdf &reader)
+{
+    std::string _payload;
+    for (uint32_t i = 0; i < reader.getBankDirectory().size(); i++)
+    {
+        cbdf::cbdfBankMapEntry_t _bank = reader.getBankAt(i);
+        if (_bank.dataPtr == NULL && _bank.size == 0)
+            continue;
+        _payload.append(bankPadding(_payload.size(), reader.getBankAlignment()), '\0');
+        cbdf::cbdfBankHeader_t _header;
+        memcpy(_header.name, _bank.name, sizeof(_header.name));
+        _header.userFlags = _bank.userFlags;
+        _header.size = _bank.size;
+        _payload.append((const char*) &_header, sizeof(_header));
+        _payload.append(_bank.dataPtr, _bank.size);
+    }
+    return _payload;
+}
+
+/*
+ * Event records are rebuilt from the decoded events, so files written with
+ * event or bank compression are evaluated on their uncompressed content.
+ * getRawData() only undoes event compression, with bank codecs the payload
+ * is put together from the decoded banks.
+ */
+int evaluateCompression(std::string fileName, std::vector<cbdfEvalResult_t> &results, uint64_t maxEvents, uint32_t threads, bool perBank, uint64_t blockSize)
+{
+    results.clear();
+    cbdfCatalogue_t _catalogue;
+    scanCatalogue(fileName, _catalogue);
+    uint64_t _stride = 1;
+    if (maxEvents && _catalogue.events > maxEvents)
+        _stride = (_catalogue.events + maxEvents - 1) / maxEvents;
+
+    cbdf _reader;
+    int _ret = _reader.fileOpen(fileName, cbdf::readMode, cbdf::guessCompression(fileName));
+    if (_ret != 0)
+        return _ret;
+    std::vector<std::string> _records, _payloads;
+    std::vector<std::string> _bankNames;
+    std::vector<std::vector<std::string> > _banks;
+    bool _bankCodecs = (_reader.getFileFeatures() & CBDF_FEATURE_BANK_CODECS) != 0;
+    _ret = _reader.readEvent();
+    while (_ret == 0 && (maxEvents == 0 || _payloads.size() < maxEvents))
+    {
+        std::string _payload;
+        if (_bankCodecs)
+            _payload = decodedPayload(_reader);
+        else if (_reader.getEventSize())
+        {
+            uint64_t _size = 0;
+            _payload.resize(_reader.getEventSize());
+            _reader.getRawData(&_payload[0], _size);
+        }
+        cbdf::cbdfEventHeader_t _header;
+        _header.openTag = 0xCBEDCBED;
+        _header.eventNumber = _reader.getEventNumber();
+        _header.userFlags = _reader.getEventUserFlags();
+        _header.eventSize = _payload.size();
+        _header.closeTag = 0xCBEDCBED;
+        cbdf::cbdfEventTrailer_t _trailer;
+        _trailer.openTag = 0xDEBCDEBC;
+        _trailer.crc32 = cbdfCrc32(_payload.data(), _payload.size());
+        _trailer.eventSize = _payload.size();
+        _trailer.closeTag = 0xDEBCDEBC;
+        std::string _record((const char*) &_header, sizeof(_header));
+        _record.append(_payload);
+        _record.append((const char*) &_trailer, sizeof(_trailer));
+        _records.push_back(_record);
+        _payloads.push_back(_payload);
+
+        for (uint32_t i = 0; perBank && i < _reader.getBankDirectory().size(); i++)
+        {
+            cbdf::cbdfBankMapEntry_t _bank = _reader.getBankAt(i);
+            if (_bank.dataPtr == NULL)
+                continue;
+            std::string _name(_bank.name, strnlen(_bank.name, sizeof(_bank.name)));
+            uint32_t _index = std::find(_bankNames.begin(), _bankNames.end(), _name) - _bankNames.begin();
+            if (_index == _bankNames.size())
+            {
+                if (_bankNames.size() >= CBDF_EVAL_MAX_BANKS)
+                    continue;
+                _bankNames.push_back(_name);
+                _banks.resize(_bankNames.size());
+            }
+            _banks[_index].push_back(std::string(_bank.dataPtr, _bank.size));
+        }
+        _ret = _reader.skipEvents(_stride - 1);
+    }
+    _reader.fileClose();
+    if (_ret < 0)
+        return _ret;
+
+    // One result per bank (events first) and codec
+    std::vector<const evalSetting_t*> _settings;
+    for (uint32_t i = 0; i < sizeof(evalSettings) / sizeof(evalSettings[0]); i++)
+        if (evalSettings[i].stream || cbdfBankCoder::available(evalSettings[i].codec))
+            _settings.push_back(&evalSettings[i]);
+    results.resize((_bankNames.size() + 1) * _settings.size());
+    std::vector<evalJob_t> _jobs;
+    for (uint32_t b = 0; b <= _bankNames.size(); b++)
+    {
+        for (uint32_t s = 0; s < _settings.size(); s++)
+        {
+            evalJob_t _job;
+            _job.setting = _settings[s];
+            if (b == 0)
+                _job.items = _settings[s]->stream ? &_records : &_payloads;
+            else
+                _job.items = &_banks[b - 1];
+            _job.result = &results[_jobs.size()];
+            _job.result->codec = _settings[s]->name;
+            _job.result->bank = (b == 0) ? std::string() : _bankNames[b - 1];
+            _job.result->stream = _settings[s]->stream;
+            _job.result->items = 0;
+            _job.result->rawBytes = 0;
+            _job.result->compressedBytes = 0;
+            _job.result->compressSeconds = 0;
+            _job.result->decompressSeconds = 0;
+            _job.result->failed = false;
+            _jobs.push_back(_job);
+        }
+    }
+
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    boost::atomic<uint32_t> _next(0);
+    boost::thread_group _workers;
+    for (uint32_t i = 0; i < threads && i < _jobs.size(); i++)
+        _workers.create_thread(boost::bind(&evalWorker, &_jobs, &_next, blockSize));
+    _workers.join_all();
+    return 0;
+}
+
+static double mbPerSecond(uint64_t bytes, double seconds)
+{
+    return (seconds > 0) ? bytes / seconds / 1e6 : 0;
+}
+
+void printEvaluation(const std::vector<cbdfEvalResult_t> &results, std::ostream &out)
+{
+    for (uint32_t i = 0; i < results.size(); i++)
+    {
+        const cbdfEvalResult_t &_result = results[i];
+        if (i == 0 || _result.bank != results[i - 1].bank)
+        {
+            out << (_result.bank.empty() ? std::string("events") : "bank " + _result.bank) << "\n";
+            out << "  codec      unit        items     raw MB   ratio  compress MB/s  decompress MB/s\n";
+        }
+        out << "  " << std::left << std::setw(10) << _result.codec << " " << std::setw(7) << (_result.stream ? "stream" : (_result.bank.empty() ? "event" : "bank")) << std::right
+            << std::setw(10) << _result.items
+            << std::fixed << std::setprecision(2)
+            << std::setw(11) << _result.rawBytes / 1e6
+            << std::setw(8) << (_result.compressedBytes ? (double) _result.rawBytes / _result.compressedBytes : 0)
+            << std::setprecision(1)
+            << std::setw(15) << mbPerSecond(_result.rawBytes, _result.compressSeconds)
+            << std::setw(17) << mbPerSecond(_result.rawBytes, _result.decompressSeconds);
+        if (_result.failed)
+            out << "  FAILED";
+        out << "\n";
+        out.unsetf(std::ios::fixed);
+    }
+}
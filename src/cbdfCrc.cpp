@@ -0,0 +1,151 @@
+/*
+ * cbdfCrc.cpp
+ *
+ *  CRC-32 of event payloads and footer blocks, the same checksum as
+ *  boost::crc_32_type and zlib
+ */
+
+#include "cbdfCrc.h"
+#include <zlib.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CBDF_CRC_CLMUL
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#define CBDF_CRC_CLMUL_MIN 64 // Shorter data is left to zlib
+
+// zlib takes 32 bit lengths
+static uint32_t tableCrc(const char* data, uint64_t size, uint32_t crc)
+{
+    while (size)
+    {
+        uInt _chunk = (size > 0x40000000) ? 0x40000000 : (uInt) size;
+        crc = ::crc32(crc, (const Bytef*) data, _chunk);
+        data += _chunk;
+        size -= _chunk;
+    }
+    return crc;
+}
+
+#ifdef CBDF_CRC_CLMUL
+
+/*
+ * Fold 64 bytes at a time with carry-less multiplication and reduce the
+ * remainder with a Barrett reduction, after Gopal et al., "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+ * 2009), with the constants of the bit reflected CRC-32 polynomial.
+ * Works on the uninverted CRC register; size is a multiple of 16 and at
+ * least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t clmulCrc(const char* data, uint64_t size, uint32_t crc)
+{
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4ULL, 0x01c6e41596ULL};
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0ULL, 0x00ccaa009eULL};
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124ULL, 0x0000000000ULL};
+    static const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641ULL, 0x01f7011641ULL};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*) k1k2);
+    data += 64;
+    size -= 64;
+
+    // Four independent 128 bit lanes, each folded 64 bytes ahead
+    while (size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        data += 64;
+        size -= 64;
+    }
+
+    // Fold the lanes into one
+    x0 = _mm_load_si128((const __m128i*) k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (size >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*) data);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i*) k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*) poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+// Runs from a static initializer, where the CPU model has to be set up first
+static bool detectClmul()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+static const bool hasClmul = detectClmul();
+
+#endif
+
+uint32_t cbdfCrc32(const char* data, uint64_t size, uint32_t crc)
+{
+#ifdef CBDF_CRC_CLMUL
+    if (hasClmul && size >= CBDF_CRC_CLMUL_MIN)
+    {
+        uint64_t _folded = size & ~15ULL;
+        crc = ~clmulCrc(data, _folded, ~crc);
+        data += _folded;
+        size -= _folded;
+    }
+#endif
+    return tableCrc(data, size, crc);
+}
@@ -0,0 +1,20 @@
+/*
+ * cbdfCrc.h
+ *
+ *  CRC-32 of event payloads and footer blocks, the same checksum as
+ *  boost::crc_32_type and zlib
+ */
+
+#ifndef CBDFCRC_H_
+#define CBDFCRC_H_
+
+#include <stdint.h>
+
+/*
+ * Continue crc (0 to start) over size bytes of data. Uses carry-less
+ * multiplication (PCLMULQDQ) on x86-64 CPUs that have it and zlib's table
+ * driven crc32() otherwise.
+ */
+uint32_t cbdfCrc32(const char* data, uint64_t size, uint32_t crc=0);
+
+#endif /* CBDFCRC_H_ */
@@ -0,0 +1,261 @@
+/*
+ * cbdfDataset.cpp
+ *
+ *  A list of cbdf files read as one logical event stream
+ */
+
+#include <cbdfDataset.h>
+#include <glob.h>
+
+cbdfDataset::cbdfDataset(mergeMode_t _mergeMode)
+{
+    mergeMode = _mergeMode;
+    currentIndex = -1;
+    prefetchIndex = -1;
+    prefetched.reader = NULL;
+    prefetched.pending = false;
+}
+
+int cbdfDataset::addFile(std::string fileName)
+{
+    return addFile(fileName, cbdf::guessCompression(fileName));
+}
+
+int cbdfDataset::addFile(std::string fileName, cbdf::compressionType_t compression)
+{
+    // The file list must not change while files are being opened in the background
+    if (!openFiles.empty())
+        return -1;
+    cbdfDatasetFile_t _file;
+    _file.fileName = fileName;
+    _file.compression = compression;
+    _file.timeStart = 0;
+    _file.eventsRead = 0;
+    _file.status = 0;
+    files.push_back(_file);
+    return 0;
+}
+
+int cbdfDataset::addGlob(std::string pattern)
+{
+    glob_t _glob;
+    if (glob(pattern.c_str(), 0, NULL, &_glob) != 0)
+        return -1;
+    int _ret = 0;
+    for (size_t i = 0; i < _glob.gl_pathc && _ret == 0; i++)
+        _ret = addFile(_glob.gl_pathv[i]);
+    globfree(&_glob);
+    return _ret;
+}
+
+/*
+ * Open a file and read its first event. Runs on the prefetch thread in
+ * sequential mode, the result is handed out by the next readEvent().
+ */
+void cbdfDataset::openFile(int index, cbdfOpenFile_t *openFile)
+{
+    cbdfDatasetFile_t &_file = files[index];
+    openFile->reader = new cbdf();
+    openFile->pending = true;
+    _file.status = openFile->reader->fileOpen(_file.fileName, cbdf::readMode, _file.compression);
+    if (_file.status != 0)
+    {
+        // The error is handed out once, then the file counts as finished
+        delete openFile->reader;
+        openFile->reader = NULL;
+        openFile->firstResult = _file.status;
+        return;
+    }
+    _file.uuid.assign(openFile->reader->getUuid(), 36);
+    _file.timeStart = openFile->reader->getFileStartTime();
+    openFile->firstResult = openFile->reader->readEvent();
+}
+
+// Open files until none is left, the next index is shared by all openers
+void cbdfDataset::openWorker(boost::atomic<uint32_t> *next)
+{
+    uint32_t _file;
+    while ((_file = (*next)++) < files.size())
+        openFile((int) _file, &openFiles[_file]);
+}
+
+void cbdfDataset::startPrefetch(int index)
+{
+    prefetchIndex = index;
+    prefetchThread = boost::thread(&cbdfDataset::openFile, this, index, &prefetched);
+}
+
+void cbdfDataset::finishPrefetch()
+{
+    if (prefetchThread.joinable())
+        prefetchThread.join();
+}
+
+int cbdfDataset::open()
+{
+    if (files.empty() || !openFiles.empty())
+        return -1;
+
+    if (mergeMode == sequential)
+    {
+        openFiles.resize(1);
+        currentIndex = 0;
+        openFile(0, &openFiles[0]);
+        if (files.size() > 1)
+            startPrefetch(1);
+        return 0;
+    }
+
+    // All files are needed before the first event can be chosen, open them in parallel
+    uint32_t _threads = boost::thread::hardware_concurrency();
+    if (_threads == 0)
+        _threads = 1;
+    boost::atomic<uint32_t> _next(0);
+    boost::thread_group _openers;
+    openFiles.resize(files.size());
+    for (uint32_t i = 0; i < _threads && i < files.size(); i++)
+        _openers.create_thread(boost::bind(&cbdfDataset::openWorker, this, &_next));
+    _openers.join_all();
+    currentIndex = -1;
+    return 0;
+}
+
+int cbdfDataset::close()
+{
+    finishPrefetch();
+    delete prefetched.reader;
+    prefetched.reader = NULL;
+    for (size_t i = 0; i < openFiles.size(); i++)
+        delete openFiles[i].reader;
+    openFiles.clear();
+    currentIndex = -1;
+    return 0;
+}
+
+// A file is finished at its trailer or when it is truncated, one that could not be opened has no reader
+static bool fileFinished(int result)
+{
+    return (result == CBDF_EOF || result == CBDF_UNEXPECTED_EOF || result == -1);
+}
+
+int cbdfDataset::readSequential()
+{
+    while (true)
+    {
+        cbdfOpenFile_t &_current = openFiles[0];
+        int _ret = CBDF_EOF;
+        if (_current.pending)
+        {
+            _current.pending = false;
+            _ret = _current.firstResult;
+        }
+        else if (_current.reader != NULL)
+        {
+            _ret = _current.reader->readEvent();
+        }
+
+        if (!fileFinished(_ret))
+        {
+            files[currentIndex].status = _ret;
+            if (_ret == 0)
+                files[currentIndex].eventsRead++;
+            return _ret;
+        }
+
+        // Report a broken file once, the next call moves on
+        if (_current.reader != NULL || _ret != CBDF_EOF)
+        {
+            files[currentIndex].status = _ret;
+            delete _current.reader;
+            _current.reader = NULL;
+            if (_ret != CBDF_EOF)
+                return _ret;
+        }
+
+        if (currentIndex + 1 >= (int) files.size())
+            return CBDF_EOF;
+
+        finishPrefetch();
+        _current = prefetched;
+        prefetched.reader = NULL;
+        currentIndex = prefetchIndex;
+        if (currentIndex + 1 < (int) files.size())
+            startPrefetch(currentIndex + 1);
+    }
+}
+
+int cbdfDataset::readMerged()
+{
+    // Refill the file the previous event was taken from
+    if (currentIndex >= 0 && openFiles[currentIndex].reader != NULL)
+    {
+        openFiles[currentIndex].firstResult = openFiles[currentIndex].reader->readEvent();
+        openFiles[currentIndex].pending = true;
+    }
+    currentIndex = -1;
+
+    int _next = -1;
+    for (size_t i = 0; i < openFiles.size(); i++)
+    {
+        cbdfOpenFile_t &_file = openFiles[i];
+        if (!_file.pending)
+            continue;
+        if (_file.firstResult != 0)
+        {
+            int _ret = _file.firstResult;
+            files[i].status = _ret;
+            _file.pending = false;
+            currentIndex = i;
+            if (fileFinished(_ret))
+            {
+                delete _file.reader;
+                _file.reader = NULL;
+                if (_ret == CBDF_EOF)
+                    continue;
+            }
+            return _ret;
+        }
+        if (_next < 0 || _file.reader->getEventNumber() < openFiles[_next].reader->getEventNumber())
+            _next = i;
+    }
+
+    if (_next < 0)
+        return CBDF_EOF;
+    openFiles[_next].pending = false;
+    files[_next].eventsRead++;
+    currentIndex = _next;
+    return 0;
+}
+
+int cbdfDataset::readEvent()
+{
+    if (openFiles.empty())
+        return -1;
+    if (mergeMode == sequential)
+        return readSequential();
+    return readMerged();
+}
+
+cbdf* cbdfDataset::getFile()
+{
+    if (mergeMode == sequential)
+        return openFiles.empty() ? NULL : openFiles[0].reader;
+    if (currentIndex < 0)
+        return NULL;
+    return openFiles[currentIndex].reader;
+}
+
+int cbdfDataset::getFileIndex()
+{
+    return currentIndex;
+}
+
+const std::vector<cbdfDataset::cbdfDatasetFile_t>& cbdfDataset::getFiles()
+{
+    return files;
+}
+
+cbdfDataset::~cbdfDataset()
+{
+    close();
+}
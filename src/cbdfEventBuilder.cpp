@@ -0,0 +1,314 @@
+/*
+ * cbdfEventBuilder.cpp
+ *
+ *  Assemble events from fragments delivered by several sources
+ */
+
+#include <cbdfEventBuilder.h>
+#include <cstring>
+#include <time.h>
+#include "cbdfFormat.h"
+
+cbdfEventBuilder::cbdfEventBuilder(cbdf* _writer, uint32_t _nSources, uint32_t _windowSize, uint32_t _timeoutMs, uint64_t firstEventNumber, uint64_t _incompleteFlag)
+    : reserved(&cbdfEventBuilder::keepSlot)
+{
+    writer = _writer;
+    nSources = (_nSources > 64) ? 64 : _nSources;
+    allSources = (nSources == 64) ? ~0ULL : ((1ULL << nSources) - 1);
+    windowSize = _windowSize ? _windowSize : 1;
+    timeoutMs = _timeoutMs;
+    incompleteFlag = _incompleteFlag;
+    nextEmit = firstEventNumber;
+    highestSeen = firstEventNumber;
+    memset(&builderStats, 0, sizeof(builderStats));
+
+    slots = new cbdfSlot_t[windowSize];
+    for (uint32_t i = 0; i < windowSize; i++)
+    {
+        slots[i].active = false;
+        slots[i].event = NULL;
+    }
+}
+
+// The slots belong to the builder, nothing to clean up when a thread ends
+void cbdfEventBuilder::keepSlot(cbdfSlot_t*)
+{
+}
+
+uint64_t cbdfEventBuilder::nowMs()
+{
+    struct timespec _now;
+    clock_gettime(CLOCK_MONOTONIC, &_now);
+    return (uint64_t) _now.tv_sec * 1000 + _now.tv_nsec / 1000000;
+}
+
+/*
+ * Lock the slot of eventNumber, opening it for that event if this is its
+ * first fragment. A source that is a full window ahead waits until the
+ * oldest event is written. Returns NULL for fragments of events that were
+ * already written.
+ */
+cbdfEventBuilder::cbdfSlot_t* cbdfEventBuilder::lockSlot(uint64_t eventNumber, int &status)
+{
+    status = 0;
+    while (true)
+    {
+        if (eventNumber < nextEmit)
+        {
+            boost::mutex::scoped_lock _lock(statsMutex);
+            builderStats.fragmentsLate++;
+            status = CBDF_FRAGMENT_LATE;
+            return NULL;
+        }
+        if (eventNumber >= nextEmit + windowSize)
+        {
+            // Too far ahead of the slowest source, wait for the head to complete or time out
+            drain(0, true);
+            boost::mutex::scoped_lock _lock(emitMutex);
+            if (eventNumber >= nextEmit + windowSize)
+                windowMoved.timed_wait(_lock, boost::posix_time::milliseconds(1));
+            continue;
+        }
+
+        cbdfSlot_t* _slot = &slots[eventNumber % windowSize];
+        _slot->mutex.lock();
+        // nextEmit only advances with the slot of the written event locked
+        if (eventNumber < nextEmit)
+        {
+            _slot->mutex.unlock();
+            continue;
+        }
+        if (!_slot->active)
+        {
+            if (_slot->event == NULL)
+            {
+                _slot->event = new cbdfEventBuffer(65536);
+                _slot->event->setBankAlignment(writer->getBankAlignment());
+            }
+            _slot->event->clearEvent();
+            _slot->active = true;
+            _slot->eventNumber = eventNumber;
+            _slot->sourceMask = 0;
+            _slot->userFlags = 0;
+            _slot->firstArrival = nowMs();
+            uint64_t _highest = highestSeen;
+            while (eventNumber > _highest && !highestSeen.compare_exchange_weak(_highest, eventNumber))
+                ;
+            return _slot;
+        }
+        if (_slot->eventNumber == eventNumber)
+            return _slot;
+        // Still occupied by an event the window moved past, retry once it is written
+        _slot->mutex.unlock();
+    }
+}
+
+// Record the fragment of source in the (locked) slot and write what became ready
+int cbdfEventBuilder::fragmentDone(cbdfSlot_t* slot, uint32_t source, uint64_t userFlags)
+{
+    slot->sourceMask |= (1ULL << source);
+    slot->userFlags |= userFlags;
+    bool _complete = (slot->sourceMask == allSources);
+    slot->mutex.unlock();
+    // A completed event may unblock the head of the window, everyone else only checks timeouts if nobody is writing
+    return drain(0, _complete);
+}
+
+int cbdfEventBuilder::addFragment(uint32_t source, uint64_t eventNumber, const char* banks, uint32_t size, uint64_t userFlags)
+{
+    if (source >= nSources)
+        return -1;
+    int _status;
+    cbdfSlot_t* _slot = lockSlot(eventNumber, _status);
+    if (_slot == NULL)
+        return _status;
+    if (_slot->sourceMask & (1ULL << source))
+    {
+        _slot->mutex.unlock();
+        boost::mutex::scoped_lock _lock(statsMutex);
+        builderStats.fragmentsDuplicate++;
+        return CBDF_FRAGMENT_DUPLICATE;
+    }
+    if (_slot->event->addRawData(banks, size))
+    {
+        _slot->mutex.unlock();
+        return -1;
+    }
+    return fragmentDone(_slot, source, userFlags);
+}
+
+// Goes through the event buffer, which pads the bank if the writer aligns them
+int cbdfEventBuilder::addBank(uint32_t source, uint64_t eventNumber, const char* name, uint16_t bankFlags, const char* data, uint32_t size)
+{
+    cbdfSlot_t* _slot = lockFragment(source, eventNumber);
+    if (_slot == NULL)
+        return -1;
+    if (_slot->event->addBank(name, bankFlags, data, size))
+    {
+        _slot->mutex.unlock();
+        return -1;
+    }
+    return fragmentDone(_slot, source, 0);
+}
+
+// Lock the slot of eventNumber for a new fragment of source, NULL if there is none or it is a duplicate
+cbdfEventBuilder::cbdfSlot_t* cbdfEventBuilder::lockFragment(uint32_t source, uint64_t eventNumber)
+{
+    if (source >= nSources)
+        return NULL;
+    int _status;
+    cbdfSlot_t* _slot = lockSlot(eventNumber, _status);
+    if (_slot == NULL)
+        return NULL;
+    if (_slot->sourceMask & (1ULL << source))
+    {
+        _slot->mutex.unlock();
+        boost::mutex::scoped_lock _lock(statsMutex);
+        builderStats.fragmentsDuplicate++;
+        return NULL;
+    }
+    return _slot;
+}
+
+char* cbdfEventBuilder::reserveFragment(uint32_t source, uint64_t eventNumber, uint32_t size)
+{
+    cbdfSlot_t* _slot = lockFragment(source, eventNumber);
+    if (_slot == NULL)
+        return NULL;
+    char* _target = _slot->event->reserveRawData(size);
+    if (_target == NULL)
+    {
+        _slot->mutex.unlock();
+        return NULL;
+    }
+    _slot->reservedSource = source;
+    reserved.reset(_slot);
+    return _target;
+}
+
+int cbdfEventBuilder::commitFragment(uint32_t source, uint64_t eventNumber, uint64_t userFlags)
+{
+    // Only the thread that reserved the fragment holds the lock of its slot
+    cbdfSlot_t* _slot = reserved.get();
+    if (_slot == NULL || !_slot->active || _slot->eventNumber != eventNumber || _slot->reservedSource != source)
+        return -1;
+    reserved.release();
+    return fragmentDone(_slot, source, userFlags);
+}
+
+/*
+ * Nothing arrived yet for the event at the head of the window. It is given
+ * up once the next event that did arrive has timed out itself.
+ */
+bool cbdfEventBuilder::headExpired(uint64_t eventNumber, uint64_t &nextActive)
+{
+    uint64_t _last = highestSeen;
+    if (_last > eventNumber + windowSize - 1)
+        _last = eventNumber + windowSize - 1;
+    for (uint64_t _event = eventNumber + 1; _event <= _last; _event++)
+    {
+        cbdfSlot_t* _slot = &slots[_event % windowSize];
+        boost::mutex::scoped_lock _lock(_slot->mutex);
+        if (_slot->active && _slot->eventNumber == _event)
+        {
+            nextActive = _event;
+            return (nowMs() - _slot->firstArrival >= timeoutMs);
+        }
+    }
+    return false;
+}
+
+/*
+ * Write events from the head of the window for as long as they are complete
+ * or timed out. Everything below forceBelow is written regardless.
+ */
+int cbdfEventBuilder::drain(uint64_t forceBelow, bool block)
+{
+    boost::mutex::scoped_lock _emitLock(emitMutex, boost::defer_lock);
+    if (block)
+        _emitLock.lock();
+    else if (!_emitLock.try_lock())
+        return 0;
+
+    int _ret = 0;
+    while (true)
+    {
+        uint64_t _event = nextEmit;
+        bool _force = (_event < forceBelow);
+        cbdfSlot_t* _slot = &slots[_event % windowSize];
+        _slot->mutex.lock();
+
+        if (!_slot->active || _slot->eventNumber != _event)
+        {
+            _slot->mutex.unlock();
+            uint64_t _nextActive = _event + 1;
+            if (!_force && !headExpired(_event, _nextActive))
+                break;
+            if (_force && _nextActive > forceBelow)
+                _nextActive = forceBelow;
+            _slot->mutex.lock();
+            nextEmit = _nextActive;
+            _slot->mutex.unlock();
+            boost::mutex::scoped_lock _lock(statsMutex);
+            builderStats.eventsSkipped += _nextActive - _event;
+            continue;
+        }
+
+        if (!_force && _slot->sourceMask != allSources && nowMs() - _slot->firstArrival < timeoutMs)
+        {
+            _slot->mutex.unlock();
+            break;
+        }
+        int _emitRet = emit(_slot);
+        if (_emitRet != 0 && _ret == 0)
+            _ret = _emitRet;
+        nextEmit = _event + 1;
+        _slot->mutex.unlock();
+    }
+    windowMoved.notify_all();
+    return _ret;
+}
+
+// Write the event of a locked slot and free the slot
+int cbdfEventBuilder::emit(cbdfSlot_t* slot)
+{
+    bool _incomplete = (slot->sourceMask != allSources);
+    slot->event->setEventUserFlags(slot->userFlags | (_incomplete ? incompleteFlag : 0));
+    slot->event->setEventNumber(slot->eventNumber);
+    slot->event->finish();
+    // Events open in the reorder window are the backlog of the writer
+    uint64_t _highest = highestSeen;
+    writer->reportBacklog(_highest > slot->eventNumber ? (double) (_highest - slot->eventNumber) / windowSize : 0);
+    int _ret = writer->writeEventRecord(slot->event->getRecord());
+    slot->active = false;
+
+    boost::mutex::scoped_lock _lock(statsMutex);
+    builderStats.eventsBuilt++;
+    if (_incomplete)
+        builderStats.eventsIncomplete++;
+    return _ret;
+}
+
+int cbdfEventBuilder::expire()
+{
+    return drain(0, true);
+}
+
+int cbdfEventBuilder::flush()
+{
+    return drain(highestSeen + 1, true);
+}
+
+cbdfEventBuilder::cbdfBuilderStats_t cbdfEventBuilder::stats()
+{
+    boost::mutex::scoped_lock _lock(statsMutex);
+    return builderStats;
+}
+
+cbdfEventBuilder::~cbdfEventBuilder()
+{
+    flush();
+    for (uint32_t i = 0; i < windowSize; i++)
+        delete slots[i].event;
+    delete[] slots;
+}
@@ -0,0 +1,612 @@
+/*
+ * cbdfFileDevice.cpp
+ *
+ *  Boost.Iostreams devices on plain file descriptors, giving cbdf control
+ *  over preallocation, writeback and page cache use of its files
+ */
+
+#include "cbdfFileDevice.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/iostreams/detail/ios.hpp>
+
+#ifdef WITH_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <vector>
+
+// One buffer of the read-ahead or write-behind ring
+struct cbdfRingBlock_t {
+    std::vector<char> data;
+    uint64_t offset;
+    uint32_t length;    // Bytes returned by a read, fill level of a write
+    uint32_t consumed;  // Read cursor within the block
+    int result;
+    bool inFlight;      // Submitted and not yet reaped
+    bool pending;       // Submitted and the result not taken up yet
+};
+
+/*
+ * io_uring with one request slot per block, driven through the kernel
+ * interface itself. Only this thread fills the submission queue and reaps
+ * the completion queue, the kernel is the other side of both. Blocks are
+ * used round robin, so the block after the current one always holds the
+ * oldest request.
+ */
+struct cbdfRing_t {
+    int ringFd;
+    char *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned sqEntries;
+    std::vector<cbdfRingBlock_t> blocks;
+    uint32_t current;
+
+    cbdfRing_t() : ringFd(-1), sqRing(NULL), cqRing(NULL), sqes(NULL), current(0) {}
+
+    ~cbdfRing_t()
+    {
+        if (ringFd < 0)
+            return;
+        drain();
+        if (sqes != NULL)
+            munmap(sqes, sqesSize);
+        if (cqRing != NULL && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != NULL)
+            munmap(sqRing, sqRingSize);
+        ::close(ringFd);
+    }
+
+    // Create the ring and map its queues, -errno on failure
+    int init(uint32_t depth)
+    {
+        struct io_uring_params _params;
+        memset(&_params, 0, sizeof(_params));
+        ringFd = syscall(__NR_io_uring_setup, depth, &_params);
+        if (ringFd < 0)
+            return -errno;
+        // IORING_OP_READ and IORING_OP_WRITE came with the same kernel as this flag
+        if (!(_params.features & IORING_FEAT_RW_CUR_POS))
+            return -ENOSYS;
+        sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+        cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(struct io_uring_cqe);
+        if (_params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        void *_map = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (_map == MAP_FAILED)
+            return -errno;
+        sqRing = (char*) _map;
+        if (_params.features & IORING_FEAT_SINGLE_MMAP)
+            cqRing = sqRing;
+        else
+        {
+            _map = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            if (_map == MAP_FAILED)
+                return -errno;
+            cqRing = (char*) _map;
+        }
+        sqesSize = _params.sq_entries * sizeof(struct io_uring_sqe);
+        _map = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (_map == MAP_FAILED)
+            return -errno;
+        sqes = (struct io_uring_sqe*) _map;
+        sqHead = (unsigned*) (sqRing + _params.sq_off.head);
+        sqTail = (unsigned*) (sqRing + _params.sq_off.tail);
+        sqMask = (unsigned*) (sqRing + _params.sq_off.ring_mask);
+        sqArray = (unsigned*) (sqRing + _params.sq_off.array);
+        cqHead = (unsigned*) (cqRing + _params.cq_off.head);
+        cqTail = (unsigned*) (cqRing + _params.cq_off.tail);
+        cqMask = (unsigned*) (cqRing + _params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*) (cqRing + _params.cq_off.cqes);
+        sqEntries = _params.sq_entries;
+        return 0;
+    }
+
+    int submit(int fd, uint32_t i, uint64_t offset, bool write)
+    {
+        cbdfRingBlock_t &_block = blocks[i];
+        unsigned _tail = *sqTail;
+        if (_tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            return -EBUSY;
+        unsigned _index = _tail & *sqMask;
+        struct io_uring_sqe *_sqe = &sqes[_index];
+        _block.offset = offset;
+        memset(_sqe, 0, sizeof(*_sqe));
+        _sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        _sqe->fd = fd;
+        _sqe->addr = (uint64_t) (uintptr_t) &_block.data[0];
+        _sqe->len = write ? _block.length : _block.data.size();
+        _sqe->off = offset;
+        _sqe->user_data = (uint64_t) (uintptr_t) &_block;
+        sqArray[_index] = _index;
+        __atomic_store_n(sqTail, _tail + 1, __ATOMIC_RELEASE);
+        _block.inFlight = true;
+        _block.pending = true;
+        int _ret;
+        do
+        {
+            _ret = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0);
+        } while (_ret < 0 && errno == EINTR);
+        if (_ret < 0)
+        {
+            _block.result = -errno;
+            _block.inFlight = false;
+            return _block.result;
+        }
+        return 0;
+    }
+
+    // Reap completions until block i is done, returns its result
+    int waitFor(uint32_t i)
+    {
+        while (blocks[i].inFlight)
+        {
+            unsigned _head = *cqHead;
+            if (_head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                    return -errno;
+                continue;
+            }
+            struct io_uring_cqe *_cqe = &cqes[_head & *cqMask];
+            cbdfRingBlock_t *_block = (cbdfRingBlock_t*) (uintptr_t) _cqe->user_data;
+            _block->result = _cqe->res;
+            _block->inFlight = false;
+            __atomic_store_n(cqHead, _head + 1, __ATOMIC_RELEASE);
+        }
+        return blocks[i].result;
+    }
+
+    void drain()
+    {
+        for (uint32_t i = 0; i < blocks.size(); i++)
+            waitFor(i);
+    }
+};
+
+// Set up a ring, NULL if io_uring is not usable on this system
+static cbdfRing_t* openRing(uint32_t depth, uint32_t blockSize)
+{
+    cbdfRing_t *_ring = new cbdfRing_t;
+    int _ret = _ring->init(depth);
+    if (_ret < 0)
+    {
+        std::cerr << "io_uring not available (" << strerror(-_ret) << "), using blocking I/O" << std::endl;
+        delete _ring;
+        return NULL;
+    }
+    _ring->blocks.resize(depth);
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        _ring->blocks[i].data.resize(blockSize);
+        _ring->blocks[i].offset = 0;
+        _ring->blocks[i].length = 0;
+        _ring->blocks[i].consumed = 0;
+        _ring->blocks[i].result = 0;
+        _ring->blocks[i].inFlight = false;
+        _ring->blocks[i].pending = false;
+    }
+    return _ring;
+}
+#endif
+
+// Write everything with blocking calls, returns false on error
+static bool writeAll(int fd, const char* s, uint64_t n, uint64_t offset, bool positioned)
+{
+    uint64_t _done = 0;
+    while (_done < n)
+    {
+        ssize_t _ret = positioned ? ::pwrite(fd, s + _done, n - _done, offset + _done) : ::write(fd, s + _done, n - _done);
+        if (_ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        _done += _ret;
+    }
+    return true;
+}
+
+struct cbdfFileSink::impl_t {
+    int fd;
+    uint64_t written;
+    uint64_t submitted;     // Bytes handed to the ring so far
+    uint64_t synced;        // End of the range last handed to writeback
+    uint64_t preallocated;
+    uint64_t writebackInterval;
+    std::string footer;
+#ifdef WITH_URING
+    cbdfRing_t *ring;
+
+    // Check the outcome of the write in block i, finishing short writes synchronously
+    bool finishWrite(uint32_t i)
+    {
+        cbdfRingBlock_t &_block = ring->blocks[i];
+        if (!_block.pending)
+            return true;
+        int _ret = ring->waitFor(i);
+        _block.pending = false;
+        if (_ret < 0)
+            return false;
+        if ((uint32_t) _ret < _block.length && !writeAll(fd, &_block.data[_ret], _block.length - _ret, _block.offset + _ret, true))
+            return false;
+        _block.length = 0;
+        return true;
+    }
+
+    // Queue the current block, even if only partly filled
+    bool submitCurrent()
+    {
+        // A block still in flight holds data that was queued already
+        if (!finishWrite(ring->current))
+            return false;
+        cbdfRingBlock_t &_block = ring->blocks[ring->current];
+        if (_block.length == 0)
+            return true;
+        if (ring->submit(fd, ring->current, submitted, true) < 0)
+            return false;
+        submitted += _block.length;
+        ring->current = (ring->current + 1) % ring->blocks.size();
+        return true;
+    }
+
+    // Wait for the submitted blocks that start before end
+    bool finishWritesBefore(uint64_t end)
+    {
+        bool _ok = true;
+        for (uint32_t i = 0; i < ring->blocks.size(); i++)
+            if (ring->blocks[i].pending && ring->blocks[i].offset < end)
+                _ok = finishWrite(i) && _ok;
+        return _ok;
+    }
+#endif
+
+    ~impl_t()
+    {
+#ifdef WITH_URING
+        delete ring;
+#endif
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+cbdfFileSink::cbdfFileSink(const std::string &fileName, const cbdf::cbdfIOOptions_t &options, uint64_t keep)
+    : pimpl(new impl_t)
+{
+    if (keep)
+    {
+        pimpl->fd = ::open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+        if (pimpl->fd >= 0 && (ftruncate(pimpl->fd, keep) != 0 || lseek(pimpl->fd, keep, SEEK_SET) < 0))
+        {
+            ::close(pimpl->fd);
+            pimpl->fd = -1;
+        }
+    }
+    else
+        pimpl->fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    pimpl->written = keep;
+    pimpl->submitted = keep;
+    pimpl->synced = keep;
+    pimpl->preallocated = 0;
+    pimpl->writebackInterval = options.writebackInterval;
+#ifdef __linux__
+    if (pimpl->fd >= 0 && options.preallocate)
+    {
+        if (fallocate(pimpl->fd, FALLOC_FL_KEEP_SIZE, keep, options.preallocate) == 0)
+            pimpl->preallocated = keep + options.preallocate;
+    }
+#endif
+#ifdef WITH_URING
+    pimpl->ring = NULL;
+    if (pimpl->fd >= 0 && options.queueDepth)
+        pimpl->ring = openRing(options.queueDepth, options.blockSize);
+#endif
+}
+
+std::streamsize cbdfFileSink::write(const char* s, std::streamsize n)
+{
+#ifdef WITH_URING
+    if (pimpl->ring != NULL)
+    {
+        // Fill the ring blocks and submit each one once it is full
+        cbdfRing_t &_ring = *pimpl->ring;
+        std::streamsize _done = 0;
+        while (_done < n)
+        {
+            if (!pimpl->finishWrite(_ring.current))
+                throw BOOST_IOSTREAMS_FAILURE("cbdf file write failed");
+            cbdfRingBlock_t &_block = _ring.blocks[_ring.current];
+            uint64_t _chunk = std::min((uint64_t) (n - _done), (uint64_t) (_block.data.size() - _block.length));
+            memcpy(&_block.data[_block.length], s + _done, _chunk);
+            _block.length += _chunk;
+            _done += _chunk;
+            if (_block.length == _block.data.size() && !pimpl->submitCurrent())
+                throw BOOST_IOSTREAMS_FAILURE("cbdf file write failed");
+        }
+    }
+    else
+#endif
+    if (!writeAll(pimpl->fd, s, n, 0, false))
+        throw BOOST_IOSTREAMS_FAILURE("cbdf file write failed");
+    pimpl->written += n;
+
+#ifdef __linux__
+    // With io_uring the data in the current block has not reached the file yet
+    uint64_t _inFile = pimpl->written;
+#ifdef WITH_URING
+    if (pimpl->ring != NULL)
+        _inFile = pimpl->submitted;
+#endif
+    if (pimpl->writebackInterval && _inFile - pimpl->synced >= pimpl->writebackInterval)
+    {
+        // Start writeback of the new range, then wait for the previous one and drop it from the cache
+        uint64_t _previous = (pimpl->synced > pimpl->writebackInterval) ? pimpl->synced - pimpl->writebackInterval : 0;
+        sync_file_range(pimpl->fd, pimpl->synced, _inFile - pimpl->synced, SYNC_FILE_RANGE_WRITE);
+        if (pimpl->synced > _previous)
+        {
+#ifdef WITH_URING
+            // Writes of the previous range may still be in flight
+            if (pimpl->ring != NULL && !pimpl->finishWritesBefore(pimpl->synced))
+                throw BOOST_IOSTREAMS_FAILURE("cbdf file write failed");
+#endif
+            sync_file_range(pimpl->fd, _previous, pimpl->synced - _previous, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(pimpl->fd, _previous, pimpl->synced - _previous, POSIX_FADV_DONTNEED);
+        }
+        pimpl->synced = _inFile;
+    }
+#endif
+    return n;
+}
+
+bool cbdfFileSink::flush()
+{
+#ifdef WITH_URING
+    // Make everything written so far visible in the file
+    if (pimpl->ring != NULL)
+    {
+        bool _ok = pimpl->submitCurrent();
+        for (uint32_t i = 0; i < pimpl->ring->blocks.size(); i++)
+            _ok = pimpl->finishWrite(i) && _ok;
+        return _ok;
+    }
+#endif
+    return true;
+}
+
+bool cbdfFileSink::sync(uint64_t &size)
+{
+    size = pimpl->written;
+    if (!flush())
+        return false;
+    int _ret;
+    do
+    {
+        _ret = fdatasync(pimpl->fd);
+    } while (_ret != 0 && errno == EINTR);
+    return _ret == 0;
+}
+
+void cbdfFileSink::setFooter(const std::string &footer)
+{
+    pimpl->footer = footer;
+}
+
+void cbdfFileSink::close()
+{
+    if (pimpl->fd < 0)
+        return;
+    if (!flush())
+        std::cerr << "cbdf: write to file failed while closing it" << std::endl;
+#ifdef WITH_URING
+    delete pimpl->ring;
+    pimpl->ring = NULL;
+#endif
+    if (!pimpl->footer.empty())
+    {
+        if (writeAll(pimpl->fd, pimpl->footer.data(), pimpl->footer.size(), pimpl->written, true))
+            pimpl->written += pimpl->footer.size();
+        else
+            std::cerr << "cbdf: unable to write the file footer" << std::endl;
+    }
+    // Give back the preallocated blocks past the real end of the file
+    if (pimpl->preallocated > pimpl->written)
+        if (ftruncate(pimpl->fd, pimpl->written) != 0)
+            std::cerr << "cbdf: unable to trim preallocated space" << std::endl;
+    ::close(pimpl->fd);
+    pimpl->fd = -1;
+}
+
+bool cbdfFileSink::is_open() const
+{
+    return pimpl->fd >= 0;
+}
+
+
+struct cbdfFileSource::impl_t {
+    int fd;
+    uint64_t offset;
+    uint64_t dropped;       // Everything below has been dropped from the page cache
+    uint64_t dropBehind;
+    uint64_t limit;         // Reads stop here if not 0
+#ifdef WITH_URING
+    cbdfRing_t *ring;
+    uint64_t nextOffset;    // File offset of the next read-ahead request
+
+    // Read ahead into all blocks, starting with the current one at offset
+    bool startReadahead(uint64_t offset)
+    {
+        uint32_t _depth = ring->blocks.size();
+        nextOffset = offset;
+        for (uint32_t i = 0; i < _depth; i++)
+        {
+            if (ring->submit(fd, (ring->current + i) % _depth, nextOffset, false) < 0)
+                return false;
+            nextOffset += ring->blocks[0].data.size();
+        }
+        return true;
+    }
+#endif
+
+    ~impl_t()
+    {
+#ifdef WITH_URING
+        delete ring;
+#endif
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+cbdfFileSource::cbdfFileSource(const std::string &fileName, const cbdf::cbdfIOOptions_t &options, uint64_t limit)
+    : pimpl(new impl_t)
+{
+    pimpl->fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    pimpl->offset = 0;
+    pimpl->dropped = 0;
+    pimpl->dropBehind = options.dropBehind;
+    pimpl->limit = limit;
+    if (pimpl->fd >= 0 && options.sequential)
+        posix_fadvise(pimpl->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#ifdef WITH_URING
+    pimpl->ring = NULL;
+    if (pimpl->fd >= 0 && options.queueDepth)
+    {
+        pimpl->ring = openRing(options.queueDepth, options.blockSize);
+        if (pimpl->ring != NULL && !pimpl->startReadahead(0))
+        {
+            delete pimpl->ring;
+            pimpl->ring = NULL;
+        }
+    }
+#endif
+}
+
+std::streamsize cbdfFileSource::read(char* s, std::streamsize n)
+{
+    std::streamsize _ret = -1;
+#ifdef WITH_URING
+    if (pimpl->ring != NULL)
+    {
+        cbdfRing_t &_ring = *pimpl->ring;
+        while (true)
+        {
+            cbdfRingBlock_t &_block = _ring.blocks[_ring.current];
+            if (_block.pending)
+            {
+                int _res = _ring.waitFor(_ring.current);
+                _block.pending = false;
+                if (_res < 0)
+                    throw BOOST_IOSTREAMS_FAILURE("cbdf file read failed");
+                _block.length = _res;
+                _block.consumed = 0;
+                if (pimpl->limit && _block.offset + _block.length > pimpl->limit)
+                    _block.length = (pimpl->limit > _block.offset) ? pimpl->limit - _block.offset : 0;
+            }
+            if (_block.consumed < _block.length)
+            {
+                _ret = std::min((uint64_t) n, (uint64_t) (_block.length - _block.consumed));
+                memcpy(s, &_block.data[_block.consumed], _ret);
+                _block.consumed += _ret;
+                break;
+            }
+            if (_block.length < _block.data.size())
+            {
+                // A short read is the end of the file, or a partial read to retry from where it stopped
+                uint64_t _end = _block.offset + _block.length;
+                _ring.drain();
+                if (_block.length == 0)
+                    return -1;
+                if (!pimpl->startReadahead(_end))
+                    throw BOOST_IOSTREAMS_FAILURE("cbdf file read failed");
+                continue;
+            }
+            if (_ring.submit(pimpl->fd, _ring.current, pimpl->nextOffset, false) < 0)
+                throw BOOST_IOSTREAMS_FAILURE("cbdf file read failed");
+            pimpl->nextOffset += _block.data.size();
+            _ring.current = (_ring.current + 1) % _ring.blocks.size();
+        }
+    }
+    else
+#endif
+    {
+        if (pimpl->limit)
+        {
+            if (pimpl->offset >= pimpl->limit)
+                return -1;
+            n = std::min((uint64_t) n, pimpl->limit - pimpl->offset);
+        }
+        do
+        {
+            _ret = ::read(pimpl->fd, s, n);
+        } while (_ret < 0 && errno == EINTR);
+        if (_ret < 0)
+            throw BOOST_IOSTREAMS_FAILURE("cbdf file read failed");
+        if (_ret == 0)
+            return -1;
+    }
+
+    pimpl->offset += _ret;
+    if (pimpl->dropBehind && pimpl->offset - pimpl->dropped >= pimpl->dropBehind)
+    {
+        posix_fadvise(pimpl->fd, pimpl->dropped, pimpl->offset - pimpl->dropped, POSIX_FADV_DONTNEED);
+        pimpl->dropped = pimpl->offset;
+    }
+    return _ret;
+}
+
+int64_t cbdfFileSource::skip(uint64_t n)
+{
+    struct stat _st;
+    if (fstat(pimpl->fd, &_st) != 0)
+        return -1;
+    uint64_t _target = std::min(pimpl->offset + n, (uint64_t) _st.st_size);
+    if (pimpl->limit && _target > pimpl->limit)
+        _target = pimpl->limit;
+    if (_target <= pimpl->offset)
+        return 0;
+#ifdef WITH_URING
+    if (pimpl->ring != NULL)
+    {
+        pimpl->ring->drain();
+        if (!pimpl->startReadahead(_target))
+            return -1;
+    }
+    else
+#endif
+    if (lseek(pimpl->fd, _target, SEEK_SET) < 0)
+        return -1;
+    int64_t _skipped = _target - pimpl->offset;
+    pimpl->offset = _target;
+    return _skipped;
+}
+
+void cbdfFileSource::close()
+{
+    if (pimpl->fd < 0)
+        return;
+#ifdef WITH_URING
+    delete pimpl->ring;
+    pimpl->ring = NULL;
+#endif
+    ::close(pimpl->fd);
+    pimpl->fd = -1;
+}
+
+bool cbdfFileSource::is_open() const
+{
+    return pimpl->fd >= 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * cbdfFileDevice.h
+ *
+ *  Boost.Iostreams devices on plain file descriptors, giving cbdf control
+ *  over preallocation, writeback and page cache use of its files
+ */
+
+#ifndef CBDFFILEDEVICE_H_
+#define CBDFFILEDEVICE_H_
+
+#include <cbdf.h>
+#include <boost/iostreams/categories.hpp>
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Sink for output files. The file is optionally preallocated with fallocate
+ * (without changing its visible size) and trimmed back to the bytes actually
+ * written on close. With a writeback interval, every interval bytes the new
+ * range is handed to the disk with sync_file_range and the range before it
+ * is waited for and dropped from the page cache, so dirty pages never pile
+ * up for a bursty flush. With a queue depth set and io_uring available,
+ * writes are collected in blocks and submitted asynchronously. With keep
+ * other than 0 an existing file is cut to its first keep bytes and
+ * written on from there instead of being truncated.
+ */
+class cbdfFileSink
+{
+public:
+
+  typedef char char_type;
+  struct category : boost::iostreams::sink_tag, boost::iostreams::closable_tag, boost::iostreams::flushable_tag {};
+
+  cbdfFileSink(const std::string &fileName, const cbdf::cbdfIOOptions_t &options, uint64_t keep=0);
+
+  std::streamsize write(const char* s, std::streamsize n);
+  bool flush();
+  bool sync(uint64_t &size); // Flush and fdatasync, size is the part of the file that is on disk
+  void setFooter(const std::string &footer); // Written behind all other data on close
+  void close();
+  bool is_open() const;
+
+private:
+
+  struct impl_t;
+  boost::shared_ptr<impl_t> pimpl;
+};
+
+/*
+ * Source for input files. Optionally advises sequential access and drops
+ * the pages behind the read cursor every dropBehind bytes. Reading on after
+ * the end of the file is allowed and picks up data appended meanwhile,
+ * unless io_uring read-ahead is used, which keeps queueDepth blocks in
+ * flight and treats the first empty read as the end of the file.
+ */
+class cbdfFileSource
+{
+public:
+
+  typedef char char_type;
+  struct category : boost::iostreams::source_tag, boost::iostreams::closable_tag {};
+
+  cbdfFileSource(const std::string &fileName, const cbdf::cbdfIOOptions_t &options, uint64_t limit=0); // A limit other than 0 is treated as the end of the file
+
+  std::streamsize read(char* s, std::streamsize n);
+  int64_t skip(uint64_t n); // Seek ahead, at most to the current end of the file. -1 on error
+  void close();
+  bool is_open() const;
+
+private:
+
+  struct impl_t;
+  boost::shared_ptr<impl_t> pimpl;
+};
+
+#endif /* CBDFFILEDEVICE_H_ */
@@ -0,0 +1,326 @@
+/*
+ * cbdfFooter.cpp
+ *
+ *  Footer blocks behind the file trailer and the event summary stored in
+ *  one of them
+ */
+
+#include "cbdfFooter.h"
+#include "cbdfFormat.h"
+#include "cbdfCrc.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint32_t payloadCrc(const char* data, uint64_t size)
+{
+    return cbdfCrc32(data, size);
+}
+
+static bool readAt(int fd, char* buffer, uint64_t size, uint64_t offset)
+{
+    while (size)
+    {
+        ssize_t _ret = pread(fd, buffer, size, offset);
+        if (_ret <= 0)
+            return false;
+        buffer += _ret;
+        size -= _ret;
+        offset += _ret;
+    }
+    return true;
+}
+
+void appendFooterBlock(std::string &footer, uint32_t type, const std::string &payload)
+{
+    cbdf::cbdfBlockHeader_t _header;
+    _header.openTag = 0xCBBDCBBD;
+    _header.type = type;
+    _header.size = payload.size();
+    _header.closeTag = 0xCBBDCBBD;
+
+    cbdf::cbdfBlockTrailer_t _trailer;
+    _trailer.openTag = 0xDBBCDBBC;
+    _trailer.type = type;
+    _trailer.crc32 = payloadCrc(payload.data(), payload.size());
+    _trailer.size = payload.size();
+    _trailer.closeTag = 0xDBBCDBBC;
+
+    footer.append((const char*) &_header, sizeof(_header));
+    footer.append(payload);
+    footer.append((const char*) &_trailer, sizeof(_trailer));
+}
+
+bool checkBlock(const cbdf::cbdfBlockHeader_t &header, const std::string &payload, const cbdf::cbdfBlockTrailer_t &trailer)
+{
+    if (header.openTag != 0xCBBDCBBD || header.closeTag != 0xCBBDCBBD || trailer.openTag != 0xDBBCDBBC || trailer.closeTag != 0xDBBCDBBC)
+        return false;
+    if (header.type != trailer.type || header.size != trailer.size || header.size != payload.size())
+        return false;
+    return payloadCrc(payload.data(), payload.size()) == trailer.crc32;
+}
+
+int readFooter(const std::string &fileName, std::vector<cbdfFooterBlock_t> &blocks, uint64_t &dataEnd)
+{
+    blocks.clear();
+    int _fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+        return -1;
+    struct stat _st;
+    if (fstat(_fd, &_st) != 0)
+    {
+        close(_fd);
+        return -1;
+    }
+
+    uint64_t _end = _st.st_size;
+    const uint64_t _overhead = sizeof(cbdf::cbdfBlockHeader_t) + sizeof(cbdf::cbdfBlockTrailer_t);
+    while (blocks.size() < CBDF_FOOTER_MAX_BLOCKS && _end >= _overhead)
+    {
+        cbdf::cbdfBlockTrailer_t _trailer;
+        if (!readAt(_fd, (char*) &_trailer, sizeof(_trailer), _end - sizeof(_trailer)))
+            break;
+        if (_trailer.openTag != 0xDBBCDBBC || _trailer.closeTag != 0xDBBCDBBC || _trailer.size > _end - _overhead)
+            break;
+        uint64_t _start = _end - _overhead - _trailer.size;
+        cbdf::cbdfBlockHeader_t _header;
+        if (!readAt(_fd, (char*) &_header, sizeof(_header), _start))
+            break;
+        if (_header.openTag != 0xCBBDCBBD || _header.closeTag != 0xCBBDCBBD || _header.type != _trailer.type || _header.size != _trailer.size)
+            break;
+        cbdfFooterBlock_t _block;
+        _block.type = _header.type;
+        _block.payload.resize(_header.size);
+        if (_header.size && !readAt(_fd, &_block.payload[0], _header.size, _start + sizeof(_header)))
+            break;
+        if (payloadCrc(_block.payload.data(), _block.payload.size()) != _trailer.crc32)
+            break;
+        blocks.insert(blocks.begin(), _block);
+        _end = _start;
+    }
+    close(_fd);
+    dataEnd = _end;
+    return blocks.size();
+}
+
+cbdfSummaryBuilder::cbdfSummaryBuilder()
+{
+    reset();
+}
+
+void cbdfSummaryBuilder::reset(uint32_t bankAlignment)
+{
+    alignment = bankAlignment;
+    events = 0;
+    payloadBytes = 0;
+    minEventNumber = 0;
+    maxEventNumber = 0;
+    minEventSize = 0;
+    maxEventSize = 0;
+    for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        sizeHistogram[i] = 0;
+    userFlags.clear();
+    otherUserFlags = 0;
+    lastFlags = 0;
+    banks.clear();
+    otherBanks = 0;
+}
+
+void cbdfSummaryBuilder::addEvent(const char* eventRecord)
+{
+    const cbdf::cbdfEventHeader_t* _header = (const cbdf::cbdfEventHeader_t*) eventRecord;
+    uint64_t _size = _header->eventSize;
+    if (events == 0)
+    {
+        minEventNumber = maxEventNumber = _header->eventNumber;
+        minEventSize = maxEventSize = _size;
+    }
+    events++;
+    payloadBytes += _size;
+    if (_header->eventNumber < minEventNumber)
+        minEventNumber = _header->eventNumber;
+    if (_header->eventNumber > maxEventNumber)
+        maxEventNumber = _header->eventNumber;
+    if (_size < minEventSize)
+        minEventSize = _size;
+    if (_size > maxEventSize)
+        maxEventSize = _size;
+    int _bin = 0;
+    for (uint64_t _s = _size; _s; _s >>= 1)
+        _bin++;
+    sizeHistogram[_bin]++;
+
+    if (lastFlags < userFlags.size() && userFlags[lastFlags].first == _header->userFlags)
+        userFlags[lastFlags].second++;
+    else
+    {
+        uint32_t i = 0;
+        while (i < userFlags.size() && userFlags[i].first != _header->userFlags)
+            i++;
+        if (i < userFlags.size())
+            userFlags[i].second++;
+        else if (userFlags.size() < CBDF_SUMMARY_MAX_ENTRIES)
+            userFlags.push_back(std::make_pair(_header->userFlags, (uint64_t) 1));
+        else
+            otherUserFlags++;
+        lastFlags = i;
+    }
+
+    // Count bank names; events usually repeat the bank sequence of the one before, so try the next entry first
+    const char* _cursor = eventRecord + sizeof(cbdf::cbdfEventHeader_t);
+    const char* _end = _cursor + _size;
+    uint32_t _next = 0;
+    const char* _payload = _cursor;
+    while (_cursor != _end)
+    {
+        uint32_t _padding = bankPadding(_cursor - _payload, alignment);
+        if ((uint64_t) (_end - _cursor) < _padding + sizeof(cbdf::cbdfBankHeader_t))
+            break;
+        _cursor += _padding;
+        const cbdf::cbdfBankHeader_t* _bank = (const cbdf::cbdfBankHeader_t*) _cursor;
+        if (_bank->size > (uint64_t) (_end - _cursor) - sizeof(cbdf::cbdfBankHeader_t))
+            break;
+        _cursor += sizeof(cbdf::cbdfBankHeader_t) + _bank->size;
+        if (_next >= banks.size() || memcmp(banks[_next].name, _bank->name, sizeof(_bank->name)) != 0)
+        {
+            _next = 0;
+            while (_next < banks.size() && memcmp(banks[_next].name, _bank->name, sizeof(_bank->name)) != 0)
+                _next++;
+            if (_next == banks.size())
+            {
+                if (banks.size() >= CBDF_SUMMARY_MAX_ENTRIES)
+                {
+                    otherBanks++;
+                    _next = 0;
+                    continue;
+                }
+                bankCount_t _entry;
+                memcpy(_entry.name, _bank->name, sizeof(_entry.name));
+                _entry.count = 0;
+                banks.push_back(_entry);
+            }
+        }
+        banks[_next].count++;
+        _next++;
+    }
+}
+
+void cbdfSummaryBuilder::serialize(std::string &payload, const char* uuid, uint64_t timeStart, uint64_t timeStop)
+{
+    cbdf::cbdfSummary_t _summary;
+    memcpy(_summary.uuid, uuid, sizeof(_summary.uuid));
+    _summary.timeStart = timeStart;
+    _summary.timeStop = timeStop;
+    _summary.events = events;
+    _summary.payloadBytes = payloadBytes;
+    _summary.minEventNumber = minEventNumber;
+    _summary.maxEventNumber = maxEventNumber;
+    _summary.minEventSize = minEventSize;
+    _summary.maxEventSize = maxEventSize;
+    for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        _summary.sizeHistogram[i] = sizeHistogram[i];
+    _summary.otherUserFlags = otherUserFlags;
+    _summary.otherBanks = otherBanks;
+    _summary.nUserFlags = userFlags.size();
+    _summary.nBanks = banks.size();
+
+    payload.assign((const char*) &_summary, sizeof(_summary));
+    for (uint32_t i = 0; i < userFlags.size(); i++)
+    {
+        payload.append((const char*) &userFlags[i].first, sizeof(uint64_t));
+        payload.append((const char*) &userFlags[i].second, sizeof(uint64_t));
+    }
+    for (uint32_t i = 0; i < banks.size(); i++)
+    {
+        payload.append(banks[i].name, sizeof(banks[i].name));
+        payload.append((const char*) &banks[i].count, sizeof(uint64_t));
+    }
+}
+
+bool cbdfSummaryBuilder::restore(const std::string &payload)
+{
+    cbdf::cbdfSummary_t _summary;
+    if (payload.size() < sizeof(_summary))
+        return false;
+    memcpy(&_summary, payload.data(), sizeof(_summary));
+    const uint64_t _flagSize = 2 * sizeof(uint64_t);
+    const uint64_t _bankSize = 12 + sizeof(uint64_t);
+    if (payload.size() != sizeof(_summary) + _summary.nUserFlags * _flagSize + _summary.nBanks * _bankSize)
+        return false;
+
+    events = _summary.events;
+    payloadBytes = _summary.payloadBytes;
+    minEventNumber = _summary.minEventNumber;
+    maxEventNumber = _summary.maxEventNumber;
+    minEventSize = _summary.minEventSize;
+    maxEventSize = _summary.maxEventSize;
+    for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        sizeHistogram[i] = _summary.sizeHistogram[i];
+    otherUserFlags = _summary.otherUserFlags;
+    otherBanks = _summary.otherBanks;
+    lastFlags = 0;
+
+    const char* _cursor = payload.data() + sizeof(_summary);
+    userFlags.resize(_summary.nUserFlags);
+    for (uint32_t i = 0; i < _summary.nUserFlags; i++)
+    {
+        memcpy(&userFlags[i].first, _cursor, sizeof(uint64_t));
+        memcpy(&userFlags[i].second, _cursor + sizeof(uint64_t), sizeof(uint64_t));
+        _cursor += _flagSize;
+    }
+    banks.resize(_summary.nBanks);
+    for (uint32_t i = 0; i < _summary.nBanks; i++)
+    {
+        memcpy(banks[i].name, _cursor, sizeof(banks[i].name));
+        memcpy(&banks[i].count, _cursor + 12, sizeof(uint64_t));
+        _cursor += _bankSize;
+    }
+    return true;
+}
+
+bool parseSummary(const std::string &payload, cbdfCatalogue_t &catalogue)
+{
+    cbdf::cbdfSummary_t _summary;
+    if (payload.size() < sizeof(_summary))
+        return false;
+    memcpy(&_summary, payload.data(), sizeof(_summary));
+    const uint64_t _flagSize = 2 * sizeof(uint64_t);
+    const uint64_t _bankSize = 12 + sizeof(uint64_t);
+    if (payload.size() != sizeof(_summary) + _summary.nUserFlags * _flagSize + _summary.nBanks * _bankSize)
+        return false;
+
+    catalogue.uuid = std::string(_summary.uuid, sizeof(_summary.uuid));
+    catalogue.timeStart = _summary.timeStart;
+    catalogue.timeStop = _summary.timeStop;
+    catalogue.events = _summary.events;
+    catalogue.firstEvent = _summary.minEventNumber;
+    catalogue.lastEvent = _summary.maxEventNumber;
+    catalogue.payloadBytes = _summary.payloadBytes;
+    catalogue.minEventSize = _summary.minEventSize;
+    catalogue.maxEventSize = _summary.maxEventSize;
+    for (int i = 0; i < CBDF_CATALOGUE_SIZE_BINS; i++)
+        catalogue.sizeHistogram[i] = _summary.sizeHistogram[i];
+    catalogue.otherUserFlags = _summary.otherUserFlags;
+    catalogue.otherBanks = _summary.otherBanks;
+
+    const char* _cursor = payload.data() + sizeof(_summary);
+    catalogue.userFlags.clear();
+    for (uint32_t i = 0; i < _summary.nUserFlags; i++)
+    {
+        uint64_t _flags, _count;
+        memcpy(&_flags, _cursor, sizeof(_flags));
+        memcpy(&_count, _cursor + sizeof(_flags), sizeof(_count));
+        catalogue.userFlags[_flags] = _count;
+        _cursor += _flagSize;
+    }
+    catalogue.banks.clear();
+    for (uint32_t i = 0; i < _summary.nBanks; i++)
+    {
+        uint64_t _count;
+        memcpy(&_count, _cursor + 12, sizeof(_count));
+        catalogue.banks[std::string(_cursor, strnlen(_cursor, 12))] += _count;
+        _cursor += _bankSize;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+ * cbdfFooter.h
+ *
+ *  Footer blocks behind the file trailer and the event summary stored in
+ *  one of them
+ */
+
+#ifndef CBDFFOOTER_H_
+#define CBDFFOOTER_H_
+
+#include <cbdf.h>
+#include <cbdfCatalogue.h>
+#include <string>
+#include <vector>
+
+#define CBDF_FOOTER_MAX_BLOCKS 16
+#define CBDF_SUMMARY_MAX_ENTRIES 1024 // Distinct user flag values and bank names listed in a summary
+
+struct cbdfFooterBlock_t {
+    uint32_t type;
+    std::string payload;
+};
+
+// Append a complete block (header, payload, trailer) to footer
+void appendFooterBlock(std::string &footer, uint32_t type, const std::string &payload);
+// True if header and trailer frame payload as one intact block
+bool checkBlock(const cbdf::cbdfBlockHeader_t &header, const std::string &payload, const cbdf::cbdfBlockTrailer_t &trailer);
+
+/*
+ * Collect the footer blocks at the end of fileName, in file order. dataEnd
+ * is set to the offset where the blocks start, i.e. the end of the (maybe
+ * compressed) event data. Returns the number of blocks or -1 if the file
+ * can not be read.
+ */
+int readFooter(const std::string &fileName, std::vector<cbdfFooterBlock_t> &blocks, uint64_t &dataEnd);
+
+// Event statistics of a file being written
+class cbdfSummaryBuilder
+{
+public:
+
+  cbdfSummaryBuilder();
+
+  void reset(uint32_t bankAlignment=0);
+  void addEvent(const char* eventRecord); // Header and payload as laid out on disk
+  void serialize(std::string &payload, const char* uuid, uint64_t timeStart, uint64_t timeStop);
+  bool restore(const std::string &payload); // Continue from a serialized state, false if it is malformed
+
+private:
+
+  struct bankCount_t {
+      char name[12];
+      uint64_t count;
+  };
+
+  uint32_t alignment;       // Of the banks in the file
+  uint64_t events;
+  uint64_t payloadBytes;
+  uint64_t minEventNumber;
+  uint64_t maxEventNumber;
+  uint64_t minEventSize;
+  uint64_t maxEventSize;
+  uint64_t sizeHistogram[CBDF_CATALOGUE_SIZE_BINS];
+  std::vector<std::pair<uint64_t, uint64_t> > userFlags;
+  uint64_t otherUserFlags;
+  uint32_t lastFlags;       // Index of the last flag value seen, events tend to repeat it
+  std::vector<bankCount_t> banks;
+  uint64_t otherBanks;
+};
+
+// Fill the statistics part of catalogue from a summary block payload, false if it is malformed
+bool parseSummary(const std::string &payload, cbdfCatalogue_t &catalogue);
+
+#endif /* CBDFFOOTER_H_ */
@@ -0,0 +1,148 @@
+/*
+ * cbdfFormat.h
+ *
+ *  On-disk structures of the cbdf format, shared by the library sources
+ */
+
+#ifndef CBDFFORMAT_H_
+#define CBDFFORMAT_H_
+
+#include <cbdf.h>
+
+#pragma pack(4) // Enforce 32 Bit alignment for ondisk format
+struct cbdf::cbdfFileHeader_t {
+    uint32_t openTag;           //0xCBDFCBDF
+    uint64_t timeStart;         //Unix time. Cast to time_t if neccessary
+    uint64_t features;          //Bitset of cbdf features (see documentation)
+    char uuid[36];              //UUID for given file stored as string (xxxxxxxx-xxxx-4xxx-xxxx-xxxxxxxxxxxx)
+    uint32_t closeTag;          //0xCBDFCBDF
+};
+
+struct cbdf::cbdfFileTrailer_t {
+    uint32_t openTag;           //0xFDBCFDBC
+    uint64_t timeStop;          //Unix time. Cast to time_t if neccessary
+    uint64_t features;          //Bitset of cbdf features (see documentation)
+    char uuid[36];              //UUID for given file for given file stored as string (xxxxxxxx-xxxx-4xxx-xxxx-xxxxxxxxxxxx)
+    uint32_t closeTag;          //0xFDBCFDBC
+};
+
+struct cbdf::cbdfEventHeader_t {
+    uint32_t openTag;           //0xCBEDCBED
+    uint64_t eventNumber;       //Linear throughout the file
+    uint64_t userFlags;         //User defined Flags (e.g. Eventtype)
+    uint64_t eventSize;         //Payload size in bytes
+    uint32_t closeTag;          //0xCBEDCBED
+};
+
+struct cbdf::cbdfEventTrailer_t {
+    uint32_t openTag;           //0xDEBCDEBC
+    uint32_t crc32;             //CRC32 checksum of payload
+    uint64_t eventSize;         //Payload size in bytes
+    uint32_t closeTag;          //0xDEBCDEBC
+};
+
+
+struct cbdf::cbdfBankHeader_t {
+    char name[12];              // \0 terminated string of up to 11 characters
+    uint16_t userFlags;         // User defined bank flags
+    uint32_t size;              // Payloadsize of the bank in bytes
+};
+
+/*
+ * Footer blocks follow the file trailer as plain bytes, also in compressed
+ * files where they come after the end of the compressed stream. Each block
+ * ends in its trailer, so readers find them walking back from the end of
+ * the file.
+ */
+struct cbdf::cbdfBlockHeader_t {
+    uint32_t openTag;           //0xCBBDCBBD
+    uint32_t type;              //Block type (CBDF_BLOCK_*)
+    uint64_t size;              //Payload size in bytes
+    uint32_t closeTag;          //0xCBBDCBBD
+};
+
+struct cbdf::cbdfBlockTrailer_t {
+    uint32_t openTag;           //0xDBBCDBBC
+    uint32_t type;              //Block type (CBDF_BLOCK_*)
+    uint32_t crc32;             //CRC32 checksum of payload
+    uint64_t size;              //Payload size in bytes
+    uint32_t closeTag;          //0xDBBCDBBC
+};
+
+/*
+ * Payload of a CBDF_BLOCK_SUMMARY block, followed by nUserFlags pairs of
+ * uint64_t (flag value, events) and nBanks entries of char[12] name and
+ * uint64_t count
+ */
+struct cbdf::cbdfSummary_t {
+    char uuid[36];
+    uint64_t timeStart;
+    uint64_t timeStop;
+    uint64_t events;
+    uint64_t payloadBytes;
+    uint64_t minEventNumber;
+    uint64_t maxEventNumber;
+    uint64_t minEventSize;
+    uint64_t maxEventSize;
+    uint64_t sizeHistogram[65]; //Bin i counts payload sizes in [2^(i-1), 2^i), bin 0 empty events
+    uint64_t otherUserFlags;    //Events whose flag value did not fit the list
+    uint64_t otherBanks;        //Banks whose name did not fit the list
+    uint32_t nUserFlags;
+    uint32_t nBanks;
+};
+
+/*
+ * Payload of the CBDF_BLOCK_CHECKPOINT block in the sidecar of a file
+ * being written, followed by nParents lineage uuids of 36 characters and
+ * the CBDF_BLOCK_SUMMARY payload of the events up to the checkpoint
+ */
+struct cbdf::cbdfCheckpoint_t {
+    cbdfFileHeader_t header;    //As at the start of the file
+    uint64_t timeStamp;
+    uint64_t fileSize;          //The file is durable and complete up to here, compressed files end a stream there
+    uint64_t dataBytes;         //Uncompressed bytes up to there
+    uint64_t events;
+    uint64_t lastEventNumber;
+    uint32_t nParents;
+    uint32_t summarySize;
+};
+#pragma pack() // reset padding to compiler defaults
+
+#define CBDF_BLOCK_SUMMARY 1
+#define CBDF_BLOCK_DICTIONARY 2 // Raw zstd dictionary, right behind the file header
+#define CBDF_BLOCK_LINEAGE 3    // uuids (36 characters each) of the files the events were copied from
+#define CBDF_BLOCK_SOURCE_INDEX 4 // Source uuid, then uint64_t event number and offset in the source per event
+#define CBDF_BLOCK_CHECKPOINT 5   // Only in checkpoint sidecars, see cbdf::setCheckpoints()
+
+#define CBDF_CHECKPOINT_SUFFIX ".ckpt"       // Appended to the file name for its checkpoint sidecar
+#define CBDF_CHECKPOINT_MAX_SIZE 16777216    // Larger sidecars are taken for damaged
+
+#define CBDF_DICTIONARY_MAX_SIZE 16777216
+
+// Bank payload alignment of a file (CBDF_FEATURE_ALIGN*), 0 for packed banks
+inline uint32_t bankAlignment(uint64_t features)
+{
+    if (features & CBDF_FEATURE_ALIGN64)
+        return 64;
+    if (features & CBDF_FEATURE_ALIGN32)
+        return 32;
+    if (features & CBDF_FEATURE_ALIGN16)
+        return 16;
+    return 0;
+}
+
+/*
+ * In files with aligned banks every bank header is preceded by zero bytes,
+ * so that its data starts at a multiple of alignment counted from the start
+ * of the event header. payloadOffset is where the bank would start without
+ * them.
+ */
+inline uint32_t bankPadding(uint64_t payloadOffset, uint32_t alignment)
+{
+    if (alignment == 0)
+        return 0;
+    uint64_t _dataOffset = sizeof(cbdf::cbdfEventHeader_t) + payloadOffset + sizeof(cbdf::cbdfBankHeader_t);
+    return (alignment - _dataOffset % alignment) % alignment;
+}
+
+#endif /* CBDFFORMAT_H_ */
@@ -0,0 +1,293 @@
+/*
+ * cbdfMultiWriter.cpp
+ *
+ *  Several producer threads writing into one cbdf output stream
+ */
+
+#include <cbdfMultiWriter.h>
+#include <cbdfBufferPool.h>
+#include <cstring>
+#include "cbdfCrc.h"
+#include "cbdfFormat.h"
+
+#define SEQUENCER_SPIN 64 // Polls of the queue before the sequencer goes to sleep
+
+cbdfEventBuffer::cbdfEventBuffer(uint64_t _eventBufferSize, cbdfAllocator* _allocator)
+{
+    allocator = _allocator ? _allocator : cbdfBufferPool::defaultPool();
+    eventBufferSize = _eventBufferSize;
+    eventBufferBase = allocator->allocate(eventBufferSize);
+    eventNumber = 0;
+    bankAlignment = 0;
+    clearEvent();
+}
+
+int cbdfEventBuffer::clearEvent()
+{
+    payloadSize = 0;
+    userFlags = 0;
+    return 0;
+}
+
+int cbdfEventBuffer::setEventUserFlags(uint64_t _userFlags)
+{
+    userFlags = _userFlags;
+    ((cbdf::cbdfEventHeader_t*) eventBufferBase)->userFlags = userFlags;
+    return 0;
+}
+
+// Also patches the header of a finished record, as done by the sequencer
+int cbdfEventBuffer::setEventNumber(uint64_t _eventNumber)
+{
+    eventNumber = _eventNumber;
+    ((cbdf::cbdfEventHeader_t*) eventBufferBase)->eventNumber = eventNumber;
+    return 0;
+}
+
+int cbdfEventBuffer::setBankAlignment(uint32_t alignment)
+{
+    bankAlignment = alignment;
+    return 0;
+}
+
+// Make room for payloadBytes more payload plus the trailer, keeping what is already there
+int cbdfEventBuffer::reserve(uint64_t payloadBytes)
+{
+    uint64_t _required = sizeof(cbdf::cbdfEventHeader_t) + payloadSize + payloadBytes + sizeof(cbdf::cbdfEventTrailer_t);
+    if (_required <= eventBufferSize)
+        return 0;
+
+    uint64_t _newSize = eventBufferSize;
+    while (_newSize < _required)
+        _newSize *= 2;
+    char* _newBuffer = allocator->allocate(_newSize);
+    if (_newBuffer == NULL)
+        return -1;
+    memcpy(_newBuffer, eventBufferBase, sizeof(cbdf::cbdfEventHeader_t) + payloadSize);
+    allocator->release(eventBufferBase, eventBufferSize);
+    eventBufferBase = _newBuffer;
+    eventBufferSize = _newSize;
+    return 0;
+}
+
+int cbdfEventBuffer::addBank(const char* name, uint16_t _userFlags, const char* dataPointer, uint32_t dataSize)
+{
+    uint32_t _padding = bankPadding(payloadSize, bankAlignment);
+    if (reserve(_padding + sizeof(cbdf::cbdfBankHeader_t) + dataSize))
+        return -1;
+    memset(getPayload() + payloadSize, 0, _padding);
+    payloadSize += _padding;
+    cbdf::cbdfBankHeader_t* _bankHeader = (cbdf::cbdfBankHeader_t*) (getPayload() + payloadSize);
+    strncpy(_bankHeader->name, name, sizeof(_bankHeader->name));
+    _bankHeader->userFlags = _userFlags;
+    _bankHeader->size = dataSize;
+    memcpy(getPayload() + payloadSize + sizeof(cbdf::cbdfBankHeader_t), dataPointer, dataSize);
+    payloadSize += sizeof(cbdf::cbdfBankHeader_t) + dataSize;
+    return 0;
+}
+
+int cbdfEventBuffer::addRawData(const char* bankPointer, uint32_t bankSize)
+{
+    char* _target = reserveRawData(bankSize);
+    if (_target == NULL)
+        return -1;
+    memcpy(_target, bankPointer, bankSize);
+    return 0;
+}
+
+char* cbdfEventBuffer::reserveRawData(uint32_t size)
+{
+    if (reserve(size))
+        return NULL;
+    char* _target = getPayload() + payloadSize;
+    payloadSize += size;
+    return _target;
+}
+
+int cbdfEventBuffer::finish()
+{
+    cbdf::cbdfEventHeader_t* _header = (cbdf::cbdfEventHeader_t*) eventBufferBase;
+    _header->openTag = 0xCBEDCBED;
+    _header->eventNumber = eventNumber;
+    _header->userFlags = userFlags;
+    _header->eventSize = payloadSize;
+    _header->closeTag = 0xCBEDCBED;
+
+    cbdf::cbdfEventTrailer_t _trailer;
+    _trailer.openTag = 0xDEBCDEBC;
+    _trailer.crc32 = cbdfCrc32(getPayload(), payloadSize);
+    _trailer.eventSize = payloadSize;
+    _trailer.closeTag = 0xDEBCDEBC;
+    memcpy(getPayload() + payloadSize, &_trailer, sizeof(_trailer));
+    return 0;
+}
+
+const char* cbdfEventBuffer::getRecord()
+{
+    return eventBufferBase;
+}
+
+uint64_t cbdfEventBuffer::getRecordSize()
+{
+    return sizeof(cbdf::cbdfEventHeader_t) + payloadSize + sizeof(cbdf::cbdfEventTrailer_t);
+}
+
+uint64_t cbdfEventBuffer::getPayloadSize()
+{
+    return payloadSize;
+}
+
+char* cbdfEventBuffer::getPayload()
+{
+    return eventBufferBase + sizeof(cbdf::cbdfEventHeader_t);
+}
+
+cbdfEventBuffer::~cbdfEventBuffer()
+{
+    allocator->release(eventBufferBase, eventBufferSize);
+}
+
+
+cbdfMultiWriter::cbdfMultiWriter(cbdf* _writer, uint32_t _queueDepth, uint64_t _eventBufferSize)
+    : filledQueue(_queueDepth), freeQueue(_queueDepth)
+{
+    writer = _writer;
+    queueDepth = _queueDepth;
+    eventBufferSize = _eventBufferSize;
+    sequencerWaiting = false;
+    stop = false;
+    submitting = 0;
+    eventsSubmitted = 0;
+    eventsWritten = 0;
+    error = 0;
+    sequencer = boost::thread(&cbdfMultiWriter::run, this);
+}
+
+/*
+ * Take a free buffer, allocating new ones until queueDepth buffers exist.
+ * Beyond that the producer waits for the sequencer to return one.
+ */
+cbdfEventBuffer* cbdfMultiWriter::getBuffer()
+{
+    cbdfEventBuffer* _buffer = NULL;
+    if (freeQueue.pop(_buffer))
+        return _buffer;
+    {
+        boost::mutex::scoped_lock _lock(buffersMutex);
+        if (buffers.size() < queueDepth)
+        {
+            _buffer = new cbdfEventBuffer(eventBufferSize);
+            _buffer->setBankAlignment(writer->getBankAlignment());
+            buffers.push_back(_buffer);
+            return _buffer;
+        }
+    }
+    while (!freeQueue.pop(_buffer))
+    {
+        boost::mutex::scoped_lock _lock(wakeupMutex);
+        bufferReturned.timed_wait(_lock, boost::posix_time::milliseconds(1));
+    }
+    return _buffer;
+}
+
+/*
+ * An event is accepted unless close() has begun. Producers announce
+ * themselves in submitting before looking at stop, so the sequencer does not
+ * finish while an accepted event is still on its way into the queue.
+ */
+int cbdfMultiWriter::submit(cbdfEventBuffer* event)
+{
+    submitting++;
+    if (stop)
+    {
+        submitting--;
+        return -1;
+    }
+    event->finish();
+    eventsSubmitted++;
+    filledQueue.push(event);
+    submitting--;
+    if (sequencerWaiting)
+    {
+        boost::mutex::scoped_lock _lock(wakeupMutex);
+        wakeup.notify_one();
+    }
+    return 0;
+}
+
+/*
+ * Sequencer: number and write events in queue order. When the queue runs
+ * dry it spins briefly and then sleeps; it announces this through
+ * sequencerWaiting so that producers only pay for a wakeup when needed.
+ */
+void cbdfMultiWriter::run()
+{
+    cbdfEventBuffer* _event;
+    uint32_t _spin = 0;
+    while (true)
+    {
+        if (filledQueue.pop(_event))
+        {
+            _event->setEventNumber(writer->getEventNumber());
+            writer->reportBacklog((double) (eventsSubmitted - eventsWritten) / queueDepth);
+            int _ret = writer->writeEventRecord(_event->getRecord());
+            if (_ret != 0 && error == 0)
+                error = _ret;
+            eventsWritten++;
+            _event->clearEvent();
+            freeQueue.push(_event);
+            bufferReturned.notify_all();
+            _spin = 0;
+            continue;
+        }
+        if (stop)
+        {
+            // Whatever was pushed before submitting dropped to 0 is in the queue
+            if (submitting == 0 && filledQueue.empty())
+                break;
+            boost::this_thread::yield();
+            continue;
+        }
+        if (_spin++ < SEQUENCER_SPIN)
+        {
+            boost::this_thread::yield();
+            continue;
+        }
+        boost::mutex::scoped_lock _lock(wakeupMutex);
+        sequencerWaiting = true;
+        if (filledQueue.empty() && !stop)
+            wakeup.timed_wait(_lock, boost::posix_time::milliseconds(10));
+        sequencerWaiting = false;
+        _spin = 0;
+    }
+}
+
+uint64_t cbdfMultiWriter::getEventsWritten()
+{
+    return eventsWritten;
+}
+
+int cbdfMultiWriter::getError()
+{
+    return error;
+}
+
+int cbdfMultiWriter::close()
+{
+    if (!sequencer.joinable())
+        return 0;
+    stop = true;
+    {
+        boost::mutex::scoped_lock _lock(wakeupMutex);
+        wakeup.notify_one();
+    }
+    sequencer.join();
+    return error;
+}
+
+cbdfMultiWriter::~cbdfMultiWriter()
+{
+    close();
+    for (size_t i = 0; i < buffers.size(); i++)
+        delete buffers[i];
+}
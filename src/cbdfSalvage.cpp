@@ -0,0 +1,81 @@
+/*
+ * cbdfSalvage.cpp
+ *
+ *  Recover the intact events of a damaged or truncated cbdf file into a
+ *  clean file
+ */
+
+#include <cbdfSalvage.h>
+
+#define CBDF_SALVAGE_NO_UUID "00000000-0000-0000-0000-000000000000"
+
+int salvageFile(std::string inputName, std::string outputName, cbdf::compressionType_t compression, cbdfSalvageStats_t &stats, bool sourceIndex)
+{
+    stats.events = 0;
+    stats.badEvents = 0;
+    stats.damagedRanges = 0;
+    stats.headerOk = false;
+    stats.trailerFound = false;
+    stats.status = 0;
+
+    cbdf::compressionType_t _inputCompression = cbdf::guessCompression(inputName);
+    uint64_t _features = 0;
+    int _ret = cbdf::readFileFeatures(inputName, _inputCompression, _features);
+    if (_ret == CBDF_UNSUPPORTED_FEATURE)
+        return stats.status = _ret;
+    stats.headerOk = (_ret == 0);
+
+    cbdf _reader;
+    cbdf _writer;
+    _reader.setReadOptions(true, CBDF_SALVAGE_IO_INTERVAL);
+    _writer.setWriteOptions(0, CBDF_SALVAGE_IO_INTERVAL);
+    if ((_ret = _reader.fileOpen(inputName, cbdf::readMode, _inputCompression)) != 0)
+        return stats.status = _ret;
+    std::string _uuid = stats.headerOk ? std::string(_reader.getUuid(), 36) : std::string(CBDF_SALVAGE_NO_UUID);
+    if (stats.headerOk && ((_ret = _writer.setLayoutFeatures(_features, _reader.getDictionary())) != 0 || (_ret = _writer.addParentUuid(_uuid)) != 0))
+    {
+        _reader.fileClose();
+        return stats.status = _ret;
+    }
+    if ((sourceIndex && (_ret = _writer.setSourceIndex(_uuid)) != 0) || (_ret = _writer.fileOpen(outputName, cbdf::writeMode, compression)) != 0)
+    {
+        _reader.fileClose();
+        return stats.status = _ret;
+    }
+
+    const char* _record;
+    bool _damaged = false;
+    while (true)
+    {
+        _ret = _reader.readEventRecord(_record, true);
+        if (_ret == 0)
+        {
+            _damaged = false;
+            if (sourceIndex)
+                _writer.addSourceIndexEntry(_reader.getEventNumber(), _reader.getEventOffset());
+            if ((_ret = _writer.writeEventRecord(_record)) != 0)
+            {
+                stats.status = _ret;
+                break;
+            }
+            stats.events++;
+            continue;
+        }
+        if (_ret == CBDF_EOF)
+        {
+            stats.trailerFound = true;
+            break;
+        }
+        if (!_damaged)
+            stats.damagedRanges++;
+        _damaged = true;
+        if (_ret == CBDF_EVENT_CRC_ERROR || _ret == CBDF_BANK_ERROR)
+            stats.badEvents++;
+        if (_reader.scanForNextEvent() != 0)
+            break;
+    }
+
+    _writer.fileClose();
+    _reader.fileClose();
+    return stats.status;
+}
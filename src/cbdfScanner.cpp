@@ -0,0 +1,179 @@
+/*
+ * cbdfScanner.cpp
+ *
+ *  Walk the records of a cbdf file's data without trusting it: event
+ *  records are only taken as such once their tags and sizes agree, and
+ *  after damage the walk resynchronises on the next record that does
+ */
+
+#include "cbdfScanner.h"
+#include "cbdfFormat.h"
+
+int cbdfFrameRecord(const char* data, uint64_t available, uint64_t &size)
+{
+    size = sizeof(cbdf::cbdfEventHeader_t);
+    if (available < size)
+        return CBDF_UNEXPECTED_EOF;
+    const cbdf::cbdfEventHeader_t* _header = (const cbdf::cbdfEventHeader_t*) data;
+    if (_header->openTag != 0xcbedcbed || _header->closeTag != 0xcbedcbed)
+        return CBDF_EVENT_HEADER_NOT_FOUND;
+    if (_header->eventSize > CBDF_SCAN_MAX_EVENT_SIZE)
+        return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
+    size = sizeof(cbdf::cbdfEventHeader_t) + _header->eventSize + sizeof(cbdf::cbdfEventTrailer_t);
+    if (available < size)
+        return CBDF_UNEXPECTED_EOF;
+    const cbdf::cbdfEventTrailer_t* _trailer = (const cbdf::cbdfEventTrailer_t*) (data + size - sizeof(cbdf::cbdfEventTrailer_t));
+    if (_trailer->openTag != 0xdebcdebc || _trailer->closeTag != 0xdebcdebc || _trailer->eventSize != _header->eventSize)
+        return CBDF_EVENT_HEADER_TRAILER_MISMATCH;
+    return 0;
+}
+
+bool cbdfFrameTrailer(const char* data, uint64_t available)
+{
+    if (data == NULL || available < sizeof(cbdf::cbdfFileTrailer_t))
+        return false;
+    const cbdf::cbdfFileTrailer_t* _trailer = (const cbdf::cbdfFileTrailer_t*) data;
+    return _trailer->openTag == 0xfdbcfdbc && _trailer->closeTag == 0xfdbcfdbc;
+}
+
+cbdfRecordScanner::cbdfRecordScanner(const char* data, uint64_t size)
+{
+    stream = NULL;
+    window = NULL;
+    windowSize = 0;
+    begin = data;
+    end = data + size;
+    position = 0;
+    streamEnd = true;
+}
+
+cbdfRecordScanner::cbdfRecordScanner(cbdfInStream* _stream)
+{
+    stream = _stream;
+    windowSize = CBDF_SCAN_WINDOW_SIZE;
+    window = new char[windowSize];
+    begin = window;
+    end = window;
+    position = 0;
+    streamEnd = false;
+}
+
+cbdfRecordScanner::~cbdfRecordScanner()
+{
+    delete[] window;
+}
+
+/*
+ * Make size bytes available at begin. The window only grows for records
+ * larger than it, which CBDF_SCAN_MAX_EVENT_SIZE bounds.
+ */
+bool cbdfRecordScanner::fill(uint64_t size)
+{
+    if ((uint64_t) (end - begin) >= size)
+        return true;
+    if (streamEnd)
+        return false;
+    uint64_t _buffered = end - begin;
+    if (size > windowSize)
+    {
+        uint64_t _newSize = windowSize;
+        while (_newSize < size)
+            _newSize *= 2;
+        char* _newWindow = new char[_newSize];
+        memcpy(_newWindow, begin, _buffered);
+        delete[] window;
+        window = _newWindow;
+        windowSize = _newSize;
+    }
+    else
+        memmove(window, begin, _buffered);
+    begin = window;
+    end = window + _buffered;
+    while ((uint64_t) (end - begin) < size && !streamEnd)
+    {
+        uint64_t _room = windowSize - (end - window);
+        uint64_t _got = stream->read((char*) end, _room);
+        end += _got;
+        if (_got < _room)
+            streamEnd = true;
+    }
+    return (uint64_t) (end - begin) >= size;
+}
+
+const char* cbdfRecordScanner::peek(uint64_t size)
+{
+    return fill(size) ? begin : NULL;
+}
+
+void cbdfRecordScanner::skip(uint64_t size)
+{
+    if (size > (uint64_t) (end - begin))
+        size = end - begin;
+    begin += size;
+    position += size;
+}
+
+uint64_t cbdfRecordScanner::recordSize(int &error)
+{
+    uint64_t _size = sizeof(cbdf::cbdfEventHeader_t);
+    const char* _data;
+    while ((_data = peek(_size)) != NULL && (error = cbdfFrameRecord(_data, _size, _size)) == CBDF_UNEXPECTED_EOF)
+        ;
+    if (_data == NULL)
+        error = CBDF_UNEXPECTED_EOF;
+    return (error == 0) ? _size : 0;
+}
+
+bool cbdfRecordScanner::trailerAt()
+{
+    return cbdfFrameTrailer(peek(sizeof(cbdf::cbdfFileTrailer_t)), (uint64_t) (end - begin));
+}
+
+cbdfRecordScanner::item_t cbdfRecordScanner::next()
+{
+    item_t _item;
+    _item.data = NULL;
+    _item.size = 0;
+    _item.offset = position;
+    _item.error = 0;
+    if (peek(1) == NULL)
+    {
+        _item.type = endOfData;
+        return _item;
+    }
+    if (trailerAt())
+    {
+        _item.type = fileTrailer;
+        _item.data = begin;
+        _item.size = sizeof(cbdf::cbdfFileTrailer_t);
+        skip(_item.size);
+        return _item;
+    }
+    _item.size = recordSize(_item.error);
+    if (_item.size)
+    {
+        _item.type = eventRecord;
+        _item.data = begin;
+        skip(_item.size);
+        return _item;
+    }
+
+    // Move on byte by byte, only positions that start with a tag are worth a full check
+    _item.type = garbage;
+    skip(1);
+    int _error;
+    const char* _tag;
+    while (peek(1) != NULL)
+    {
+        if ((_tag = peek(sizeof(uint32_t))) != NULL)
+        {
+            uint32_t _value;
+            memcpy(&_value, _tag, sizeof(_value));
+            if ((_value == 0xfdbcfdbc && trailerAt()) || (_value == 0xcbedcbed && recordSize(_error)))
+                break;
+        }
+        skip(1);
+    }
+    _item.size = position - _item.offset;
+    return _item;
+}
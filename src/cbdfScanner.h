@@ -0,0 +1,69 @@
+/*
+ * cbdfScanner.h
+ *
+ *  Walk the records of a cbdf file's data without trusting it: event
+ *  records are only taken as such once their tags and sizes agree, and
+ *  after damage the walk resynchronises on the next record that does
+ */
+
+#ifndef CBDFSCANNER_H_
+#define CBDFSCANNER_H_
+
+#include <cbdf.h>
+#include "cbdfStream.h"
+
+#define CBDF_SCAN_MAX_EVENT_SIZE 268435456ULL // Larger payload sizes are taken for damage
+#define CBDF_SCAN_WINDOW_SIZE 4194304         // Bytes read from a stream at once
+
+/*
+ * Check the event record data starts with, available bytes of it are in
+ * memory. Returns 0 and its size if tags and sizes agree,
+ * CBDF_UNEXPECTED_EOF with the size needed to tell if fewer bytes are
+ * available, else the error.
+ */
+int cbdfFrameRecord(const char* data, uint64_t available, uint64_t &size);
+bool cbdfFrameTrailer(const char* data, uint64_t available); // A file trailer starts at data
+
+class cbdfRecordScanner
+{
+public:
+
+  enum itemType_t {eventRecord=0, fileTrailer=1, garbage=2, endOfData=3};
+
+  struct item_t {
+      itemType_t type;
+      const char* data;         // Record or trailer, NULL for garbage. Valid until the next call unless mapped()
+      uint64_t size;
+      uint64_t offset;          // In the uncompressed data of the file
+      int error;                // For garbage: CBDF_* code of why it is no record
+  };
+
+  cbdfRecordScanner(const char* data, uint64_t size); // Data already in memory, e.g. a mapped file
+  cbdfRecordScanner(cbdfInStream* stream);             // Read through a window, the stream stays owned by the caller
+  ~cbdfRecordScanner();
+
+  // At least size bytes from the current position, NULL if the data ends before
+  const char* peek(uint64_t size);
+  void skip(uint64_t size);
+  uint64_t offset() { return position; }
+  bool mapped() { return stream == NULL; }
+
+  // The next record, trailer or garbage up to where the next one starts
+  item_t next();
+
+private:
+
+  uint64_t recordSize(int &error);   // Of the record at the current position, 0 if there is none
+  bool trailerAt();
+  bool fill(uint64_t size);
+
+  cbdfInStream* stream;
+  char* window;
+  uint64_t windowSize;
+  const char* begin;                 // Data at position
+  const char* end;                   // End of the data in memory
+  uint64_t position;
+  bool streamEnd;
+};
+
+#endif /* CBDFSCANNER_H_ */
@@ -0,0 +1,83 @@
+/*
+ * cbdfSkim.cpp
+ *
+ *  Copy the events of cbdf files that pass a selection into skim files,
+ *  which index each event back to where it came from
+ */
+
+#include <cbdfSkim.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+int skimFile(std::string inputName, std::string outputName, cbdf::compressionType_t compression, const cbdfSkimSelection_t &selection, cbdfSkimStats_t &stats)
+{
+    stats.inputName = inputName;
+    stats.outputName.clear();
+    stats.events = 0;
+    stats.selected = 0;
+    stats.bytes = 0;
+    stats.status = 0;
+
+    cbdf _reader;
+    cbdf _writer;
+    int _ret = _reader.fileOpen(inputName, cbdf::readMode, cbdf::guessCompression(inputName));
+    if (_ret != 0)
+        return stats.status = _ret;
+    std::string _uuid(_reader.getUuid(), 36);
+    if ((_ret = _writer.setLayoutFeatures(_reader.getFileFeatures(), _reader.getDictionary())) != 0 || (_ret = _writer.addParentUuid(_uuid)) != 0 || (_ret = _writer.setSourceIndex(_uuid)) != 0 || (_ret = _writer.fileOpen(outputName, cbdf::writeMode, compression)) != 0)
+    {
+        _reader.fileClose();
+        return stats.status = _ret;
+    }
+    stats.outputName = _writer.getFileName();
+
+    const char* _record;
+    while ((_ret = _reader.readEventRecord(_record, false)) == 0)
+    {
+        stats.events++;
+        if ((_reader.getEventUserFlags() & selection.flagMask) != selection.flagValue)
+            continue;
+        if (selection.predicate && (_reader.parseBanks() != 0 || !selection.predicate(_reader)))
+            continue;
+        _writer.addSourceIndexEntry(_reader.getEventNumber(), _reader.getEventOffset());
+        if ((_ret = _writer.writeEventRecord(_record)) != 0)
+            break;
+        stats.selected++;
+        stats.bytes += cbdf::eventRecordSize(_record);
+    }
+
+    _writer.fileClose();
+    _reader.fileClose();
+    return stats.status = (_ret == CBDF_EOF) ? 0 : _ret;
+}
+
+static void skimWorker(const std::vector<std::string> *inputNames, const std::vector<std::string> *outputNames, cbdf::compressionType_t compression, const cbdfSkimSelection_t *selection, std::vector<cbdfSkimStats_t> *stats, boost::atomic<uint32_t> *next)
+{
+    uint32_t _file;
+    while ((_file = (*next)++) < inputNames->size())
+        skimFile((*inputNames)[_file], (*outputNames)[_file], compression, *selection, (*stats)[_file]);
+}
+
+int skimFiles(const std::vector<std::string> &inputNames, const std::vector<std::string> &outputNames, cbdf::compressionType_t compression, const cbdfSkimSelection_t &selection, std::vector<cbdfSkimStats_t> &stats, uint32_t threads)
+{
+    if (inputNames.size() != outputNames.size())
+        return -1;
+    stats.clear();
+    stats.resize(inputNames.size());
+
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    boost::atomic<uint32_t> _next(0);
+    boost::thread_group _workers;
+    for (uint32_t i = 0; i < threads && i < inputNames.size(); i++)
+        _workers.create_thread(boost::bind(&skimWorker, &inputNames, &outputNames, compression, &selection, &stats, &_next));
+    _workers.join_all();
+
+    for (uint32_t i = 0; i < stats.size(); i++)
+        if (stats[i].status != 0)
+            return stats[i].status;
+    return 0;
+}
@@ -0,0 +1,609 @@
+/*
+ * cbdfStream.cpp
+ *
+ *  Buffered input and output streams of cbdf files with a direct path for
+ *  uncompressed files and a Boost.Iostreams chain for compressed ones
+ */
+
+#include "cbdfStream.h"
+#include "cbdfFileDevice.h"
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <cstdlib>
+
+#ifdef WITH_LZMA
+#include "lzma.hpp"
+#endif
+
+#ifdef WITH_LZO
+#include "lzo.hpp"
+#endif
+
+#define CBDF_IO_BUFFER_SIZE 65536 // Stream buffer in front of the backends
+
+namespace boostIO = boost::iostreams;
+
+cbdfInStream::cbdfInStream(uint64_t bufferSize)
+{
+    bufSize = bufferSize;
+    bufBase = new char[bufSize];
+    bufPos = bufBase;
+    bufEnd = bufBase;
+    failed = false;
+}
+
+cbdfInStream::~cbdfInStream()
+{
+    delete[] bufBase;
+}
+
+uint64_t cbdfInStream::readSlow(char* buffer, uint64_t size)
+{
+    uint64_t _done = bufEnd - bufPos;
+    memcpy(buffer, bufPos, _done);
+    bufPos = bufEnd;
+    while (_done < size)
+    {
+        uint64_t _left = size - _done;
+        int64_t _ret;
+        if (_left >= bufSize)
+        {
+            // Large reads go straight to the destination
+            _ret = fetch(buffer + _done, _left);
+            if (_ret > 0)
+                _done += _ret;
+        }
+        else
+        {
+            _ret = fetch(bufBase, bufSize);
+            if (_ret > 0)
+            {
+                uint64_t _chunk = std::min(_left, (uint64_t) _ret);
+                bufPos = bufBase;
+                bufEnd = bufBase + _ret;
+                memcpy(buffer + _done, bufPos, _chunk);
+                bufPos += _chunk;
+                _done += _chunk;
+            }
+        }
+        if (_ret <= 0)
+        {
+            failed = (_ret < 0);
+            break;
+        }
+    }
+    return _done;
+}
+
+uint64_t cbdfInStream::skip(uint64_t size)
+{
+    uint64_t _done = std::min(size, (uint64_t) (bufEnd - bufPos));
+    bufPos += _done;
+    while (_done < size)
+    {
+        int64_t _ret = discard(size - _done);
+        if (_ret <= 0)
+        {
+            failed = (_ret < 0);
+            break;
+        }
+        _done += _ret;
+    }
+    return _done;
+}
+
+int64_t cbdfInStream::discard(uint64_t size)
+{
+    int64_t _ret = fetch(bufBase, std::min(size, bufSize));
+    bufPos = bufBase;
+    bufEnd = bufBase;
+    return _ret;
+}
+
+cbdfOutStream::cbdfOutStream(uint64_t bufferSize)
+{
+    bufSize = bufferSize;
+    bufBase = new char[bufSize];
+    bufPos = bufBase;
+    bufEnd = bufBase + bufSize;
+    closed = false;
+}
+
+cbdfOutStream::~cbdfOutStream()
+{
+    delete[] bufBase;
+}
+
+bool cbdfOutStream::drain()
+{
+    uint64_t _size = bufPos - bufBase;
+    bufPos = bufBase;
+    return (_size == 0) || store(bufBase, _size);
+}
+
+bool cbdfOutStream::writeSlow(const char* data, uint64_t size)
+{
+    // Top up the buffer first, so that the file is written in whole, aligned buffers
+    uint64_t _space = bufEnd - bufPos;
+    memcpy(bufPos, data, _space);
+    bufPos += _space;
+    data += _space;
+    size -= _space;
+    if (!drain())
+        return false;
+    uint64_t _direct = size - size % bufSize;
+    if (_direct && !store(data, _direct))
+        return false;
+    data += _direct;
+    size -= _direct;
+    memcpy(bufPos, data, size);
+    bufPos += size;
+    return true;
+}
+
+bool cbdfOutStream::flush()
+{
+    return drain() && sync();
+}
+
+bool cbdfOutStream::restart()
+{
+    return drain() && newStream();
+}
+
+bool cbdfOutStream::persist(uint64_t &fileSize)
+{
+    return drain() && sync() && syncFile(fileSize);
+}
+
+bool cbdfOutStream::close(const std::string &footer)
+{
+    if (closed)
+        return true;
+    closed = true;
+    bool _ok = drain();
+    return finish(footer) && _ok;
+}
+
+// Uncompressed files: the stream buffer talks to the file descriptor device directly
+
+class cbdfFileInStream : public cbdfInStream
+{
+public:
+    cbdfFileInStream(const cbdfFileSource &_source) : cbdfInStream(CBDF_IO_BUFFER_SIZE), source(_source) {}
+
+protected:
+    int64_t fetch(char* buffer, uint64_t size)
+    {
+        try
+        {
+            std::streamsize _ret = source.read(buffer, size);
+            return (_ret < 0) ? 0 : _ret;
+        }
+        catch (std::exception &)
+        {
+            return -1;
+        }
+    }
+    int64_t discard(uint64_t size) { return source.skip(size); }
+
+private:
+    cbdfFileSource source;
+};
+
+class cbdfFileOutStream : public cbdfOutStream
+{
+public:
+    cbdfFileOutStream(const cbdfFileSink &_sink) : cbdfOutStream(CBDF_IO_BUFFER_SIZE), sink(_sink) {}
+
+protected:
+    bool store(const char* data, uint64_t size)
+    {
+        try
+        {
+            sink.write(data, size);
+            return true;
+        }
+        catch (std::exception &)
+        {
+            return false;
+        }
+    }
+    bool sync() { return sink.flush(); }
+    bool syncFile(uint64_t &fileSize) { return sink.sync(fileSize); }
+    bool finish(const std::string &footer)
+    {
+        bool _ok = sink.flush();
+        sink.setFooter(footer);
+        sink.close();
+        return _ok;
+    }
+
+private:
+    cbdfFileSink sink;
+};
+
+// Compressed files: the stream buffer feeds a Boost.Iostreams chain ending in the file device
+
+class cbdfFilterInStream : public cbdfInStream
+{
+public:
+    cbdfFilterInStream() : cbdfInStream(CBDF_IO_BUFFER_SIZE) {}
+    boostIO::filtering_istream chain;
+
+protected:
+    int64_t fetch(char* buffer, uint64_t size)
+    {
+        chain.read(buffer, size);
+        int64_t _ret = chain.gcount();
+        if (chain.bad())
+            return -1;
+        chain.clear();
+        return _ret;
+    }
+};
+
+// Put the compressor of compr in front of chain, false if there is none compiled in
+static bool pushCompressor(boostIO::filtering_ostream &chain, cbdf::compressionType_t compr)
+{
+    switch (compr)
+    {
+    case (cbdf::gzip):
+        chain.push(boostIO::gzip_compressor());
+        return true;
+    case (cbdf::bzip2):
+        chain.push(boostIO::bzip2_compressor());
+        return true;
+    case (cbdf::xz):
+#ifdef WITH_LZMA
+        chain.push(boostIO::lzma_compressor());
+        return true;
+#endif
+        break;
+    case (cbdf::lzo):
+#ifdef WITH_LZO
+        chain.push(boostIO::lzo_compressor());
+        return true;
+#endif
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+// End of the chain. The file sink itself stays open when the chain is rebuilt for a new compressed stream
+class cbdfChainSink
+{
+public:
+    typedef char char_type;
+    struct category : boostIO::sink_tag, boostIO::flushable_tag {};
+
+    cbdfChainSink(const cbdfFileSink &_sink) : sink(_sink) {}
+    std::streamsize write(const char* s, std::streamsize n) { return sink.write(s, n); }
+    bool flush() { return sink.flush(); }
+
+private:
+    cbdfFileSink sink;
+};
+
+class cbdfFilterOutStream : public cbdfOutStream
+{
+public:
+    cbdfFilterOutStream(cbdf::compressionType_t _compression, const cbdfFileSink &_sink) : cbdfOutStream(CBDF_IO_BUFFER_SIZE), compression(_compression), sink(_sink) {}
+
+    bool open()
+    {
+        if (!pushCompressor(chain, compression))
+            return false;
+        chain.push(cbdfChainSink(sink), CBDF_IO_BUFFER_SIZE);
+        return true;
+    }
+
+protected:
+    bool store(const char* data, uint64_t size)
+    {
+        chain.write(data, size);
+        return chain.good();
+    }
+    bool sync()
+    {
+        chain.flush();
+        return chain.good();
+    }
+    bool newStream()
+    {
+        // Closing the compressor writes the end of its stream, a fresh one starts the next
+        if (!chain.good())
+            return false;
+        chain.pop();
+        bool _ok = chain.good();
+        chain.reset();
+        return open() && _ok;
+    }
+    bool syncFile(uint64_t &fileSize) { return sink.sync(fileSize); }
+    bool finish(const std::string &footer)
+    {
+        bool _ok = chain.good();
+        chain.pop();
+        sink.setFooter(footer);
+        sink.close();
+        return _ok;
+    }
+
+private:
+    boostIO::filtering_ostream chain;
+    cbdf::compressionType_t compression;
+    cbdfFileSink sink;
+};
+
+/*
+ * Compressed files written by several threads: the data is cut into blocks
+ * that are compressed as complete streams of their own (gzip members, bzip2
+ * or xz streams) on a pool of workers and written to the file in order.
+ * Readers take the concatenated streams for one. A restart or sync ends the
+ * current block early, so checkpoints work as with a single compressor.
+ */
+class cbdfParallelOutStream : public cbdfOutStream
+{
+public:
+    cbdfParallelOutStream(cbdf::compressionType_t _compression, const cbdfFileSink &_sink, uint32_t threads, uint64_t _blockSize)
+        : cbdfOutStream(CBDF_IO_BUFFER_SIZE), compression(_compression), sink(_sink), blockSize(_blockSize), stopping(false), failed(false)
+    {
+        maxJobs = 2 * threads;
+        for (uint32_t i = 0; i < threads; i++)
+            workers.create_thread(boost::bind(&cbdfParallelOutStream::compressBlocks, this));
+    }
+
+    ~cbdfParallelOutStream()
+    {
+        stopWorkers();
+        for (std::deque<job_t*>::iterator _it = jobs.begin(); _it != jobs.end(); _it++)
+            delete *_it;
+    }
+
+protected:
+    bool store(const char* data, uint64_t size)
+    {
+        block.append(data, size);
+        return (block.size() < blockSize) || submitBlock();
+    }
+    bool sync()
+    {
+        if (!submitBlock())
+            return false;
+        while (!jobs.empty())
+            if (!writeOldest())
+                return false;
+        return sink.flush();
+    }
+    bool newStream() { return sync(); }
+    bool syncFile(uint64_t &fileSize) { return sink.sync(fileSize); }
+    bool finish(const std::string &footer)
+    {
+        bool _ok = sync();
+        stopWorkers();
+        sink.setFooter(footer);
+        sink.close();
+        return _ok;
+    }
+
+private:
+    struct job_t {
+        std::string data;
+        std::string stream;
+        bool done;
+        bool ok;
+    };
+
+    // Worker loop, blocks are taken in the order they were handed in
+    void compressBlocks()
+    {
+        while (true)
+        {
+            job_t* _job;
+            {
+                boost::mutex::scoped_lock _lock(mutex);
+                while (todo.empty() && !stopping)
+                    work.wait(_lock);
+                if (todo.empty())
+                    return;
+                _job = todo.front();
+                todo.pop_front();
+            }
+            bool _ok = false;
+            try
+            {
+                boostIO::filtering_ostream _chain;
+                if (pushCompressor(_chain, compression))
+                {
+                    _chain.push(boostIO::back_inserter(_job->stream));
+                    _chain.write(_job->data.data(), _job->data.size());
+                    _ok = _chain.good();
+                    _chain.pop();
+                    _ok = _ok && _chain.good();
+                }
+            }
+            catch (std::exception &)
+            {
+                _ok = false;
+            }
+            std::string().swap(_job->data);
+            boost::mutex::scoped_lock _lock(mutex);
+            _job->ok = _ok;
+            _job->done = true;
+            finished.notify_all();
+        }
+    }
+
+    // Queue the data collected so far as a block, writing out old blocks while too many are in flight
+    bool submitBlock()
+    {
+        if (failed)
+            return false;
+        if (!block.empty())
+        {
+            job_t* _job = new job_t;
+            _job->data.swap(block);
+            _job->done = false;
+            _job->ok = false;
+            jobs.push_back(_job);
+            boost::mutex::scoped_lock _lock(mutex);
+            todo.push_back(_job);
+            work.notify_one();
+        }
+        while (jobs.size() > maxJobs)
+            if (!writeOldest())
+                return false;
+        return true;
+    }
+
+    bool writeOldest()
+    {
+        job_t* _job = jobs.front();
+        {
+            boost::mutex::scoped_lock _lock(mutex);
+            while (!_job->done)
+                finished.wait(_lock);
+        }
+        jobs.pop_front();
+        bool _ok = _job->ok;
+        if (_ok)
+        {
+            try
+            {
+                sink.write(_job->stream.data(), _job->stream.size());
+            }
+            catch (std::exception &)
+            {
+                _ok = false;
+            }
+        }
+        delete _job;
+        failed = failed || !_ok;
+        return _ok;
+    }
+
+    void stopWorkers()
+    {
+        {
+            boost::mutex::scoped_lock _lock(mutex);
+            stopping = true;
+            work.notify_all();
+        }
+        workers.join_all();
+    }
+
+    cbdf::compressionType_t compression;
+    cbdfFileSink sink;
+    uint64_t blockSize;
+    uint32_t maxJobs;
+    std::string block;              // Data of the next block
+    std::deque<job_t*> jobs;        // Blocks in file order, owned by the writing thread
+    std::deque<job_t*> todo;        // Blocks no worker has taken yet
+    boost::mutex mutex;
+    boost::condition_variable work;
+    boost::condition_variable finished;
+    boost::thread_group workers;
+    bool stopping;
+    bool failed;
+};
+
+cbdfInStream* openInStream(const std::string &fileName, cbdf::compressionType_t compr, const cbdf::cbdfIOOptions_t &options, uint64_t dataEnd)
+{
+    if (compr == cbdf::none)
+    {
+        cbdfFileSource _source(fileName, options, dataEnd);
+        if (!_source.is_open())
+            return NULL;
+        return new cbdfFileInStream(_source);
+    }
+
+    cbdfFilterInStream* _in = new cbdfFilterInStream;
+    switch (compr)
+    {
+    case (cbdf::gzip):
+        _in->chain.push(boostIO::gzip_decompressor());
+        break;
+    case (cbdf::bzip2):
+        _in->chain.push(boostIO::bzip2_decompressor());
+        break;
+    case (cbdf::xz):
+#ifdef WITH_LZMA
+        _in->chain.push(boostIO::lzma_decompressor());
+#else
+        std::cerr << "No LZMA support enabled at compile time -- Exiting\n";
+        exit(-1);
+#endif
+        break;
+    case (cbdf::lzo):
+#ifdef WITH_LZO
+        _in->chain.push(boostIO::lzo_decompressor());
+#else
+        std::cerr << "No LZO support enabled at compile time -- Exiting\n";
+        exit(-1);
+#endif
+        break;
+    default:
+        break;
+    }
+    _in->chain.push(cbdfFileSource(fileName, options, dataEnd), CBDF_IO_BUFFER_SIZE);
+    if (!_in->chain.component<cbdfFileSource>(1)->is_open())
+    {
+        delete _in;
+        return NULL;
+    }
+    return _in;
+}
+
+cbdfOutStream* openOutStream(std::string &fileName, cbdf::compressionType_t compr, const cbdf::cbdfIOOptions_t &options, uint64_t keep)
+{
+    switch (compr)
+    {
+    case (cbdf::gzip):
+        fileName = fileName + ".gz";
+        break;
+    case (cbdf::bzip2):
+        fileName = fileName + ".bz2";
+        break;
+    case (cbdf::xz):
+#ifdef WITH_LZMA
+        fileName = fileName + ".xz";
+#else
+        std::cerr << "LZMA support not enabled at compile time, writing uncompressed!\n";
+        compr = cbdf::none;
+#endif
+        break;
+    case (cbdf::lzo):
+#ifdef WITH_LZO
+        fileName = fileName + ".lzo";
+#else
+        std::cerr << "LZO support not enabled at compile time, writing uncompressed!\n";
+        compr = cbdf::none;
+#endif
+        break;
+    default:
+        break;
+    }
+
+    cbdfFileSink _sink(fileName, options, keep);
+    if (!_sink.is_open())
+        return NULL;
+    if (compr == cbdf::none)
+        return new cbdfFileOutStream(_sink);
+    // lzo readers do not take concatenated streams
+    if (options.compressThreads > 1 && compr != cbdf::lzo)
+        return new cbdfParallelOutStream(compr, _sink, options.compressThreads, options.compressBlockSize);
+    cbdfFilterOutStream* _out = new cbdfFilterOutStream(compr, _sink);
+    _out->open();
+    return _out;
+}
@@ -0,0 +1,105 @@
+/*
+ * cbdfStream.h
+ *
+ *  Buffered input and output streams of cbdf files. Transfers the buffer can
+ *  serve are handled inline; only refills and drains go through a backend,
+ *  which is either the file descriptor device itself (uncompressed files) or
+ *  a Boost.Iostreams chain with the compressor in front of it.
+ */
+
+#ifndef CBDFSTREAM_H_
+#define CBDFSTREAM_H_
+
+#include <cbdf.h>
+#include <cstring>
+#include <string>
+
+class cbdfInStream
+{
+public:
+
+  cbdfInStream(uint64_t bufferSize);
+  virtual ~cbdfInStream();
+
+  // Read up to size bytes, fewer only at the (current) end of the data or on error
+  uint64_t read(char* buffer, uint64_t size)
+  {
+      if (size <= (uint64_t) (bufEnd - bufPos))
+      {
+          memcpy(buffer, bufPos, size);
+          bufPos += size;
+          return size;
+      }
+      return readSlow(buffer, size);
+  }
+  uint64_t skip(uint64_t size); // Like read, but the data is dropped
+  bool bad() const { return failed; }
+
+protected:
+
+  // Get up to size bytes from the backend, 0 at the end of the data, -1 on error
+  virtual int64_t fetch(char* buffer, uint64_t size) = 0;
+  // Move the backend up to size bytes ahead, by default by reading and dropping the data
+  virtual int64_t discard(uint64_t size);
+
+private:
+
+  uint64_t readSlow(char* buffer, uint64_t size);
+
+  char *bufBase, *bufPos, *bufEnd;
+  uint64_t bufSize;
+  bool failed;
+};
+
+class cbdfOutStream
+{
+public:
+
+  cbdfOutStream(uint64_t bufferSize);
+  virtual ~cbdfOutStream(); // Buffered data is lost unless close() was called
+
+  bool write(const char* data, uint64_t size)
+  {
+      if (size <= (uint64_t) (bufEnd - bufPos))
+      {
+          memcpy(bufPos, data, size);
+          bufPos += size;
+          return true;
+      }
+      return writeSlow(data, size);
+  }
+  bool flush(); // Hand everything written so far to the file
+  bool restart(); // End the compressed stream here and begin a new one, so the data so far decodes without what follows
+  bool persist(uint64_t &fileSize); // Flush and fdatasync, fileSize is the part of the file that is on disk
+  bool close(const std::string &footer=std::string()); // The footer is stored as is behind the (compressed) data
+
+protected:
+
+  virtual bool store(const char* data, uint64_t size) = 0; // Pass data on to the backend
+  virtual bool sync() = 0;   // Push backend buffers (compressor state) to the file
+  virtual bool newStream() { return true; } // Finish the compressed stream and start the next one
+  virtual bool syncFile(uint64_t &fileSize) = 0;
+  virtual bool finish(const std::string &footer) = 0; // Finish and close the file
+
+private:
+
+  bool writeSlow(const char* data, uint64_t size);
+  bool drain();
+
+  char *bufBase, *bufPos, *bufEnd;
+  uint64_t bufSize;
+  bool closed;
+};
+
+// Open fileName for reading, NULL if it can not be opened. A dataEnd other than 0 ends the data before the footer
+cbdfInStream* openInStream(const std::string &fileName, cbdf::compressionType_t compr, const cbdf::cbdfIOOptions_t &options, uint64_t dataEnd=0);
+
+/*
+ * Create fileName for writing, the extension of the compression is appended
+ * to it. With keep other than 0 the existing file is cut to keep bytes and
+ * written on from there, compressed files in a new stream behind the ones
+ * kept. NULL on failure
+ */
+cbdfOutStream* openOutStream(std::string &fileName, cbdf::compressionType_t compr, const cbdf::cbdfIOOptions_t &options, uint64_t keep=0);
+
+#endif /* CBDFSTREAM_H_ */
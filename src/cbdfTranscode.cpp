@@ -0,0 +1,220 @@
+/*
+ * cbdfTranscode.cpp
+ *
+ *  Copy the events of a cbdf file into a file with other compression
+ *  settings, as raw event records
+ */
+
+#include <cbdfTranscode.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind.hpp>
+#include <deque>
+
+// Consecutive event records, checked as a whole by one worker
+struct cbdfTranscodeBatch_t {
+    std::string records;
+    std::vector<uint64_t> offsets;
+    std::vector<bool> bad;
+    bool checked;
+};
+
+/*
+ * Batches are queued twice: in pending until a worker picks them up and in
+ * ordered until the writer is done with them, so they are written in file
+ * order however the workers finish.
+ */
+class cbdfTranscodePipeline
+{
+public:
+
+  cbdfTranscodePipeline(cbdf* _reader, bool _stopOnError);
+
+  void read();
+  void check();
+  int write(cbdf* writer, cbdfTranscodeStats_t &stats);
+
+  int readStatus;
+
+private:
+
+  bool enqueue(cbdfTranscodeBatch_t* batch);
+
+  cbdf* reader;
+  bool stopOnError;
+  bool readDone;
+  bool abort;
+  std::deque<cbdfTranscodeBatch_t*> pending;
+  std::deque<cbdfTranscodeBatch_t*> ordered;
+  boost::mutex mutex;
+  boost::condition_variable work;
+  boost::condition_variable checked;
+  boost::condition_variable space;
+};
+
+cbdfTranscodePipeline::cbdfTranscodePipeline(cbdf* _reader, bool _stopOnError)
+{
+    reader = _reader;
+    stopOnError = _stopOnError;
+    readStatus = 0;
+    readDone = false;
+    abort = false;
+}
+
+// False once the writer gave up, the batch is dropped then
+bool cbdfTranscodePipeline::enqueue(cbdfTranscodeBatch_t* batch)
+{
+    boost::mutex::scoped_lock _lock(mutex);
+    while (ordered.size() >= CBDF_TRANSCODE_MAX_BATCHES && !abort)
+        space.wait(_lock);
+    if (abort)
+    {
+        delete batch;
+        return false;
+    }
+    pending.push_back(batch);
+    ordered.push_back(batch);
+    work.notify_one();
+    return true;
+}
+
+// Reader thread: collect records into batches until the end of the input
+void cbdfTranscodePipeline::read()
+{
+    cbdfTranscodeBatch_t* _batch = new cbdfTranscodeBatch_t;
+    _batch->checked = false;
+    const char* _record;
+    int _ret;
+    while ((_ret = reader->readEventRecord(_record, false)) == 0 || _ret == CBDF_EVENT_CRC_ERROR)
+    {
+        if (_ret == CBDF_EVENT_CRC_ERROR)
+        {
+            // Compressed events are checked by the reader itself, a failed one has no record to pass on
+            _batch->offsets.push_back(_batch->records.size());
+            _batch->bad.push_back(true);
+            continue;
+        }
+        _batch->offsets.push_back(_batch->records.size());
+        _batch->bad.push_back(false);
+        _batch->records.append(_record, cbdf::eventRecordSize(_record));
+        if (_batch->records.size() >= CBDF_TRANSCODE_BATCH_SIZE)
+        {
+            if (!enqueue(_batch))
+            {
+                _batch = NULL;
+                _ret = CBDF_EOF;
+                break;
+            }
+            _batch = new cbdfTranscodeBatch_t;
+            _batch->checked = false;
+        }
+    }
+    readStatus = (_ret == CBDF_EOF) ? 0 : _ret;
+    if (_batch != NULL)
+        enqueue(_batch);
+    boost::mutex::scoped_lock _lock(mutex);
+    readDone = true;
+    work.notify_all();
+    checked.notify_all();
+}
+
+// Worker thread: check the CRC of every record of a batch
+void cbdfTranscodePipeline::check()
+{
+    while (true)
+    {
+        cbdfTranscodeBatch_t* _batch;
+        {
+            boost::mutex::scoped_lock _lock(mutex);
+            while (pending.empty() && !readDone && !abort)
+                work.wait(_lock);
+            if (pending.empty())
+                return;
+            _batch = pending.front();
+            pending.pop_front();
+        }
+        for (uint32_t i = 0; i < _batch->offsets.size(); i++)
+            if (!_batch->bad[i] && cbdf::checkEventRecord(_batch->records.data() + _batch->offsets[i]) != 0)
+                _batch->bad[i] = true;
+        boost::mutex::scoped_lock _lock(mutex);
+        _batch->checked = true;
+        checked.notify_all();
+    }
+}
+
+// Writer, on the calling thread: write the checked batches in order. After an error the rest is only drained
+int cbdfTranscodePipeline::write(cbdf* writer, cbdfTranscodeStats_t &stats)
+{
+    int _ret = 0;
+    while (true)
+    {
+        cbdfTranscodeBatch_t* _batch;
+        {
+            boost::mutex::scoped_lock _lock(mutex);
+            while (!(ordered.empty() ? readDone : ordered.front()->checked))
+                checked.wait(_lock);
+            if (ordered.empty())
+                break;
+            _batch = ordered.front();
+        }
+        for (uint32_t i = 0; i < _batch->offsets.size() && _ret == 0; i++)
+        {
+            if (_batch->bad[i])
+            {
+                stats.badEvents++;
+                if (stopOnError)
+                    _ret = CBDF_EVENT_CRC_ERROR;
+                continue;
+            }
+            const char* _record = _batch->records.data() + _batch->offsets[i];
+            _ret = writer->writeEventRecord(_record);
+            if (_ret == 0)
+            {
+                stats.events++;
+                stats.bytes += cbdf::eventRecordSize(_record);
+            }
+        }
+        boost::mutex::scoped_lock _lock(mutex);
+        ordered.pop_front();
+        delete _batch;
+        if (_ret != 0)
+            abort = true;
+        space.notify_all();
+    }
+    return _ret;
+}
+
+int transcodeFile(std::string inputName, cbdf &writer, std::string outputName, cbdf::compressionType_t compression, cbdfTranscodeStats_t &stats, uint32_t workers, bool stopOnError)
+{
+    stats.events = 0;
+    stats.bytes = 0;
+    stats.badEvents = 0;
+
+    cbdf _reader;
+    int _ret = _reader.fileOpen(inputName, cbdf::readMode, cbdf::guessCompression(inputName));
+    if (_ret != 0)
+        return _ret;
+    if ((_ret = writer.setLayoutFeatures(_reader.getFileFeatures(), _reader.getDictionary())) != 0 || (_ret = writer.addParentUuid(std::string(_reader.getUuid(), 36))) != 0 || (_ret = writer.fileOpen(outputName, cbdf::writeMode, compression)) != 0)
+    {
+        _reader.fileClose();
+        return _ret;
+    }
+
+    if (workers == 0)
+        workers = 1;
+    cbdfTranscodePipeline _pipeline(&_reader, stopOnError);
+    boost::thread _readThread(boost::bind(&cbdfTranscodePipeline::read, &_pipeline));
+    boost::thread_group _workers;
+    for (uint32_t i = 0; i < workers; i++)
+        _workers.create_thread(boost::bind(&cbdfTranscodePipeline::check, &_pipeline));
+    _ret = _pipeline.write(&writer, stats);
+    _readThread.join();
+    _workers.join_all();
+
+    writer.fileClose();
+    _reader.fileClose();
+    if (_ret == 0)
+        _ret = _pipeline.readStatus;
+    return _ret;
+}
@@ -0,0 +1,387 @@
+/*
+ * cbdfVerify.cpp
+ *
+ *  Check the structure and checksums of cbdf files without decoding any
+ *  events, and report where they are damaged
+ */
+
+#include <cbdfVerify.h>
+#include "cbdfFormat.h"
+#include "cbdfFooter.h"
+#include "cbdfScanner.h"
+#include "cbdfStream.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Event records of one stretch of the file, in place for mapped files and copied for streamed ones
+struct cbdfVerifyBatch_t {
+    std::string storage;
+    const char* base;
+    uint64_t bytes;
+    std::vector<std::pair<uint64_t, uint64_t> > records; // Offset from base, offset in the file
+};
+
+class cbdfVerifyPipeline
+{
+public:
+
+  cbdfVerifyPipeline();
+
+  void submit(cbdfVerifyBatch_t* batch);
+  void finish();
+  void check();
+
+  std::vector<cbdfVerifyRange_t> ranges;
+  uint64_t badEvents;
+
+private:
+
+  std::deque<cbdfVerifyBatch_t*> pending;
+  uint32_t inFlight;
+  bool done;
+  boost::mutex mutex;
+  boost::condition_variable work;
+  boost::condition_variable space;
+};
+
+cbdfVerifyPipeline::cbdfVerifyPipeline()
+{
+    badEvents = 0;
+    inFlight = 0;
+    done = false;
+}
+
+void cbdfVerifyPipeline::submit(cbdfVerifyBatch_t* batch)
+{
+    boost::mutex::scoped_lock _lock(mutex);
+    while (inFlight >= CBDF_VERIFY_MAX_BATCHES)
+        space.wait(_lock);
+    inFlight++;
+    pending.push_back(batch);
+    work.notify_one();
+}
+
+void cbdfVerifyPipeline::finish()
+{
+    boost::mutex::scoped_lock _lock(mutex);
+    done = true;
+    work.notify_all();
+}
+
+// Worker thread: CRCs of whole batches, only damaged records are reported back
+void cbdfVerifyPipeline::check()
+{
+    while (true)
+    {
+        cbdfVerifyBatch_t* _batch;
+        {
+            boost::mutex::scoped_lock _lock(mutex);
+            while (pending.empty() && !done)
+                work.wait(_lock);
+            if (pending.empty())
+                return;
+            _batch = pending.front();
+            pending.pop_front();
+        }
+        std::vector<cbdfVerifyRange_t> _bad;
+        for (uint64_t i = 0; i < _batch->records.size(); i++)
+        {
+            const char* _record = _batch->base + _batch->records[i].first;
+            if (cbdf::checkEventRecord(_record) == 0)
+                continue;
+            cbdfVerifyRange_t _range;
+            _range.offset = _batch->records[i].second;
+            _range.size = cbdf::eventRecordSize(_record);
+            _range.firstEvent = _range.lastEvent = ((const cbdf::cbdfEventHeader_t*) _record)->eventNumber;
+            _range.records = 1;
+            _range.error = CBDF_EVENT_CRC_ERROR;
+            _bad.push_back(_range);
+        }
+        delete _batch;
+        boost::mutex::scoped_lock _lock(mutex);
+        ranges.insert(ranges.end(), _bad.begin(), _bad.end());
+        badEvents += _bad.size();
+        inFlight--;
+        space.notify_one();
+    }
+}
+
+static bool rangeBefore(const cbdfVerifyRange_t &a, const cbdfVerifyRange_t &b)
+{
+    return a.offset < b.offset;
+}
+
+static double monotonicSeconds()
+{
+    struct timespec _ts;
+    clock_gettime(CLOCK_MONOTONIC, &_ts);
+    return _ts.tv_sec + _ts.tv_nsec * 1e-9;
+}
+
+// Header and dictionary block, true if they are intact and were skipped
+static bool checkHeader(cbdfRecordScanner &scanner, cbdf::cbdfFileHeader_t &header)
+{
+    const char* _data = scanner.peek(sizeof(header));
+    if (_data == NULL)
+        return false;
+    memcpy(&header, _data, sizeof(header));
+    if (header.openTag != 0xcbdfcbdf || header.closeTag != 0xcbdfcbdf)
+        return false;
+    if (!(header.features & CBDF_FEATURE_DICTIONARY))
+    {
+        scanner.skip(sizeof(header));
+        return true;
+    }
+    cbdf::cbdfBlockHeader_t _blockHeader;
+    cbdf::cbdfBlockTrailer_t _blockTrailer;
+    if ((_data = scanner.peek(sizeof(header) + sizeof(_blockHeader))) == NULL)
+        return false;
+    memcpy(&_blockHeader, _data + sizeof(header), sizeof(_blockHeader));
+    if (_blockHeader.openTag != 0xCBBDCBBD || _blockHeader.type != CBDF_BLOCK_DICTIONARY || _blockHeader.size > CBDF_DICTIONARY_MAX_SIZE)
+        return false;
+    uint64_t _size = sizeof(header) + sizeof(_blockHeader) + _blockHeader.size + sizeof(_blockTrailer);
+    if ((_data = scanner.peek(_size)) == NULL)
+        return false;
+    memcpy(&_blockTrailer, _data + _size - sizeof(_blockTrailer), sizeof(_blockTrailer));
+    if (!checkBlock(_blockHeader, std::string(_data + sizeof(header) + sizeof(_blockHeader), _blockHeader.size), _blockTrailer))
+        return false;
+    scanner.skip(_size);
+    return true;
+}
+
+// Every block the features announce has to be there
+static bool checkFooter(uint64_t features, const std::vector<cbdfFooterBlock_t> &blocks, uint64_t &summaryEvents)
+{
+    static const struct {
+        uint64_t feature;
+        uint32_t block;
+    } _expected[] = {
+        {CBDF_FEATURE_SUMMARY, CBDF_BLOCK_SUMMARY},
+        {CBDF_FEATURE_LINEAGE, CBDF_BLOCK_LINEAGE},
+        {CBDF_FEATURE_SOURCE_INDEX, CBDF_BLOCK_SOURCE_INDEX},
+    };
+    bool _ok = !(features & CBDF_FEATURE_FOOTER) || !blocks.empty();
+    for (uint32_t i = 0; i < sizeof(_expected) / sizeof(_expected[0]); i++)
+    {
+        if (!(features & _expected[i].feature))
+            continue;
+        bool _found = false;
+        for (uint32_t j = 0; j < blocks.size(); j++)
+            _found |= blocks[j].type == _expected[i].block;
+        _ok &= _found;
+    }
+    for (uint32_t j = 0; j < blocks.size(); j++)
+        if (blocks[j].type == CBDF_BLOCK_SUMMARY && blocks[j].payload.size() >= sizeof(cbdf::cbdfSummary_t))
+            memcpy(&summaryEvents, blocks[j].payload.data() + offsetof(cbdf::cbdfSummary_t, events), sizeof(summaryEvents));
+    return _ok;
+}
+
+/*
+ * The calling thread walks the records and hands them to the workers in
+ * batches; damaged stretches between records are reported right away,
+ * records with a bad CRC by the workers. Both are merged by offset at the
+ * end.
+ */
+int verifyFile(std::string fileName, cbdfVerifyReport_t &report, uint32_t threads)
+{
+    double _start = monotonicSeconds();
+    report.fileName = fileName;
+    report.status = 0;
+    report.headerOk = false;
+    report.trailerOk = false;
+    report.footerOk = false;
+    report.events = 0;
+    report.badEvents = 0;
+    report.summaryEvents = 0;
+    report.bytes = 0;
+    report.seconds = 0;
+    report.badRanges.clear();
+
+    std::vector<cbdfFooterBlock_t> _blocks;
+    uint64_t _dataEnd;
+    if (readFooter(fileName, _blocks, _dataEnd) < 0)
+        return report.status = CBDF_FILE_HEADER_ERROR;
+    cbdf::compressionType_t _compr = cbdf::guessCompression(fileName);
+    uint64_t _features = 0;
+    cbdf::readFileFeatures(fileName, _compr, _features);
+    if (!(_features & CBDF_FEATURE_FOOTER))
+        _dataEnd = 0;
+
+    // Uncompressed data is checked where it lies in the page cache
+    cbdfRecordScanner* _scanner;
+    cbdfInStream* _stream = NULL;
+    void* _map = MAP_FAILED;
+    uint64_t _mapSize = 0;
+    if (_compr == cbdf::none)
+    {
+        int _fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat _st;
+        if (_fd < 0 || fstat(_fd, &_st) != 0)
+        {
+            if (_fd >= 0)
+                close(_fd);
+            return report.status = CBDF_FILE_HEADER_ERROR;
+        }
+        _mapSize = _dataEnd ? _dataEnd : _st.st_size;
+        if (_mapSize)
+            _map = mmap(NULL, _mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+        close(_fd);
+        if (_mapSize && _map == MAP_FAILED)
+            return report.status = CBDF_FILE_HEADER_ERROR;
+        if (_mapSize)
+            madvise(_map, _mapSize, MADV_SEQUENTIAL);
+        _scanner = new cbdfRecordScanner(_mapSize ? (const char*) _map : "", _mapSize);
+    }
+    else
+    {
+        cbdf::cbdfIOOptions_t _options = {0, 0, true, 0, 0, 0, 0, 0};
+        _stream = openInStream(fileName, _compr, _options, _dataEnd);
+        if (_stream == NULL)
+            return report.status = CBDF_FILE_HEADER_ERROR;
+        _scanner = new cbdfRecordScanner(_stream);
+    }
+
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    cbdfVerifyPipeline _pipeline;
+    boost::thread_group _workers;
+    for (uint32_t i = 0; i < threads; i++)
+        _workers.create_thread(boost::bind(&cbdfVerifyPipeline::check, &_pipeline));
+
+    cbdf::cbdfFileHeader_t _header;
+    report.headerOk = checkHeader(*_scanner, _header);
+    std::vector<cbdfVerifyRange_t> _ranges;
+    bool _pendingGap = false;           // The last range waits for the event number behind it
+    uint64_t _lastEvent = 0;
+    uint64_t _records = 0;
+    bool _trailerSeen = false;
+    cbdfVerifyBatch_t* _batch = NULL;
+    while (true)
+    {
+        cbdfRecordScanner::item_t _item = _scanner->next();
+        if (_item.type == cbdfRecordScanner::endOfData)
+            break;
+        if (_item.type == cbdfRecordScanner::garbage)
+        {
+            cbdfVerifyRange_t _range;
+            _range.offset = _item.offset;
+            _range.size = _item.size;
+            _range.firstEvent = _lastEvent ? _lastEvent + 1 : 0;
+            _range.lastEvent = 0;
+            _range.records = 0;
+            _range.error = _item.error;
+            _ranges.push_back(_range);
+            _pendingGap = true;
+            continue;
+        }
+        if (_item.type == cbdfRecordScanner::fileTrailer)
+        {
+            const cbdf::cbdfFileTrailer_t* _trailer = (const cbdf::cbdfFileTrailer_t*) _item.data;
+            report.trailerOk = !_trailerSeen && report.headerOk && _trailer->features == _header.features && memcmp(_trailer->uuid, _header.uuid, sizeof(_header.uuid)) == 0;
+            _trailerSeen = true;
+            continue;
+        }
+
+        uint64_t _eventNumber = ((const cbdf::cbdfEventHeader_t*) _item.data)->eventNumber;
+        if (_pendingGap && _eventNumber > 0 && _eventNumber - 1 >= _ranges.back().firstEvent)
+            _ranges.back().lastEvent = _eventNumber - 1;
+        _pendingGap = false;
+        _lastEvent = _eventNumber;
+        _records++;
+        if (_batch == NULL)
+        {
+            _batch = new cbdfVerifyBatch_t;
+            _batch->base = (const char*) _map;
+            _batch->bytes = 0;
+        }
+        if (_scanner->mapped())
+            _batch->records.push_back(std::make_pair(_item.offset, _item.offset));
+        else
+        {
+            _batch->records.push_back(std::make_pair((uint64_t) _batch->storage.size(), _item.offset));
+            _batch->storage.append(_item.data, _item.size);
+        }
+        _batch->bytes += _item.size;
+        if (_batch->bytes >= CBDF_VERIFY_BATCH_SIZE)
+        {
+            if (!_scanner->mapped())
+                _batch->base = _batch->storage.data();
+            _pipeline.submit(_batch);
+            _batch = NULL;
+        }
+    }
+    if (_batch != NULL)
+    {
+        if (!_scanner->mapped())
+            _batch->base = _batch->storage.data();
+        _pipeline.submit(_batch);
+    }
+    _pipeline.finish();
+    _workers.join_all();
+    report.bytes = _scanner->offset();
+    delete _scanner;
+    delete _stream;
+    if (_map != MAP_FAILED)
+        munmap(_map, _mapSize);
+
+    // Neighbouring damage is one range
+    _ranges.insert(_ranges.end(), _pipeline.ranges.begin(), _pipeline.ranges.end());
+    std::sort(_ranges.begin(), _ranges.end(), rangeBefore);
+    for (uint64_t i = 0; i < _ranges.size(); i++)
+    {
+        if (!report.badRanges.empty() && report.badRanges.back().offset + report.badRanges.back().size == _ranges[i].offset)
+        {
+            cbdfVerifyRange_t &_last = report.badRanges.back();
+            _last.size += _ranges[i].size;
+            if (_last.firstEvent == 0)
+                _last.firstEvent = _ranges[i].firstEvent;
+            if (_ranges[i].lastEvent)
+                _last.lastEvent = _ranges[i].lastEvent;
+            _last.records += _ranges[i].records;
+        }
+        else
+            report.badRanges.push_back(_ranges[i]);
+    }
+    report.badEvents = _pipeline.badEvents;
+    report.events = _records - report.badEvents;
+    report.footerOk = checkFooter(_features, _blocks, report.summaryEvents);
+
+    if (!report.headerOk)
+        report.status = CBDF_FILE_HEADER_ERROR;
+    else if (!report.badRanges.empty())
+        report.status = report.badRanges.front().error;
+    else if (!report.trailerOk)
+        report.status = CBDF_UNEXPECTED_EOF;
+    else if (!report.footerOk)
+        report.status = CBDF_FOOTER_ERROR;
+    report.seconds = monotonicSeconds() - _start;
+    return report.status;
+}
+
+void printVerifyReport(const cbdfVerifyReport_t &report, std::ostream &out)
+{
+    out << "file=" << report.fileName << " status=" << report.status
+        << " header=" << (report.headerOk ? "ok" : "bad")
+        << " trailer=" << (report.trailerOk ? "ok" : "bad")
+        << " footer=" << (report.footerOk ? "ok" : "bad")
+        << " events=" << report.events << " bad=" << report.badEvents << " summary=" << report.summaryEvents
+        << " bytes=" << report.bytes << " seconds=" << report.seconds << "\n";
+    for (uint64_t i = 0; i < report.badRanges.size(); i++)
+    {
+        const cbdfVerifyRange_t &_range = report.badRanges[i];
+        out << "range file=" << report.fileName << " offset=" << _range.offset << " size=" << _range.size
+            << " first=" << _range.firstEvent << " last=" << _range.lastEvent
+            << " records=" << _range.records << " error=" << _range.error << "\n";
+    }
+}
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <vector>
 
 // Define Error Codes
 
@@ -27,28 +28,111 @@
 #define CBDF_EVENT_CRC_ERROR -4
 #define CBDF_UNEXPECTED_EOF -5
 #define CBDF_BANK_ERROR -6
+#define CBDF_FRAGMENT_LATE -7
+#define CBDF_FRAGMENT_DUPLICATE -8
+#define CBDF_UNSUPPORTED_FEATURE -9
+#define CBDF_FOOTER_ERROR -10
 
+/*
+ * Feature bits of the file header and trailer. Bits 0-31 are optional: a
+ * reader that does not know one can still read the file, it only misses a
+ * faster way to do so. Bits 32-55 are required: they change how events or
+ * banks are laid out, and files carrying a required bit the reader does not
+ * know are refused. The top 8 bits hold the version of this registry the
+ * writer used. Bits are never reassigned, files without any (version 0)
+ * predate the registry.
+ */
+#define CBDF_FEATURE_REGISTRY_VERSION 1
+#define CBDF_FEATURES_OPTIONAL 0x00000000ffffffffULL
+#define CBDF_FEATURES_REQUIRED 0x00ffffff00000000ULL
+#define CBDF_FEATURES_VERSION_SHIFT 56
+
+#define CBDF_FEATURE_FOOTER 0x1ULL  // Footer blocks follow the file trailer, compressed data ends before them
+#define CBDF_FEATURE_SUMMARY 0x2ULL // One of them holds the event statistics of the file
+#define CBDF_FEATURE_LINEAGE 0x4ULL // One of them lists the uuids of the files the events were copied from
+#define CBDF_FEATURE_SOURCE_INDEX 0x8ULL // One of them maps each event to its event number and offset in the file it was copied from
+
+#define CBDF_FEATURE_ALIGN16 0x100000000ULL // Bank data starts 16 byte aligned, banks are preceded by zero padding
+#define CBDF_FEATURE_ALIGN32 0x200000000ULL // Same for 32 bytes
+#define CBDF_FEATURE_ALIGN64 0x400000000ULL // Same for 64 bytes
+#define CBDF_FEATURE_BANK_CODECS 0x800000000ULL // Banks may be filtered and compressed one by one, see setBankCodec()
+#define CBDF_FEATURE_DICTIONARY 0x1000000000ULL // A zstd dictionary block follows the file header, see setDictionary()
+#define CBDF_FEATURE_EVENT_ZSTD 0x2000000000ULL // Event payloads are zstd frames behind their uncompressed size, see setEventCompression()
+#define CBDF_FEATURE_EVENT_CODECS 0x4000000000ULL // Event payloads are stored behind their uncompressed size and codec, see setAdaptiveCompression()
+
+#define CBDF_FEATURES_KNOWN (CBDF_FEATURE_FOOTER | CBDF_FEATURE_SUMMARY | CBDF_FEATURE_LINEAGE | CBDF_FEATURE_SOURCE_INDEX | CBDF_FEATURE_ALIGN16 | CBDF_FEATURE_ALIGN32 | CBDF_FEATURE_ALIGN64 | CBDF_FEATURE_BANK_CODECS | CBDF_FEATURE_DICTIONARY | CBDF_FEATURE_EVENT_ZSTD | CBDF_FEATURE_EVENT_CODECS)
+
+#define CBDF_BANK_FLAGS_RESERVED 0xff00 // Bank user flag bits kept by the library in files with bank codecs
+
+class cbdfAllocator;
+class cbdfInStream;
+class cbdfOutStream;
+class cbdfSummaryBuilder;
+class cbdfBankCoder;
+class cbdfCompressionController;
 
 
 class cbdf
 {
+public:
+
+  // Enums to enhance readability of code
+
+  enum fileAccessMode_t {readMode=0,writeMode=1};
+  enum compressionType_t {none=0,gzip=1,bzip2=3,xz=4,lzo=5};
+  enum dumpMode_t {ascii=0,hex=1};
+  enum bankCodec_t {bankRaw=0,bankDeflate=1,bankLZ4=2,bankZstd=3};
+  enum bankFilter_t {filterDelta=1,filterByteShuffle=2,filterBitShuffle=4};
+
+  // On-disk structures, defined in cbdfFormat.h
+
+  struct cbdfFileHeader_t;
+  struct cbdfFileTrailer_t;
+  struct cbdfEventHeader_t;
+  struct cbdfEventTrailer_t;
+  struct cbdfBankHeader_t;
+  struct cbdfBlockHeader_t;
+  struct cbdfBlockTrailer_t;
+  struct cbdfSummary_t;
+  struct cbdfCheckpoint_t;
+
+  // Page cache and block allocation hints for the underlying files, 0 disables an option
+
+  struct cbdfIOOptions_t{
+      uint64_t preallocate;       // Reserve this many bytes when an output file is created
+      uint64_t writebackInterval; // Write out and drop written data every this many bytes
+      bool sequential;            // Advise sequential access on input files
+      uint64_t dropBehind;        // Drop read data from the page cache every this many bytes
+      uint32_t queueDepth;        // io_uring requests in flight per file, 0 uses blocking read/write
+      uint32_t blockSize;         // Size of each io_uring request
+      uint32_t compressThreads;   // Compress output blocks as independent streams on this many threads, 0 or 1 compresses inline
+      uint64_t compressBlockSize; // Data per independently compressed block
+  };
+
+  // Cost and reach of the checkpoints taken since the file was opened
+
+  struct cbdfCheckpointStats_t{
+      uint64_t checkpoints;
+      uint64_t fileSize;          // Durable part of the file at the last one
+      uint64_t lastEventNumber;   // Last event it covers
+      uint64_t codecNs;           // Spent ending compressed streams, summed over all checkpoints
+      uint64_t syncNs;            // Spent in fdatasync and writing checkpoint records
+      uint64_t maxNs;             // Longest checkpoint
+  };
+
 private:
 
   // Structural components
 
-  struct cbdfFileHeader_t;
   cbdfFileHeader_t *wFileHeader,*rFileHeader;
-  struct cbdfFileTrailer_t;
   cbdfFileTrailer_t *wFileTrailer,*rFileTrailer;
-  struct cbdfEventHeader_t;
   cbdfEventHeader_t *wEventHeader,*rEventHeader;
-  struct cbdfEventTrailer_t;
   cbdfEventTrailer_t *wEventTrailer,*rEventTrailer;
-  struct cbdfBankHeader_t;
   cbdfBankHeader_t *wBankHeader,*rBankHeader;
   
   // Buffers
 
+  cbdfAllocator* allocator;
   char* eventBufferBase;
   char* readBufferPtr;
   char* payloadBase;
@@ -62,13 +146,93 @@ private:
   uint64_t payloadSize;
   uint64_t bytesBuffered;
   std::string currentFileName;
+  uint64_t rStreamOffset;           // Bytes read from the uncompressed input so far
+  uint64_t rEventOffset;            // Where the current event record starts in it
+  std::string rPending;             // Input handed back by scanForNextEvent(), read before the stream
+  uint64_t rPendingPos;
+  bool rFramed;                     // Tags and sizes of the last record read agreed
   
   bool eventBuffered;
 
+  // Follow mode (read a file that is still being written)
+
+  bool followMode;
+  uint32_t followTimeout;
+  int followFd;
+
+  // File rotation (split a run into chunks of limited size, event count or duration)
+
+  struct cbdfRotator_t;
+  cbdfRotator_t *rotator;
+  uint64_t rotationBytes;
+  uint64_t rotationEvents;
+  uint32_t rotationSeconds;
+  uint64_t chunkBytes;
+  uint64_t chunkEvents;
+  uint64_t chunkStart;
+  uint32_t rotationChunk;
+  std::string rotationBaseName;
+
+  // Checkpoints (make the file durable and recoverable up to the last event now and then)
+
+  uint64_t checkpointBytes;
+  uint32_t checkpointSeconds;
+  uint64_t checkpointAt;            // chunkBytes at the last checkpoint
+  uint64_t checkpointTime;
+  cbdfCheckpointStats_t checkpointStats;
+  compressionType_t wCompression;   // Of the file being written, checkpoints can not end lzo streams
+
   // File I/O streams
 
-  void *cbdfInFile; // really boost::iostreams::filtering_istream *cbdfInFile;
-  void *cbdfOutFile; // really boost::iostreams::filtering_ostream *cbdfOutFile;
+  cbdfInStream *cbdfInFile;
+  cbdfOutStream *cbdfOutFile;
+  cbdfIOOptions_t ioOptions;
+
+  // Event statistics written to the summary footer
+
+  cbdfSummaryBuilder *summary;
+  bool summaryEnabled;
+  bool summaryRequested;            // Set by setSummary(), otherwise only uncompressed files get a summary
+  std::vector<std::string> parentUuids;
+  std::string sourceUuid;           // Source index of the current chunk, empty when not kept
+  std::string sourceIndex;
+  std::string sourcePending;         // Entry for the next event, added to the index once that is written
+
+  // Alignment of bank data relative to the event header, 0 for packed banks
+
+  uint32_t wBankAlignment;
+  uint32_t rBankAlignment;
+  bool wForeignBankCodecs;          // Records copied from a file with bank codecs may carry encoded banks
+
+  // Per bank compression. Decompressed banks of the current event share one buffer
+
+  struct cbdfCodecRule_t{
+      char name[12];              // All zero for the default rule
+      uint32_t codec;
+      int level;
+      bool codecSet;              // Otherwise the codec and level of the default rule apply
+      uint16_t filter;            // Pre-filter bits as stored in the bank user flags
+  };
+  std::vector<cbdfCodecRule_t> codecRules;
+  cbdfBankCoder *coder;
+  char* filterBufferBase;           // Scratch space of the pre-filters
+  uint64_t filterBufferSize;
+  bool rBankCodecs;
+  std::map<std::string, uint32_t> bankIndex; // Directory index of each bank in bankMap, only kept for files with bank codecs
+  char* decodeBufferBase;
+  uint64_t decodeBufferSize;
+  uint64_t decodeBufferUsed;
+  uint64_t decodeBufferNeeded;      // Room all compressed banks of the current event take
+
+  // Whole event compression with a zstd dictionary shared by all events of a file
+
+  std::string wDictionary;
+  std::string rDictionary;
+  bool wEventZstd;
+  int wEventLevel;
+  bool rEventZstd;
+  cbdfCompressionController *controller; // Only in adaptive mode
+  bool rEventCodecs;
 
   // Utility functions
 
@@ -83,13 +247,32 @@ private:
 
   //Private Methods
 
-  int resizeEventbuffer();
+  int resizeEventbuffer(uint64_t requiredSize, uint64_t keepBytes);
 
   int writeFileHeader();
   int writeFileTrailer();
+  uint64_t writeRecord(const char* eventRecord);
+  uint64_t layoutFeatures();
+  int unpackEvent();
+  void buildFooter(std::string &footer, uint64_t timeStop);
 
   int readFileHeader();
   int readFileTrailer();
+  int readRecord(bool checkCrc);
+
+  bool rotationEnabled();
+  std::string chunkFileName(uint32_t chunk);
+  void startRotator(int compr);
+  void stopRotator();
+  int checkRotation();
+  int rotateFile();
+
+  bool checkpointsEnabled();
+  int checkCheckpoint();
+  int resumeFile(std::string fileName, bool adoptLayout);
+
+  int readStream(char* buffer, uint64_t size);
+  void waitForData(uint32_t timeoutMs);
 
   // Integrity checks
   uint32_t crc32();
@@ -101,16 +284,14 @@ private:
 
   int checkEvent();
 
+  int parseBankDirectory();
+  int decodeBank(uint32_t index);
+  uint32_t codecRule(const std::string &bankName);
+  char* filterBuffer(uint64_t size);
 
 
 public:
 
-  // Enums to enhance readability of code
-
-  enum fileAccessMode_t {readMode=0,writeMode=1};
-  enum compressionType_t {none=0,gzip=1,bzip2=3,xz=4,lzo=5};
-  enum dumpMode_t {ascii=0,hex=1};
-
   // Struct for public access to the event data
 
 #pragma pack(4) // Enforce 32 Bit alignment for ondisk format
@@ -125,41 +306,91 @@ public:
   typedef std::pair<std::string,cbdfBankMapEntry_t> bankPair_t;
   typedef std::map<std::string, cbdfBankMapEntry_t> bankMap_t;
   typedef std::map<std::string, cbdfBankMapEntry_t>::iterator bankMapIt_t;
-  bankMap_t bankMap;
+  typedef std::vector<cbdfBankMapEntry_t> bankDirectory_t;
+  bankMap_t bankMap; // Direct access gives encoded banks as stored, use getBank() or getBanks()
+  bankDirectory_t bankDirectory; // Banks of the current event in on-disk order
 
   fileAccessMode_t fileAccessMode;
 
-  // Constructor
+  // Constructor, buffers are taken from the shared default pool unless an allocator is given
 
-  cbdf(uint64_t _eventBufferSize=1048576);
+  cbdf(uint64_t _eventBufferSize=1048576, cbdfAllocator* _allocator=NULL);
 
   // File Handling
 
   int fileOpen(std::string filename, fileAccessMode_t mode=readMode, compressionType_t=none );
   int fileClose();
+  int flush(); // Push buffered events to the file, e.g. for readers in follow mode. -1 if the file could not be written
+  int setCheckpoints(uint64_t intervalBytes, uint32_t intervalSeconds=0); // Take a checkpoint every this many bytes of events or seconds, 0 disables a limit
+  int checkpoint(); // Make all events written so far durable and record them in the sidecar <file>.ckpt
+  int getCheckpointStats(cbdfCheckpointStats_t &stats);
+  int fileResume(std::string fileName); // Continue a file that was not closed after its last checkpoint, fileName as on disk
+  static int recoverFile(std::string fileName, uint64_t &events); // Close a file that was not closed at its last checkpoint, events is what it keeps
+  int setFollowMode(bool follow, uint32_t idleTimeoutMs=0); // Wait for more data instead of failing at the end of the file, 0 waits forever
+  int setRotation(uint64_t maxBytes, uint64_t maxEvents=0, uint32_t maxSeconds=0); // Continue in a new file <name>_NNNN once a limit is hit, 0 disables a limit
+  int setWriteOptions(uint64_t preallocateBytes, uint64_t writebackInterval=0); // Preallocate output files and write them back while they grow, 0 disables an option
+  int setReadOptions(bool sequential=true, uint64_t dropBehind=0); // Readahead hint and page cache drop-behind for input files
+  int setAsyncIO(uint32_t queueDepth, uint32_t blockSize=1048576); // Read ahead and write behind with io_uring, falls back to blocking I/O where unavailable
+  int setCompressionThreads(uint32_t threads, uint64_t blockSize=8388608); // Compress gzip, bzip2 and xz output in blocks of this size on several threads, each block a stream of its own
+  int setSummary(bool enable); // Store event counts, user flag and bank statistics behind the file trailer (default on for uncompressed files, gzip, bzip2 and xz tools take it for trailing garbage)
+  int setBankAlignment(uint32_t alignment); // Pad banks so their data starts 16, 32 or 64 byte aligned in memory, 0 packs them (default)
+  uint32_t getBankAlignment(); // Of the open file
+  int setBankCodec(std::string bankName, bankCodec_t codec, int level=0); // Compress banks of this name, "" for all banks without a rule of their own. -1 if the codec is not compiled in
+  int setBankFilter(std::string bankName, uint32_t filters, uint32_t elementSize); // Or'ed bankFilter_t run on elements of 1, 2, 4 or 8 bytes before the codec, delta first. Without setBankCodec() for the name the "" codec applies
+  int setDictionary(const std::string &dictionary); // zstd dictionary for event compression and zstd banks, stored behind the file header. -1 without zstd
+  int setEventCompression(bool enable, int level=0); // Compress every event payload as one zstd frame, readers still see the uncompressed payload. -1 without zstd
+  int setAdaptiveCompression(bool enable, double targetBacklog=0.25, double cpuBudget=0.5); // Compress events with a codec and level picked per event, stepping down while the backlog or the time spent compressing exceed their targets
+  int reportBacklog(double fill); // Fill level 0..1 of the queue feeding this writer, cbdfMultiWriter and cbdfEventBuilder report theirs
+  int getEventCompression(bankCodec_t &codec, int &level); // Setting the next event is compressed with
+  static int trainDictionary(const std::vector<std::string> &samples, uint32_t maxSize, std::string &dictionary); // From sample payloads, e.g. of getRawData()
 
   // Write access methods
   int clearEvent(); //Resets pointer of event buffer without incrementing the eventcounter
   int writeEvent(); //Write event and increment eventcounter;
   int setEventUserFlags(uint64_t userFlags);
   int addBank(const char* name, uint16_t userFlags, char* dataPointer, uint32_t dataSize);
-  int addRawData(char* bankPointer, uint32_t bankSize);
+  int addRawData(char* bankPointer, uint32_t bankSize); // Copied as is, with aligned banks it has to carry the padding itself
+  int writeEventRecord(const char* eventRecord); // Write a finished header+payload+trailer record, keeping its event number. Its banks must use the alignment of the file
+  int setLayoutFeatures(uint64_t features, const std::string &dictionary=std::string()); // Take over bank alignment, bank codecs and the dictionary (getDictionary()) of the file records are copied from with writeEventRecord()
+  int addParentUuid(std::string uuid); // Record a file the events were copied from in the lineage footer
+  int setSourceIndex(std::string uuid); // Keep a footer index of the event number and offset each written event has in this source file
+  int addSourceIndexEntry(uint64_t eventNumber, uint64_t offset); // For the next event written, e.g. getEventNumber() and getEventOffset() of the reader. Dropped if that write fails
 
   // Read access methods
   int readEvent();
+  int readEventRecord(const char* &record, bool checkCrc=true); // Next event as header+payload+trailer record without building the bank directory, valid until the next read
+  int parseBanks(); // Build the bank directory of an event read with readEventRecord(), the record itself is not changed
   int skipEvents(int);
-  cbdfBankMapEntry_t getBank(std::string bankName);
-  bankMapIt_t getBanks();
-  int getRawData(char* dataPointer, uint64_t &dataSize);
+  cbdfBankMapEntry_t getBank(std::string bankName); // Compressed or filtered banks are decoded on the first call, one that fails to decode comes back with dataPtr NULL and size 0
+  cbdfBankMapEntry_t getBankAt(uint32_t index); // Entry of the bank directory, decoded like getBank()
+  bankMapIt_t getBanks(); // Start of bankMap with all banks decoded like getBank(), only then does iterating it give their data
+  const bankDirectory_t& getBankDirectory(); // Encoded banks keep their codec and filter bits in the user flags until they were decoded
+  int getRawData(char* dataPointer, uint64_t &dataSize); // Copy the payload of the current event, dataPointer has to hold getEventSize() bytes
   uint64_t getEventNumber();
   uint64_t getEventUserFlags();
   uint64_t getEventSize();
+  uint64_t getEventOffset(); // Of the current event record in the uncompressed data of the file
 
   char* getUuid();
+  uint64_t getFileStartTime();
   std::string getFileName();
+  static compressionType_t guessCompression(std::string fileName); // From the extension fileOpen appends
+
+  // Feature negotiation
+  uint64_t getFileFeatures(); // Feature bits of the open file, including the registry version
+  const std::string& getDictionary(); // zstd dictionary stored in the file being read, empty without one
+  static int readFileFeatures(std::string fileName, compressionType_t compr, uint64_t &features); // Only reads the file header, CBDF_UNSUPPORTED_FEATURE if the file can not be read by this version
+  static uint64_t unsupportedFeatures(uint64_t features); // Required bits this version does not know
+  static std::string describeFeatures(uint64_t features); // e.g. "v1 footer summary"
+  static int readLineage(std::string fileName, std::vector<std::string> &parentUuids); // From the lineage footer, -1 if there is none
+  static int readSourceIndex(std::string fileName, std::string &uuid, std::vector<std::pair<uint64_t, uint64_t> > &entries); // (event number, offset) per event in file order, -1 if there is none
+
+  // Event records as read by readEventRecord() and written by writeEventRecord()
+  static uint64_t eventRecordSize(const char* record);
+  static int checkEventRecord(const char* record); // Tags, sizes and CRC
   
   // Error handling functions
-  int scanForNextEvent();
+  int scanForNextEvent(); // After a read error, move on to the next intact event record or the file trailer. CBDF_UNEXPECTED_EOF if there is none
 
   // Debug function
   void printFileHeader();
@@ -0,0 +1,98 @@
+/*
+ * cbdfBufferPool.h
+ *
+ *  Pluggable allocators for the event buffers of cbdf instances
+ */
+
+#ifndef CBDFBUFFERPOOL_H_
+#define CBDFBUFFERPOOL_H_
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+/*
+ * Interface used by cbdf to obtain and hand back its event buffer.
+ * allocate() may round the requested size up and reports the granted size
+ * back through its argument. Buffer contents are undefined on allocation.
+ */
+class cbdfAllocator
+{
+public:
+  virtual char* allocate(uint64_t &size) = 0;
+  virtual void release(char* buffer, uint64_t size) = 0;
+  virtual ~cbdfAllocator() {}
+};
+
+/*
+ * Thread safe pool of page aligned buffers. Sizes are rounded up to a power
+ * of two number of pages, released buffers are kept on a free list per size
+ * and handed out again to the next instance asking for that size. At most
+ * maxCachedBytes are kept idle, everything above is returned to the system.
+ *
+ * A pool can be bound to a NUMA node (requires libnuma at compile time), all
+ * of its buffers are then placed and prefaulted on that node when they are
+ * first mapped. Use one pool per socket for writers pinned to that socket.
+ */
+class cbdfBufferPool : public cbdfAllocator
+{
+public:
+
+  enum hugePageMode_t {noHugePages=0, transparentHugePages=1, explicitHugePages=2};
+
+  struct cbdfPoolStats_t {
+      uint64_t allocations;     // Calls to allocate()
+      uint64_t poolHits;        // Allocations served from the free list
+      uint64_t systemAllocations;
+      uint64_t systemReleases;
+      uint64_t bytesMapped;     // Bytes currently mapped by the pool, idle or in use
+      uint64_t bytesCached;     // Idle bytes on the free lists
+      uint64_t hugePageBytes;   // Mapped bytes backed (explicit) or advised (transparent) as huge pages
+      uint64_t hugePageFallbacks; // Explicit huge page mappings that fell back to normal pages
+      uint64_t pagesSampled;    // Pages whose placement was checked by stats()
+      uint64_t pagesLocal;      // Sampled pages residing on the requested node
+      uint64_t pagesRemote;     // Sampled pages residing on another node
+  };
+
+  cbdfBufferPool(uint64_t maxCachedBytes=268435456, hugePageMode_t hugePageMode=noHugePages, int numaNode=-1);
+
+  // Pool shared by all cbdf instances that are not given an allocator
+  static cbdfBufferPool* defaultPool();
+
+  char* allocate(uint64_t &size);
+  void release(char* buffer, uint64_t size);
+
+  // Return all idle buffers to the system
+  void trim();
+
+  // Counters, page placement of the mapped buffers is sampled on each call
+  cbdfPoolStats_t stats();
+
+  virtual ~cbdfBufferPool();
+
+private:
+
+  typedef std::map<uint64_t, std::vector<char*> > freeList_t;
+  struct cbdfMapping_t {
+      uint64_t size;
+      bool hugePages;
+  };
+  typedef std::map<char*, cbdfMapping_t> mappedList_t;
+
+  uint64_t roundSize(uint64_t size);
+  char* systemAllocate(uint64_t size);
+  void systemRelease(char* buffer, uint64_t size);
+  void samplePlacement(cbdfPoolStats_t &poolStats);
+
+  boost::mutex poolMutex;
+  freeList_t freeList;
+  mappedList_t mappedList;
+  cbdfPoolStats_t poolStats;
+  uint64_t maxCachedBytes;
+  uint64_t pageSize;
+  hugePageMode_t hugePageMode;
+  int numaNode;
+};
+
+#endif /* CBDFBUFFERPOOL_H_ */
@@ -0,0 +1,60 @@
+/*
+ * cbdfCatalogue.h
+ *
+ *  Event catalogue of a cbdf file built from the event headers and trailers
+ *  only, without reading or checking the payloads
+ */
+
+#ifndef CBDFCATALOGUE_H_
+#define CBDFCATALOGUE_H_
+
+#include <cbdf.h>
+#include <map>
+#include <string>
+#include <ostream>
+
+#define CBDF_CATALOGUE_SIZE_BINS 65
+#define CBDF_CATALOGUE_MAX_FLAGS 1024 // Distinct user flag values counted individually
+
+struct cbdfCatalogue_t {
+    std::string fileName;
+    std::string uuid;
+    uint64_t features;              // Feature bits of the file header
+    uint64_t timeStart;
+    uint64_t timeStop;              // 0 if the file has no trailer
+    uint64_t events;
+    uint64_t firstEvent;
+    uint64_t lastEvent;
+    uint64_t payloadBytes;          // As stored, i.e. compressed in files with event compression unless taken from a summary
+    uint64_t minEventSize;
+    uint64_t maxEventSize;
+    uint64_t sizeHistogram[CBDF_CATALOGUE_SIZE_BINS]; // Bin i counts payload sizes in [2^(i-1), 2^i), bin 0 empty events
+    std::map<uint64_t, uint64_t> userFlags;          // Events per user flag value
+    uint64_t otherUserFlags;        // Events with flag values beyond CBDF_CATALOGUE_MAX_FLAGS distinct ones
+    std::map<std::string, uint64_t> banks; // Occurrences per bank name, only known from a file summary
+    uint64_t otherBanks;
+    bool complete;                  // The file trailer was reached
+    bool fromSummary;               // Taken from the summary footer instead of a scan
+    int status;                     // 0 or the error that stopped the scan
+};
+
+/*
+ * Catalogue a file, taking the fastest path its features allow. Files
+ * written with a summary footer (CBDF_FEATURE_SUMMARY) only have their
+ * header and last few KB read, with first/lastEvent being the lowest and
+ * highest event number. Otherwise the event headers are walked: payloads of
+ * uncompressed files are seeked over, compressed files still have to be
+ * decompressed but nothing is copied or checksummed. Returns
+ * catalogue.status; a catalogue of the events up to an error is filled in
+ * either way. Files with required features this version does not know give
+ * CBDF_UNSUPPORTED_FEATURE.
+ */
+int scanCatalogue(std::string fileName, cbdfCatalogue_t &catalogue, bool useSummary=true); // Compression is taken from the file extension
+int scanCatalogue(std::string fileName, cbdf::compressionType_t compression, cbdfCatalogue_t &catalogue, bool useSummary=true);
+
+// Read only the summary footer of a file, -1 if it has none
+int readFileSummary(std::string fileName, cbdfCatalogue_t &catalogue);
+
+void printCatalogue(const cbdfCatalogue_t &catalogue, std::ostream &out, bool printUserFlags=true);
+
+#endif /* CBDFCATALOGUE_H_ */
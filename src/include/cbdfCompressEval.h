@@ -0,0 +1,45 @@
+/*
+ * cbdfCompressEval.h
+ *
+ *  Compression ratio and speed of the available codecs measured on events
+ *  sampled from a cbdf file
+ */
+
+#ifndef CBDFCOMPRESSEVAL_H_
+#define CBDFCOMPRESSEVAL_H_
+
+#include <cbdf.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define CBDF_EVAL_MAX_BANKS 64 // Distinct bank names evaluated separately
+
+struct cbdfEvalResult_t {
+    std::string codec;          // Codec and level, e.g. "xz-6" or "zstd-3"
+    std::string bank;           // Empty for whole events
+    bool stream;                // A fileOpen() stream codec, else a bank/event codec
+    uint64_t items;             // Blocks, events or banks compressed
+    uint64_t rawBytes;
+    uint64_t compressedBytes;   // Items that do not shrink count with their raw size, as the writer stores them
+    double compressSeconds;     // CPU time of the thread running the codec
+    double decompressSeconds;
+    bool failed;                // The codec failed or did not give back the input
+};
+
+/*
+ * Sample up to maxEvents events spread over fileName and run every codec
+ * and level compiled in on them, in parallel on threads threads (0: one
+ * per core). Stream codecs (none, gzip, bzip2, xz, lzo) compress blocks of
+ * blockSize bytes of event records the way they appear in a file; the codecs
+ * of setBankCodec() and setEventCompression() compress each event payload
+ * on its own. With perBank the same is repeated on the data of each bank
+ * name, for stream codecs on blocks of that bank's data only. Returns 0 or
+ * the error of opening or reading the file; results are ordered by bank,
+ * then codec.
+ */
+int evaluateCompression(std::string fileName, std::vector<cbdfEvalResult_t> &results, uint64_t maxEvents=2000, uint32_t threads=0, bool perBank=true, uint64_t blockSize=1048576);
+
+void printEvaluation(const std::vector<cbdfEvalResult_t> &results, std::ostream &out);
+
+#endif /* CBDFCOMPRESSEVAL_H_ */
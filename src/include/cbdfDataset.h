@@ -0,0 +1,91 @@
+/*
+ * cbdfDataset.h
+ *
+ *  A list of cbdf files read as one logical event stream
+ */
+
+#ifndef CBDFDATASET_H_
+#define CBDFDATASET_H_
+
+#include <cbdf.h>
+#include <vector>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+/*
+ * Reads a set of files, e.g. the chunks of a rotated run or the outputs of
+ * several writers, as one stream of events.
+ *
+ * sequential:  files are read one after the other in the order they were
+ *              added (glob matches are added sorted by name). The next file
+ *              is opened and its first event read on a background thread
+ *              while the current file is consumed.
+ * eventNumber: all files are open at once and events are merged in
+ *              ascending event number. open() opens them on up to one
+ *              thread per core.
+ *
+ * After readEvent() the event is accessed through the cbdf instance returned
+ * by getFile(), which also gives the uuid and name of the file it came from.
+ */
+class cbdfDataset
+{
+public:
+
+  enum mergeMode_t {sequential=0, eventNumber=1};
+
+  struct cbdfDatasetFile_t {
+      std::string fileName;
+      cbdf::compressionType_t compression;
+      std::string uuid;         // Filled once the file has been opened
+      uint64_t timeStart;       // Filled once the file has been opened
+      uint64_t eventsRead;
+      int status;               // Last return code of fileOpen()/readEvent() for this file
+  };
+
+  cbdfDataset(mergeMode_t mergeMode=sequential);
+
+  // Compression is taken from the file extension
+  int addFile(std::string fileName);
+  int addFile(std::string fileName, cbdf::compressionType_t compression);
+  int addGlob(std::string pattern);
+
+  int open();
+  int close();
+
+  // Returns 0 for an event, CBDF_EOF after the last event of the last file or an error of the current file
+  int readEvent();
+
+  cbdf* getFile();
+  int getFileIndex();
+  const std::vector<cbdfDatasetFile_t>& getFiles();
+
+  virtual ~cbdfDataset();
+
+private:
+
+  struct cbdfOpenFile_t {
+      cbdf* reader;
+      int firstResult;      // Result of the read done ahead, returned by the next readEvent()
+      bool pending;
+  };
+
+  void openFile(int index, cbdfOpenFile_t *openFile);
+  void openWorker(boost::atomic<uint32_t> *next);
+  void startPrefetch(int index);
+  void finishPrefetch();
+
+  int readSequential();
+  int readMerged();
+
+  mergeMode_t mergeMode;
+  std::vector<cbdfDatasetFile_t> files;
+  std::vector<cbdfOpenFile_t> openFiles;  // eventNumber mode: one per file, sequential: current file only
+  int currentIndex;
+
+  boost::thread prefetchThread;
+  cbdfOpenFile_t prefetched;
+  int prefetchIndex;
+};
+
+#endif /* CBDFDATASET_H_ */
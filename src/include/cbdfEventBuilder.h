@@ -0,0 +1,107 @@
+/*
+ * cbdfEventBuilder.h
+ *
+ *  Assemble events from fragments delivered by several sources
+ */
+
+#ifndef CBDFEVENTBUILDER_H_
+#define CBDFEVENTBUILDER_H_
+
+#include <cbdf.h>
+#include <cbdfMultiWriter.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+/*
+ * Collects the fragments that up to 64 sources (detector subsystems)
+ * deliver for the same event number and writes them as one event. A
+ * fragment is a sequence of banks in the layout addBank() produces and is
+ * copied once, straight into the event being assembled; reserveFragment()
+ * lets a source fill it in place without any copy. If the writer aligns its
+ * banks (cbdf::setBankAlignment()), addBank() pads them accordingly while
+ * raw fragments are taken as they are.
+ *
+ * Events are kept in a reorder window of windowSize consecutive event
+ * numbers, each slot with its own lock, so sources working on different
+ * events do not contend. An event is written, in event number order and
+ * keeping its event number, once all sources reported or timeoutMs after its
+ * first fragment arrived. A source running a full window ahead waits for
+ * the oldest event to be written. Incomplete events get incompleteFlag
+ * or'ed into their user flags, event numbers no source reported are
+ * skipped once a later event timed out.
+ *
+ * All methods are thread safe. The cbdf writer must be open in writeMode and
+ * is only used by the builder until it is destroyed.
+ */
+class cbdfEventBuilder
+{
+public:
+
+  struct cbdfBuilderStats_t {
+      uint64_t eventsBuilt;
+      uint64_t eventsIncomplete;
+      uint64_t eventsSkipped;     // Event numbers no source ever reported
+      uint64_t fragmentsLate;     // Fragments for events already written
+      uint64_t fragmentsDuplicate;
+  };
+
+  cbdfEventBuilder(cbdf* writer, uint32_t nSources, uint32_t windowSize=256, uint32_t timeoutMs=100, uint64_t firstEventNumber=1, uint64_t incompleteFlag=0);
+
+  int addFragment(uint32_t source, uint64_t eventNumber, const char* banks, uint32_t size, uint64_t userFlags=0);
+  int addBank(uint32_t source, uint64_t eventNumber, const char* name, uint16_t bankFlags, const char* data, uint32_t size); // A fragment of one bank
+
+  // Zero copy: returns space for size bytes of banks inside the event. The event stays locked until
+  // commitFragment(), the calling thread must not use the builder in between.
+  char* reserveFragment(uint32_t source, uint64_t eventNumber, uint32_t size);
+  int commitFragment(uint32_t source, uint64_t eventNumber, uint64_t userFlags=0); // -1 unless the calling thread reserved this fragment
+
+  int expire(); // Write events whose timeout passed, call periodically if sources can go quiet
+  int flush();  // Write all pending events, complete or not
+
+  cbdfBuilderStats_t stats();
+
+  virtual ~cbdfEventBuilder();
+
+private:
+
+  struct cbdfSlot_t {
+      boost::mutex mutex;
+      bool active;
+      uint64_t eventNumber;
+      uint64_t sourceMask;
+      uint64_t userFlags;
+      uint64_t firstArrival;
+      uint32_t reservedSource;  // Source of the fragment reserveFragment() handed out
+      cbdfEventBuffer* event;
+  };
+
+  cbdfSlot_t* lockSlot(uint64_t eventNumber, int &status);
+  cbdfSlot_t* lockFragment(uint32_t source, uint64_t eventNumber);
+  int fragmentDone(cbdfSlot_t* slot, uint32_t source, uint64_t userFlags);
+  int drain(uint64_t forceBelow, bool block);
+  bool headExpired(uint64_t eventNumber, uint64_t &nextActive);
+  int emit(cbdfSlot_t* slot);
+  static uint64_t nowMs();
+  static void keepSlot(cbdfSlot_t*);
+
+  cbdf* writer;
+  uint32_t nSources;
+  uint64_t allSources;
+  uint32_t windowSize;
+  uint32_t timeoutMs;
+  uint64_t incompleteFlag;
+
+  cbdfSlot_t* slots;
+  boost::thread_specific_ptr<cbdfSlot_t> reserved; // Slot the calling thread holds between reserveFragment() and commitFragment()
+  boost::mutex emitMutex;
+  boost::condition_variable windowMoved;
+  boost::atomic<uint64_t> nextEmit;
+  boost::atomic<uint64_t> highestSeen;
+
+  cbdfBuilderStats_t builderStats;
+  boost::mutex statsMutex;
+};
+
+#endif /* CBDFEVENTBUILDER_H_ */
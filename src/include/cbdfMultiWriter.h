@@ -0,0 +1,114 @@
+/*
+ * cbdfMultiWriter.h
+ *
+ *  Several producer threads writing into one cbdf output stream
+ */
+
+#ifndef CBDFMULTIWRITER_H_
+#define CBDFMULTIWRITER_H_
+
+#include <cbdf.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/*
+ * A standalone event under construction. Banks are laid out exactly as
+ * cbdf::addBank() does it, finish() adds the event header and trailer
+ * (including the CRC) so that the buffer holds a complete event record.
+ * Each producer thread fills its own buffer, no locking is involved.
+ */
+class cbdfEventBuffer
+{
+public:
+
+  cbdfEventBuffer(uint64_t _eventBufferSize=1048576, cbdfAllocator* _allocator=NULL);
+
+  int clearEvent();
+  int setEventUserFlags(uint64_t userFlags);
+  int setEventNumber(uint64_t eventNumber);
+  int setBankAlignment(uint32_t alignment); // Must match the file the event is written to, see cbdf::getBankAlignment()
+  int addBank(const char* name, uint16_t userFlags, const char* dataPointer, uint32_t dataSize);
+  int addRawData(const char* bankPointer, uint32_t bankSize);
+  char* reserveRawData(uint32_t size); // Append size bytes to the payload and return them to be filled in place
+
+  int finish(); // Fill in header and trailer, the record is then ready for cbdf::writeEventRecord()
+
+  const char* getRecord();
+  uint64_t getRecordSize();
+  uint64_t getPayloadSize();
+  char* getPayload();
+
+  virtual ~cbdfEventBuffer();
+
+private:
+
+  int reserve(uint64_t payloadBytes);
+
+  cbdfAllocator* allocator;
+  char* eventBufferBase;
+  uint64_t eventBufferSize;
+  uint64_t payloadSize;
+  uint64_t eventNumber;
+  uint64_t userFlags;
+  uint32_t bankAlignment;
+};
+
+/*
+ * Thread safe front end of a cbdf writer. Producers take an event buffer
+ * with getBuffer(), fill it and hand it back with submit(). Submitted events
+ * travel through a lock-free queue to a single sequencer thread, which gives
+ * them consecutive event numbers and writes them with writeEventRecord(), so
+ * the file is byte for byte what writeEvent() would produce. At most
+ * queueDepth events are in flight, getBuffer() blocks beyond that. The share
+ * of them waiting is reported to the writer as its backlog
+ * (cbdf::reportBacklog()).
+ *
+ * The cbdf writer must be open in writeMode and must not be used by anyone
+ * else until close() has returned.
+ */
+class cbdfMultiWriter
+{
+public:
+
+  cbdfMultiWriter(cbdf* writer, uint32_t queueDepth=1024, uint64_t eventBufferSize=65536);
+
+  cbdfEventBuffer* getBuffer();
+  int submit(cbdfEventBuffer* event); // -1 once close() has begun, an accepted event is written before close() returns
+
+  uint64_t getEventsWritten();
+  int getError(); // First error returned by the writer, 0 if none
+
+  int close(); // Write all submitted events and stop the sequencer
+
+  virtual ~cbdfMultiWriter();
+
+private:
+
+  void run();
+
+  cbdf* writer;
+  uint32_t queueDepth;
+  uint64_t eventBufferSize;
+
+  boost::lockfree::queue<cbdfEventBuffer*> filledQueue;
+  boost::lockfree::queue<cbdfEventBuffer*> freeQueue;
+  std::vector<cbdfEventBuffer*> buffers;
+  boost::mutex buffersMutex;
+
+  boost::atomic<bool> sequencerWaiting;
+  boost::atomic<bool> stop;
+  boost::atomic<uint32_t> submitting; // Producers inside submit()
+  boost::atomic<uint64_t> eventsSubmitted;
+  boost::atomic<uint64_t> eventsWritten;
+  boost::atomic<int> error;
+  boost::mutex wakeupMutex;
+  boost::condition_variable wakeup;
+  boost::condition_variable bufferReturned;
+  boost::thread sequencer;
+};
+
+#endif /* CBDFMULTIWRITER_H_ */
@@ -0,0 +1,39 @@
+/*
+ * cbdfSalvage.h
+ *
+ *  Recover the intact events of a damaged or truncated cbdf file into a
+ *  clean file
+ */
+
+#ifndef CBDFSALVAGE_H_
+#define CBDFSALVAGE_H_
+
+#include <cbdf.h>
+#include <string>
+
+#define CBDF_SALVAGE_IO_INTERVAL 67108864 // Page cache drop-behind of the input and write-back of the output, in bytes
+
+struct cbdfSalvageStats_t {
+    uint64_t events;            // Recovered and written
+    uint64_t badEvents;         // Intact records dropped for a CRC or decompression error
+    uint64_t damagedRanges;     // Stretches of the input skipped, each up to the next intact record
+    bool headerOk;              // Without it the bank layout of the input is unknown and taken to be packed
+    bool trailerFound;          // The input ended in its file trailer
+    int status;                 // 0 or the error of opening or writing a file
+};
+
+/*
+ * Copy every event of inputName whose tags, sizes and CRC agree to
+ * outputName. After damage the reader resynchronises on the next intact
+ * record (cbdf::scanForNextEvent()), so a run killed mid-write or a
+ * corrupted stretch only costs the events in it. A damaged file header is
+ * searched like any other damage, from the first byte of the input. The output gets a proper
+ * trailer and summary footer, takes over the bank layout of the input and
+ * lists it in its lineage footer. With sourceIndex it also keeps the event
+ * number and offset each event had in the input (cbdf::readSourceIndex()).
+ * Memory use is bounded by the largest event and the resync window, the
+ * page cache by CBDF_SALVAGE_IO_INTERVAL. Returns stats.status.
+ */
+int salvageFile(std::string inputName, std::string outputName, cbdf::compressionType_t compression, cbdfSalvageStats_t &stats, bool sourceIndex=false);
+
+#endif /* CBDFSALVAGE_H_ */
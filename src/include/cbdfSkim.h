@@ -0,0 +1,57 @@
+/*
+ * cbdfSkim.h
+ *
+ *  Copy the events of cbdf files that pass a selection into skim files,
+ *  which index each event back to where it came from
+ */
+
+#ifndef CBDFSKIM_H_
+#define CBDFSKIM_H_
+
+#include <cbdf.h>
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+
+/*
+ * Events are selected when (userFlags & flagMask) == flagValue and, if set,
+ * the predicate returns true. The predicate sees the reader with the bank
+ * directory of the event built, so it can look at banks with getBank(). It
+ * is called from several threads at once by skimFiles().
+ */
+struct cbdfSkimSelection_t {
+    uint64_t flagMask;          // 0 selects on the predicate only
+    uint64_t flagValue;
+    boost::function<bool (cbdf &reader)> predicate;
+};
+
+struct cbdfSkimStats_t {
+    std::string inputName;
+    std::string outputName;     // As opened, with the extension of the output compression
+    uint64_t events;            // Read from the input
+    uint64_t selected;          // Written to the skim
+    uint64_t bytes;             // Event records written, before output compression
+    int status;                 // 0 or the error that ended the skim of this file
+};
+
+/*
+ * Write the selected events of inputName to outputName. Records are passed
+ * on as read: without building a bank directory unless the selection has a
+ * predicate, and without checking or recomputing the CRC (inputs with event
+ * compression are the exception, their records are rebuilt around the
+ * uncompressed payload). Events keep their event number and user flags. The
+ * skim takes over the bank layout of the input, lists its uuid in the
+ * lineage footer and stores a source index block with the event number and
+ * offset each event has in the input (cbdf::readSourceIndex()).
+ */
+int skimFile(std::string inputName, std::string outputName, cbdf::compressionType_t compression, const cbdfSkimSelection_t &selection, cbdfSkimStats_t &stats);
+
+/*
+ * skimFile() for each pair of input and output names, on threads threads
+ * (0: one per core). One thread reads, selects and writes a whole file, so
+ * files are read sequentially and skims stay I/O bound. Returns 0 or the
+ * first status in stats that is not 0.
+ */
+int skimFiles(const std::vector<std::string> &inputNames, const std::vector<std::string> &outputNames, cbdf::compressionType_t compression, const cbdfSkimSelection_t &selection, std::vector<cbdfSkimStats_t> &stats, uint32_t threads=0);
+
+#endif /* CBDFSKIM_H_ */
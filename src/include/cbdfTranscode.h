@@ -0,0 +1,41 @@
+/*
+ * cbdfTranscode.h
+ *
+ *  Copy the events of a cbdf file into a file with other compression
+ *  settings, as raw event records
+ */
+
+#ifndef CBDFTRANSCODE_H_
+#define CBDFTRANSCODE_H_
+
+#include <cbdf.h>
+#include <string>
+
+#define CBDF_TRANSCODE_BATCH_SIZE 1048576 // Bytes of event records handed between the pipeline stages at once
+#define CBDF_TRANSCODE_MAX_BATCHES 16     // Batches in flight
+
+struct cbdfTranscodeStats_t {
+    uint64_t events;            // Written to the output
+    uint64_t bytes;             // Event records written, before output compression
+    uint64_t badEvents;         // Dropped for a CRC mismatch
+};
+
+/*
+ * Copy all events of inputName to outputName without building a bank
+ * directory. Events keep their event number, user flags and payload, the
+ * output takes over the bank layout and dictionary of the input
+ * (cbdf::setLayoutFeatures()) and lists its uuid in the lineage footer. The
+ * copy runs as a pipeline: a reader thread decompresses the input, workers
+ * threads check the CRC of batches of records and the calling thread hands
+ * them to the writer, which compresses them, on several threads if it was
+ * set up with cbdf::setCompressionThreads().
+ *
+ * The writer must not be open; it may be set up beforehand (rotation, event
+ * compression, I/O options) and is closed when the copy ends. Events with a
+ * bad CRC are dropped and counted unless stopOnError, which ends the copy
+ * at the first one. Returns 0, the read error that ended the copy (the
+ * output is still closed properly) or an error of opening either file.
+ */
+int transcodeFile(std::string inputName, cbdf &writer, std::string outputName, cbdf::compressionType_t compression, cbdfTranscodeStats_t &stats, uint32_t workers=2, bool stopOnError=false);
+
+#endif /* CBDFTRANSCODE_H_ */
@@ -0,0 +1,62 @@
+/*
+ * cbdfVerify.h
+ *
+ *  Check the structure and checksums of cbdf files without decoding any
+ *  events, and report where they are damaged
+ */
+
+#ifndef CBDFVERIFY_H_
+#define CBDFVERIFY_H_
+
+#include <cbdf.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define CBDF_VERIFY_BATCH_SIZE 4194304 // Bytes of event records a worker checks at once
+#define CBDF_VERIFY_MAX_BATCHES 32     // Batches in flight
+
+// Consecutive damaged bytes of the data, in the uncompressed stream for compressed files
+struct cbdfVerifyRange_t {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t firstEvent;        // Event numbers of the damaged records or, for unreadable data, the gap between the
+    uint64_t lastEvent;         // good events around it. 0 where the number is not known
+    uint64_t records;           // Records with a CRC mismatch in the range, the rest of it did not frame a record
+    int error;                  // CBDF_* code of the first problem in the range
+};
+
+struct cbdfVerifyReport_t {
+    std::string fileName;
+    int status;                 // 0 if the file is intact, else the first problem found
+    bool headerOk;
+    bool trailerOk;             // The data ends in a file trailer that matches the header
+    bool footerOk;              // All footer blocks the features announce are present and intact
+    uint64_t events;            // Good event records
+    uint64_t badEvents;         // Records with a CRC mismatch
+    uint64_t summaryEvents;     // Events the summary footer counts, 0 without one
+    uint64_t bytes;             // Data walked, uncompressed
+    double seconds;
+    std::vector<cbdfVerifyRange_t> badRanges;
+};
+
+/*
+ * Check fileName: the file header (and dictionary block), the tags and sizes
+ * of every event header and trailer, the CRC of every payload as stored,
+ * the file trailer and the footer blocks. Banks are not looked at.
+ * Uncompressed files are mapped into memory and checked in place; compressed
+ * files are decompressed on one thread, which is then the limit. CRCs are
+ * checked on threads threads (0: one per core). After damage the check goes
+ * on at the next intact record, so a report covers the whole file. Returns
+ * report.status, or CBDF_FILE_HEADER_ERROR if the file can not be opened.
+ */
+int verifyFile(std::string fileName, cbdfVerifyReport_t &report, uint32_t threads=0);
+
+/*
+ * One line per file and per bad range, as space separated key=value pairs:
+ *   file=<name> status=<code> header=ok|bad trailer=ok|bad footer=ok|bad events=<n> bad=<n> summary=<n> bytes=<n> seconds=<s>
+ *   range file=<name> offset=<n> size=<n> first=<n> last=<n> records=<n> error=<code>
+ */
+void printVerifyReport(const cbdfVerifyReport_t &report, std::ostream &out);
+
+#endif /* CBDFVERIFY_H_ */
@@ -335,10 +335,11 @@ lzma_decompressor_impl<Alloc>::lzma_decompressor_impl()
 template<typename Alloc>
 bool lzma_decompressor_impl<Alloc>::filter
     ( const char*& src_begin, const char* src_end,
-      char*& dest_begin, char* dest_end, bool /* flush */ )
+      char*& dest_begin, char* dest_end, bool flush )
 {
+    // Files may hold several concatenated streams, only the end of the input ends the last one
     before(src_begin, src_end, dest_begin, dest_end);
-    int result = inflate(lzma::run);
+    int result = inflate(flush ? lzma::finish : lzma::run);
     after(src_begin, dest_begin, false);
     lzma_error::check(result);
     return result != lzma::stream_end;
@@ -136,7 +136,7 @@ void lzma_base::do_init
     lzma_error::check(
         compress ?
             lzma_easy_encoder(s, p.level, LZMA_CHECK_CRC64) :
-            lzma_stream_decoder(s, 100 * 1024 * 1024, 0 )
+            lzma_stream_decoder(s, 100 * 1024 * 1024, LZMA_CONCATENATED )
     );
 }
 
@@ -0,0 +1,113 @@
+/*
+ * asyncIOTest.cpp
+ *
+ *  Files written and read through the io_uring ring, with writeback, flushes
+ *  and checkpoints on the way, must hold exactly the events of blocking I/O
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#define ASYNC_IO_TEST_EVENTS 3000
+
+static std::string payload(uint32_t event)
+{
+    std::string _data(event * 7919 % 9000 + 1, '\0');
+    for (uint32_t i = 0; i < _data.size(); i++)
+        _data[i] = (char) (i * 31 + event);
+    return _data;
+}
+
+static int writeFile(const std::string &fileName, cbdf::compressionType_t compression, uint32_t queueDepth)
+{
+    cbdf _writer;
+    // Small blocks, so that events span blocks and the ring wraps many times
+    if (_writer.setAsyncIO(queueDepth, 4096) != 0 || _writer.setWriteOptions(1048576, 65536) != 0
+        || (compression == cbdf::none && _writer.setCheckpoints(200000) != 0)
+        || _writer.fileOpen(fileName, cbdf::writeMode, compression) != 0)
+        return -1;
+    for (uint32_t i = 0; i < ASYNC_IO_TEST_EVENTS; i++)
+    {
+        std::string _data = payload(i);
+        _writer.addBank("DATA", 0, &_data[0], _data.size());
+        if (_writer.writeEvent() != 0)
+            return -1;
+        if (i % 500 == 0 && _writer.flush() != 0)
+            return -1;
+    }
+    return _writer.fileClose();
+}
+
+static uint32_t readFile(const std::string &fileName, cbdf::compressionType_t compression, uint32_t queueDepth)
+{
+    cbdf _reader;
+    if (_reader.setAsyncIO(queueDepth, 4096) != 0 || _reader.fileOpen(fileName, cbdf::readMode, compression) != 0)
+    {
+        std::cerr << fileName << ": cannot open with queue depth " << queueDepth << "\n";
+        return 1;
+    }
+    uint32_t _events = 0;
+    int _ret;
+    while ((_ret = _reader.readEvent()) == 0)
+    {
+        std::string _data = payload(_events);
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        if (_bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _data.size()) != 0)
+        {
+            std::cerr << fileName << ": event " << _events << " differs with queue depth " << queueDepth << "\n";
+            return 1;
+        }
+        _events++;
+    }
+    _reader.fileClose();
+    if (_ret != CBDF_EOF || _events != ASYNC_IO_TEST_EVENTS)
+    {
+        std::cerr << fileName << ": " << _events << " events, then status " << _ret << " with queue depth " << queueDepth << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _baseName[] = "/tmp/asyncIOTestXXXXXX";
+    int _fd = mkstemp(_baseName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+    unlink(_baseName);
+
+    static const cbdf::compressionType_t _compressions[] = {cbdf::none, cbdf::gzip};
+    static const char* _extensions[] = {"", ".gz"};
+    uint32_t _failed = 0;
+    for (uint32_t c = 0; c < 2; c++)
+    {
+        // Written through the ring and with blocking I/O, each read both ways
+        for (uint32_t w = 0; w < 2; w++)
+        {
+            std::string _fileName = _baseName;
+            if (writeFile(_fileName, _compressions[c], w ? 0 : 4) != 0)
+            {
+                std::cerr << _fileName << ": write failed\n";
+                _failed++;
+                continue;
+            }
+            _fileName += _extensions[c];
+            _failed += readFile(_fileName, _compressions[c], 4);
+            _failed += readFile(_fileName, _compressions[c], 0);
+            unlink(_fileName.c_str());
+            unlink((_fileName + ".ckpt").c_str());
+        }
+    }
+
+    std::cout << _failed << " async I/O round trips failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+ * bankDirectoryTest.cpp
+ *
+ *  Randomized round trip of valid and corrupted event payloads, comparing
+ *  the bank directory readEvent() builds with the bank walk it replaced
+ */
+
+#include <cbdf.h>
+#include "cbdfFormat.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <unistd.h>
+
+struct referenceBank_t {
+    std::string name;
+    uint16_t userFlags;
+    uint32_t size;
+    uint64_t dataOffset;
+};
+
+/*
+ * The walk of the original readEvent(), kept apart from the library. It
+ * runs on a copy with slack behind the payload, as it may read a bank
+ * header past the end, and bounds the name, which it took as a C string.
+ */
+static int referenceWalk(const std::string &payload, std::vector<referenceBank_t> &banks)
+{
+    std::string _padded = payload + std::string(sizeof(cbdf::cbdfBankHeader_t), '\0');
+    const char* _payloadPtr = _padded.data();
+    uint64_t _sizeRead = 0;
+    banks.clear();
+    while (_sizeRead < payload.size())
+    {
+        cbdf::cbdfBankHeader_t _header;
+        memcpy(&_header, _payloadPtr + _sizeRead, sizeof(_header));
+        referenceBank_t _bank;
+        _bank.name.assign(_header.name, strnlen(_header.name, sizeof(_header.name)));
+        _bank.userFlags = _header.userFlags;
+        _bank.size = _header.size;
+        _bank.dataOffset = _sizeRead + sizeof(_header);
+        banks.push_back(_bank);
+        _sizeRead += sizeof(_header) + (uint64_t) _header.size;
+    }
+    if (_sizeRead != payload.size())
+    {
+        banks.clear();
+        return CBDF_BANK_ERROR;
+    }
+    return 0;
+}
+
+static uint32_t randomBelow(uint32_t limit)
+{
+    return (uint32_t) (rand() % limit);
+}
+
+static std::string validPayload()
+{
+    static const char* _names[] = {"ADC", "TDC", "SCALER", "TRIGGER", "ELEVENCHARS"};
+    std::string _payload;
+    uint32_t _banks = randomBelow(7);
+    for (uint32_t i = 0; i < _banks; i++)
+    {
+        cbdf::cbdfBankHeader_t _header;
+        memset(&_header, 0, sizeof(_header));
+        if (randomBelow(8) == 0)
+            memset(_header.name, 'X', sizeof(_header.name)); // Not terminated
+        else
+            strcpy(_header.name, _names[randomBelow(5)]);
+        _header.userFlags = (uint16_t) randomBelow(65536);
+        _header.size = randomBelow(4) == 0 ? 0 : randomBelow(300);
+        _payload.append((const char*) &_header, sizeof(_header));
+        for (uint32_t j = 0; j < _header.size; j++)
+            _payload.push_back((char) randomBelow(256));
+    }
+    return _payload;
+}
+
+static std::string corruptPayload(std::string payload)
+{
+    switch (randomBelow(5))
+    {
+    case 0: // Flip bytes anywhere
+        for (uint32_t i = randomBelow(4) + 1; i > 0 && !payload.empty(); i--)
+            payload[randomBelow(payload.size())] ^= (char) (randomBelow(255) + 1);
+        break;
+    case 1: // Cut the end
+        if (!payload.empty())
+            payload.resize(randomBelow(payload.size()));
+        break;
+    case 2: // Junk shorter than a bank header behind the last bank
+        for (uint32_t i = randomBelow(sizeof(cbdf::cbdfBankHeader_t) - 1) + 1; i > 0; i--)
+            payload.push_back((char) randomBelow(256));
+        break;
+    case 3: // Size of the first bank beyond the payload or close to 4 GB
+        if (payload.size() >= sizeof(cbdf::cbdfBankHeader_t))
+        {
+            uint32_t _size = randomBelow(2) ? (uint32_t) payload.size() : 0xffffffffU - randomBelow(64);
+            memcpy(&payload[offsetof(cbdf::cbdfBankHeader_t, size)], &_size, sizeof(_size));
+        }
+        break;
+    default: // Grow or shrink the size of the first bank by a little
+        if (payload.size() >= sizeof(cbdf::cbdfBankHeader_t))
+        {
+            uint32_t _size;
+            memcpy(&_size, &payload[offsetof(cbdf::cbdfBankHeader_t, size)], sizeof(_size));
+            _size += randomBelow(41) - 20;
+            memcpy(&payload[offsetof(cbdf::cbdfBankHeader_t, size)], &_size, sizeof(_size));
+        }
+        break;
+    }
+    return payload;
+}
+
+static bool compareEvent(cbdf &reader, int ret, const std::string &payload, uint32_t event)
+{
+    std::vector<referenceBank_t> _banks;
+    int _ret = referenceWalk(payload, _banks);
+    const cbdf::bankDirectory_t &_directory = reader.getBankDirectory();
+    if (ret != _ret || _directory.size() != _banks.size())
+    {
+        std::cerr << "event " << event << ": status " << ret << " with " << _directory.size() << " banks, reference "
+                  << _ret << " with " << _banks.size() << " banks\n";
+        return false;
+    }
+    if (_ret != 0 || _banks.empty())
+        return true;
+
+    const char* _base = _directory[0].dataPtr - _banks[0].dataOffset;
+    for (uint32_t i = 0; i < _banks.size(); i++)
+    {
+        const cbdf::cbdfBankMapEntry_t &_entry = _directory[i];
+        std::string _name(_entry.name, strnlen(_entry.name, sizeof(_entry.name)));
+        if (_name != _banks[i].name || _entry.userFlags != _banks[i].userFlags || _entry.size != _banks[i].size
+            || (uint64_t) (_entry.dataPtr - _base) != _banks[i].dataOffset
+            || memcmp(_entry.dataPtr, payload.data() + _banks[i].dataOffset, _entry.size) != 0)
+        {
+            std::cerr << "event " << event << ": bank " << i << " differs from the reference\n";
+            return false;
+        }
+        // The map keeps the first bank of a name, as the old walk did
+        for (uint32_t j = 0; j < i; j++)
+            if (_banks[j].name == _name)
+                _name.clear();
+        if (!_name.empty() && reader.getBank(_name).dataPtr != _entry.dataPtr)
+        {
+            std::cerr << "event " << event << ": bank " << _name << " not found by name\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int _seed = (argc > 1) ? (unsigned int) strtoul(argv[1], NULL, 0) : 20260101;
+    uint32_t _events = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : 20000;
+    srand(_seed);
+
+    char _fileName[] = "/tmp/bankDirectoryTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    std::vector<std::string> _payloads;
+    cbdf _writer;
+    _writer.setSummary(false);
+    if (_writer.fileOpen(_fileName, cbdf::writeMode, cbdf::none) != 0)
+    {
+        std::cerr << "Cannot open " << _fileName << " for writing\n";
+        unlink(_fileName);
+        return 1;
+    }
+    for (uint32_t i = 0; i < _events; i++)
+    {
+        std::string _payload = validPayload();
+        if (randomBelow(2))
+            _payload = corruptPayload(_payload);
+        _payloads.push_back(_payload);
+        if ((!_payload.empty() && _writer.addRawData(&_payload[0], _payload.size()) != 0) || _writer.writeEvent() != 0)
+        {
+            std::cerr << "Cannot write event " << i << "\n";
+            unlink(_fileName);
+            return 1;
+        }
+    }
+    _writer.fileClose();
+
+    cbdf _reader;
+    uint32_t _failed = 0, _rejected = 0;
+    if (_reader.fileOpen(_fileName, cbdf::readMode) != 0)
+    {
+        std::cerr << "Cannot open " << _fileName << " for reading\n";
+        unlink(_fileName);
+        return 1;
+    }
+    for (uint32_t i = 0; i < _events; i++)
+    {
+        int _ret = _reader.readEvent();
+        if (_ret != 0 && _ret != CBDF_BANK_ERROR)
+        {
+            std::cerr << "Cannot read event " << i << ", status " << _ret << "\n";
+            _failed++;
+            break;
+        }
+        if (_ret != 0)
+            _rejected++;
+        if (!compareEvent(_reader, _ret, _payloads[i], i))
+            _failed++;
+    }
+    _reader.fileClose();
+    unlink(_fileName);
+
+    std::cout << _events << " events, " << _rejected << " rejected, " << _failed << " differ from the reference (seed "
+              << _seed << ")\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/*
+ * bankFilterTest.cpp
+ *
+ *  Round trip of banks through every filter combination and element size,
+ *  with bank lengths that leave partial vectors and partial elements, and
+ *  filtered banks under the default codec
+ */
+
+#include <cbdf.h>
+#include "cbdfCodec.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+static const uint32_t filterSets[] = {cbdf::filterDelta, cbdf::filterByteShuffle, cbdf::filterBitShuffle,
+                                      cbdf::filterDelta | cbdf::filterByteShuffle, cbdf::filterDelta | cbdf::filterBitShuffle};
+static const uint32_t elementSizes[] = {1, 2, 4, 8};
+
+// Slowly changing samples with some noise, and every few events plain noise
+static std::string bankData(uint32_t size, uint32_t seed)
+{
+    std::string _data(size, '\0');
+    for (uint32_t i = 0; i < size; i++)
+        _data[i] = (seed % 3 == 0) ? (char) rand() : (char) (i / 5 + seed + rand() % 4);
+    return _data;
+}
+
+static uint32_t runFilter(const char* fileName, uint32_t filters, uint32_t elementSize)
+{
+    cbdf _writer;
+    _writer.setSummary(false);
+    if (_writer.setBankCodec("DATA", cbdf::bankRaw) != 0 || _writer.setBankFilter("DATA", filters, elementSize) != 0
+        || _writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+    {
+        std::cerr << "Cannot set up filters " << filters << " on " << elementSize << " byte elements\n";
+        return 1;
+    }
+    std::vector<std::string> _banks;
+    srand(filters * 16 + elementSize);
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        uint32_t _size = (i < 100) ? i : rand() % 5000;
+        _banks.push_back(bankData(_size, i));
+        _writer.addBank("DATA", 7, _size ? &_banks.back()[0] : NULL, _size);
+        _writer.addBank("KEEP", 8, _size ? &_banks.back()[0] : NULL, _size);
+        _writer.writeEvent();
+    }
+    _writer.fileClose();
+
+    cbdf _reader;
+    uint32_t _failed = 0;
+    _reader.fileOpen(fileName, cbdf::readMode);
+    for (uint32_t i = 0; i < _banks.size(); i++)
+    {
+        if (_reader.readEvent() != 0)
+        {
+            std::cerr << "Cannot read event " << i << "\n";
+            return _failed + 1;
+        }
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        cbdf::cbdfBankMapEntry_t _kept = _reader.getBankAt(1);
+        if (_bank.userFlags != 7 || _bank.size != _banks[i].size() || memcmp(_bank.dataPtr, _banks[i].data(), _bank.size) != 0
+            || _kept.userFlags != 8 || _kept.size != _banks[i].size() || memcmp(_kept.dataPtr, _banks[i].data(), _kept.size) != 0)
+        {
+            std::cerr << "filters " << filters << " on " << elementSize << " byte elements: bank of " << _banks[i].size()
+                      << " bytes in event " << i << " differs\n";
+            _failed++;
+        }
+    }
+    _reader.fileClose();
+    return _failed;
+}
+
+/*
+ * A filter set for one bank must not take it out of the default codec. The
+ * samples are smooth, so the filtered banks have to shrink to well below
+ * half of their size.
+ */
+static uint32_t runDefaultCodec(const char* fileName, uint32_t codec, uint32_t filters, uint32_t elementSize)
+{
+    cbdf _writer;
+    _writer.setSummary(false);
+    if (_writer.setBankCodec("", (cbdf::bankCodec_t) codec) != 0 || _writer.setBankFilter("DATA", filters, elementSize) != 0
+        || _writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+    {
+        std::cerr << "Cannot set up codec " << codec << " with filters " << filters << "\n";
+        return 1;
+    }
+    std::string _data(4096, '\0');
+    uint64_t _raw = 0;
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        for (uint32_t j = 0; j < _data.size(); j++)
+            _data[j] = (char) (j / 64 + i);
+        _writer.addBank("DATA", 0, &_data[0], _data.size());
+        _writer.writeEvent();
+        _raw += _data.size();
+    }
+    _writer.fileClose();
+
+    cbdf _reader;
+    uint64_t _stored = 0;
+    uint32_t _events = 0;
+    _reader.fileOpen(fileName, cbdf::readMode);
+    while (_reader.readEvent() == 0)
+    {
+        _stored += _reader.getBankDirectory()[0].size;
+        // Walking the map has to give the decoded bank as well
+        cbdf::bankMapIt_t _itBank = _reader.getBanks();
+        if (_itBank == _reader.bankMap.end())
+            return 1;
+        cbdf::cbdfBankMapEntry_t _bank = _itBank->second;
+        for (uint32_t j = 0; j < _data.size(); j++)
+            _data[j] = (char) (j / 64 + _events);
+        if (_bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _bank.size) != 0)
+        {
+            std::cerr << "codec " << codec << " with filters " << filters << ": bank in event " << _events << " differs\n";
+            return 1;
+        }
+        _events++;
+    }
+    _reader.fileClose();
+    if (_events != 100 || _stored * 2 > _raw)
+    {
+        std::cerr << "codec " << codec << " with filters " << filters << " on " << elementSize << " byte elements: "
+                  << _events << " events, " << _stored << " of " << _raw << " bytes stored\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/bankFilterTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    uint32_t _failed = 0;
+    for (uint32_t f = 0; f < sizeof(filterSets) / sizeof(filterSets[0]); f++)
+        for (uint32_t e = 0; e < sizeof(elementSizes) / sizeof(elementSizes[0]); e++)
+            _failed += runFilter(_fileName, filterSets[f], elementSizes[e]);
+    for (uint32_t c = cbdf::bankDeflate; c <= cbdf::bankZstd; c++)
+        if (cbdfBankCoder::available(c))
+            for (uint32_t f = 0; f < sizeof(filterSets) / sizeof(filterSets[0]); f++)
+                for (uint32_t e = 0; e < sizeof(elementSizes) / sizeof(elementSizes[0]); e++)
+                    _failed += runDefaultCodec(_fileName, c, filterSets[f], elementSizes[e]);
+    unlink(_fileName);
+
+    std::cout << _failed << " banks differ after filtering or were not compressed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+/*
+ * checkpointTest.cpp
+ *
+ *  A writer that dies after a checkpoint, with more events and a torn write
+ *  behind it, leaves a file that recoverFile() closes and fileResume()
+ *  continues, keeping exactly the events up to the checkpoint
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CHECKPOINT_TEST_KEPT 100    // Events before the checkpoint
+#define CHECKPOINT_TEST_LOST 37     // Events flushed after it
+#define CHECKPOINT_TEST_ADDED 20    // Events written after resuming
+
+static std::string payload(uint32_t event)
+{
+    std::string _data(event * 131 % 700 + 1, '\0');
+    for (uint32_t i = 0; i < _data.size(); i++)
+        _data[i] = (char) (i * 7 + event);
+    return _data;
+}
+
+static int writeEvents(cbdf &writer, uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        std::string _data = payload(i);
+        writer.addBank("DATA", 0, &_data[0], _data.size());
+        if (writer.writeEvent() != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Write, checkpoint, write some more and die without closing the file, then tear its end
+static int abandonFile(const std::string &fileName, const std::string &diskName, cbdf::compressionType_t compression)
+{
+    pid_t _pid = fork();
+    if (_pid < 0)
+        return -1;
+    if (_pid == 0)
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, compression) != 0 || writeEvents(_writer, 0, CHECKPOINT_TEST_KEPT) != 0
+            || _writer.checkpoint() != 0 || writeEvents(_writer, CHECKPOINT_TEST_KEPT, CHECKPOINT_TEST_LOST) != 0 || _writer.flush() != 0)
+            _exit(1);
+        _exit(0);
+    }
+    int _status;
+    if (waitpid(_pid, &_status, 0) != _pid || !WIFEXITED(_status) || WEXITSTATUS(_status) != 0)
+        return -1;
+    std::ofstream _file(diskName.c_str(), std::ios::out | std::ios::app | std::ios::binary);
+    _file.write("\xcb\xed\xcb\xed torn", 9);
+    return _file ? 0 : -1;
+}
+
+static uint32_t readBack(const std::string &diskName, cbdf::compressionType_t compression, uint32_t expected)
+{
+    cbdf _reader;
+    if (_reader.fileOpen(diskName, cbdf::readMode, compression) != 0)
+    {
+        std::cerr << diskName << ": cannot open\n";
+        return 1;
+    }
+    uint32_t _events = 0;
+    uint64_t _first = 0;
+    int _ret;
+    while ((_ret = _reader.readEvent()) == 0)
+    {
+        if (_events == 0)
+            _first = _reader.getEventNumber();
+        std::string _data = payload(_events);
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        if (_reader.getEventNumber() != _first + _events || _bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _data.size()) != 0)
+        {
+            std::cerr << diskName << ": event " << _events << " differs\n";
+            return 1;
+        }
+        _events++;
+    }
+    if (_ret != CBDF_EOF || _events != expected)
+    {
+        std::cerr << diskName << ": " << _events << " of " << expected << " events, then status " << _ret << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t testRecover(const std::string &fileName, cbdf::compressionType_t compression)
+{
+    std::string _diskName = fileName + ((compression == cbdf::gzip) ? ".gz" : "");
+    if (abandonFile(fileName, _diskName, compression) != 0)
+    {
+        std::cerr << _diskName << ": cannot write the abandoned file\n";
+        return 1;
+    }
+    uint32_t _failed = 0;
+    uint64_t _events = 0;
+    int _ret = cbdf::recoverFile(_diskName, _events);
+    if (_ret != 0 || _events != CHECKPOINT_TEST_KEPT)
+    {
+        std::cerr << _diskName << ": recovery kept " << _events << " events, status " << _ret << "\n";
+        _failed++;
+    }
+    else
+        _failed += readBack(_diskName, compression, CHECKPOINT_TEST_KEPT);
+    unlink(_diskName.c_str());
+    unlink((_diskName + ".ckpt").c_str());
+    return _failed;
+}
+
+static uint32_t testResume(const std::string &fileName, cbdf::compressionType_t compression)
+{
+    std::string _diskName = fileName + ((compression == cbdf::gzip) ? ".gz" : "");
+    if (abandonFile(fileName, _diskName, compression) != 0)
+    {
+        std::cerr << _diskName << ": cannot write the abandoned file\n";
+        return 1;
+    }
+    uint32_t _failed = 0;
+    {
+        cbdf _writer;
+        int _ret = _writer.fileResume(_diskName);
+        if (_ret != 0 || writeEvents(_writer, CHECKPOINT_TEST_KEPT, CHECKPOINT_TEST_ADDED) != 0 || _writer.fileClose() != 0)
+        {
+            std::cerr << _diskName << ": cannot continue the file, status " << _ret << "\n";
+            _failed++;
+        }
+    }
+    if (_failed == 0)
+        _failed += readBack(_diskName, compression, CHECKPOINT_TEST_KEPT + CHECKPOINT_TEST_ADDED);
+    unlink(_diskName.c_str());
+    unlink((_diskName + ".ckpt").c_str());
+    return _failed;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/checkpointTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+    unlink(_fileName);
+
+    uint32_t _failed = 0;
+    _failed += testRecover(_fileName, cbdf::none);
+    _failed += testRecover(_fileName, cbdf::gzip);
+    _failed += testResume(_fileName, cbdf::none);
+    _failed += testResume(_fileName, cbdf::gzip);
+
+    std::cout << _failed << " checkpoint checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
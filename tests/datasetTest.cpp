@@ -0,0 +1,111 @@
+/*
+ * datasetTest.cpp
+ *
+ *  A file of a dataset that can not be opened is reported once and then
+ *  skipped, in both merge modes
+ */
+
+#include <cbdf.h>
+#include <cbdfDataset.h>
+#include "cbdfFormat.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstddef>
+#include <cstdlib>
+#include <unistd.h>
+
+#define DATASET_TEST_UNKNOWN_FEATURE 0x0080000000000000ULL // Required, not known to this version
+
+static int writeFile(const std::string &fileName, uint32_t events)
+{
+    cbdf _writer;
+    char _data[64] = {0};
+    if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+        return -1;
+    for (uint32_t i = 0; i < events; i++)
+    {
+        _writer.addBank("ADC", 0, _data, sizeof(_data));
+        _writer.writeEvent();
+    }
+    return _writer.fileClose();
+}
+
+// Set a required feature bit no reader knows in the file header
+static int addUnknownFeature(const std::string &fileName)
+{
+    std::fstream _file(fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t _features;
+    _file.seekg(offsetof(cbdf::cbdfFileHeader_t, features));
+    if (!_file.read((char*) &_features, sizeof(_features)))
+        return -1;
+    _features |= DATASET_TEST_UNKNOWN_FEATURE;
+    _file.seekp(offsetof(cbdf::cbdfFileHeader_t, features));
+    return _file.write((const char*) &_features, sizeof(_features)) ? 0 : -1;
+}
+
+static uint32_t readDataset(cbdfDataset::mergeMode_t mode, const std::string &unreadable, const std::string &good)
+{
+    cbdfDataset _dataset(mode);
+    _dataset.addFile(unreadable, cbdf::none);
+    _dataset.addFile(good, cbdf::none);
+    if (_dataset.open() != 0)
+    {
+        std::cerr << "mode " << mode << ": cannot open the dataset\n";
+        return 1;
+    }
+    int _ret = _dataset.readEvent();
+    if (_ret != CBDF_UNSUPPORTED_FEATURE)
+    {
+        std::cerr << "mode " << mode << ": unreadable file gave status " << _ret << "\n";
+        return 1;
+    }
+    uint32_t _events = 0;
+    while ((_ret = _dataset.readEvent()) == 0)
+    {
+        if (_dataset.getFileIndex() != 1 || _dataset.getFile() == NULL)
+        {
+            std::cerr << "mode " << mode << ": event from file " << _dataset.getFileIndex() << "\n";
+            return 1;
+        }
+        _events++;
+    }
+    if (_ret != CBDF_EOF || _events != 10)
+    {
+        std::cerr << "mode " << mode << ": " << _events << " events, then status " << _ret << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _unreadable[] = "/tmp/datasetTestXXXXXX";
+    char _good[] = "/tmp/datasetTestXXXXXX";
+    int _fd1 = mkstemp(_unreadable);
+    int _fd2 = mkstemp(_good);
+    if (_fd1 < 0 || _fd2 < 0)
+    {
+        std::cerr << "Cannot create temporary files\n";
+        return 1;
+    }
+    close(_fd1);
+    close(_fd2);
+
+    uint32_t _failed = 0;
+    if (writeFile(_unreadable, 5) != 0 || addUnknownFeature(_unreadable) != 0 || writeFile(_good, 10) != 0)
+    {
+        std::cerr << "Cannot write the test files\n";
+        _failed++;
+    }
+    else
+    {
+        _failed += readDataset(cbdfDataset::sequential, _unreadable, _good);
+        _failed += readDataset(cbdfDataset::eventNumber, _unreadable, _good);
+    }
+    unlink(_unreadable);
+    unlink(_good);
+
+    std::cout << _failed << " dataset modes failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
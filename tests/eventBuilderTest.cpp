@@ -0,0 +1,249 @@
+/*
+ * eventBuilderTest.cpp
+ *
+ *  Three sources deliver their fragments through addBank(), addFragment()
+ *  and reserveFragment()/commitFragment(). Every event is written complete
+ *  and a thread that reserved nothing can not commit a fragment. Once a
+ *  source stops delivering, its events are written flagged incomplete after
+ *  the timeout, and fragments it sends later are refused as late.
+ */
+
+#include <cbdf.h>
+#include <cbdfEventBuilder.h>
+#include <cbdfMultiWriter.h>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#define BUILDER_TEST_EVENTS 500
+#define BUILDER_TEST_INCOMPLETE 0x8000
+#define BUILDER_TEST_ABANDONED_AFTER 60 // Last event the stopping source delivers
+
+static boost::atomic<uint32_t> builderFailures(0);
+
+static void bankSource(cbdfEventBuilder *builder)
+{
+    char _data[32];
+    for (uint64_t e = 1; e <= BUILDER_TEST_EVENTS; e++)
+    {
+        memset(_data, (int) e, sizeof(_data));
+        if (builder->addBank(0, e, "SRC0", 0, _data, sizeof(_data)) != 0)
+            builderFailures++;
+    }
+}
+
+static void fragmentSource(cbdfEventBuilder *builder)
+{
+    cbdfEventBuffer _fragment(4096);
+    char _data[48];
+    for (uint64_t e = 1; e <= BUILDER_TEST_EVENTS; e++)
+    {
+        memset(_data, (int) e + 1, sizeof(_data));
+        _fragment.clearEvent();
+        _fragment.addBank("SRC1", 0, _data, sizeof(_data));
+        if (builder->addFragment(1, e, _fragment.getPayload(), _fragment.getPayloadSize()) != 0)
+            builderFailures++;
+    }
+}
+
+static void reservingSource(cbdfEventBuilder *builder)
+{
+    cbdfEventBuffer _fragment(4096);
+    char _data[64];
+    for (uint64_t e = 1; e <= BUILDER_TEST_EVENTS; e++)
+    {
+        memset(_data, (int) e + 2, sizeof(_data));
+        _fragment.clearEvent();
+        _fragment.addBank("SRC2", 0, _data, sizeof(_data));
+        char* _target = builder->reserveFragment(2, e, _fragment.getPayloadSize());
+        if (_target == NULL)
+        {
+            builderFailures++;
+            continue;
+        }
+        memcpy(_target, _fragment.getPayload(), _fragment.getPayloadSize());
+        // Not the reserved fragment, the slot stays locked for the right commit
+        if (builder->commitFragment(2, e + 1) != -1 || builder->commitFragment(1, e) != -1)
+            builderFailures++;
+        if (builder->commitFragment(2, e) != 0)
+            builderFailures++;
+    }
+}
+
+// Commits from a thread that holds no reservation, while the sources run
+static void strayCommits(cbdfEventBuilder *builder, boost::atomic<bool> *done)
+{
+    uint64_t e = 1;
+    while (!*done)
+    {
+        if (builder->commitFragment(2, e) != -1)
+            builderFailures++;
+        e = (e % BUILDER_TEST_EVENTS) + 1;
+        boost::this_thread::yield();
+    }
+}
+
+static uint32_t checkBank(cbdf &reader, const char* name, uint32_t size, char value)
+{
+    cbdf::cbdfBankMapEntry_t _bank = reader.getBank(name);
+    if (_bank.dataPtr == NULL || _bank.size != size)
+        return 1;
+    for (uint32_t i = 0; i < size; i++)
+        if (_bank.dataPtr[i] != value)
+            return 1;
+    return 0;
+}
+
+static uint32_t testThreeSources(const std::string &fileName)
+{
+    uint32_t _failed = 0;
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+        {
+            std::cerr << "Cannot open " << fileName << "\n";
+            return 1;
+        }
+        {
+            cbdfEventBuilder _builder(&_writer, 3, 16, 10000, 1, BUILDER_TEST_INCOMPLETE);
+            if (_builder.commitFragment(2, 1) != -1)
+                _failed++;
+            boost::atomic<bool> _done(false);
+            boost::thread _stray(boost::bind(&strayCommits, &_builder, &_done));
+            boost::thread_group _sources;
+            _sources.create_thread(boost::bind(&bankSource, &_builder));
+            _sources.create_thread(boost::bind(&fragmentSource, &_builder));
+            _sources.create_thread(boost::bind(&reservingSource, &_builder));
+            _sources.join_all();
+            _done = true;
+            _stray.join();
+            _builder.flush();
+            cbdfEventBuilder::cbdfBuilderStats_t _stats = _builder.stats();
+            if (_stats.eventsBuilt != BUILDER_TEST_EVENTS || _stats.eventsIncomplete != 0)
+            {
+                std::cerr << _stats.eventsBuilt << " events built, " << _stats.eventsIncomplete << " incomplete\n";
+                _failed++;
+            }
+        }
+        _writer.fileClose();
+    }
+    _failed += builderFailures;
+
+    cbdf _reader;
+    uint64_t _events = 0;
+    if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+        _failed++;
+    else
+    {
+        while (_reader.readEvent() == 0)
+        {
+            _events++;
+            uint64_t e = _reader.getEventNumber();
+            if (e != _events || (_reader.getEventUserFlags() & BUILDER_TEST_INCOMPLETE))
+            {
+                std::cerr << "event " << e << " with flags " << _reader.getEventUserFlags() << " read as event " << _events << "\n";
+                _failed++;
+            }
+            if (checkBank(_reader, "SRC0", 32, (char) e) || checkBank(_reader, "SRC1", 48, (char) (e + 1)) || checkBank(_reader, "SRC2", 64, (char) (e + 2)))
+            {
+                std::cerr << "event " << e << ": bad fragment\n";
+                _failed++;
+            }
+        }
+        if (_events != BUILDER_TEST_EVENTS)
+        {
+            std::cerr << _events << " events read\n";
+            _failed++;
+        }
+        _reader.fileClose();
+    }
+    return _failed;
+}
+
+// One source stops after BUILDER_TEST_ABANDONED_AFTER, the other one keeps going
+static uint32_t testAbandonedSource(const std::string &fileName)
+{
+    uint32_t _failed = 0;
+    char _data[16];
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+        {
+            std::cerr << "Cannot open " << fileName << "\n";
+            return 1;
+        }
+        {
+            cbdfEventBuilder _builder(&_writer, 2, 16, 50, 1, BUILDER_TEST_INCOMPLETE);
+            for (uint64_t e = 1; e <= BUILDER_TEST_EVENTS; e++)
+            {
+                memset(_data, (int) e, sizeof(_data));
+                if (_builder.addBank(0, e, "SRC0", 0, _data, sizeof(_data)) != 0)
+                    _failed++;
+                if (e <= BUILDER_TEST_ABANDONED_AFTER && _builder.addBank(1, e, "SRC1", 0, _data, sizeof(_data)) != 0)
+                    _failed++;
+            }
+            // Running a window ahead forced the events of the stopped source out
+            if (_builder.addFragment(1, BUILDER_TEST_ABANDONED_AFTER + 1, _data, 0) != CBDF_FRAGMENT_LATE)
+            {
+                std::cerr << "late fragment of the stopped source was taken\n";
+                _failed++;
+            }
+            _builder.flush();
+            cbdfEventBuilder::cbdfBuilderStats_t _stats = _builder.stats();
+            if (_stats.eventsBuilt != BUILDER_TEST_EVENTS || _stats.eventsIncomplete != BUILDER_TEST_EVENTS - BUILDER_TEST_ABANDONED_AFTER || _stats.fragmentsLate != 1)
+            {
+                std::cerr << "stopped source: " << _stats.eventsBuilt << " events built, " << _stats.eventsIncomplete << " incomplete, " << _stats.fragmentsLate << " late fragments\n";
+                _failed++;
+            }
+        }
+        _writer.fileClose();
+    }
+
+    cbdf _reader;
+    uint64_t _events = 0;
+    if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+        return _failed + 1;
+    while (_reader.readEvent() == 0)
+    {
+        _events++;
+        uint64_t e = _reader.getEventNumber();
+        bool _complete = (e <= BUILDER_TEST_ABANDONED_AFTER);
+        bool _flagged = (_reader.getEventUserFlags() & BUILDER_TEST_INCOMPLETE) != 0;
+        if (e != _events || _flagged == _complete || checkBank(_reader, "SRC0", sizeof(_data), (char) e)
+            || (_complete ? checkBank(_reader, "SRC1", sizeof(_data), (char) e) : _reader.getBank("SRC1").dataPtr != NULL))
+        {
+            std::cerr << "stopped source: event " << e << " with flags " << _reader.getEventUserFlags() << " read as event " << _events << "\n";
+            _failed++;
+        }
+    }
+    if (_events != BUILDER_TEST_EVENTS)
+    {
+        std::cerr << "stopped source: " << _events << " events read\n";
+        _failed++;
+    }
+    return _failed;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/eventBuilderTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    uint32_t _failed = 0;
+    _failed += testThreeSources(_fileName);
+    _failed += testAbandonedSource(_fileName);
+    unlink(_fileName);
+
+    std::cout << _failed << " event builder checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
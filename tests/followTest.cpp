@@ -0,0 +1,161 @@
+/*
+ * followTest.cpp
+ *
+ *  A reader in follow mode gets every event a writer flushes while it is
+ *  running. Once the writer dies without closing the file, leaving a torn
+ *  record behind, the reader gives up after its idle timeout. flush() fails
+ *  when the events can not be written.
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define FOLLOW_TEST_BATCH 20
+#define FOLLOW_TEST_BATCHES 10
+#define FOLLOW_TEST_IDLE_MS 500
+
+static std::string payload(uint32_t event)
+{
+    std::string _data(event * 17 % 300 + 4, '\0');
+    for (uint32_t i = 0; i < _data.size(); i++)
+        _data[i] = (char) (i + event);
+    return _data;
+}
+
+/*
+ * Write the first batch, wait for the reader to have it, write the rest
+ * batch by batch and die without closing the file
+ */
+static void runWriter(const std::string &fileName, int readerDone)
+{
+    cbdf _writer;
+    if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+        _exit(1);
+    for (uint32_t b = 0; b < FOLLOW_TEST_BATCHES; b++)
+    {
+        for (uint32_t i = b * FOLLOW_TEST_BATCH; i < (b + 1) * FOLLOW_TEST_BATCH; i++)
+        {
+            std::string _data = payload(i);
+            _writer.addBank("DATA", 0, &_data[0], _data.size());
+            if (_writer.writeEvent() != 0)
+                _exit(1);
+        }
+        if (_writer.flush() != 0)
+            _exit(1);
+        if (b == 0)
+        {
+            char _byte;
+            if (read(readerDone, &_byte, 1) != 1)
+                _exit(1);
+        }
+        usleep(10000);
+    }
+    _exit(0);
+}
+
+static uint32_t testAbandonedWriter(const std::string &fileName)
+{
+    int _pipe[2];
+    if (pipe(_pipe) != 0)
+        return 1;
+    pid_t _pid = fork();
+    if (_pid < 0)
+        return 1;
+    if (_pid == 0)
+    {
+        close(_pipe[1]);
+        runWriter(fileName, _pipe[0]);
+    }
+    close(_pipe[0]);
+
+    uint32_t _failed = 0;
+    cbdf _reader;
+    _reader.setFollowMode(true, FOLLOW_TEST_IDLE_MS);
+    if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+    {
+        std::cerr << "Cannot follow " << fileName << "\n";
+        _failed++;
+    }
+    uint32_t _events = 0;
+    uint64_t _first = 0;
+    int _ret = CBDF_FILE_HEADER_ERROR;
+    while (_failed == 0 && (_ret = _reader.readEvent()) == 0)
+    {
+        if (_events == 0)
+            _first = _reader.getEventNumber();
+        std::string _data = payload(_events);
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        if (_reader.getEventNumber() != _first + _events || _bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _data.size()) != 0)
+        {
+            std::cerr << "event " << _events << " differs\n";
+            _failed++;
+        }
+        _events++;
+        // The writer only goes on once the first batch was followed
+        if (_events == FOLLOW_TEST_BATCH && write(_pipe[1], "", 1) != 1)
+            _failed++;
+        if (_events == FOLLOW_TEST_BATCHES * FOLLOW_TEST_BATCH)
+        {
+            // Tear the end once the writer is gone, the reader waits on the partial record
+            int _status;
+            if (waitpid(_pid, &_status, 0) != _pid || !WIFEXITED(_status) || WEXITSTATUS(_status) != 0)
+                _failed++;
+            _pid = -1;
+            std::ofstream _file(fileName.c_str(), std::ios::out | std::ios::app | std::ios::binary);
+            _file.write("\xed\xcb\xed\xcb torn", 9);
+        }
+    }
+    close(_pipe[1]);
+    if (_pid > 0)
+        waitpid(_pid, NULL, 0);
+    if (_ret != CBDF_UNEXPECTED_EOF || _events != FOLLOW_TEST_BATCHES * FOLLOW_TEST_BATCH)
+    {
+        std::cerr << "followed " << _events << " events, then status " << _ret << "\n";
+        _failed++;
+    }
+    return _failed;
+}
+
+static uint32_t testFailedFlush()
+{
+    if (access("/dev/full", W_OK) != 0)
+        return 0;
+    cbdf _writer;
+    char _data[64] = {0};
+    if (_writer.fileOpen("/dev/full", cbdf::writeMode, cbdf::none) != 0)
+        return 0;
+    _writer.addBank("DATA", 0, _data, sizeof(_data));
+    _writer.writeEvent();
+    if (_writer.flush() != -1)
+    {
+        std::cerr << "flush to /dev/full succeeded\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/followTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    uint32_t _failed = 0;
+    _failed += testAbandonedWriter(_fileName);
+    _failed += testFailedFlush();
+    unlink(_fileName);
+
+    std::cout << _failed << " follow checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/*
+ * multiWriterTest.cpp
+ *
+ *  Producers keep submitting while the multi writer is closed, every event
+ *  accepted by submit() has to end up in the file
+ */
+
+#include <cbdf.h>
+#include <cbdfMultiWriter.h>
+#include <iostream>
+#include <cstdlib>
+#include <unistd.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+#define MULTI_WRITER_TEST_PRODUCERS 4
+#define MULTI_WRITER_TEST_ROUNDS 20
+
+static void produce(cbdfMultiWriter* multiWriter, boost::atomic<uint64_t>* accepted)
+{
+    char _data[256] = {0};
+    while (true)
+    {
+        cbdfEventBuffer* _event = multiWriter->getBuffer();
+        _event->addBank("ADC", 0, _data, sizeof(_data));
+        if (multiWriter->submit(_event) != 0)
+            return;
+        (*accepted)++;
+    }
+}
+
+static uint32_t runRound(const char* fileName, uint32_t round)
+{
+    cbdf _writer;
+    _writer.setSummary(false);
+    if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+    {
+        std::cerr << "Cannot open " << fileName << " for writing\n";
+        return 1;
+    }
+    boost::atomic<uint64_t> _accepted(0);
+    cbdfMultiWriter* _multiWriter = new cbdfMultiWriter(&_writer, 64, 4096);
+    boost::thread_group _producers;
+    for (uint32_t i = 0; i < MULTI_WRITER_TEST_PRODUCERS; i++)
+        _producers.create_thread(boost::bind(produce, _multiWriter, &_accepted));
+    usleep(1000 * (round % 5 + 1));
+    int _ret = _multiWriter->close();
+    _producers.join_all();
+    uint64_t _written = _multiWriter->getEventsWritten();
+    delete _multiWriter;
+    _writer.fileClose();
+
+    cbdf _reader;
+    uint64_t _read = 0;
+    uint64_t _first = 0;
+    _reader.fileOpen(fileName, cbdf::readMode);
+    while (_reader.readEvent() == 0)
+    {
+        if (_read == 0)
+            _first = _reader.getEventNumber();
+        if (_reader.getEventNumber() != _first + _read)
+            break;
+        _read++;
+    }
+    _reader.fileClose();
+    if (_ret != 0 || _written != _accepted || _read != _accepted)
+    {
+        std::cerr << "round " << round << ": " << _accepted << " events accepted, " << _written << " written, "
+                  << _read << " read back, status " << _ret << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/multiWriterTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    uint32_t _failed = 0;
+    for (uint32_t i = 0; i < MULTI_WRITER_TEST_ROUNDS; i++)
+        _failed += runRound(_fileName, i);
+    unlink(_fileName);
+
+    std::cout << _failed << " rounds lost events\n";
+    return (_failed == 0) ? 0 : 1;
+}
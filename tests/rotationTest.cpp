@@ -0,0 +1,204 @@
+/*
+ * rotationTest.cpp
+ *
+ *  A rotating writer fills every chunk up to the event limit, event numbers
+ *  continue across chunks and no empty chunk is left behind. Of a run whose
+ *  writer died, every chunk is either complete or recovered from its
+ *  checkpoint, without losing an event.
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static std::string chunkName(const std::string &base, uint32_t chunk)
+{
+    char _suffix[16];
+    snprintf(_suffix, sizeof(_suffix), "_%04u", chunk);
+    return base + _suffix;
+}
+
+static uint32_t writeAndCheck(const std::string &base, uint32_t events, uint32_t perChunk)
+{
+    {
+        cbdf _writer;
+        char _data[64] = {0};
+        _writer.setRotation(0, perChunk);
+        if (_writer.fileOpen(base, cbdf::writeMode, cbdf::none) != 0)
+        {
+            std::cerr << events << " events: cannot open " << base << "\n";
+            return 1;
+        }
+        for (uint32_t i = 0; i < events; i++)
+        {
+            _writer.addBank("ADC", 0, _data, sizeof(_data));
+            if (_writer.writeEvent() != 0)
+            {
+                std::cerr << events << " events: write " << i << " failed\n";
+                return 1;
+            }
+        }
+        if (_writer.fileClose() != 0)
+        {
+            std::cerr << events << " events: close failed\n";
+            return 1;
+        }
+    }
+
+    uint32_t _failed = 0;
+    uint32_t _chunks = (events + perChunk - 1) / perChunk;
+    uint64_t _next = 0;
+    bool _first = true;
+    for (uint32_t c = 0; c < _chunks; c++)
+    {
+        std::string _name = chunkName(base, c);
+        cbdf _reader;
+        if (_reader.fileOpen(_name, cbdf::readMode, cbdf::none) != 0)
+        {
+            std::cerr << events << " events: cannot read " << _name << "\n";
+            _failed++;
+            continue;
+        }
+        uint32_t _expected = (c + 1 < _chunks) ? perChunk : events - c * perChunk;
+        uint32_t _read = 0;
+        int _ret;
+        while ((_ret = _reader.readEvent()) == 0)
+        {
+            if (!_first && _reader.getEventNumber() != _next)
+            {
+                std::cerr << _name << ": event " << _reader.getEventNumber() << " where " << _next << " was expected\n";
+                _failed++;
+            }
+            _first = false;
+            _next = _reader.getEventNumber() + 1;
+            _read++;
+        }
+        if (_ret != CBDF_EOF || _read != _expected)
+        {
+            std::cerr << _name << ": " << _read << " of " << _expected << " events, then status " << _ret << "\n";
+            _failed++;
+        }
+        _reader.fileClose();
+        unlink(_name.c_str());
+    }
+    std::string _extra = chunkName(base, _chunks);
+    if (access(_extra.c_str(), F_OK) == 0)
+    {
+        std::cerr << events << " events: " << _extra << " was left behind\n";
+        unlink(_extra.c_str());
+        _failed++;
+    }
+    return _failed;
+}
+
+// A checkpoint after every event, then the writer dies with the chunks rotated out maybe not yet closed
+static uint32_t abandonAndRecover(const std::string &base, uint32_t events, uint32_t perChunk)
+{
+    pid_t _pid = fork();
+    if (_pid < 0)
+        return 1;
+    if (_pid == 0)
+    {
+        cbdf _writer;
+        char _data[64] = {0};
+        if (_writer.setRotation(0, perChunk) != 0 || _writer.setCheckpoints(1) != 0 || _writer.fileOpen(base, cbdf::writeMode, cbdf::none) != 0)
+            _exit(1);
+        for (uint32_t i = 0; i < events; i++)
+        {
+            _writer.addBank("ADC", 0, _data, sizeof(_data));
+            if (_writer.writeEvent() != 0)
+                _exit(1);
+        }
+        _exit(0);
+    }
+    int _status;
+    if (waitpid(_pid, &_status, 0) != _pid || !WIFEXITED(_status) || WEXITSTATUS(_status) != 0)
+    {
+        std::cerr << "abandoned run: writer failed\n";
+        return 1;
+    }
+
+    uint32_t _failed = 0;
+    uint32_t _chunks = (events + perChunk - 1) / perChunk;
+    uint64_t _next = 0;
+    uint32_t _total = 0;
+    for (uint32_t c = 0; c < _chunks; c++)
+    {
+        std::string _name = chunkName(base, c);
+        bool _checkpointed = (access((_name + ".ckpt").c_str(), F_OK) == 0);
+        if (c + 1 == _chunks && !_checkpointed)
+        {
+            std::cerr << _name << ": the chunk being written has no checkpoint\n";
+            _failed++;
+        }
+        if (_checkpointed)
+        {
+            uint64_t _kept = 0;
+            if (cbdf::recoverFile(_name, _kept) != 0)
+            {
+                std::cerr << _name << ": cannot recover\n";
+                _failed++;
+            }
+            unlink((_name + ".ckpt").c_str());
+        }
+        cbdf _reader;
+        if (_reader.fileOpen(_name, cbdf::readMode, cbdf::none) != 0)
+        {
+            std::cerr << _name << ": cannot read\n";
+            _failed++;
+            continue;
+        }
+        int _ret;
+        while ((_ret = _reader.readEvent()) == 0)
+        {
+            if (_total > 0 && _reader.getEventNumber() != _next)
+            {
+                std::cerr << _name << ": event " << _reader.getEventNumber() << " where " << _next << " was expected\n";
+                _failed++;
+            }
+            _next = _reader.getEventNumber() + 1;
+            _total++;
+        }
+        if (_ret != CBDF_EOF)
+        {
+            std::cerr << _name << ": status " << _ret << " after " << _total << " events\n";
+            _failed++;
+        }
+        _reader.fileClose();
+        unlink(_name.c_str());
+    }
+    // The chunk opened ahead of time holds nothing yet
+    unlink(chunkName(base, _chunks).c_str());
+    if (_total != events)
+    {
+        std::cerr << "abandoned run: " << _total << " of " << events << " events kept\n";
+        _failed++;
+    }
+    return _failed;
+}
+
+int main()
+{
+    char _base[] = "/tmp/rotationTestXXXXXX";
+    int _fd = mkstemp(_base);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+    unlink(_base);
+
+    uint32_t _failed = 0;
+    _failed += writeAndCheck(_base, 300, 100);
+    _failed += writeAndCheck(_base, 250, 100);
+    _failed += writeAndCheck(_base, 1, 100);
+    _failed += abandonAndRecover(_base, 250, 100);
+
+    std::cout << _failed << " rotation checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/*
+ * salvageTest.cpp
+ *
+ *  salvageFile() keeps every intact event of a file with a corrupt payload,
+ *  a smashed event header and a truncated end, and of a truncated gzip file
+ */
+
+#include <cbdf.h>
+#include <cbdfSalvage.h>
+#include "cbdfFormat.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#define SALVAGE_TEST_EVENTS 200
+#define SALVAGE_TEST_BAD_CRC 50     // Payload overwritten
+#define SALVAGE_TEST_BAD_HEADER 120 // Open tag overwritten
+#define SALVAGE_TEST_GZIP_EVENTS 2000 // Compressed data is lost up to a decompressor buffer before the cut
+
+static std::string payload(uint32_t event)
+{
+    std::string _data(event * 61 % 500 + 16, '\0');
+    for (uint32_t i = 0; i < _data.size(); i++)
+        _data[i] = (char) (i * 13 + event);
+    return _data;
+}
+
+// Offsets of the event records, in the uncompressed data
+static int writeFile(const std::string &fileName, cbdf::compressionType_t compression, uint32_t events, std::vector<uint64_t> &offsets)
+{
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, compression) != 0)
+            return -1;
+        for (uint32_t i = 0; i < events; i++)
+        {
+            std::string _data = payload(i);
+            _writer.addBank("DATA", 0, &_data[0], _data.size());
+            if (_writer.writeEvent() != 0)
+                return -1;
+        }
+        if (_writer.fileClose() != 0)
+            return -1;
+    }
+    cbdf _reader;
+    std::string _diskName = fileName + ((compression == cbdf::gzip) ? ".gz" : "");
+    if (_reader.fileOpen(_diskName, cbdf::readMode, compression) != 0)
+        return -1;
+    offsets.clear();
+    while (_reader.readEvent() == 0)
+        offsets.push_back(_reader.getEventOffset());
+    return (offsets.size() == events) ? 0 : -1;
+}
+
+static int overwrite(const std::string &fileName, uint64_t offset, const char* data, uint32_t size)
+{
+    std::fstream _file(fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    _file.seekp(offset);
+    _file.write(data, size);
+    return _file ? 0 : -1;
+}
+
+// The salvaged events have to be the kept ones of the input, in order and unchanged
+static uint32_t readSalvaged(const std::string &fileName, const std::set<uint32_t> &lost, uint32_t inputEvents)
+{
+    cbdf _reader;
+    if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+    {
+        std::cerr << fileName << ": cannot open the salvaged file\n";
+        return 1;
+    }
+    uint32_t _event = 0;
+    uint64_t _first = 0;
+    bool _firstRead = false;
+    int _ret;
+    while ((_ret = _reader.readEvent()) == 0)
+    {
+        while (lost.count(_event))
+            _event++;
+        if (!_firstRead)
+            _first = _reader.getEventNumber() - _event;
+        _firstRead = true;
+        std::string _data = payload(_event);
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        if (_reader.getEventNumber() != _first + _event || _bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _data.size()) != 0)
+        {
+            std::cerr << fileName << ": event " << _reader.getEventNumber() << " is not input event " << _event << "\n";
+            return 1;
+        }
+        _event++;
+    }
+    while (lost.count(_event))
+        _event++;
+    if (_ret != CBDF_EOF || _event != inputEvents)
+    {
+        std::cerr << fileName << ": salvage ended at input event " << _event << " with status " << _ret << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t testDamaged(const std::string &fileName, const std::string &outputName)
+{
+    std::vector<uint64_t> _offsets;
+    if (writeFile(fileName, cbdf::none, SALVAGE_TEST_EVENTS, _offsets) != 0)
+    {
+        std::cerr << "Cannot write " << fileName << "\n";
+        return 1;
+    }
+    const char _garbage[8] = {'d', 'a', 'm', 'a', 'g', 'e', 'd', '!'};
+    uint64_t _payloadOffset = _offsets[SALVAGE_TEST_BAD_CRC] + sizeof(cbdf::cbdfEventHeader_t) + 16;
+    uint64_t _lastOffset = _offsets[SALVAGE_TEST_EVENTS - 1];
+    if (overwrite(fileName, _payloadOffset, _garbage, sizeof(_garbage)) != 0
+        || overwrite(fileName, _offsets[SALVAGE_TEST_BAD_HEADER], _garbage, 4) != 0
+        || truncate(fileName.c_str(), _lastOffset + 40) != 0)
+    {
+        std::cerr << "Cannot damage " << fileName << "\n";
+        return 1;
+    }
+
+    uint32_t _failed = 0;
+    cbdfSalvageStats_t _stats;
+    int _ret = salvageFile(fileName, outputName, cbdf::none, _stats, true);
+    if (_ret != 0 || _stats.events != SALVAGE_TEST_EVENTS - 3 || _stats.badEvents != 1 || _stats.damagedRanges < 2 || !_stats.headerOk || _stats.trailerFound)
+    {
+        std::cerr << "damaged file: status " << _ret << ", " << _stats.events << " events, " << _stats.badEvents << " bad, "
+                  << _stats.damagedRanges << " damaged ranges, header " << _stats.headerOk << ", trailer " << _stats.trailerFound << "\n";
+        _failed++;
+    }
+    std::set<uint32_t> _lost;
+    _lost.insert(SALVAGE_TEST_BAD_CRC);
+    _lost.insert(SALVAGE_TEST_BAD_HEADER);
+    _lost.insert(SALVAGE_TEST_EVENTS - 1);
+    _failed += readSalvaged(outputName, _lost, SALVAGE_TEST_EVENTS);
+
+    // Each event keeps its offset in the damaged input
+    std::string _uuid;
+    std::vector<std::pair<uint64_t, uint64_t> > _entries;
+    if (cbdf::readSourceIndex(outputName, _uuid, _entries) != 0 || _entries.size() != SALVAGE_TEST_EVENTS - 3)
+    {
+        std::cerr << "damaged file: no source index for each salvaged event\n";
+        _failed++;
+    }
+    else
+    {
+        uint32_t _event = 0;
+        for (uint32_t i = 0; i < _entries.size(); i++, _event++)
+        {
+            while (_lost.count(_event))
+                _event++;
+            if (_entries[i].second != _offsets[_event])
+            {
+                std::cerr << "damaged file: salvaged event " << i << " indexed at " << _entries[i].second << ", not " << _offsets[_event] << "\n";
+                _failed++;
+                break;
+            }
+        }
+    }
+    unlink(fileName.c_str());
+    unlink(outputName.c_str());
+    return _failed;
+}
+
+// A gzip file cut in the middle keeps the events of the data that still decompresses
+static uint32_t testTruncatedGzip(const std::string &fileName, const std::string &outputName)
+{
+    std::vector<uint64_t> _offsets;
+    std::string _diskName = fileName + ".gz";
+    if (writeFile(fileName, cbdf::gzip, SALVAGE_TEST_GZIP_EVENTS, _offsets) != 0)
+    {
+        std::cerr << "Cannot write " << _diskName << "\n";
+        return 1;
+    }
+    std::ifstream _file(_diskName.c_str(), std::ios::binary | std::ios::ate);
+    uint64_t _size = _file.tellg();
+    _file.close();
+    if (truncate(_diskName.c_str(), _size * 2 / 3) != 0)
+    {
+        std::cerr << "Cannot truncate " << _diskName << "\n";
+        return 1;
+    }
+
+    uint32_t _failed = 0;
+    cbdfSalvageStats_t _stats;
+    int _ret = salvageFile(_diskName, outputName, cbdf::none, _stats);
+    if (_ret != 0 || _stats.events < SALVAGE_TEST_GZIP_EVENTS / 2 || _stats.events >= SALVAGE_TEST_GZIP_EVENTS * 2 / 3 || _stats.badEvents != 0 || _stats.trailerFound)
+    {
+        std::cerr << "truncated gzip file: status " << _ret << ", " << _stats.events << " events, " << _stats.badEvents << " bad, trailer " << _stats.trailerFound << "\n";
+        _failed++;
+    }
+    else
+    {
+        // What is kept is the start of the file, without gaps
+        std::set<uint32_t> _lost;
+        for (uint32_t i = _stats.events; i < SALVAGE_TEST_GZIP_EVENTS; i++)
+            _lost.insert(i);
+        _failed += readSalvaged(outputName, _lost, SALVAGE_TEST_GZIP_EVENTS);
+    }
+    unlink(_diskName.c_str());
+    unlink(outputName.c_str());
+    return _failed;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/salvageTestXXXXXX";
+    char _outputName[] = "/tmp/salvageTestXXXXXX";
+    int _fd1 = mkstemp(_fileName);
+    int _fd2 = mkstemp(_outputName);
+    if (_fd1 < 0 || _fd2 < 0)
+    {
+        std::cerr << "Cannot create temporary files\n";
+        return 1;
+    }
+    close(_fd1);
+    close(_fd2);
+
+    uint32_t _failed = 0;
+    _failed += testDamaged(_fileName, _outputName);
+    _failed += testTruncatedGzip(_fileName, _outputName);
+    unlink(_fileName);
+
+    std::cout << _failed << " salvage checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/*
+ * skimTest.cpp
+ *
+ *  skimFiles() selects on user flags and a bank predicate. The skim of a
+ *  file whose writer died mid-record holds the selected events before the
+ *  torn record, each indexed back to its offset in the input.
+ */
+
+#include <cbdf.h>
+#include <cbdfSkim.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SKIM_TEST_EVENTS 300
+#define SKIM_TEST_FLAG 0x4
+
+static bool selected(uint32_t event)
+{
+    return (event % 3 == 0) && (event % 2 == 0);
+}
+
+static int writeEvents(cbdf &writer, uint32_t events)
+{
+    char _data[40];
+    for (uint32_t i = 0; i < events; i++)
+    {
+        memset(_data, (int) i, sizeof(_data));
+        writer.setEventUserFlags((i % 3 == 0) ? SKIM_TEST_FLAG : 0);
+        writer.addBank("DATA", 0, _data, sizeof(_data));
+        if (writer.writeEvent() != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int writeFile(const std::string &fileName)
+{
+    cbdf _writer;
+    if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0 || writeEvents(_writer, SKIM_TEST_EVENTS) != 0)
+        return -1;
+    return _writer.fileClose();
+}
+
+// The writer flushes its events and dies without closing the file, the last record is torn
+static int abandonFile(const std::string &fileName)
+{
+    pid_t _pid = fork();
+    if (_pid < 0)
+        return -1;
+    if (_pid == 0)
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0 || writeEvents(_writer, SKIM_TEST_EVENTS) != 0 || _writer.flush() != 0)
+            _exit(1);
+        _exit(0);
+    }
+    int _status;
+    if (waitpid(_pid, &_status, 0) != _pid || !WIFEXITED(_status) || WEXITSTATUS(_status) != 0)
+        return -1;
+    cbdf _reader;
+    if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+        return -1;
+    uint64_t _lastOffset = 0;
+    while (_reader.readEvent() == 0)
+        _lastOffset = _reader.getEventOffset();
+    _reader.fileClose();
+    return truncate(fileName.c_str(), _lastOffset + 20);
+}
+
+// Even events, decided on the bank the predicate finds
+static bool evenEvent(cbdf &reader)
+{
+    cbdf::cbdfBankMapEntry_t _bank = reader.getBank("DATA");
+    return _bank.dataPtr != NULL && _bank.size == 40 && (_bank.dataPtr[0] & 1) == 0;
+}
+
+static uint32_t checkSkim(const std::string &inputName, const std::string &skimName, uint32_t inputEvents)
+{
+    std::vector<uint64_t> _offsets;
+    std::vector<uint64_t> _numbers;
+    {
+        cbdf _input;
+        if (_input.fileOpen(inputName, cbdf::readMode, cbdf::none) != 0)
+            return 1;
+        while (_input.readEvent() == 0)
+        {
+            _numbers.push_back(_input.getEventNumber());
+            _offsets.push_back(_input.getEventOffset());
+        }
+    }
+
+    std::vector<uint32_t> _expected;
+    for (uint32_t i = 0; i < inputEvents; i++)
+        if (selected(i))
+            _expected.push_back(i);
+
+    cbdf _reader;
+    if (_reader.fileOpen(skimName, cbdf::readMode, cbdf::none) != 0)
+    {
+        std::cerr << skimName << ": cannot open\n";
+        return 1;
+    }
+    uint32_t _events = 0;
+    int _ret;
+    while ((_ret = _reader.readEvent()) == 0)
+    {
+        if (_events >= _expected.size() || _reader.getEventNumber() != _numbers[_expected[_events]] || _reader.getEventUserFlags() != SKIM_TEST_FLAG)
+        {
+            std::cerr << skimName << ": unexpected event " << _reader.getEventNumber() << "\n";
+            return 1;
+        }
+        _events++;
+    }
+    if (_ret != CBDF_EOF || _events != _expected.size())
+    {
+        std::cerr << skimName << ": " << _events << " of " << _expected.size() << " events, then status " << _ret << "\n";
+        return 1;
+    }
+
+    std::string _uuid;
+    std::vector<std::pair<uint64_t, uint64_t> > _entries;
+    if (cbdf::readSourceIndex(skimName, _uuid, _entries) != 0 || _entries.size() != _expected.size())
+    {
+        std::cerr << skimName << ": no source index entry for each event\n";
+        return 1;
+    }
+    for (uint32_t i = 0; i < _entries.size(); i++)
+        if (_entries[i].first != _numbers[_expected[i]] || _entries[i].second != _offsets[_expected[i]])
+        {
+            std::cerr << skimName << ": event " << _entries[i].first << " indexed at " << _entries[i].second << "\n";
+            return 1;
+        }
+    return 0;
+}
+
+int main()
+{
+    char _intact[] = "/tmp/skimTestXXXXXX";
+    char _abandoned[] = "/tmp/skimTestXXXXXX";
+    char _skim1[] = "/tmp/skimTestXXXXXX";
+    char _skim2[] = "/tmp/skimTestXXXXXX";
+    char* _names[] = {_intact, _abandoned, _skim1, _skim2};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        int _fd = mkstemp(_names[i]);
+        if (_fd < 0)
+        {
+            std::cerr << "Cannot create temporary files\n";
+            return 1;
+        }
+        close(_fd);
+    }
+
+    uint32_t _failed = 0;
+    if (writeFile(_intact) != 0 || abandonFile(_abandoned) != 0)
+    {
+        std::cerr << "Cannot write the test files\n";
+        _failed++;
+    }
+    else
+    {
+        std::vector<std::string> _inputs;
+        std::vector<std::string> _outputs;
+        _inputs.push_back(_intact);
+        _inputs.push_back(_abandoned);
+        _outputs.push_back(_skim1);
+        _outputs.push_back(_skim2);
+        cbdfSkimSelection_t _selection;
+        _selection.flagMask = SKIM_TEST_FLAG;
+        _selection.flagValue = SKIM_TEST_FLAG;
+        _selection.predicate = &evenEvent;
+        std::vector<cbdfSkimStats_t> _stats;
+        int _ret = skimFiles(_inputs, _outputs, cbdf::none, _selection, _stats, 2);
+        if (_ret != CBDF_UNEXPECTED_EOF || _stats[0].status != 0 || _stats[0].events != SKIM_TEST_EVENTS
+            || _stats[1].status != CBDF_UNEXPECTED_EOF || _stats[1].events != SKIM_TEST_EVENTS - 1)
+        {
+            std::cerr << "skim status " << _ret << ", intact file " << _stats[0].status << " after " << _stats[0].events
+                      << " events, abandoned file " << _stats[1].status << " after " << _stats[1].events << " events\n";
+            _failed++;
+        }
+        _failed += checkSkim(_intact, _skim1, SKIM_TEST_EVENTS);
+        _failed += checkSkim(_abandoned, _skim2, SKIM_TEST_EVENTS - 1);
+    }
+    for (uint32_t i = 0; i < 4; i++)
+        unlink(_names[i]);
+
+    std::cout << _failed << " skim checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
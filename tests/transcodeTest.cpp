@@ -0,0 +1,162 @@
+/*
+ * transcodeTest.cpp
+ *
+ *  transcodeFile() of a file with a corrupt payload and a torn last record
+ *  drops the bad event, stops at the tear and closes an output that holds
+ *  every good event before it. With stopOnError it ends at the bad event.
+ */
+
+#include <cbdf.h>
+#include <cbdfTranscode.h>
+#include "cbdfFormat.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#define TRANSCODE_TEST_EVENTS 500
+#define TRANSCODE_TEST_BAD_CRC 123  // Payload overwritten
+
+static std::string payload(uint32_t event)
+{
+    std::string _data(event * 37 % 900 + 8, '\0');
+    for (uint32_t i = 0; i < _data.size(); i++)
+        _data[i] = (char) (i / 8 + event);
+    return _data;
+}
+
+// Write the input and damage it, returns its uuid
+static int writeDamaged(const std::string &fileName, std::string &uuid)
+{
+    std::vector<uint64_t> _offsets;
+    {
+        cbdf _writer;
+        if (_writer.fileOpen(fileName, cbdf::writeMode, cbdf::none) != 0)
+            return -1;
+        for (uint32_t i = 0; i < TRANSCODE_TEST_EVENTS; i++)
+        {
+            std::string _data = payload(i);
+            _writer.addBank("DATA", 0, &_data[0], _data.size());
+            if (_writer.writeEvent() != 0)
+                return -1;
+        }
+        if (_writer.fileClose() != 0)
+            return -1;
+    }
+    {
+        cbdf _reader;
+        if (_reader.fileOpen(fileName, cbdf::readMode, cbdf::none) != 0)
+            return -1;
+        uuid.assign(_reader.getUuid(), 36);
+        while (_reader.readEvent() == 0)
+            _offsets.push_back(_reader.getEventOffset());
+    }
+    if (_offsets.size() != TRANSCODE_TEST_EVENTS)
+        return -1;
+    {
+        std::fstream _file(fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        _file.seekp(_offsets[TRANSCODE_TEST_BAD_CRC] + sizeof(cbdf::cbdfEventHeader_t) + 20);
+        _file.write("damaged!", 8);
+        if (!_file)
+            return -1;
+    }
+    return truncate(fileName.c_str(), _offsets[TRANSCODE_TEST_EVENTS - 1] + 30);
+}
+
+// The output has to hold the input events up to last, except the bad one, and name the input as its parent
+static uint32_t checkOutput(const std::string &outputName, const std::string &uuid, uint32_t last)
+{
+    std::vector<std::string> _parents;
+    if (cbdf::readLineage(outputName, _parents) != 0 || _parents.size() != 1 || _parents[0] != uuid)
+    {
+        std::cerr << outputName << ": input is not listed in the lineage\n";
+        return 1;
+    }
+    cbdf _reader;
+    if (_reader.fileOpen(outputName, cbdf::readMode, cbdf::gzip) != 0)
+    {
+        std::cerr << outputName << ": cannot open\n";
+        return 1;
+    }
+    uint32_t _event = 0;
+    uint64_t _first = 0;
+    int _ret;
+    while ((_ret = _reader.readEvent()) == 0)
+    {
+        if (_event == TRANSCODE_TEST_BAD_CRC)
+            _event++;
+        if (_event == 0)
+            _first = _reader.getEventNumber();
+        std::string _data = payload(_event);
+        cbdf::cbdfBankMapEntry_t _bank = _reader.getBank("DATA");
+        if (_reader.getEventNumber() != _first + _event || _bank.size != _data.size() || memcmp(_bank.dataPtr, _data.data(), _data.size()) != 0)
+        {
+            std::cerr << outputName << ": event " << _reader.getEventNumber() << " is not input event " << _event << "\n";
+            return 1;
+        }
+        _event++;
+    }
+    if (_ret != CBDF_EOF || _event != last)
+    {
+        std::cerr << outputName << ": ends before input event " << _event << " with status " << _ret << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    char _inputName[] = "/tmp/transcodeTestXXXXXX";
+    char _outputBase[] = "/tmp/transcodeTestXXXXXX";
+    int _fd1 = mkstemp(_inputName);
+    int _fd2 = mkstemp(_outputBase);
+    if (_fd1 < 0 || _fd2 < 0)
+    {
+        std::cerr << "Cannot create temporary files\n";
+        return 1;
+    }
+    close(_fd1);
+    close(_fd2);
+    unlink(_outputBase);
+    std::string _outputName = std::string(_outputBase) + ".gz";
+
+    uint32_t _failed = 0;
+    std::string _uuid;
+    if (writeDamaged(_inputName, _uuid) != 0)
+    {
+        std::cerr << "Cannot write " << _inputName << "\n";
+        _failed++;
+    }
+    else
+    {
+        // Past the bad event up to the torn record
+        cbdf _writer;
+        cbdfTranscodeStats_t _stats;
+        int _ret = transcodeFile(_inputName, _writer, _outputBase, cbdf::gzip, _stats, 3);
+        if (_ret != CBDF_UNEXPECTED_EOF || _stats.events != TRANSCODE_TEST_EVENTS - 2 || _stats.badEvents != 1)
+        {
+            std::cerr << "transcode: status " << _ret << ", " << _stats.events << " events, " << _stats.badEvents << " bad\n";
+            _failed++;
+        }
+        _failed += checkOutput(_outputName, _uuid, TRANSCODE_TEST_EVENTS - 1);
+        unlink(_outputName.c_str());
+
+        // Up to the bad event
+        cbdf _stopping;
+        _ret = transcodeFile(_inputName, _stopping, _outputBase, cbdf::gzip, _stats, 3, true);
+        if (_ret != CBDF_EVENT_CRC_ERROR || _stats.events != TRANSCODE_TEST_BAD_CRC || _stats.badEvents != 1)
+        {
+            std::cerr << "transcode stopping on errors: status " << _ret << ", " << _stats.events << " events, " << _stats.badEvents << " bad\n";
+            _failed++;
+        }
+        _failed += checkOutput(_outputName, _uuid, TRANSCODE_TEST_BAD_CRC);
+        unlink(_outputName.c_str());
+    }
+    unlink(_inputName);
+
+    std::cout << _failed << " transcode checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
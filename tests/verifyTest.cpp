@@ -0,0 +1,157 @@
+/*
+ * verifyTest.cpp
+ *
+ *  verifyFile() passes an intact file and, for a file with a corrupt
+ *  payload, a smashed event header and a truncated end, reports each damage
+ *  with the events it hit while counting all good events
+ */
+
+#include <cbdf.h>
+#include <cbdfVerify.h>
+#include "cbdfFormat.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#define VERIFY_TEST_EVENTS 200
+#define VERIFY_TEST_BAD_CRC 50      // Payload overwritten
+#define VERIFY_TEST_BAD_HEADER 120  // Open tag overwritten
+
+// Event numbers and offsets of the records as written
+static int writeFile(const std::string &fileName, cbdf::compressionType_t compression, std::vector<uint64_t> &numbers, std::vector<uint64_t> &offsets)
+{
+    {
+        cbdf _writer;
+        char _data[256];
+        if (_writer.fileOpen(fileName, cbdf::writeMode, compression) != 0)
+            return -1;
+        for (uint32_t i = 0; i < VERIFY_TEST_EVENTS; i++)
+        {
+            memset(_data, (int) i, sizeof(_data));
+            _writer.addBank("DATA", 0, _data, i % sizeof(_data) + 1);
+            if (_writer.writeEvent() != 0)
+                return -1;
+        }
+        if (_writer.fileClose() != 0)
+            return -1;
+    }
+    cbdf _reader;
+    std::string _diskName = fileName + ((compression == cbdf::gzip) ? ".gz" : "");
+    if (_reader.fileOpen(_diskName, cbdf::readMode, compression) != 0)
+        return -1;
+    numbers.clear();
+    offsets.clear();
+    while (_reader.readEvent() == 0)
+    {
+        numbers.push_back(_reader.getEventNumber());
+        offsets.push_back(_reader.getEventOffset());
+    }
+    return (offsets.size() == VERIFY_TEST_EVENTS) ? 0 : -1;
+}
+
+static int overwrite(const std::string &fileName, uint64_t offset, const char* data, uint32_t size)
+{
+    std::fstream _file(fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    _file.seekp(offset);
+    _file.write(data, size);
+    return _file ? 0 : -1;
+}
+
+static uint32_t testIntact(const std::string &fileName, cbdf::compressionType_t compression)
+{
+    std::vector<uint64_t> _numbers;
+    std::vector<uint64_t> _offsets;
+    std::string _diskName = fileName + ((compression == cbdf::gzip) ? ".gz" : "");
+    if (writeFile(fileName, compression, _numbers, _offsets) != 0)
+    {
+        std::cerr << "Cannot write " << _diskName << "\n";
+        return 1;
+    }
+    uint32_t _failed = 0;
+    cbdfVerifyReport_t _report;
+    int _ret = verifyFile(_diskName, _report, 3);
+    if (_ret != 0 || !_report.headerOk || !_report.trailerOk || !_report.footerOk || _report.events != VERIFY_TEST_EVENTS
+        || _report.badEvents != 0 || !_report.badRanges.empty())
+    {
+        printVerifyReport(_report, std::cerr);
+        _failed++;
+    }
+    unlink(_diskName.c_str());
+    return _failed;
+}
+
+static uint32_t testDamaged(const std::string &fileName)
+{
+    std::vector<uint64_t> _numbers;
+    std::vector<uint64_t> _offsets;
+    if (writeFile(fileName, cbdf::none, _numbers, _offsets) != 0)
+    {
+        std::cerr << "Cannot write " << fileName << "\n";
+        return 1;
+    }
+    const char _garbage[8] = {'d', 'a', 'm', 'a', 'g', 'e', 'd', '!'};
+    if (overwrite(fileName, _offsets[VERIFY_TEST_BAD_CRC] + sizeof(cbdf::cbdfEventHeader_t) + 16, _garbage, sizeof(_garbage)) != 0
+        || overwrite(fileName, _offsets[VERIFY_TEST_BAD_HEADER], _garbage, 4) != 0
+        || truncate(fileName.c_str(), _offsets[VERIFY_TEST_EVENTS - 1] + 40) != 0)
+    {
+        std::cerr << "Cannot damage " << fileName << "\n";
+        return 1;
+    }
+
+    uint32_t _failed = 0;
+    cbdfVerifyReport_t _report;
+    int _ret = verifyFile(fileName, _report, 3);
+    if (_ret == 0 || _ret != _report.status || !_report.headerOk || _report.trailerOk || _report.events != VERIFY_TEST_EVENTS - 3
+        || _report.badEvents != 1 || _report.badRanges.size() != 3)
+    {
+        std::cerr << "damaged file:\n";
+        printVerifyReport(_report, std::cerr);
+        unlink(fileName.c_str());
+        return 1;
+    }
+
+    // In file order: the bad CRC, the smashed header, the cut off record
+    const cbdfVerifyRange_t &_crc = _report.badRanges[0];
+    if (_crc.offset != _offsets[VERIFY_TEST_BAD_CRC] || _crc.records != 1 || _crc.error != CBDF_EVENT_CRC_ERROR
+        || _crc.firstEvent != _numbers[VERIFY_TEST_BAD_CRC] || _crc.lastEvent != _numbers[VERIFY_TEST_BAD_CRC])
+        _failed++;
+    const cbdfVerifyRange_t &_header = _report.badRanges[1];
+    if (_header.offset != _offsets[VERIFY_TEST_BAD_HEADER] || _header.size != _offsets[VERIFY_TEST_BAD_HEADER + 1] - _offsets[VERIFY_TEST_BAD_HEADER]
+        || _header.records != 0 || _header.firstEvent != _numbers[VERIFY_TEST_BAD_HEADER] || _header.lastEvent != _numbers[VERIFY_TEST_BAD_HEADER])
+        _failed++;
+    const cbdfVerifyRange_t &_end = _report.badRanges[2];
+    if (_end.offset != _offsets[VERIFY_TEST_EVENTS - 1] || _end.size != 40 || _end.firstEvent != _numbers[VERIFY_TEST_EVENTS - 1])
+        _failed++;
+    if (_failed)
+    {
+        std::cerr << "damaged file, ranges do not match the damage:\n";
+        printVerifyReport(_report, std::cerr);
+    }
+    unlink(fileName.c_str());
+    return _failed;
+}
+
+int main()
+{
+    char _fileName[] = "/tmp/verifyTestXXXXXX";
+    int _fd = mkstemp(_fileName);
+    if (_fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file\n";
+        return 1;
+    }
+    close(_fd);
+
+    uint32_t _failed = 0;
+    _failed += testIntact(_fileName, cbdf::none);
+    _failed += testIntact(_fileName, cbdf::gzip);
+    _failed += testDamaged(_fileName);
+    unlink(_fileName);
+
+    std::cout << _failed << " verify checks failed\n";
+    return (_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+/*
+ * cbdf-catalogue.cpp
+ *
+ *  Print the event catalogue of cbdf files without decoding their payloads
+ */
+
+#include <cbdf.h>
+#include <cbdfCatalogue.h>
+#include <iostream>
+#include <cstring>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-catalogue [-q] [-s] file [file ...]\n"
+              << "  -q  do not list the user flag values\n"
+              << "  -s  scan the events even if the file has a summary footer\n";
+}
+
+int main(int argc, char** argv)
+{
+    bool _userFlags = true;
+    bool _useSummary = true;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-q") == 0)
+            _userFlags = false;
+        else if (strcmp(argv[_first], "-s") == 0)
+            _useSummary = false;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (_first >= argc)
+    {
+        usage();
+        return 2;
+    }
+
+    int _failed = 0;
+    uint64_t _events = 0;
+    uint64_t _bytes = 0;
+    for (int i = _first; i < argc; i++)
+    {
+        cbdfCatalogue_t _catalogue;
+        if (scanCatalogue(argv[i], _catalogue, _useSummary) != 0)
+            _failed++;
+        printCatalogue(_catalogue, std::cout, _userFlags);
+        _events += _catalogue.events;
+        _bytes += _catalogue.payloadBytes;
+    }
+    if (argc - _first > 1)
+        std::cout << "total " << argc - _first << " files, " << _events << " events, " << _bytes << " payload bytes, " << _failed << " with errors\n";
+    return _failed ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * cbdf-compress-eval.cpp
+ *
+ *  Measure compression ratio and codec speed on events sampled from a cbdf
+ *  file, per codec and level and per bank name
+ */
+
+#include <cbdf.h>
+#include <cbdfCompressEval.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-compress-eval [-n events] [-t threads] [-b blockSize] [-e] file [file ...]\n"
+              << "  -n  sample at most this many events per file (default 2000, 0 for all)\n"
+              << "  -t  codecs run in parallel (default one per core)\n"
+              << "  -b  block size of the stream codecs in bytes (default 1048576)\n"
+              << "  -e  whole events only, no breakdown per bank\n";
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t _maxEvents = 2000;
+    uint32_t _threads = 0;
+    uint64_t _blockSize = 1048576;
+    bool _perBank = true;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-n") == 0 && _first + 1 < argc)
+            _maxEvents = strtoull(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-t") == 0 && _first + 1 < argc)
+            _threads = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-b") == 0 && _first + 1 < argc)
+            _blockSize = strtoull(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-e") == 0)
+            _perBank = false;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (_first >= argc || _blockSize == 0)
+    {
+        usage();
+        return 2;
+    }
+
+    int _failed = 0;
+    for (int i = _first; i < argc; i++)
+    {
+        std::vector<cbdfEvalResult_t> _results;
+        int _ret = evaluateCompression(argv[i], _results, _maxEvents, _threads, _perBank, _blockSize);
+        std::cout << argv[i] << "\n";
+        if (_ret != 0)
+        {
+            std::cout << "  status      " << _ret << "\n";
+            _failed++;
+            continue;
+        }
+        printEvaluation(_results, std::cout);
+    }
+    return _failed ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * cbdf-dict.cpp
+ *
+ *  Train a zstd dictionary on the event payloads of cbdf files, for
+ *  cbdf::setDictionary()
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-dict [-n events] [-s size] -o dictionary file [file ...]\n"
+              << "  -n  use at most this many events as samples (default 10000)\n"
+              << "  -s  maximum dictionary size in bytes (default 16384)\n"
+              << "  -o  file the dictionary is written to\n";
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t _maxEvents = 10000;
+    uint32_t _maxSize = 16384;
+    std::string _output;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-n") == 0 && _first + 1 < argc)
+            _maxEvents = strtoull(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-s") == 0 && _first + 1 < argc)
+            _maxSize = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-o") == 0 && _first + 1 < argc)
+            _output = argv[++_first];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (_first >= argc || _output.empty() || _maxEvents == 0 || _maxSize == 0)
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<std::string> _samples;
+    uint64_t _sampleBytes = 0;
+    for (int i = _first; i < argc && _samples.size() < _maxEvents; i++)
+    {
+        cbdf _reader;
+        if (_reader.fileOpen(argv[i], cbdf::readMode, cbdf::guessCompression(argv[i])) != 0)
+        {
+            std::cerr << "Can not open " << argv[i] << std::endl;
+            continue;
+        }
+        while (_samples.size() < _maxEvents && _reader.readEvent() == 0)
+        {
+            std::string _payload(_reader.getEventSize(), '\0');
+            uint64_t _size = 0;
+            if (_payload.empty() || _reader.getRawData(&_payload[0], _size) != 0)
+                continue;
+            _samples.push_back(_payload);
+            _sampleBytes += _size;
+        }
+        _reader.fileClose();
+    }
+    std::cerr << _samples.size() << " events, " << _sampleBytes << " bytes of samples" << std::endl;
+
+    std::string _dictionary;
+    if (cbdf::trainDictionary(_samples, _maxSize, _dictionary) != 0)
+    {
+        std::cerr << "Training failed, too few or too small samples?" << std::endl;
+        return 1;
+    }
+    std::ofstream _out(_output.c_str(), std::ios::binary);
+    _out.write(_dictionary.data(), _dictionary.size());
+    if (!_out)
+    {
+        std::cerr << "Can not write " << _output << std::endl;
+        return 1;
+    }
+    std::cerr << "Wrote " << _dictionary.size() << " byte dictionary to " << _output << std::endl;
+    return 0;
+}
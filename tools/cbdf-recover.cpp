@@ -0,0 +1,39 @@
+/*
+ * cbdf-recover.cpp
+ *
+ *  Finish files whose writer died, from their last checkpoint
+ */
+
+#include <cbdf.h>
+#include <iostream>
+#include <cstring>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-recover file...\n"
+              << "  Cut each file back to its last checkpoint (<file>.ckpt) and add the trailer and footer.\n"
+              << "  Files without one can still be rescued with cbdf-salvage.\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        usage();
+        return 2;
+    }
+    int _failed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        uint64_t _events = 0;
+        int _ret = cbdf::recoverFile(argv[i], _events);
+        if (_ret == 0)
+            std::cout << argv[i] << ": " << _events << " events kept\n";
+        else
+        {
+            std::cout << argv[i] << ": not recovered, status " << _ret << "\n";
+            _failed++;
+        }
+    }
+    return _failed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * cbdf-salvage.cpp
+ *
+ *  Rebuild a clean cbdf file from the intact events of a damaged or
+ *  truncated one
+ */
+
+#include <cbdf.h>
+#include <cbdfSalvage.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-salvage [-c codec] [-i] input output\n"
+              << "  -c  output compression: none, gzip, bzip2, xz or lzo (default that of the input), the extension is appended\n"
+              << "  -i  also store the event number and offset each event had in the input\n";
+}
+
+int main(int argc, char** argv)
+{
+    int _compression = -1;
+    bool _sourceIndex = false;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-c") == 0 && _first + 1 < argc)
+        {
+            std::string _name = argv[++_first];
+            if (_name == "none")
+                _compression = cbdf::none;
+            else if (_name == "gzip")
+                _compression = cbdf::gzip;
+            else if (_name == "bzip2")
+                _compression = cbdf::bzip2;
+            else if (_name == "xz")
+                _compression = cbdf::xz;
+            else if (_name == "lzo")
+                _compression = cbdf::lzo;
+            else
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[_first], "-i") == 0)
+            _sourceIndex = true;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (argc - _first != 2)
+    {
+        usage();
+        return 2;
+    }
+    if (_compression < 0)
+        _compression = cbdf::guessCompression(argv[_first]);
+
+    cbdfSalvageStats_t _stats;
+    int _ret = salvageFile(argv[_first], argv[_first + 1], (cbdf::compressionType_t) _compression, _stats, _sourceIndex);
+    std::cout << std::dec << argv[_first] << ": " << _stats.events << " events recovered, " << _stats.badEvents << " bad events, "
+              << _stats.damagedRanges << " damaged ranges, header " << (_stats.headerOk ? "ok" : "bad")
+              << ", trailer " << (_stats.trailerFound ? "found" : "missing");
+    if (_ret != 0)
+        std::cout << ", status " << _ret;
+    std::cout << "\n";
+    return (_ret != 0) ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * cbdf-skim.cpp
+ *
+ *  Write the events of cbdf files that match user flags or carry a bank into
+ *  skim files, or list where the events of skim files came from
+ */
+
+#include <cbdf.h>
+#include <cbdfSkim.h>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-skim [-m mask] [-v value] [-b bank] [-c codec] [-d directory] [-s suffix] [-j threads] file [file ...]\n"
+              << "       cbdf-skim -l skim [skim ...]\n"
+              << "  -m  select events whose user flags and'ed with mask equal value (default 0, all events)\n"
+              << "  -v  see -m (default 0)\n"
+              << "  -b  only select events that carry a bank of this name\n"
+              << "  -c  output compression: none, gzip, bzip2, xz or lzo (default none), the extension is appended\n"
+              << "  -d  directory the skims are written to (default .)\n"
+              << "  -s  inserted into the file name before .cbdf (default _skim)\n"
+              << "  -j  files skimmed in parallel (default one per core)\n"
+              << "  -l  list source uuid, event number and offset of each event of skim files\n";
+}
+
+// Stands in for any bank predicate
+static bool hasBank(const std::string* bankName, cbdf &reader)
+{
+    return reader.bankMap.find(*bankName) != reader.bankMap.end();
+}
+
+static int listIndex(const char* fileName)
+{
+    std::string _uuid;
+    std::vector<std::pair<uint64_t, uint64_t> > _entries;
+    if (cbdf::readSourceIndex(fileName, _uuid, _entries) != 0)
+    {
+        std::cerr << fileName << ": no source index\n";
+        return 1;
+    }
+    std::cout << "# " << fileName << "\n";
+    for (uint64_t i = 0; i < _entries.size(); i++)
+        std::cout << _uuid << " " << _entries[i].first << " " << _entries[i].second << "\n";
+    return 0;
+}
+
+// dir/name with the suffix before .cbdf and without the input compression extension
+static std::string skimName(std::string inputName, const std::string &directory, const std::string &suffix)
+{
+    if (cbdf::guessCompression(inputName) != cbdf::none)
+        inputName = inputName.substr(0, inputName.find_last_of('.'));
+    size_t _slash = inputName.find_last_of('/');
+    if (_slash != std::string::npos)
+        inputName = inputName.substr(_slash + 1);
+    size_t _dot = inputName.rfind(".cbdf");
+    if (_dot != std::string::npos && _dot + 5 == inputName.size())
+        inputName.insert(_dot, suffix);
+    else
+        inputName += suffix;
+    return directory + "/" + inputName;
+}
+
+int main(int argc, char** argv)
+{
+    cbdfSkimSelection_t _selection;
+    _selection.flagMask = 0;
+    _selection.flagValue = 0;
+    std::string _bankName;
+    cbdf::compressionType_t _compression = cbdf::none;
+    std::string _directory = ".";
+    std::string _suffix = "_skim";
+    uint32_t _threads = 0;
+    bool _list = false;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-m") == 0 && _first + 1 < argc)
+            _selection.flagMask = strtoull(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-v") == 0 && _first + 1 < argc)
+            _selection.flagValue = strtoull(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-b") == 0 && _first + 1 < argc)
+            _bankName = argv[++_first];
+        else if (strcmp(argv[_first], "-c") == 0 && _first + 1 < argc)
+        {
+            std::string _name = argv[++_first];
+            if (_name == "none")
+                _compression = cbdf::none;
+            else if (_name == "gzip")
+                _compression = cbdf::gzip;
+            else if (_name == "bzip2")
+                _compression = cbdf::bzip2;
+            else if (_name == "xz")
+                _compression = cbdf::xz;
+            else if (_name == "lzo")
+                _compression = cbdf::lzo;
+            else
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[_first], "-d") == 0 && _first + 1 < argc)
+            _directory = argv[++_first];
+        else if (strcmp(argv[_first], "-s") == 0 && _first + 1 < argc)
+            _suffix = argv[++_first];
+        else if (strcmp(argv[_first], "-j") == 0 && _first + 1 < argc)
+            _threads = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-l") == 0)
+            _list = true;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (_first >= argc)
+    {
+        usage();
+        return 2;
+    }
+
+    if (_list)
+    {
+        int _ret = 0;
+        for (int i = _first; i < argc; i++)
+            _ret |= listIndex(argv[i]);
+        return _ret;
+    }
+
+    if ((_selection.flagValue & ~_selection.flagMask) != 0)
+    {
+        std::cerr << "Value has bits outside the mask, no event can match\n";
+        return 2;
+    }
+    if (!_bankName.empty())
+        _selection.predicate = boost::bind(&hasBank, &_bankName, _1);
+
+    std::vector<std::string> _inputs;
+    std::vector<std::string> _outputs;
+    for (int i = _first; i < argc; i++)
+    {
+        _inputs.push_back(argv[i]);
+        _outputs.push_back(skimName(argv[i], _directory, _suffix));
+    }
+    std::vector<cbdfSkimStats_t> _stats;
+    int _ret = skimFiles(_inputs, _outputs, _compression, _selection, _stats, _threads);
+    for (uint32_t i = 0; i < _stats.size(); i++)
+    {
+        std::cout << _stats[i].inputName << " -> " << _stats[i].outputName << ": " << _stats[i].selected << " of " << _stats[i].events << " events, " << _stats[i].bytes << " bytes";
+        if (_stats[i].status != 0)
+            std::cout << ", status " << _stats[i].status;
+        std::cout << "\n";
+    }
+    return (_ret != 0) ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * cbdf-transcode.cpp
+ *
+ *  Copy cbdf files into files with other compression settings, e.g. from the
+ *  live format to the archive format
+ */
+
+#include <cbdf.h>
+#include <cbdfTranscode.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-transcode [-c codec] [-z level] [-a] [-j workers] [-t threads] [-s] [-k bytes] input output\n"
+              << "  -c  output compression: none, gzip, bzip2, xz or lzo (default xz), the extension is appended\n"
+              << "  -z  also compress each event with zstd at this level\n"
+              << "  -a  compress each event with adaptive codec and level\n"
+              << "  -j  CRC checking threads (default 2)\n"
+              << "  -t  compression threads, each compresses 8 MB blocks as streams of their own (default 2, 1 writes one stream, lzo always does)\n"
+              << "  -s  stop at the first event with a bad CRC instead of dropping it\n"
+              << "  -k  take a checkpoint every this many bytes of events and report their cost\n";
+}
+
+int main(int argc, char** argv)
+{
+    cbdf::compressionType_t _compression = cbdf::xz;
+    int _eventLevel = -1;
+    bool _adaptive = false;
+    uint32_t _workers = 2;
+    uint32_t _threads = 2;
+    bool _stopOnError = false;
+    uint64_t _checkpointBytes = 0;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-c") == 0 && _first + 1 < argc)
+        {
+            std::string _name = argv[++_first];
+            if (_name == "none")
+                _compression = cbdf::none;
+            else if (_name == "gzip")
+                _compression = cbdf::gzip;
+            else if (_name == "bzip2")
+                _compression = cbdf::bzip2;
+            else if (_name == "xz")
+                _compression = cbdf::xz;
+            else if (_name == "lzo")
+                _compression = cbdf::lzo;
+            else
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[_first], "-z") == 0 && _first + 1 < argc)
+            _eventLevel = atoi(argv[++_first]);
+        else if (strcmp(argv[_first], "-a") == 0)
+            _adaptive = true;
+        else if (strcmp(argv[_first], "-j") == 0 && _first + 1 < argc)
+            _workers = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-t") == 0 && _first + 1 < argc)
+            _threads = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-s") == 0)
+            _stopOnError = true;
+        else if (strcmp(argv[_first], "-k") == 0 && _first + 1 < argc)
+            _checkpointBytes = strtoull(argv[++_first], NULL, 0);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (argc - _first != 2)
+    {
+        usage();
+        return 2;
+    }
+
+    cbdf _writer;
+    if ((_eventLevel >= 0 && _writer.setEventCompression(true, _eventLevel) != 0) || (_adaptive && _writer.setAdaptiveCompression(true) != 0))
+        return 1;
+    _writer.setCheckpoints(_checkpointBytes);
+    _writer.setCompressionThreads(_threads);
+    cbdfTranscodeStats_t _stats;
+    int _ret = transcodeFile(argv[_first], _writer, argv[_first + 1], _compression, _stats, _workers, _stopOnError);
+    std::cout << argv[_first] << " -> " << _writer.getFileName() << ": " << _stats.events << " events, " << _stats.bytes << " bytes, " << _stats.badEvents << " bad events";
+    cbdf::cbdfCheckpointStats_t _checkpoints;
+    _writer.getCheckpointStats(_checkpoints);
+    if (_checkpoints.checkpoints)
+        std::cout << ", " << _checkpoints.checkpoints << " checkpoints, avg codec " << _checkpoints.codecNs / _checkpoints.checkpoints / 1000
+                  << " us, sync " << _checkpoints.syncNs / _checkpoints.checkpoints / 1000 << " us, max " << _checkpoints.maxNs / 1000 << " us";
+    if (_ret != 0)
+        std::cout << ", status " << _ret;
+    std::cout << "\n";
+    return (_ret != 0 || _stats.badEvents) ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * cbdf-verify.cpp
+ *
+ *  Check cbdf files for damage and report the bad ranges
+ */
+
+#include <cbdf.h>
+#include <cbdfVerify.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+static void usage()
+{
+    std::cerr << "Usage: cbdf-verify [-j threads] [-f files] file [file ...]\n"
+              << "  -j  CRC threads per file (default one per core)\n"
+              << "  -f  files verified at the same time (default 1), for compressed files whose decompression is the limit\n"
+              << "Prints one line per file and per bad range, see cbdfVerify.h. Exits with 1 if any file is damaged\n";
+}
+
+struct verifyJobs_t {
+    char** names;
+    uint32_t count;
+    uint32_t threads;
+    boost::atomic<uint32_t> next;
+    boost::atomic<uint32_t> damaged;
+    boost::mutex output;
+};
+
+static void verifyWorker(verifyJobs_t* jobs)
+{
+    uint32_t _file;
+    while ((_file = jobs->next++) < jobs->count)
+    {
+        cbdfVerifyReport_t _report;
+        if (verifyFile(jobs->names[_file], _report, jobs->threads) != 0)
+            jobs->damaged++;
+        boost::mutex::scoped_lock _lock(jobs->output);
+        printVerifyReport(_report, std::cout);
+        std::cout.flush();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t _threads = 0;
+    uint32_t _files = 1;
+    int _first = 1;
+    for (; _first < argc && argv[_first][0] == '-'; _first++)
+    {
+        if (strcmp(argv[_first], "-j") == 0 && _first + 1 < argc)
+            _threads = strtoul(argv[++_first], NULL, 0);
+        else if (strcmp(argv[_first], "-f") == 0 && _first + 1 < argc)
+            _files = strtoul(argv[++_first], NULL, 0);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (_first >= argc)
+    {
+        usage();
+        return 2;
+    }
+    if (_files == 0)
+        _files = 1;
+
+    verifyJobs_t _jobs;
+    _jobs.names = argv + _first;
+    _jobs.count = argc - _first;
+    _jobs.threads = _threads;
+    _jobs.next = 0;
+    _jobs.damaged = 0;
+    boost::thread_group _workers;
+    for (uint32_t i = 0; i < _files && i < _jobs.count; i++)
+        _workers.create_thread(boost::bind(&verifyWorker, &_jobs));
+    _workers.join_all();
+    return _jobs.damaged ? 1 : 0;
+}